@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "util/LogRecord.hpp"
+
+static void Usage()
+{
+    fprintf( stderr, "Usage: logdecode <log> [output]\n" );
+    fprintf( stderr, "  converts a binary log file to text, printed to stdout if no output is given\n" );
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 || argc > 3 )
+    {
+        Usage();
+        return 1;
+    }
+
+    const char* source = argv[1];
+    const char* destination = argc > 2 ? argv[2] : nullptr;
+
+    FILE* src = fopen( source, "rb" );
+    if( !src )
+    {
+        fprintf( stderr, "Failed to open log file %s\n", source );
+        return 1;
+    }
+
+    fseek( src, 0, SEEK_END );
+    const auto sz = ftell( src );
+    fseek( src, 0, SEEK_SET );
+
+    std::vector<char> data( sz );
+    const auto rd = fread( data.data(), 1, sz, src );
+    fclose( src );
+
+    std::string text;
+    const auto ok = LogRecord::Decode( text, data.data(), rd );
+
+    FILE* dst = destination ? fopen( destination, "wb" ) : stdout;
+    if( !dst )
+    {
+        fprintf( stderr, "Failed to open output file %s\n", destination );
+        return 1;
+    }
+    fwrite( text.data(), 1, text.size(), dst );
+    if( dst != stdout ) fclose( dst );
+
+    if( !ok )
+    {
+        fprintf( stderr, "Log file %s is not a binary log, or it is damaged\n", source );
+        return 1;
+    }
+    return 0;
+}
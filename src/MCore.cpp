@@ -14,7 +14,10 @@ static void PrintHelp()
     printf( "  -d, --debug                  Enable debug logging\n" );
     printf( "  -e, --external               Show external callstacks\n" );
     printf( "  -s, --sync-logs              Synchronize log output\n" );
+    printf( "  -a, --async-logs             Write log output on a background thread\n" );
     printf( "  -l, --log-file               Log to file\n" );
+    printf( "  -b, --binary-log             Log to file in binary format, see logdecode. Messages\n" );
+    printf( "                               are stored unformatted only with --async-logs\n" );
     printf( "  -V, --validation [on|off]    Enable or disable validation layers\n" );
     printf( "  --help                       Print this help\n" );
 }
@@ -37,14 +40,19 @@ int main( int argc, char** argv )
         { "debug", no_argument, nullptr, 'd' },
         { "external", no_argument, nullptr, 'e' },
         { "sync-logs", no_argument, nullptr, 's' },
+        { "async-logs", no_argument, nullptr, 'a' },
         { "log-file", no_argument, nullptr, 'l' },
+        { "binary-log", no_argument, nullptr, 'b' },
         { "validation", required_argument, nullptr, 'V' },
         { "help", no_argument, nullptr, OptHelp },
         {}
     };
 
+    bool logToFile = false;
+    auto logFileFormat = LogFileFormat::Text;
+
     int opt;
-    while( ( opt = getopt_long( argc, argv, "deslV:", longOptions, nullptr ) ) != -1 )
+    while( ( opt = getopt_long( argc, argv, "desalbV:", longOptions, nullptr ) ) != -1 )
     {
         switch (opt)
         {
@@ -57,8 +65,15 @@ int main( int argc, char** argv )
         case 's':
             SetLogSynchronized( true );
             break;
+        case 'a':
+            SetLogAsync( true );
+            break;
         case 'l':
-            SetLogToFile( true );
+            logToFile = true;
+            break;
+        case 'b':
+            logToFile = true;
+            logFileFormat = LogFileFormat::Binary;
             break;
         case 'V':
             enableValidation = ParseBoolean( optarg );
@@ -71,6 +86,8 @@ int main( int argc, char** argv )
         }
     }
 
+    if( logToFile ) SetLogToFile( true, logFileFormat );
+
     printf( "Starting " ANSI_BOLD ANSI_ITALIC "Modern Core" ANSI_RESET "…\n\n" );
     printf( "Build id: %s\n\n", GitRef );
 
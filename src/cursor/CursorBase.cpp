@@ -4,6 +4,14 @@ const CursorData* CursorBase::Get( uint32_t size, CursorType type ) const
 {
     auto it = m_cursor.find( size );
     if( it == m_cursor.end() ) return nullptr;
+
+    std::lock_guard lock( m_lock );
+    if( m_loaded.find( size ) == m_loaded.end() )
+    {
+        Load( size, it->second );
+        m_loaded.emplace( size );
+    }
+
     auto& t = it->second.type[(int)type];
     if( t.bitmaps.empty() ) return &it->second.type[(int)CursorType::Default];
     return &t;
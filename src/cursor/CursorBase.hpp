@@ -2,6 +2,8 @@
 
 #include <array>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "CursorType.hpp"
@@ -10,6 +12,7 @@
 
 class Bitmap;
 
+// Pixels are premultiplied ARGB, as in X cursor files
 struct CursorBitmap
 {
     std::shared_ptr<Bitmap> bitmap;
@@ -45,8 +48,21 @@ public:
     [[nodiscard]] const CursorData* Get( uint32_t size, CursorType type ) const;
     [[nodiscard]] bool Valid() const { return !m_cursor.empty(); }
 
+    // Files and directories the theme was resolved from. The theme may have changed if their
+    // modification times differ.
+    [[nodiscard]] const std::vector<std::string>& Sources() const { return m_sources; }
+
 protected:
     CursorBase() = default;
 
-    unordered_flat_map<uint32_t, CursorSize> m_cursor;
+    // Decodes images of all cursor types at the given size. Called once per size, on first Get.
+    // Themes only create the size entries when loaded, so that the returned data stays in place.
+    virtual void Load( uint32_t, CursorSize& ) const {}
+
+    mutable unordered_flat_map<uint32_t, CursorSize> m_cursor;
+    std::vector<std::string> m_sources;
+
+private:
+    mutable std::mutex m_lock;
+    mutable unordered_flat_set<uint32_t> m_loaded;
 };
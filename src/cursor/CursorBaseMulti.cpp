@@ -1,9 +1,16 @@
 #include <algorithm>
 #include <ranges>
+#include <sys/stat.h>
 
 #include "CursorBaseMulti.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
 
+CursorBaseMulti::~CursorBaseMulti()
+{
+}
+
 uint32_t CursorBaseMulti::FitSize( uint32_t size ) const
 {
     CheckPanic( !m_cursor.empty(), "Cursor is empty" );
@@ -31,3 +38,23 @@ void CursorBaseMulti::CalcSizes()
     for( auto& v : m_cursor ) m_sizes.emplace_back( v.first );
     std::ranges::sort( m_sizes );
 }
+
+const FileBuffer* CursorBaseMulti::MapFile( const std::string& path )
+{
+    FileWrapper f( path.c_str(), "rb" );
+    if( !f ) return nullptr;
+
+    struct stat st;
+    if( fstat( fileno( f ), &st ) != 0 || !S_ISREG( st.st_mode ) ) return nullptr;
+
+    try
+    {
+        auto buf = std::make_unique<FileBuffer>( (FILE*)f );
+        if( buf->size() == 0 ) return nullptr;
+        return m_files.emplace_back( std::move( buf ) ).get();
+    }
+    catch( const FileBuffer::FileException& )
+    {
+        return nullptr;
+    }
+}
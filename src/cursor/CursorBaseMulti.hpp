@@ -1,13 +1,19 @@
 #pragma once
 
+#include <memory>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 #include "CursorBase.hpp"
 
+class FileBuffer;
+
 class CursorBaseMulti : public CursorBase
 {
 public:
+    ~CursorBaseMulti() override;
+
     [[nodiscard]] uint32_t FitSize( uint32_t size ) const override;
 
     NoCopy( CursorBaseMulti );
@@ -17,6 +23,11 @@ protected:
 
     void CalcSizes();
 
+    // Maps cursor file into memory for the lifetime of the theme. Returns nullptr if the file
+    // cannot be read.
+    const FileBuffer* MapFile( const std::string& path );
+
 private:
     std::vector<uint32_t> m_sizes;
+    std::vector<std::unique_ptr<FileBuffer>> m_files;
 };
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <vector>
+
+#include "CursorCache.hpp"
+#include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
+#include "util/Filesystem.hpp"
+#include "util/Logs.hpp"
+#include "util/RobinHood.hpp"
+
+constexpr char CacheMagic[8] = { 'm', 'c', 'c', 'u', 'r', 's', 'o', 'r' };
+constexpr uint32_t CacheVersion = 1;
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t request;       // size asked for
+    uint32_t size;          // nominal size of the stored cursors
+    uint32_t keySize;
+    uint32_t numSources;
+    uint32_t numBitmaps;
+    uint32_t numFrames;
+    uint32_t atlasWidth;
+    uint32_t atlasHeight;
+};
+
+struct CacheSource
+{
+    int64_t mtime;          // nanoseconds, -1 if the path does not exist
+    uint64_t length;
+};
+
+struct CacheType
+{
+    uint32_t firstBitmap;
+    uint32_t numBitmaps;
+    uint32_t firstFrame;
+    uint32_t numFrames;
+};
+
+// Bitmaps are stacked vertically in the atlas, identical images share the rows
+struct CacheBitmap
+{
+    uint32_t row;
+    uint32_t width;
+    uint32_t height;
+    uint32_t xhot;
+    uint32_t yhot;
+};
+
+using CacheTypes = std::array<CacheType, (int)CursorType::NUM>;
+
+// Cursor search paths are built from these
+static std::string GetKey( const char* theme )
+{
+    std::string key = theme;
+    for( auto env : { "XCURSOR_PATH", "XDG_DATA_HOME" } )
+    {
+        key += '\n';
+        auto val = getenv( env );
+        if( val ) key += val;
+    }
+    return key;
+}
+
+static int64_t GetModificationTime( const std::string& path )
+{
+    struct stat st;
+    if( stat( path.c_str(), &st ) != 0 ) return -1;
+    return int64_t( st.st_mtim.tv_sec ) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static void Put( std::string& out, const void* data, size_t size )
+{
+    out.append( (const char*)data, size );
+}
+
+template<typename T>
+static void Put( std::string& out, const T& value )
+{
+    out.append( (const char*)&value, sizeof( T ) );
+}
+
+template<typename T>
+static bool Read( const char*& ptr, const char* end, T& value )
+{
+    if( size_t( end - ptr ) < sizeof( T ) ) return false;
+    memcpy( &value, ptr, sizeof( T ) );
+    ptr += sizeof( T );
+    return true;
+}
+
+template<typename T>
+static bool Read( const char*& ptr, const char* end, std::vector<T>& value, size_t count )
+{
+    if( size_t( end - ptr ) / sizeof( T ) < count ) return false;
+    value.resize( count );
+    memcpy( value.data(), ptr, sizeof( T ) * count );
+    ptr += sizeof( T ) * count;
+    return true;
+}
+
+static bool Validate( const CacheHeader& hdr, const CacheTypes& types, const std::vector<CacheBitmap>& bitmaps, const std::vector<CursorFrame>& frames )
+{
+    if( types[0].numBitmaps == 0 ) return false;
+    for( auto& type : types )
+    {
+        if( uint64_t( type.firstBitmap ) + type.numBitmaps > hdr.numBitmaps ) return false;
+        if( uint64_t( type.firstFrame ) + type.numFrames > hdr.numFrames ) return false;
+        if( ( type.numBitmaps == 0 ) != ( type.numFrames == 0 ) ) return false;
+        for( uint32_t i=0; i<type.numFrames; i++ )
+        {
+            if( frames[type.firstFrame + i].frame >= type.numBitmaps ) return false;
+        }
+    }
+    for( auto& v : bitmaps )
+    {
+        if( v.width == 0 || v.width > hdr.atlasWidth ) return false;
+        if( v.height == 0 || uint64_t( v.row ) + v.height > hdr.atlasHeight ) return false;
+    }
+    return true;
+}
+
+std::unique_ptr<CursorCache> CursorCache::Load( const std::string& path, const char* theme, uint32_t size )
+{
+    ZoneScoped;
+
+    FileWrapper f( path.c_str(), "rb" );
+    if( !f ) return nullptr;
+
+    std::unique_ptr<FileBuffer> buf;
+    try
+    {
+        buf = std::make_unique<FileBuffer>( (FILE*)f );
+    }
+    catch( const FileBuffer::FileException& )
+    {
+        return nullptr;
+    }
+
+    auto ptr = buf->data();
+    const auto end = ptr + buf->size();
+
+    CacheHeader hdr;
+    if( !Read( ptr, end, hdr ) || memcmp( hdr.magic, CacheMagic, sizeof( CacheMagic ) ) != 0 || hdr.version != CacheVersion ) return nullptr;
+    if( hdr.request != size ) return nullptr;
+
+    const auto key = GetKey( theme );
+    if( hdr.keySize != key.size() || size_t( end - ptr ) < key.size() || memcmp( ptr, key.data(), key.size() ) != 0 ) return nullptr;
+    ptr += key.size();
+
+    for( uint32_t i=0; i<hdr.numSources; i++ )
+    {
+        CacheSource src;
+        if( !Read( ptr, end, src ) || size_t( end - ptr ) < src.length ) return nullptr;
+        const std::string source( ptr, src.length );
+        ptr += src.length;
+
+        if( GetModificationTime( source ) != src.mtime )
+        {
+            mclog( LogLevel::Debug, "Cursor cache is out of date, %s has changed", source.c_str() );
+            return nullptr;
+        }
+    }
+
+    CacheTypes types;
+    std::vector<CacheBitmap> bitmaps;
+    std::vector<CursorFrame> frames;
+    if( !Read( ptr, end, types ) ) return nullptr;
+    if( !Read( ptr, end, bitmaps, hdr.numBitmaps ) ) return nullptr;
+    if( !Read( ptr, end, frames, hdr.numFrames ) ) return nullptr;
+    if( uint64_t( size_t( end - ptr ) ) < uint64_t( hdr.atlasWidth ) * hdr.atlasHeight * 4 ) return nullptr;
+    if( !Validate( hdr, types, bitmaps, frames ) ) return nullptr;
+
+    const auto atlas = (const uint8_t*)ptr;
+    const auto atlasStride = size_t( hdr.atlasWidth ) * 4;
+
+    auto cache = std::unique_ptr<CursorCache>( new CursorCache );
+    cache->m_size = hdr.size;
+    auto& cursor = cache->m_cursor.emplace( hdr.size, CursorSize {} ).first->second;
+
+    unordered_flat_map<uint32_t, std::shared_ptr<Bitmap>> rows;
+    for( int i=0; i<(int)CursorType::NUM; i++ )
+    {
+        auto& type = types[i];
+        auto& cursorData = cursor.type[i];
+        for( uint32_t j=0; j<type.numBitmaps; j++ )
+        {
+            auto& v = bitmaps[type.firstBitmap + j];
+            auto& bitmap = rows[v.row];
+            if( !bitmap )
+            {
+                bitmap = std::make_shared<Bitmap>( v.width, v.height );
+                for( uint32_t y=0; y<v.height; y++ )
+                {
+                    memcpy( bitmap->Data() + y * v.width * 4, atlas + ( v.row + y ) * atlasStride, v.width * 4 );
+                }
+            }
+            cursorData.bitmaps.emplace_back( CursorBitmap { bitmap, v.xhot, v.yhot } );
+        }
+        cursorData.frames.assign( frames.begin() + type.firstFrame, frames.begin() + type.firstFrame + type.numFrames );
+    }
+
+    mclog( LogLevel::Info, "Loaded cursor theme %s from cache", theme );
+    return cache;
+}
+
+bool CursorCache::Save( const std::string& path, const char* theme, uint32_t size, const CursorBase& cursor )
+{
+    ZoneScoped;
+
+    const auto fit = cursor.FitSize( size );
+    const auto def = cursor.Get( fit, CursorType::Default );
+    if( !def ) return false;
+
+    CacheTypes types;
+    std::vector<CacheBitmap> bitmaps;
+    std::vector<CursorFrame> frames;
+
+    // Aliased cursor names often decode to the same image
+    std::vector<const Bitmap*> atlas;
+    std::vector<uint32_t> atlasRow;
+    unordered_flat_map<size_t, std::vector<uint32_t>> atlasHash;
+    uint32_t atlasWidth = 0;
+    uint32_t atlasHeight = 0;
+
+    for( int i=0; i<(int)CursorType::NUM; i++ )
+    {
+        auto& type = types[i];
+        type = { (uint32_t)bitmaps.size(), 0, (uint32_t)frames.size(), 0 };
+
+        // Missing cursors fall back to the default one when loaded
+        const auto data = cursor.Get( fit, (CursorType)i );
+        if( i != 0 && data == def ) continue;
+
+        for( auto& v : data->bitmaps )
+        {
+            const auto bmp = v.bitmap.get();
+            const auto bytes = size_t( bmp->Width() ) * bmp->Height() * 4;
+            auto& slots = atlasHash[std::hash<std::string_view>()( std::string_view( (const char*)bmp->Data(), bytes ) )];
+            auto it = std::ranges::find_if( slots, [&atlas, bmp, bytes]( uint32_t slot ) {
+                return atlas[slot]->Width() == bmp->Width() && atlas[slot]->Height() == bmp->Height() && memcmp( atlas[slot]->Data(), bmp->Data(), bytes ) == 0;
+            } );
+            if( it == slots.end() )
+            {
+                it = slots.emplace( slots.end(), (uint32_t)atlas.size() );
+                atlas.emplace_back( bmp );
+                atlasRow.emplace_back( atlasHeight );
+                atlasWidth = std::max( atlasWidth, bmp->Width() );
+                atlasHeight += bmp->Height();
+            }
+            bitmaps.emplace_back( CacheBitmap { atlasRow[*it], bmp->Width(), bmp->Height(), v.xhot, v.yhot } );
+        }
+        frames.insert( frames.end(), data->frames.begin(), data->frames.end() );
+
+        type.numBitmaps = (uint32_t)data->bitmaps.size();
+        type.numFrames = (uint32_t)data->frames.size();
+    }
+
+    const auto key = GetKey( theme );
+    auto& sources = cursor.Sources();
+
+    CacheHeader hdr = {};
+    memcpy( hdr.magic, CacheMagic, sizeof( CacheMagic ) );
+    hdr.version = CacheVersion;
+    hdr.request = size;
+    hdr.size = fit;
+    hdr.keySize = (uint32_t)key.size();
+    hdr.numSources = (uint32_t)sources.size();
+    hdr.numBitmaps = (uint32_t)bitmaps.size();
+    hdr.numFrames = (uint32_t)frames.size();
+    hdr.atlasWidth = atlasWidth;
+    hdr.atlasHeight = atlasHeight;
+
+    std::string out;
+    Put( out, hdr );
+    Put( out, key.data(), key.size() );
+    for( auto& v : sources )
+    {
+        Put( out, CacheSource { GetModificationTime( v ), v.size() } );
+        Put( out, v.data(), v.size() );
+    }
+    Put( out, types );
+    Put( out, bitmaps.data(), sizeof( CacheBitmap ) * bitmaps.size() );
+    Put( out, frames.data(), sizeof( CursorFrame ) * frames.size() );
+
+    const auto atlasOffset = out.size();
+    const auto atlasStride = size_t( atlasWidth ) * 4;
+    out.resize( atlasOffset + atlasStride * atlasHeight );
+    for( size_t i=0; i<atlas.size(); i++ )
+    {
+        const auto bmp = atlas[i];
+        for( uint32_t y=0; y<bmp->Height(); y++ )
+        {
+            memcpy( out.data() + atlasOffset + ( atlasRow[i] + y ) * atlasStride, bmp->Data() + y * bmp->Width() * 4, bmp->Width() * 4 );
+        }
+    }
+
+    // Written under a temporary name, so that readers never see a partial file
+    const auto pos = path.rfind( '/' );
+    if( pos != std::string::npos && !CreateDirectories( path.substr( 0, pos ) ) ) return false;
+    const auto tmp = path + '.' + std::to_string( getpid() );
+    {
+        FileWrapper f( tmp.c_str(), "wb" );
+        if( !f || fwrite( out.data(), 1, out.size(), f ) != out.size() )
+        {
+            mclog( LogLevel::Warning, "Failed to write cursor cache %s", path.c_str() );
+            unlink( tmp.c_str() );
+            return false;
+        }
+    }
+    if( rename( tmp.c_str(), path.c_str() ) != 0 )
+    {
+        unlink( tmp.c_str() );
+        return false;
+    }
+
+    mclog( LogLevel::Debug, "Saved cursor theme %s to cache, %u images in %ux%u atlas", theme, (uint32_t)atlas.size(), atlasWidth, atlasHeight );
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+#include "CursorBase.hpp"
+
+// Cursor theme resolved and decoded at a single size, stored in one file. The cache is valid
+// for the theme name, the requested size and the cursor search paths, for as long as the
+// theme sources are not modified.
+class CursorCache : public CursorBase
+{
+public:
+    // Returns nullptr if the cache file is missing, damaged, or out of date
+    [[nodiscard]] static std::unique_ptr<CursorCache> Load( const std::string& path, const char* theme, uint32_t size );
+    static bool Save( const std::string& path, const char* theme, uint32_t size, const CursorBase& cursor );
+
+    [[nodiscard]] uint32_t FitSize( uint32_t ) const override { return m_size; }
+
+    NoCopy( CursorCache );
+
+private:
+    CursorCache() = default;
+
+    uint32_t m_size;
+};
@@ -1,5 +1,6 @@
 #include <format>
 
+#include "CursorCache.hpp"
 #include "CursorTheme.hpp"
 #include "WinCursor.hpp"
 #include "XCursor.hpp"
@@ -10,6 +11,16 @@ CursorTheme::CursorTheme()
     Config config( "mouse.ini" );
 
     const auto themeName = config.Get( "Theme", "Name", "default" );
+    const uint32_t size = config.Get( "Theme", "Size", 24 );
+    const auto cachePath = Config::GetPath( "cursor.cache" );
+
+    m_cursor = CursorCache::Load( cachePath, themeName, size );
+    if( m_cursor )
+    {
+        m_size = m_cursor->FitSize( size );
+        return;
+    }
+
     m_cursor = std::make_unique<XCursor>( themeName );
     if( !m_cursor->Valid() )
     {
@@ -17,7 +28,8 @@ CursorTheme::CursorTheme()
         if( !m_cursor->Valid() ) throw( CursorException( std::format( "Cannot load mouse cursor theme {}", themeName ) ) );
     }
 
-    m_size = m_cursor->FitSize( config.Get( "Theme", "Size", 24 ) );
+    m_size = m_cursor->FitSize( size );
+    CursorCache::Save( cachePath, themeName, size, *m_cursor );
 }
 
 CursorTheme::~CursorTheme()
@@ -1,15 +1,18 @@
+#include <algorithm>
+#include <memory>
+#include <ranges>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <tracy/Tracy.hpp>
 #include <vector>
 
 #include "CursorType.hpp"
 #include "WinCursor.hpp"
-#include "util/Alloca.h"
 #include "util/Bitmap.hpp"
 #include "util/Config.hpp"
-#include "util/FileWrapper.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
@@ -104,177 +107,178 @@ struct BitmapInfoHeader
     uint32_t clrImportant;
 };
 
+static uint32_t PaletteSize( const BitmapInfoHeader& hdr )
+{
+    return hdr.clrUsed ? hdr.clrUsed : (1 << hdr.bitCount);
+}
+
+// Size of the image, including header, palette and mask. Zero if the image is not supported.
 // TODO: Support 16-bit color and PNG payload.
-static bool LoadCursor( CursorType cursorType, unordered_flat_map<uint32_t, CursorSize>& cursor, FileWrapper& f, size_t offset, bool insertFrame )
+static size_t ImageSize( const BitmapInfoHeader& hdr )
 {
-    IconHeader hdr;
-    if( !f.Read( &hdr, sizeof( hdr ) ) ) return false;
-    if( hdr.reserved != 0 || hdr.type != 2 ) return false;
+    if( hdr.size != sizeof( hdr ) ) return 0;
+    if( hdr.compression != 0 ) return 0;
 
-    std::vector<IconEntry> entries( hdr.count );
-    if( !f.Read( entries.data(), sizeof( IconEntry ) * hdr.count ) ) return false;
+    const uint64_t w = hdr.width;
+    const uint64_t h = abs( hdr.height / 2 );
+    if( hdr.width <= 0 || h == 0 ) return 0;
+    if( (w*h) % 8 != 0 ) return 0;
 
-    uint32_t bestBitCount = 0;
-    for( uint32_t i=0; i<hdr.count; i++ )
+    const auto stride = ( w + 31 ) / 32 * 32;
+    uint64_t sz = sizeof( hdr ) + stride*h/8;
+    switch( hdr.bitCount )
     {
-        BitmapInfoHeader bmpHdr;
-        fseek( f, offset + entries[i].dataOffset, SEEK_SET );
-        if( !f.Read( &bmpHdr, sizeof( bmpHdr ) ) ) return false;
-        if( bmpHdr.size != sizeof( bmpHdr ) ) return false;
-        if( bmpHdr.compression != 0 ) return false;
-
-        if( bmpHdr.bitCount > bestBitCount ) bestBitCount = bmpHdr.bitCount;
+    case 1:
+    case 4:
+    case 8:
+        if( PaletteSize( hdr ) > 256 ) return 0;
+        sz += sizeof( uint32_t ) * PaletteSize( hdr ) + w*h*hdr.bitCount/8;
+        break;
+    case 32:
+        sz += w*h*4;
+        break;
+    default:
+        return 0;
     }
+    return sz;
+}
 
-    const auto type = (int)cursorType;
-    for( auto& v : entries )
-    {
-        if( v.reserved != 0 ) return false;
-
-        BitmapInfoHeader bmpHdr;
-        fseek( f, offset + v.dataOffset, SEEK_SET );
-        if( !f.Read( &bmpHdr, sizeof( bmpHdr ) ) ) return false;
-        if( bmpHdr.size != sizeof( bmpHdr ) ) return false;
-        if( bmpHdr.compression != 0 ) return false;
-
-        const auto w = bmpHdr.width;
-        const auto h = abs( bmpHdr.height / 2 );
-
-        if( (w*h) % 8 != 0 ) return false;
+static std::shared_ptr<Bitmap> DecodeImage( const char* data )
+{
+    BitmapInfoHeader bmpHdr;
+    memcpy( &bmpHdr, data, sizeof( bmpHdr ) );
+    auto src = (const uint8_t*)data + sizeof( bmpHdr );
 
-        const auto stride = ( w + 31 ) / 32 * 32;
-        const auto msz = stride*h/8;
+    const auto w = bmpHdr.width;
+    const auto h = abs( bmpHdr.height / 2 );
+    const auto stride = ( w + 31 ) / 32 * 32;
 
-        if( bmpHdr.bitCount != bestBitCount )
-        {
-            const int colors = bmpHdr.clrUsed ? bmpHdr.clrUsed : (1 << bmpHdr.bitCount);
-            switch( bmpHdr.bitCount )
-            {
-            case 1:
-                fseek( f, sizeof( uint32_t ) * colors + (w*h/8) + msz, SEEK_CUR );
-                break;
-            case 4:
-                fseek( f, sizeof( uint32_t ) * colors + (w*h/2) + msz, SEEK_CUR );
-                break;
-            case 8:
-                fseek( f, sizeof( uint32_t ) * colors + (w*h) + msz, SEEK_CUR );
-                break;
-            case 16:
-                return false;
-            case 32:
-                fseek( f, w*h*4 + msz, SEEK_CUR );
-                break;
-            default:
-                return false;
-            };
-            continue;
-        }
+    auto bitmap = std::make_shared<Bitmap>( w, h );
+    auto dst = bitmap->Data();
 
-        auto bitmap = std::make_unique<Bitmap>( w, h );
+    if( bmpHdr.bitCount == 32 )
+    {
+        memcpy( dst, src, w*h*4 );
+        src += w*h*4;
+    }
+    else
+    {
+        uint32_t palette[256] = {};
+        const auto colors = PaletteSize( bmpHdr );
+        memcpy( palette, src, sizeof( uint32_t ) * colors );
+        src += sizeof( uint32_t ) * colors;
 
         switch( bmpHdr.bitCount )
         {
         case 1:
-        {
-            const int colors = bmpHdr.clrUsed ? bmpHdr.clrUsed : (1 << bmpHdr.bitCount);
-            std::vector<uint32_t> palette( colors );
-            if( !f.Read( palette.data(), sizeof( uint32_t ) * colors ) ) return false;
-
-            auto msz = w*h/8;
-            auto data = (uint8_t*)alloca( msz );
-            if( !f.Read( data, msz ) ) return false;
-            auto dst = bitmap->Data();
-            while( msz > 0 )
+            for( int i=0; i<w*h/8; i++ )
             {
-                auto px = *data++;
-                for( int i=0; i<8; i++ )
+                uint8_t px = *src++;
+                for( int j=0; j<8; j++ )
                 {
                     memcpy( dst, &palette[px >> 7], 4 );
                     dst += 4;
                     px <<= 1;
                 }
-                msz--;
             }
             break;
-        }
         case 4:
-        case 8:
-        {
-            const int colors = bmpHdr.clrUsed ? bmpHdr.clrUsed : (1 << bmpHdr.bitCount);
-            std::vector<uint32_t> palette( colors );
-            if( !f.Read( palette.data(), sizeof( uint32_t ) * colors ) ) return false;
-
-            auto dst = bitmap->Data();
-            auto cnt = w*h;
-            if( bmpHdr.bitCount == 4 )
+            for( int i=0; i<w*h/2; i++ )
             {
-                while( cnt > 0 )
-                {
-                    uint8_t px;
-                    if( !f.Read( &px, 1 ) ) return false;
-                    memcpy( dst, &palette[px >> 4], 4 );
-                    dst += 4;
-                    memcpy( dst, &palette[px & 0xF], 4 );
-                    dst += 4;
-                    cnt -= 2;
-                }
+                const auto px = *src++;
+                memcpy( dst, &palette[px >> 4], 4 );
+                dst += 4;
+                memcpy( dst, &palette[px & 0xF], 4 );
+                dst += 4;
             }
-            else
+            break;
+        case 8:
+            for( int i=0; i<w*h; i++ )
             {
-                while( cnt > 0 )
-                {
-                    uint8_t px;
-                    if( !f.Read( &px, 1 ) ) return false;
-                    memcpy( dst, &palette[px], 4 );
-                    dst += 4;
-                    cnt--;
-                }
+                memcpy( dst, &palette[*src++], 4 );
+                dst += 4;
             }
             break;
-        }
-        case 16:
-            return false;
-        case 32:
-            if( !f.Read( bitmap->Data(), w*h*4 ) ) return false;
-            break;
         default:
-            return false;
+            break;
         }
+    }
 
-        auto mask = (uint8_t*)alloca( msz );
-        if( !f.Read( mask, msz ) ) return false;
-
-        auto dst = bitmap->Data();
-        for( int y=0; y<h; y++ )
+    dst = bitmap->Data();
+    for( int y=0; y<h; y++ )
+    {
+        for( int x=0; x<w/8; x++ )
         {
-            for( int x=0; x<w/8; x++ )
+            auto px = *src++;
+            for( int i=0; i<8; i++ )
             {
-                auto px = *mask++;
-                for( int i=0; i<8; i++ )
+                if( (px & 0x80) == 0 )
                 {
-                    if( (px & 0x80) == 0 )
-                    {
-                        if( bmpHdr.bitCount != 32 ) *(dst+3) = 0xFF;
-                    }
-                    else
-                    {
-                        memset( dst, 0, 4 );
-                    }
-                    dst += 4;
-                    px <<= 1;
+                    if( bmpHdr.bitCount != 32 ) *(dst+3) = 0xFF;
+                }
+                else
+                {
+                    memset( dst, 0, 4 );
                 }
+                dst += 4;
+                px <<= 1;
             }
-            mask += ( stride - w ) / 8;
         }
+        src += ( stride - w ) / 8;
+    }
 
-        if( bmpHdr.height > 0 ) bitmap->FlipVertical();
+    // Alpha channel of 32-bit images is not premultiplied. Palette images are opaque or fully
+    // transparent, and need no conversion.
+    if( bmpHdr.bitCount == 32 )
+    {
+        dst = bitmap->Data();
+        for( int i=0; i<w*h; i++ )
+        {
+            const auto a = dst[3];
+            for( int c=0; c<3; c++ ) dst[c] = ( dst[c] * a + 127 ) / 255;
+            dst += 4;
+        }
+    }
 
-        auto it = cursor.find( w );
-        if( it == cursor.end() ) it = cursor.emplace( w, CursorSize {} ).first;
+    if( bmpHdr.height > 0 ) bitmap->FlipVertical();
+    return bitmap;
+}
 
-        auto& cursorData = it->second.type[type];
-        cursorData.bitmaps.emplace_back( CursorBitmap { std::move( bitmap ), v.xhot, v.yhot } );
-        if( insertFrame ) cursorData.frames.emplace_back( CursorFrame {} );
+bool WinCursor::IndexIcons( const char* data, size_t size, size_t offset, ImageList& images )
+{
+    IconHeader hdr;
+    if( offset + sizeof( hdr ) > size ) return false;
+    memcpy( &hdr, data + offset, sizeof( hdr ) );
+    if( hdr.reserved != 0 || hdr.type != 2 ) return false;
+    if( hdr.count > ( size - offset - sizeof( hdr ) ) / sizeof( IconEntry ) ) return false;
+
+    std::vector<IconEntry> entries( hdr.count );
+    memcpy( entries.data(), data + offset + sizeof( hdr ), sizeof( IconEntry ) * hdr.count );
+
+    uint32_t bestBitCount = 0;
+    for( auto& v : entries )
+    {
+        if( v.reserved != 0 ) return false;
+
+        const auto pos = offset + v.dataOffset;
+        BitmapInfoHeader bmpHdr;
+        if( pos + sizeof( bmpHdr ) > size ) return false;
+        memcpy( &bmpHdr, data + pos, sizeof( bmpHdr ) );
+
+        const auto imageSize = ImageSize( bmpHdr );
+        if( imageSize == 0 || imageSize > size - pos ) return false;
+
+        if( bmpHdr.bitCount > bestBitCount ) bestBitCount = bmpHdr.bitCount;
+    }
+
+    for( auto& v : entries )
+    {
+        const auto pos = offset + v.dataOffset;
+        BitmapInfoHeader bmpHdr;
+        memcpy( &bmpHdr, data + pos, sizeof( bmpHdr ) );
+        if( bmpHdr.bitCount != bestBitCount ) continue;
+
+        images.emplace_back( bmpHdr.width, Image { data + pos, v.xhot, v.yhot } );
     }
 
     return true;
@@ -299,137 +303,147 @@ struct AniHeader
     uint32_t flags;
 };
 
-static bool LoadCursor( const std::string& path, CursorType cursorType, unordered_flat_map<uint32_t, CursorSize>& cursor )
+bool WinCursor::IndexCursor( const FileBuffer* file, CursorType cursorType )
 {
-    FileWrapper f( path.c_str(), "rb" );
-    if( !f ) return false;
+    if( !file ) return false;
+    const auto data = file->data();
+    const auto size = file->size();
+
+    ImageList images;
+    Animation animation;
 
-    uint32_t magic;
-    if( !f.Read( &magic, 4 ) ) return false;
-    if( memcmp( &magic, "RIFF", 4 ) != 0 )
+    if( size < 12 || memcmp( data, "RIFF", 4 ) != 0 )
     {
-        fseek( f, 0, SEEK_SET );
-        return LoadCursor( cursorType, cursor, f, 0, true );
+        if( !IndexIcons( data, size, 0, images ) ) return false;
     }
+    else
+    {
+        if( memcmp( data + 8, "ACON", 4 ) != 0 ) return false;
 
-    if( fseek( f, 4, SEEK_CUR ) != 0 ) return false;
-    if( !f.Read( &magic, 4 ) ) return false;
-    if( memcmp( &magic, "ACON", 4 ) != 0 ) return false;
-
-    bool gotFrames = false;
-    bool gotAniHeader = false;
-    AniHeader aniHeader;
+        bool gotFrames = false;
+        bool gotAniHeader = false;
+        AniHeader aniHeader;
 
-    std::vector<uint32_t> rate;
-    std::vector<uint32_t> seq;
+        size_t pos = 12;
+        while( pos + sizeof( RiffChunk ) <= size )
+        {
+            RiffChunk chunk;
+            memcpy( &chunk, data + pos, sizeof( RiffChunk ) );
+            pos += sizeof( RiffChunk );
 
-    for(;;)
-    {
-        RiffChunk chunk;
-        if( !f.Read( &chunk, sizeof( RiffChunk ) ) ) break;
+            const auto end = pos + chunk.size;
+            if( end > size ) break;
 
-        if( memcmp( &chunk.fourcc, "LIST", 4 ) == 0 )
-        {
-            uint32_t hdrid;
-            if( !f.Read( &hdrid, 4 ) ) return false;
-            if( memcmp( &hdrid, "fram", 4 ) != 0 )
+            if( memcmp( &chunk.fourcc, "LIST", 4 ) == 0 )
             {
-                fseek( f, chunk.size - 4, SEEK_CUR );
-                continue;
-            }
+                if( chunk.size >= 4 && memcmp( data + pos, "fram", 4 ) == 0 )
+                {
+                    if( !gotAniHeader ) return false;
 
-            if( !gotAniHeader ) return false;
-            for( uint32_t i=0; i<aniHeader.numFrames; i++ )
+                    auto framePos = pos + 4;
+                    for( uint32_t i=0; i<aniHeader.numFrames; i++ )
+                    {
+                        RiffChunk icon;
+                        if( framePos + sizeof( RiffChunk ) > end ) return false;
+                        memcpy( &icon, data + framePos, sizeof( RiffChunk ) );
+                        if( memcmp( &icon.fourcc, "icon", 4 ) != 0 ) return false;
+                        framePos += sizeof( RiffChunk );
+
+                        if( !IndexIcons( data, end, framePos, images ) ) return false;
+                        framePos += icon.size + ( icon.size & 1 );
+                    }
+                    gotFrames = true;
+                }
+            }
+            else if( memcmp( &chunk.fourcc, "anih", 4 ) == 0 )
             {
-                RiffChunk icon;
-                if( !f.Read( &icon, sizeof( RiffChunk ) ) ) return false;
-                if( memcmp( &icon.fourcc, "icon", 4 ) != 0 ) return false;
+                if( chunk.size != sizeof( AniHeader ) ) return false;
+                memcpy( &aniHeader, data + pos, sizeof( AniHeader ) );
 
-                if( !LoadCursor( cursorType, cursor, f, ftell( f ), false ) ) return false;
+                // Bit 1 is the IconFlag value. Zero indicated images are raw data.
+                // This is not supported.
+                if( (aniHeader.flags & 1) == 0 ) return false;
+
+                gotAniHeader = true;
             }
-            gotFrames = true;
+            else if( memcmp( &chunk.fourcc, "rate", 4 ) == 0 )
+            {
+                CheckPanic( gotAniHeader, "rate chunk before anih" );
+                if( chunk.size != sizeof( uint32_t ) * aniHeader.numSteps ) return false;
+                animation.rate.resize( aniHeader.numSteps );
+                memcpy( animation.rate.data(), data + pos, sizeof( uint32_t ) * aniHeader.numSteps );
+            }
+            else if( memcmp( &chunk.fourcc, "seq ", 4 ) == 0 )
+            {
+                CheckPanic( gotAniHeader, "seq chunk before anih" );
+                if( chunk.size != sizeof( uint32_t ) * aniHeader.numSteps ) return false;
+                animation.seq.resize( aniHeader.numSteps );
+                memcpy( animation.seq.data(), data + pos, sizeof( uint32_t ) * aniHeader.numSteps );
+            }
+
+            pos = end + ( chunk.size & 1 );
         }
-        else if( memcmp( &chunk.fourcc, "anih", 4 ) == 0 )
-        {
-            if( chunk.size != sizeof( AniHeader ) ) return false;
-            if( !f.Read( &aniHeader, sizeof( AniHeader ) ) ) return false;
+        if( !gotFrames ) return false;
 
-            // Bit 1 is the IconFlag value. Zero indicated images are raw data.
-            // This is not supported.
-            if( (aniHeader.flags & 1) == 0 ) return false;
+        animation.animated = true;
+        animation.displayRate = aniHeader.displayRate;
 
-            gotAniHeader = true;
-        }
-        else if( memcmp( &chunk.fourcc, "rate", 4 ) == 0 )
-        {
-            CheckPanic( gotAniHeader, "rate chunk before anih" );
-            if( chunk.size != sizeof( uint32_t ) * aniHeader.numSteps ) return false;
-            rate.resize( aniHeader.numSteps );
-            if( !f.Read( rate.data(), sizeof( uint32_t ) * aniHeader.numSteps ) ) return false;
-        }
-        else if( memcmp( &chunk.fourcc, "seq ", 4 ) == 0 )
+        // Frame sequence is shared by all sizes, so each size must have a complete set of frames
+        unordered_flat_map<uint32_t, uint32_t> numBitmaps;
+        for( auto& v : images ) numBitmaps[v.first]++;
+        for( auto& v : numBitmaps )
         {
-            CheckPanic( gotAniHeader, "seq chunk before anih" );
-            if( chunk.size != sizeof( uint32_t ) * aniHeader.numSteps ) return false;
-            seq.resize( aniHeader.numSteps );
-            if( !f.Read( seq.data(), sizeof( uint32_t ) * aniHeader.numSteps ) ) return false;
-        }
-        else
-        {
-            fseek( f, chunk.size, SEEK_CUR );
+            if( !animation.seq.empty() )
+            {
+                if( !animation.rate.empty() && animation.rate.size() != animation.seq.size() ) return false;
+                if( std::ranges::any_of( animation.seq, [&v]( uint32_t frame ){ return frame >= v.second; } ) ) return false;
+            }
+            else if( !animation.rate.empty() && animation.rate.size() != v.second )
+            {
+                return false;
+            }
         }
     }
 
-    for( auto& v : cursor )
+    m_animation[(int)cursorType] = std::move( animation );
+    for( auto& v : images ) m_images[v.first][(int)cursorType].emplace_back( v.second );
+
+    return true;
+}
+
+void WinCursor::Load( uint32_t size, CursorSize& cursor ) const
+{
+    ZoneScoped;
+
+    auto it = m_images.find( size );
+    if( it == m_images.end() ) return;
+
+    for( int i=0; i<(int)CursorType::NUM; i++ )
     {
-        auto& cursorData = v.second.type[(int)cursorType];
-        if( rate.empty() )
+        auto& images = it->second[i];
+        if( images.empty() ) continue;
+
+        auto& cursorData = cursor.type[i];
+        for( auto& v : images ) cursorData.bitmaps.emplace_back( CursorBitmap { DecodeImage( v.data ), v.xhot, v.yhot } );
+
+        auto& animation = m_animation[i];
+        if( !animation.animated )
         {
-            if( seq.empty() )
-            {
-                cursorData.frames.resize( cursorData.bitmaps.size() );
-                for( uint32_t i=0; i<cursorData.bitmaps.size(); i++ )
-                {
-                    cursorData.frames[i].delay = aniHeader.displayRate * 16667;
-                    cursorData.frames[i].frame = i;
-                }
-            }
-            else
-            {
-                cursorData.frames.resize( seq.size() );
-                for( uint32_t i=0; i<seq.size(); i++ )
-                {
-                    cursorData.frames[i].delay = aniHeader.displayRate * 16667;
-                    cursorData.frames[i].frame = seq[i];
-                }
-            }
+            cursorData.frames.resize( cursorData.bitmaps.size() );
+            continue;
         }
-        else
+
+        const auto& seq = animation.seq;
+        const auto& rate = animation.rate;
+        cursorData.frames.resize( seq.empty() ? cursorData.bitmaps.size() : seq.size() );
+        for( uint32_t j=0; j<cursorData.frames.size(); j++ )
         {
-            if( seq.empty() )
-            {
-                if( rate.size() != cursorData.bitmaps.size() ) return false;
-                cursorData.frames.resize( rate.size() );
-                for( uint32_t i=0; i<rate.size(); i++ )
-                {
-                    cursorData.frames[i].delay = rate[i] * 16667;
-                    cursorData.frames[i].frame = i;
-                }
-            }
-            else
-            {
-                if( rate.size() != seq.size() ) return false;
-                cursorData.frames.resize( seq.size() );
-                for( uint32_t i=0; i<seq.size(); i++ )
-                {
-                    cursorData.frames[i].delay = rate[i] * 16667;
-                    cursorData.frames[i].frame = seq[i];
-                }
-            }
+            cursorData.frames[j].delay = ( rate.empty() ? animation.displayRate : rate[j] ) * 16667;
+            cursorData.frames[j].frame = seq.empty() ? j : seq[j];
         }
     }
 
-    return gotFrames;
+    mclog( LogLevel::Debug, "Decoded Windows cursors of size %u", size );
 }
 
 WinCursor::WinCursor( const char* theme )
@@ -440,22 +454,25 @@ WinCursor::WinCursor( const char* theme )
     {
         const auto path = dir + theme + '/';
         const auto iniPath = path + "theme.ini";
+        m_sources.emplace_back( dir );
+        m_sources.emplace_back( path );
+        m_sources.emplace_back( iniPath );
         Config ini( iniPath );
         if( ini )
         {
             const char* defaultName;
             if( ini.GetOpt( "Theme", "Default", defaultName ) )
             {
-                CheckPanic( m_cursor.empty(), "m_cursor is not empty" );
-                if( LoadCursor( path + defaultName, CursorType::Default, m_cursor ) )
+                CheckPanic( m_images.empty(), "m_images is not empty" );
+                if( IndexCursor( MapFile( path + defaultName ), CursorType::Default ) )
                 {
-                    auto it = m_cursor.find( 32 );
-                    CheckPanic( it != m_cursor.end(), "32x32 cursor size not found" );
+                    auto it = m_images.find( 32 );
+                    CheckPanic( it != m_images.end(), "32x32 cursor size not found" );
 
                     for( int i=1; i<(int)CursorType::NUM; i++ )
                     {
                         const char* name;
-                        if( !ini.GetOpt( "Theme", CursorNames[i], name ) || !LoadCursor( path + name, (CursorType)i, m_cursor ) )
+                        if( !ini.GetOpt( "Theme", CursorNames[i], name ) || !IndexCursor( MapFile( path + name ), (CursorType)i ) )
                         {
                             numCursors--;
                         }
@@ -463,11 +480,12 @@ WinCursor::WinCursor( const char* theme )
                 }
             }
         }
-        if( !m_cursor.empty() ) break;
+        if( !m_images.empty() ) break;
     }
-    if( m_cursor.empty() ) return;
+    if( m_images.empty() ) return;
 
+    for( auto& v : m_images ) m_cursor.emplace( v.first, CursorSize {} );
     CalcSizes();
 
-    mclog( LogLevel::Info, "Loaded %i Windows cursors from theme %s", numCursors, theme );
+    mclog( LogLevel::Info, "Indexed %i Windows cursors from theme %s", numCursors, theme );
 }
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
 #include "CursorBaseMulti.hpp"
 
 class WinCursor : public CursorBaseMulti
@@ -8,4 +14,31 @@ public:
     explicit WinCursor( const char* theme );
 
     NoCopy( WinCursor );
+
+protected:
+    void Load( uint32_t size, CursorSize& cursor ) const override;
+
+private:
+    struct Image
+    {
+        const char* data;   // bitmap info header in mapped cursor file
+        uint16_t xhot;
+        uint16_t yhot;
+    };
+
+    struct Animation
+    {
+        bool animated = false;
+        uint32_t displayRate = 0;
+        std::vector<uint32_t> rate;
+        std::vector<uint32_t> seq;
+    };
+
+    using ImageList = std::vector<std::pair<uint32_t, Image>>;
+
+    bool IndexCursor( const FileBuffer* file, CursorType cursorType );
+    static bool IndexIcons( const char* data, size_t size, size_t offset, ImageList& images );
+
+    unordered_flat_map<uint32_t, std::array<std::vector<Image>, (int)CursorType::NUM>> m_images;
+    std::array<Animation, (int)CursorType::NUM> m_animation;
 };
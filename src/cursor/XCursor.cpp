@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <array>
 #include <memory>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,13 +7,15 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <ranges>
+#include <tracy/Tracy.hpp>
+#include <utility>
 #include <vector>
 
 #include "CursorType.hpp"
 #include "XCursor.hpp"
 #include "util/Bitmap.hpp"
 #include "util/Config.hpp"
-#include "util/FileWrapper.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
 #include "util/RobinHood.hpp"
@@ -106,10 +109,11 @@ static std::vector<std::string> GetPaths()
     return ret;
 }
 
-static std::vector<std::string> GetThemeData( const char* theme )
+static std::vector<std::string> GetThemeData( const char* theme, std::vector<std::string>& sources )
 {
     std::vector<std::string> themeData;
     static const auto paths = GetPaths();
+    sources = paths;
 
     unordered_flat_set<std::string> done;
     std::vector<std::string> todo { theme };
@@ -127,6 +131,8 @@ static std::vector<std::string> GetThemeData( const char* theme )
             struct stat st;
             if( stat( path.c_str(), &st ) == 0 && ( st.st_mode & S_IFMT ) == S_IFDIR )
             {
+                sources.emplace_back( path );
+
                 const auto configPath = path + "/index.theme";
                 Config ini( configPath );
                 if( ini )
@@ -142,6 +148,7 @@ static std::vector<std::string> GetThemeData( const char* theme )
                 if( stat( path.c_str(), &st ) == 0 && ( st.st_mode & S_IFMT ) == S_IFDIR )
                 {
                     mclog( LogLevel::Debug, "Including cursor theme %s", curr.c_str() );
+                    sources.emplace_back( path );
                     themeData.emplace_back( std::move( path ) );
                 }
             }
@@ -180,41 +187,67 @@ struct XcursorImage
     uint32_t delay;
 };
 
-static bool LoadCursor( const std::string& path, int cursorType, unordered_flat_map<uint32_t, CursorSize>& cursor )
+static bool IndexCursor( const FileBuffer* file, int cursorType, unordered_flat_map<uint32_t, std::array<std::vector<const char*>, (int)CursorType::NUM>>& images )
 {
-    FileWrapper f( path.c_str(), "rb" );
-    if( !f ) return false;
+    if( !file ) return false;
+    const auto data = file->data();
+    const auto size = file->size();
 
     XcursorHdr hdr;
-    if( !f.Read( &hdr, sizeof( hdr ) ) || memcmp( &hdr.magic, "Xcur", 4 ) != 0 ) return false;
-
-    std::vector<XcursorToc> toc( hdr.ntoc );
-    if( !f.Read( toc.data(), sizeof( XcursorToc ) * hdr.ntoc ) ) return false;
+    if( size < sizeof( hdr ) ) return false;
+    memcpy( &hdr, data, sizeof( hdr ) );
+    if( memcmp( &hdr.magic, "Xcur", 4 ) != 0 ) return false;
+    if( hdr.ntoc > ( size - sizeof( hdr ) ) / sizeof( XcursorToc ) ) return false;
 
-    for( auto& v : toc )
+    std::vector<std::pair<uint32_t, const char*>> found;
+    for( uint32_t i=0; i<hdr.ntoc; i++ )
     {
-        if( v.type != XcursorTypeImage ) continue;
-        fseek( f, v.pos + XcursorChunkHdrSize, SEEK_SET );
+        XcursorToc toc;
+        memcpy( &toc, data + sizeof( hdr ) + i * sizeof( XcursorToc ), sizeof( XcursorToc ) );
+        if( toc.type != XcursorTypeImage ) continue;
+
+        const auto pos = size_t( toc.pos ) + XcursorChunkHdrSize;
+        if( pos + sizeof( XcursorImage ) > size ) return false;
         XcursorImage img;
-        if( !f.Read( &img, sizeof( XcursorImage ) ) ) return false;
+        memcpy( &img, data + pos, sizeof( XcursorImage ) );
+        if( uint64_t( img.width ) * img.height * 4 > size - pos - sizeof( XcursorImage ) ) return false;
+
+        found.emplace_back( toc.subtype, data + pos );
+    }
 
-        auto bitmap = std::make_shared<Bitmap>( img.width, img.height );
-        if( !f.Read( bitmap->Data(), img.width * img.height * 4 ) ) return false;
+    for( auto& v : found ) images[v.first][cursorType].emplace_back( v.second );
+    return true;
+}
 
-        auto it = cursor.find( v.subtype );
-        if( it == cursor.end() ) it = cursor.emplace( v.subtype, CursorSize {} ).first;
+void XCursor::Load( uint32_t size, CursorSize& cursor ) const
+{
+    ZoneScoped;
 
-        auto& cursorData = it->second.type[cursorType];
-        cursorData.frames.emplace_back( CursorFrame { img.delay * 1000, (uint32_t)cursorData.bitmaps.size() } );
-        cursorData.bitmaps.emplace_back( CursorBitmap { std::move( bitmap ), img.xhot, img.yhot } );
+    auto it = m_images.find( size );
+    if( it == m_images.end() ) return;
+
+    for( int i=0; i<(int)CursorType::NUM; i++ )
+    {
+        auto& cursorData = cursor.type[i];
+        for( auto ptr : it->second[i] )
+        {
+            XcursorImage img;
+            memcpy( &img, ptr, sizeof( XcursorImage ) );
+
+            auto bitmap = std::make_shared<Bitmap>( img.width, img.height );
+            memcpy( bitmap->Data(), ptr + sizeof( XcursorImage ), img.width * img.height * 4 );
+
+            cursorData.frames.emplace_back( CursorFrame { img.delay * 1000, (uint32_t)cursorData.bitmaps.size() } );
+            cursorData.bitmaps.emplace_back( CursorBitmap { std::move( bitmap ), img.xhot, img.yhot } );
+        }
     }
 
-    return true;
+    mclog( LogLevel::Debug, "Decoded X cursors of size %u", size );
 }
 
 XCursor::XCursor( const char* theme )
 {
-    const auto themeData = GetThemeData( theme );
+    const auto themeData = GetThemeData( theme, m_sources );
     const auto numTypes = (int)CursorType::NUM;
 
     int left = numTypes;
@@ -222,17 +255,18 @@ XCursor::XCursor( const char* theme )
     {
         for( int i=0; i<numTypes; i++ )
         {
-            if( std::ranges::any_of( m_cursor, [i]( const auto& v ){ return !v.second.type[i].bitmaps.empty(); } ) ) continue;
+            if( std::ranges::any_of( m_images, [i]( const auto& v ){ return !v.second[i].empty(); } ) ) continue;
 
             const auto path = td + CursorNames[i];
-            if( LoadCursor( path, i, m_cursor ) ) left--;
+            if( IndexCursor( MapFile( path ), i, m_images ) ) left--;
             if( left == 0 ) break;
         }
         if( left == 0 ) break;
     }
-    if( m_cursor.empty() ) return;
+    if( m_images.empty() ) return;
 
+    for( auto& v : m_images ) m_cursor.emplace( v.first, CursorSize {} );
     CalcSizes();
 
-    mclog( LogLevel::Info, "Loaded %i/%i X cursors from theme %s", numTypes - left, numTypes, theme );
+    mclog( LogLevel::Info, "Indexed %i/%i X cursors from theme %s", numTypes - left, numTypes, theme );
 }
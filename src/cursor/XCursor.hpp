@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <vector>
+
 #include "CursorBaseMulti.hpp"
 
 class XCursor : public CursorBaseMulti
@@ -8,4 +11,11 @@ public:
     explicit XCursor( const char* theme );
 
     NoCopy( XCursor );
+
+protected:
+    void Load( uint32_t size, CursorSize& cursor ) const override;
+
+private:
+    // Image chunks in mapped cursor files, for each nominal size and cursor type
+    unordered_flat_map<uint32_t, std::array<std::vector<const char*>, (int)CursorType::NUM>> m_images;
 };
@@ -7,18 +7,21 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class CompressedBitmap;
 class FileWrapper;
+class TaskDispatch;
 
 class DdsLoader : public ImageLoader
 {
 public:
-    explicit DdsLoader( std::shared_ptr<FileWrapper> file );
+    explicit DdsLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td );
     NoCopy( DdsLoader );
 
     static bool IsValidSignature( const uint8_t* buf, size_t size );
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<CompressedBitmap> LoadCompressed() override;
 
 private:
     bool m_valid;
@@ -26,4 +29,6 @@ private:
 
     uint32_t m_format;
     uint32_t m_offset;
+
+    TaskDispatch* m_td;
 };
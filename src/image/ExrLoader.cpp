@@ -11,7 +11,10 @@
 #include "util/Colorspace.hpp"
 #include "util/DataBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/IccCache.hpp"
+#include "util/NoCopy.hpp"
 #include "util/Panic.hpp"
+#include "util/StripPipeline.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
 
@@ -26,6 +29,103 @@ static void FixAlpha( float* ptr, size_t sz )
     while( --sz );
 }
 
+// Returns nullptr if no conversion is needed.
+static IccTransform CreateTransform( const Imf::Header& header, Colorspace colorspace )
+{
+    const auto chroma = header.findTypedAttribute<OPENEXR_IMF_INTERNAL_NAMESPACE::ChromaticitiesAttribute>( "chromaticities" );
+    if( !chroma && colorspace == Colorspace::BT709 ) return nullptr;
+
+    auto profileIn = IccProfile::Rgb( white709, primaries709, 1 );
+    if( chroma )
+    {
+        const auto neutral = header.findTypedAttribute<IMATH_NAMESPACE::V2f>( "adoptedNeutral" );
+        const auto white = neutral ? cmsCIExyY { neutral->x, neutral->y, 1 } : cmsCIExyY { 0.3127f, 0.329f, 1 };
+
+        const cmsCIExyYTRIPLE primaries = {
+            { chroma->value().red.x, chroma->value().red.y, 1 },
+            { chroma->value().green.x, chroma->value().green.y, 1 },
+            { chroma->value().blue.x, chroma->value().blue.y, 1 }
+        };
+        profileIn = IccProfile::Rgb( white, primaries, 1 );
+    }
+
+    const auto profileOut = IccProfile::Rgb( white709, colorspace == Colorspace::BT709 ? primaries709 : primaries2020, 1 );
+    return IccCache::Instance().Get( profileIn, TYPE_RGBA_HALF_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL );
+}
+
+static void Convert( cmsHTRANSFORM transform, const Imf::Rgba* src, float* dst, size_t sz )
+{
+    if( transform )
+    {
+        cmsDoTransform( transform, src, dst, sz );
+        FixAlpha( dst, sz );
+    }
+    else
+    {
+        do
+        {
+            *dst++ = src->r;
+            *dst++ = src->g;
+            *dst++ = src->b;
+            *dst++ = 1;
+            src++;
+        }
+        while( --sz );
+    }
+}
+
+class ExrStripSource : public StripSource
+{
+public:
+    ExrStripSource( Imf::RgbaInputFile& exr, TaskDispatch* td )
+        : m_exr( exr )
+        , m_td( td )
+        , m_transform( CreateTransform( exr.header(), Colorspace::BT709 ) )
+    {
+        const auto dw = m_exr.dataWindow();
+        m_minX = dw.min.x;
+        m_minY = dw.min.y;
+        m_width = dw.max.x - dw.min.x + 1;
+        m_height = dw.max.y - dw.min.y + 1;
+    }
+
+    NoCopy( ExrStripSource );
+
+    [[nodiscard]] uint32_t Width() const override { return m_width; }
+    [[nodiscard]] uint32_t Height() const override { return m_height; }
+
+    void Read( float* dst, uint32_t y, uint32_t rows ) override
+    {
+        const size_t sz = size_t( m_width ) * rows;
+        if( m_buf.size() < sz ) m_buf.resize( sz );
+
+        const auto y0 = m_minY + int( y );
+        m_exr.setFrameBuffer( m_buf.data() - m_minX - ptrdiff_t( y0 ) * m_width, 1, m_width );
+        m_exr.readPixels( y0, y0 + int( rows ) - 1 );
+
+        if( m_td )
+        {
+            m_td->ParallelFor( sz, m_td->Grain( sz, sizeof( Imf::Rgba ) + 4 * sizeof( float ) ), [src = m_buf.data(), dst, transform = m_transform.get()]( size_t begin, size_t end ) {
+                Convert( transform, src + begin, dst + begin * 4, end - begin );
+            } );
+        }
+        else
+        {
+            Convert( m_transform.get(), m_buf.data(), dst, sz );
+        }
+    }
+
+private:
+    Imf::RgbaInputFile& m_exr;
+    TaskDispatch* m_td;
+    IccTransform m_transform;
+
+    int m_minX, m_minY;
+    uint32_t m_width, m_height;
+
+    std::vector<Imf::Rgba> m_buf;
+};
+
 class ExrStream : public Imf::IStream
 {
 public:
@@ -132,30 +232,8 @@ bool ExrLoader::IsValid() const
 
 std::unique_ptr<Bitmap> ExrLoader::Load()
 {
-    auto hdr = LoadHdr( Colorspace::BT709 );
-    if( m_td )
-    {
-        auto bmp = std::make_unique<Bitmap>( hdr->Width(), hdr->Height() );
-        auto src = hdr->Data();
-        auto dst = bmp->Data();
-        size_t sz = hdr->Width() * hdr->Height();
-        while( sz > 0 )
-        {
-            const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-            m_td->Queue( [src, dst, chunk, tonemap = m_tonemap] {
-                ToneMap::Process( tonemap, (uint32_t*)dst, src, chunk );
-            } );
-            src += chunk * 4;
-            dst += chunk * 4;
-            sz -= chunk;
-        }
-        m_td->Sync();
-        return bmp;
-    }
-    else
-    {
-        return hdr->Tonemap( m_tonemap );
-    }
+    auto strips = LoadStrips();
+    return StripPipeline( *strips, m_tonemap, m_td ).Process();
 }
 
 std::unique_ptr<BitmapHdr> ExrLoader::LoadHdr( Colorspace colorspace )
@@ -174,108 +252,27 @@ std::unique_ptr<BitmapHdr> ExrLoader::LoadHdr( Colorspace colorspace )
     m_exr->readPixels( dw.min.y, dw.max.y );
 
     auto bmp = std::make_unique<BitmapHdr>( width, height, colorspace );
+    const auto transform = CreateTransform( m_exr->header(), colorspace );
 
-    const auto chroma = m_exr->header().findTypedAttribute<OPENEXR_IMF_INTERNAL_NAMESPACE::ChromaticitiesAttribute>( "chromaticities" );
-    if( chroma )
-    {
-        const auto neutral = m_exr->header().findTypedAttribute<IMATH_NAMESPACE::V2f>( "adoptedNeutral" );
-        const auto white = neutral ? cmsCIExyY { neutral->x, neutral->y, 1 } : cmsCIExyY { 0.3127f, 0.329f, 1 };
-
-        const auto& cv = chroma->value();
-        const cmsCIExyYTRIPLE primaries = {
-            { chroma->value().red.x, chroma->value().red.y, 1 },
-            { chroma->value().green.x, chroma->value().green.y, 1 },
-            { chroma->value().blue.x, chroma->value().blue.y, 1 }
-        };
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-        auto profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_HALF_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-
-        if( m_td )
-        {
-            auto src = hdr.data();
-            auto dst = bmp->Data();
-            auto sz = width * height;
-            while( sz > 0 )
-            {
-                auto chunk = std::min<size_t>( sz, 16 * 1024 );
-                m_td->Queue( [src, dst, chunk, transform] {
-                    cmsDoTransform( transform, src, dst, chunk );
-                    FixAlpha( dst, chunk );
-                } );
-                src += chunk;
-                dst += chunk * 4;
-                sz -= chunk;
-            }
-            m_td->Sync();
-        }
-        else
-        {
-            cmsDoTransform( transform, hdr.data(), bmp->Data(), width * height );
-            FixAlpha( bmp->Data(), width * height );
-        }
-
-        cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
-    }
-    else if( colorspace == Colorspace::BT2020 )
+    auto src = hdr.data();
+    auto dst = bmp->Data();
+    const size_t sz = width * height;
+    if( m_td )
     {
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-        auto profileIn = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_HALF_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-
-        if( m_td )
-        {
-            auto src = hdr.data();
-            auto dst = bmp->Data();
-            auto sz = width * height;
-            while( sz > 0 )
-            {
-                auto chunk = std::min<size_t>( sz, 16 * 1024 );
-                m_td->Queue( [src, dst, chunk, transform] {
-                    cmsDoTransform( transform, src, dst, chunk );
-                    FixAlpha( dst, chunk );
-                } );
-                src += chunk;
-                dst += chunk * 4;
-                sz -= chunk;
-            }
-            m_td->Sync();
-        }
-        else
-        {
-            cmsDoTransform( transform, hdr.data(), bmp->Data(), width * height );
-            FixAlpha( bmp->Data(), width * height );
-        }
-
-        cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
+        m_td->ParallelFor( sz, m_td->Grain( sz, sizeof( Imf::Rgba ) + 4 * sizeof( float ) ), [src, dst, transform = transform.get()]( size_t begin, size_t end ) {
+            Convert( transform, src + begin, dst + begin * 4, end - begin );
+        } );
     }
     else
     {
-        auto dst = bmp->Data();
-        auto src = hdr.data();
-        auto sz = width * height;
-        do
-        {
-            *dst++ = src->r;
-            *dst++ = src->g;
-            *dst++ = src->b;
-            *dst++ = 1;
-            src++;
-        }
-        while( --sz );
+        Convert( transform.get(), src, dst, sz );
     }
 
     return bmp;
 }
+
+std::unique_ptr<StripSource> ExrLoader::LoadStrips()
+{
+    CheckPanic( m_exr, "Invalid EXR file" );
+    return std::make_unique<ExrStripSource>( *m_exr, m_td );
+}
@@ -33,6 +33,7 @@ public:
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
+    [[nodiscard]] std::unique_ptr<StripSource> LoadStrips() override;
 
 private:
     std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::IStream> m_stream;
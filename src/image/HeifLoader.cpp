@@ -13,154 +13,16 @@
 #include "util/BitmapHdr.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/IccCache.hpp"
 #include "util/Panic.hpp"
 #include "util/Simd.hpp"
+#include "util/StripPipeline.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
+#include "util/YCbCr.hpp"
 
-static float Pq( float N, float NominalLuminanceMul )
-{
-    constexpr float m1 = 0.1593017578125f;
-    constexpr float m1inv = 1.f / m1;
-    constexpr float m2 = 78.84375f;
-    constexpr float m2inv = 1.f / m2;
-    constexpr float c1 = 0.8359375f;
-    constexpr float c2 = 18.8515625f;
-    constexpr float c3 = 18.6875f;
-
-    const auto Nm2 = std::powf( std::max( N, 0.f ), m2inv );
-    return 10000.f * std::powf( std::max( 0.f, Nm2 - c1 ) / ( c2 - c3 * Nm2 ), m1inv ) * NominalLuminanceMul;
-}
-
-static float Hlg( float E )
-{
-    constexpr float a = 0.17883277f;
-    constexpr float b = 0.28466892f;
-    constexpr float c = 0.55991073f;
-
-    if( E < 0 )
-    {
-        return -1.f * Hlg( -1.f * E );
-    }
-    else if( E <= 0.5f )
-    {
-        return E * E / 3.f;
-    }
-    else
-    {
-        return ( std::exp( ( E - c ) / a ) + b ) / 12.f;
-    }
-}
-
-#if defined __SSE4_1__ && defined __FMA__
-static void LinearizePq128( float* ptr, int sz, float NominalLuminanceMul )
-{
-    while( sz > 0 )
-    {
-        __m128 px0 = _mm_loadu_ps( ptr );
-        __m128 px1 = _mm_max_ps( px0, _mm_setzero_ps() );
-        __m128 Nm2 = _mm_pow_ps( px1, _mm_set1_ps( 1.f / 78.84375f ) );
-
-        __m128 px2 = _mm_sub_ps( Nm2, _mm_set1_ps( 0.8359375f ) );
-        __m128 px3 = _mm_max_ps( px2, _mm_setzero_ps() );
-
-        __m128 px4 = _mm_fnmadd_ps( _mm_set1_ps( 18.6875f ), Nm2, _mm_set1_ps( 18.8515625f ) );
-        __m128 px5 = _mm_div_ps( px3, px4 );
-
-        __m128 px6 = _mm_pow_ps( px5, _mm_set1_ps( 1.f / 0.1593017578125f ) );
-        __m128 ret = _mm_mul_ps( px6, _mm_set1_ps( 10000.f * NominalLuminanceMul ) );
-
-        __m128 b = _mm_blend_ps( ret, px0, 0x8 );
-        _mm_storeu_ps( ptr, b );
-
-        ptr += 4;
-        sz--;
-    }
-}
-
-#  if defined __AVX2__
-static void LinearizePq256( float* ptr, int sz, float NominalLuminanceMul )
-{
-    while( sz > 1 )
-    {
-        __m256 px0 = _mm256_loadu_ps( ptr );
-        __m256 px1 = _mm256_max_ps( px0, _mm256_setzero_ps() );
-        __m256 Nm2 = _mm256_pow_ps( px1, _mm256_set1_ps( 1.f / 78.84375f ) );
-
-        __m256 px2 = _mm256_sub_ps( Nm2, _mm256_set1_ps( 0.8359375f ) );
-        __m256 px3 = _mm256_max_ps( px2, _mm256_setzero_ps() );
-
-        __m256 px4 = _mm256_fnmadd_ps( _mm256_set1_ps( 18.6875f ), Nm2, _mm256_set1_ps( 18.8515625f ) );
-        __m256 px5 = _mm256_div_ps( px3, px4 );
-
-        __m256 px6 = _mm256_pow_ps( px5, _mm256_set1_ps( 1.f / 0.1593017578125f ) );
-        __m256 ret = _mm256_mul_ps( px6, _mm256_set1_ps( 10000.f * NominalLuminanceMul ) );
-
-        __m256 b = _mm256_blend_ps( ret, px0, 0x88 );
-        _mm256_storeu_ps( ptr, b );
-
-        ptr += 8;
-        sz -= 2;
-    }
-}
-#  endif
-
-#  if defined __AVX512F__
-static void LinearizePq512( float* ptr, int sz, float NominalLuminanceMul )
-{
-    while( sz > 3 )
-    {
-        __m512 px0 = _mm512_loadu_ps( ptr );
-        __m512 px1 = _mm512_max_ps( px0, _mm512_setzero_ps() );
-        __m512 Nm2 = _mm512_pow_ps( px1, _mm512_set1_ps( 1.f / 78.84375f ) );
-
-        __m512 px2 = _mm512_sub_ps( Nm2, _mm512_set1_ps( 0.8359375f ) );
-        __m512 px3 = _mm512_max_ps( px2, _mm512_setzero_ps() );
-
-        __m512 px4 = _mm512_fnmadd_ps( _mm512_set1_ps( 18.6875f ), Nm2, _mm512_set1_ps( 18.8515625f ) );
-        __m512 px5 = _mm512_div_ps( px3, px4 );
-
-        __m512 px6 = _mm512_pow_ps( px5, _mm512_set1_ps( 1.f / 0.1593017578125f ) );
-        __m512 ret = _mm512_mul_ps( px6, _mm512_set1_ps( 10000.f * NominalLuminanceMul ) );
-
-        __m512 b = _mm512_mask_blend_ps( 0x8888, ret, px0 );
-        _mm512_storeu_ps( ptr, b );
-
-        ptr += 16;
-        sz -= 4;
-    }
-}
-#  endif
-
-static void LinearizePq( float* ptr, int sz, float NominalLuminanceMul )
-{
-#  ifdef __AVX512F__
-    LinearizePq512( ptr, sz, NominalLuminanceMul );
-    if( (sz & 3) == 0 ) return;
-    ptr += ( sz & ~3 ) * 4;
-    sz &= 3;
-#  endif
-#  ifdef __AVX2__
-    LinearizePq256( ptr, sz, NominalLuminanceMul );
-    if( (sz & 1) == 0 ) return;
-    ptr += ( sz & ~1 ) * 4;
-    sz &= 1;
-#  endif
-    LinearizePq128( ptr, sz, NominalLuminanceMul );
-}
-#else
-static void LinearizePq( float* ptr, int sz, float NominalLuminanceMul )
-{
-    for( int i=0; i<sz; i++ )
-    {
-        ptr[0] = Pq( ptr[0], NominalLuminanceMul );
-        ptr[1] = Pq( ptr[1], NominalLuminanceMul );
-        ptr[2] = Pq( ptr[2], NominalLuminanceMul );
-
-        ptr += 4;
-    }
-}
-#endif
+// Pixels converted at once through the stack scratch buffer
+constexpr size_t BlockSize = 16 * 1024;
 
 static void ApplyGainMap( float* ptr, size_t sz, const float* gptr, float headroom )
 {
@@ -233,6 +95,37 @@ static void ApplyGainMap( float* ptr, size_t sz, const float* gptr, float headro
 }
 
 
+class HeifStripSource : public StripSource
+{
+public:
+    explicit HeifStripSource( HeifLoader& loader )
+        : m_loader( loader )
+    {
+    }
+
+    [[nodiscard]] uint32_t Width() const override { return m_loader.m_width; }
+    [[nodiscard]] uint32_t Height() const override { return m_loader.m_height; }
+
+    void Read( float* dst, uint32_t y, uint32_t rows ) override
+    {
+        const size_t offset = size_t( y ) * m_loader.m_width;
+        const size_t sz = size_t( rows ) * m_loader.m_width;
+        if( m_loader.m_td )
+        {
+            m_loader.m_td->ParallelFor( sz, m_loader.m_td->Grain( sz, 4 * sizeof( float ) ), [this, dst, offset]( size_t begin, size_t end ) {
+                m_loader.DecodeHdr( dst + begin * 4, end - begin, offset + begin );
+            } );
+        }
+        else
+        {
+            m_loader.DecodeHdr( dst, sz, offset );
+        }
+    }
+
+private:
+    HeifLoader& m_loader;
+};
+
 HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
     : m_valid( false )
     , m_tonemap( tonemap )
@@ -244,9 +137,6 @@ HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator ton
     , m_nclx( nullptr )
     , m_gainMap( nullptr )
     , m_iccData( nullptr )
-    , m_profileIn( nullptr )
-    , m_profileOut( nullptr )
-    , m_transform( nullptr )
     , m_td( td )
 {
     fseek( *m_file, 0, SEEK_SET );
@@ -260,9 +150,6 @@ HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator ton
 
 HeifLoader::~HeifLoader()
 {
-    if( m_transform ) cmsDeleteTransform( m_transform );
-    if( m_profileOut ) cmsCloseProfile( m_profileOut );
-    if( m_profileIn ) cmsCloseProfile( m_profileIn );
     delete[] m_iccData;
     delete[] m_gainMap;
     if( m_nclx ) heif_nclx_color_profile_free( m_nclx );
@@ -310,29 +197,22 @@ std::unique_ptr<Bitmap> HeifLoader::Load()
 
         if( m_td )
         {
-            size_t offset = 0;
-            size_t sz = m_width * m_height;
-            while( sz > 0 )
-            {
-                const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                m_td->Queue( [this, out, chunk, offset] {
-                    auto ptr = (float*)alloca( chunk * 4 * sizeof( float ) );
+            const size_t sz = m_width * m_height;
+            m_td->ParallelFor( sz, m_td->Grain( sz, 4 * sizeof( float ) + sizeof( uint32_t ) ), [this, out]( size_t begin, size_t end ) {
+                auto ptr = (float*)alloca( std::min( end - begin, BlockSize ) * 4 * sizeof( float ) );
+                for( size_t offset = begin; offset < end; offset += BlockSize )
+                {
+                    const auto chunk = std::min( end - offset, BlockSize );
                     LoadYCbCr( ptr, chunk, offset );
-                    ConvertYCbCrToRGB( ptr, chunk );
-                    cmsDoTransform( m_transform, ptr, out, chunk );
-                } );
-                out += chunk;
-                sz -= chunk;
-                offset += chunk;
-            }
-            m_td->Sync();
+                    cmsDoTransform( m_transform.get(), ptr, out + offset, chunk );
+                }
+            } );
         }
         else
         {
             auto tmp = std::make_unique<BitmapHdr>( m_width, m_height, Colorspace::BT709 );
             LoadYCbCr( tmp->Data(), m_width * m_height, 0 );
-            ConvertYCbCrToRGB( tmp->Data(), m_width * m_height );
-            cmsDoTransform( m_transform, tmp->Data(), out, m_width * m_height );
+            cmsDoTransform( m_transform.get(), tmp->Data(), out, m_width * m_height );
         }
 
         return bmp;
@@ -346,34 +226,79 @@ std::unique_ptr<Bitmap> HeifLoader::Load()
             auto bmp = std::make_unique<Bitmap>( m_width, m_height );
             auto out = (uint32_t*)bmp->Data();
 
-            size_t offset = 0;
-            size_t sz = m_width * m_height;
-            while( sz > 0 )
-            {
-                const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                m_td->Queue( [this, out, chunk, offset] {
-                    auto ptr = (float*)alloca( chunk * 4 * sizeof( float ) );
-                    LoadYCbCr( ptr, chunk, offset );
-                    ConvertYCbCrToRGB( ptr, chunk );
-                    if( m_transform ) cmsDoTransform( m_transform, ptr, ptr, chunk );
-                    ApplyTransfer( ptr, chunk, offset );
-                    ToneMap::Process( m_tonemap, out, ptr, chunk );
-                } );
-                out += chunk;
-                sz -= chunk;
-                offset += chunk;
-            }
-            m_td->Sync();
+            const size_t sz = m_width * m_height;
+            m_td->ParallelFor( sz, m_td->Grain( sz, 4 * sizeof( float ) + sizeof( uint32_t ) ), [this, out]( size_t begin, size_t end ) {
+                auto ptr = (float*)alloca( std::min( end - begin, BlockSize ) * 4 * sizeof( float ) );
+                for( size_t offset = begin; offset < end; offset += BlockSize )
+                {
+                    const auto chunk = std::min( end - offset, BlockSize );
+                    DecodeHdr( ptr, chunk, offset );
+                    ToneMap::Process( m_tonemap, out + offset, ptr, chunk );
+                }
+            } );
             return bmp;
         }
         else
         {
-            std::unique_ptr<BitmapHdr> hdr = LoadHdr( Colorspace::BT709 );
-            return hdr->Tonemap( m_tonemap );
+            if( !SetupDecode( true, Colorspace::BT709 ) ) return nullptr;
+
+            HeifStripSource strips( *this );
+            return StripPipeline( strips, m_tonemap ).Process();
         }
     }
 }
 
+std::unique_ptr<Bitmap> HeifLoader::LoadScaled( uint32_t targetWidth, uint32_t targetHeight )
+{
+    if( !m_buf && !Open() ) return nullptr;
+
+    // Thumbnails are SDR, they can only stand in for the SDR rendition
+    if( m_image || ( IsHdr() && !m_handleGainMap ) ) return Load();
+
+    const auto scale = MaxDownscale( m_width, m_height, targetWidth, targetHeight );
+    if( scale <= 1 ) return Load();
+
+    const auto num = heif_image_handle_get_number_of_thumbnails( m_handle );
+    if( num <= 0 ) return Load();
+
+    std::vector<heif_item_id> ids( num );
+    heif_image_handle_get_list_of_thumbnail_IDs( m_handle, ids.data(), num );
+
+    heif_image_handle* best = nullptr;
+    int bestWidth = 0;
+    int bestHeight = 0;
+    for( auto id : ids )
+    {
+        heif_image_handle* thumb;
+        if( heif_image_handle_get_thumbnail( m_handle, id, &thumb ).code != heif_error_Ok ) continue;
+
+        const auto w = heif_image_handle_get_width( thumb );
+        const auto h = heif_image_handle_get_height( thumb );
+        if( w * scale >= m_width && h * scale >= m_height && ( !best || w < bestWidth ) )
+        {
+            if( best ) heif_image_handle_release( best );
+            best = thumb;
+            bestWidth = w;
+            bestHeight = h;
+        }
+        else
+        {
+            heif_image_handle_release( thumb );
+        }
+    }
+
+    if( best )
+    {
+        mclog( LogLevel::Info, "HEIF: Using %dx%d thumbnail", bestWidth, bestHeight );
+        heif_image_handle_release( m_handle );
+        m_handle = best;
+        m_width = bestWidth;
+        m_height = bestHeight;
+    }
+
+    return Load();
+}
+
 std::unique_ptr<BitmapHdr> HeifLoader::LoadHdr( Colorspace colorspace )
 {
     if( !m_buf && !Open() ) return nullptr;
@@ -382,35 +307,28 @@ std::unique_ptr<BitmapHdr> HeifLoader::LoadHdr( Colorspace colorspace )
     auto bmp = std::make_unique<BitmapHdr>( m_width, m_height, colorspace );
     if( m_td )
     {
-        auto ptr = bmp->Data();
-        size_t offset = 0;
-        size_t sz = m_width * m_height;
-        while( sz > 0 )
-        {
-            const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-            m_td->Queue( [this, ptr, chunk, offset] {
-                LoadYCbCr( ptr, chunk, offset );
-                ConvertYCbCrToRGB( ptr, chunk );
-                if( m_transform ) cmsDoTransform( m_transform, ptr, ptr, chunk );
-                ApplyTransfer( ptr, chunk, offset );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-            offset += chunk;
-        }
-        m_td->Sync();
+        auto data = bmp->Data();
+        const size_t sz = m_width * m_height;
+        m_td->ParallelFor( sz, m_td->Grain( sz, 4 * sizeof( float ) ), [this, data]( size_t begin, size_t end ) {
+            DecodeHdr( data + begin * 4, end - begin, begin );
+        } );
     }
     else
     {
-        LoadYCbCr( bmp->Data(), m_width * m_height, 0 );
-        ConvertYCbCrToRGB( bmp->Data(), m_width * m_height );
-        if( m_transform ) cmsDoTransform( m_transform, bmp->Data(), bmp->Data(), m_width * m_height );
-        ApplyTransfer( bmp->Data(), m_width * m_height, 0 );
+        DecodeHdr( bmp->Data(), m_width * m_height, 0 );
     }
 
     return bmp;
 }
 
+std::unique_ptr<StripSource> HeifLoader::LoadStrips()
+{
+    if( !IsHdr() ) return nullptr;
+    if( !SetupDecode( true, Colorspace::BT709 ) ) return nullptr;
+
+    return std::make_unique<HeifStripSource>( *this );
+}
+
 bool HeifLoader::Open()
 {
     CheckPanic( m_valid, "Invalid HEIF file" );
@@ -480,9 +398,22 @@ bool HeifLoader::Open()
 
 bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
 {
-    auto err = heif_decode_image( m_handle, &m_image, heif_colorspace_YCbCr, heif_chroma_444, nullptr );
+    // Decode to the native chroma format, subsampled chroma is upsampled during conversion. Other
+    // layouts, like monochrome, are expanded by libheif.
+    auto err = heif_decode_image( m_handle, &m_image, heif_colorspace_undefined, heif_chroma_undefined, nullptr );
     if( err.code != heif_error_Ok ) return false;
 
+    const auto chroma = heif_image_get_chroma_format( m_image );
+    if( heif_image_get_colorspace( m_image ) != heif_colorspace_YCbCr || ( chroma != heif_chroma_420 && chroma != heif_chroma_422 && chroma != heif_chroma_444 ) )
+    {
+        heif_image_release( m_image );
+        m_image = nullptr;
+        err = heif_decode_image( m_handle, &m_image, heif_colorspace_YCbCr, heif_chroma_444, nullptr );
+        if( err.code != heif_error_Ok ) return false;
+    }
+    m_subsampledX = heif_image_get_chroma_format( m_image ) != heif_chroma_444;
+    m_subsampledY = heif_image_get_chroma_format( m_image ) == heif_chroma_420;
+
     m_colorspace = colorspace;
 
     if( !m_nclx )
@@ -510,21 +441,31 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
     m_planeCb = heif_image_get_plane_readonly( m_image, heif_channel_Cb, &strideCb );
     m_planeCr = heif_image_get_plane_readonly( m_image, heif_channel_Cr, &strideCr );
     m_planeA  = heif_image_get_plane_readonly( m_image, heif_channel_Alpha, &strideA );
-    CheckPanic( strideY == strideCb && strideY == strideCr, "Decoded output is not 444" );
-    m_stride = strideY;
-
     if( !m_planeY || !m_planeCb || !m_planeCr ) return false;
 
+    CheckPanic( strideCb == strideCr, "Decoded chroma planes have different layout" );
+    CheckPanic( m_subsampledX || strideY == strideCb, "Decoded output is not 444" );
+    m_stride = strideY;
+    m_strideChroma = strideCb;
+    m_strideAlpha = strideA;
+    m_chromaWidth = heif_image_get_width( m_image, heif_channel_Cb );
+    m_chromaHeight = heif_image_get_height( m_image, heif_channel_Cb );
+    if( m_subsampledX ) mclog( LogLevel::Info, "HEIF: Chroma subsampled to %dx%d", m_chromaWidth, m_chromaHeight );
+
     const auto bppY = heif_image_get_bits_per_pixel_range( m_image, heif_channel_Y );
     const auto bppCb = heif_image_get_bits_per_pixel_range( m_image, heif_channel_Cb );
     const auto bppCr = heif_image_get_bits_per_pixel_range( m_image, heif_channel_Cr );
     CheckPanic( bppY == bppCb && bppY == bppCr, "Decoded output has mixed bit width" );
 
     m_bpp = bppY;
-    m_bppDiv = 1.f / ( ( 1 << bppY ) - 1 );
     mclog( LogLevel::Info, "HEIF: %d bpp", bppY );
 
-    if( bppY > 8 ) m_stride /= 2;
+    if( bppY > 8 )
+    {
+        m_stride /= 2;
+        m_strideChroma /= 2;
+        m_strideAlpha /= 2;
+    }
 
     // H.273, 8.3, VideoFullRangeFlag is false if not present
     if( !m_nclx || !m_nclx->full_range_flag )
@@ -532,28 +473,28 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
         mclog( LogLevel::Info, "HEIF: Full range flag not set, converting to full range" );
     }
 
-    m_matrix = Conversion::BT601;
+    m_matrix = YCbCr::Matrix::BT601;
     if( m_nclx )
     {
         switch( m_nclx->matrix_coefficients )
         {
         case heif_matrix_coefficients_RGB_GBR:
-            m_matrix = Conversion::GBR;
+            m_matrix = YCbCr::Matrix::GBR;
             mclog( LogLevel::Info, "HEIF: Matrix coefficients GBR" );
             break;
         case heif_matrix_coefficients_ITU_R_BT_709_5:
-            m_matrix = Conversion::BT709;
+            m_matrix = YCbCr::Matrix::BT709;
             mclog( LogLevel::Info, "HEIF: Matrix coefficients BT.709" );
             break;
         case heif_matrix_coefficients_unspecified:      // see https://github.com/AOMediaCodec/libavif/wiki/CICP
         case heif_matrix_coefficients_ITU_R_BT_470_6_System_B_G:
         case heif_matrix_coefficients_ITU_R_BT_601_6:
-            m_matrix = Conversion::BT601;
+            m_matrix = YCbCr::Matrix::BT601;
             mclog( LogLevel::Info, "HEIF: Matrix coefficients BT.601" );
             break;
         case heif_matrix_coefficients_ITU_R_BT_2020_2_non_constant_luminance:
         case heif_matrix_coefficients_ITU_R_BT_2020_2_constant_luminance:
-            m_matrix = Conversion::BT2020;
+            m_matrix = YCbCr::Matrix::BT2020;
             mclog( LogLevel::Info, "HEIF: Matrix coefficients BT.2020" );
             break;
         default:
@@ -580,29 +521,25 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
         }
     }
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
+    m_converter = std::make_unique<YCbCr::Converter>( m_bpp, m_nclx && m_nclx->full_range_flag, m_matrix );
 
     // cmsCreate_sRGBProfile() uses 2.2 gamma internally, not the proper 61966-2-1 transfer function
-    cmsToneCurve* gamma = cmsBuildGamma( nullptr, 2.2f );
-    cmsToneCurve* gamma3[3] = { gamma, gamma, gamma };
+    constexpr float Gamma = 2.2f;
 
+    auto& cache = IccCache::Instance();
     if( m_iccData )
     {
-        m_profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSize );
-        int outType;
+        const auto profileIn = IccProfile::FromMemory( m_iccData, m_iccSize );
         if( hdr )
         {
             CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
-            m_profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
-            outType = TYPE_RGBA_FLT;
+            const auto profileOut = IccProfile::Rgb( white709, colorspace == Colorspace::BT709 ? primaries709 : primaries2020, 1 );
+            m_transform = cache.Get( profileIn, TYPE_RGBA_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
         }
         else
         {
-            m_profileOut = cmsCreate_sRGBProfile();
-            outType = TYPE_RGBA_8;
+            m_transform = cache.Get( profileIn, TYPE_RGBA_FLT, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
         }
-        m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, outType, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
     }
     else if( m_nclx )
     {
@@ -615,33 +552,25 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
 
         if( hdr )
         {
-            m_profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
             if( m_nclx->color_primaries != heif_color_primaries_ITU_R_BT_709_5 )
             {
                 CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
-                m_profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
-                m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+                const auto profileOut = IccProfile::Rgb( white709, colorspace == Colorspace::BT709 ? primaries709 : primaries2020, 1 );
+                m_transform = cache.Get( IccProfile::Rgb( white, primaries, 1 ), TYPE_RGBA_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
             }
         }
         else
         {
-            m_profileIn = cmsCreateRGBProfile( &white, &primaries, gamma3 );
-            m_profileOut = cmsCreate_sRGBProfile();
-            m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+            m_transform = cache.Get( IccProfile::Rgb( white, primaries, Gamma ), TYPE_RGBA_FLT, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
         }
     }
     else
     {
         CheckPanic( !hdr, "Can't be HDR here" );
 
-        m_profileIn = cmsCreateRGBProfile( &white709, &primaries709, gamma3 );
-        m_profileOut = cmsCreate_sRGBProfile();
-        m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        m_transform = cache.Get( IccProfile::Rgb( white709, primaries709, Gamma ), TYPE_RGBA_FLT, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
     }
 
-    cmsFreeToneCurve( linear );
-    cmsFreeToneCurve( gamma );
-
     if( hdr && m_handleGainMap )
     {
         heif_image* gainMap;
@@ -687,232 +616,46 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
     return true;
 }
 
-template<typename T>
-static inline void ProcessYCbCrAlpha( float* ptr, const T* srcY, const T* srcCb, const T* srcCr, const T* srcA, size_t sz, size_t offset, size_t width, size_t stride, float div )
-{
-    const auto gap = stride - width;
-
-    const int py = offset / width;
-    int px = offset % width;
-
-    srcY += py * stride + px;
-    srcCb += py * stride + px;
-    srcCr += py * stride + px;
-    srcA += py * stride + px;
-
-    for(;;)
-    {
-        auto line = std::min( sz, size_t( width - px ) );
-        sz -= line;
-        while( line-- )
-        {
-            *ptr++ = float(*srcY++) * div;
-            *ptr++ = float(*srcCb++) * div - 0.5f;
-            *ptr++ = float(*srcCr++) * div - 0.5f;
-            *ptr++ = float(*srcA++) * div;
-        }
-        if( sz == 0 ) break;
-        px = 0;
-
-        srcY += gap;
-        srcCb += gap;
-        srcCr += gap;
-        srcA += gap;
-    }
-}
-
-template<typename T>
-static inline void ProcessYCbCr( float* ptr, const T* srcY, const T* srcCb, const T* srcCr, size_t sz, size_t offset, size_t width, size_t stride, float div )
-{
-    const auto gap = stride - width;
-
-    const int py = offset / width;
-    int px = offset % width;
-
-    srcY += py * stride + px;
-    srcCb += py * stride + px;
-    srcCr += py * stride + px;
-
-    for(;;)
-    {
-        auto line = std::min( sz, size_t( width - px ) );
-        sz -= line;
-        while( line-- )
-        {
-            *ptr++ = float(*srcY++) * div;
-            *ptr++ = float(*srcCb++) * div - 0.5f;
-            *ptr++ = float(*srcCr++) * div - 0.5f;
-            *ptr++ = 1.f;
-        }
-        if( sz == 0 ) break;
-        px = 0;
-
-        srcY += gap;
-        srcCb += gap;
-        srcCr += gap;
-    }
-}
-
 void HeifLoader::LoadYCbCr( float* ptr, size_t sz, size_t offset )
 {
-    if( m_planeA )
-    {
-        if( m_bpp > 8 )
-        {
-            ProcessYCbCrAlpha( ptr, (uint16_t*)m_planeY, (uint16_t*)m_planeCb, (uint16_t*)m_planeCr, (uint16_t*)m_planeA, sz, offset, m_width, m_stride, m_bppDiv );
-        }
-        else
-        {
-            ProcessYCbCrAlpha( ptr, m_planeY, m_planeCb, m_planeCr, m_planeA, sz, offset, m_width, m_stride, m_bppDiv );
-        }
-    }
-    else
-    {
-        if( m_bpp > 8 )
-        {
-            ProcessYCbCr( ptr, (uint16_t*)m_planeY, (uint16_t*)m_planeCb, (uint16_t*)m_planeCr, sz, offset, m_width, m_stride, m_bppDiv );
-        }
-        else
-        {
-            ProcessYCbCr( ptr, m_planeY, m_planeCb, m_planeCr, sz, offset, m_width, m_stride, m_bppDiv );
-        }
-    }
-
-    // H.273, 8.3, VideoFullRangeFlag is false if not present
-    if( !m_nclx || !m_nclx->full_range_flag )
-    {
-        constexpr float scale = 255.f / 219.f;
-        constexpr float offset = 16.f / 255.f;
-
-        do
-        {
-            ptr[0] = ( ptr[0] - offset ) * scale;
-            ptr += 4;
-        }
-        while( --sz );
-    }
-}
-
-void HeifLoader::ConvertYCbCrToRGB( float* ptr, size_t sz )
-{
-    if( m_matrix == Conversion::GBR )
-    {
-        do
-        {
-            const auto g = ptr[0];
-            const auto b = ptr[1] + 0.5f;
-            const auto r = ptr[2] + 0.5f;
-
-            ptr[0] = r;
-            ptr[1] = g;
-            ptr[2] = b;
+    const size_t sample = m_bpp > 8 ? 2 : 1;
+    size_t y = offset / m_width;
+    size_t x = offset % m_width;
 
-            ptr += 4;
-        }
-        while( --sz );
-    }
-    else
+    while( sz > 0 )
     {
-        float a, b, c, d;
-        switch( m_matrix )
+        const auto line = std::min( sz, size_t( m_width - x ) );
+        const auto pos = ( y * m_stride + x ) * sample;
+        const auto alpha = m_planeA ? m_planeA + ( y * m_strideAlpha + x ) * sample : nullptr;
+        if( !m_subsampledX )
         {
-        case Conversion::BT601:
-            a = 1.402f;
-            b = -0.344136f;
-            c = -0.714136f;
-            d = 1.772f;
-            break;
-        case Conversion::BT709:
-            a = 1.5748f;
-            b = -0.1873f;
-            c = -0.4681f;
-            d = 1.8556f;
-            break;
-        case Conversion::BT2020:
-            a = 1.4746f;
-            b = -0.16455312684366f;
-            c = -0.57135312684366f;
-            d = 1.8814f;
-            break;
-        default:
-            Panic( "Invalid conversion matrix" );
-            break;
+            m_converter->Convert( ptr, m_planeY + pos, m_planeCb + pos, m_planeCr + pos, alpha, line );
         }
-
-#ifdef __AVX512F__
-        __m512 abcd16 = _mm512_set_ps( c, d, b, a, c, d, b, a, c, d, b, a, c, d, b, a );
-        while( sz >= 4 )
-        {
-            __m512 px0 = _mm512_loadu_ps( ptr );
-            __m512 px1 = _mm512_shuffle_ps( px0, px0, _MM_SHUFFLE( 2, 1, 1, 2 ) );
-            __m512 mul = _mm512_mul_ps( px1, abcd16 );
-            __m512 a0 = _mm512_shuffle_ps( mul, mul, _MM_SHUFFLE( 3, 3, 3, 3 ) );
-            __m512 a1 = _mm512_mask_blend_ps( 0x2222, _mm512_setzero_ps(), a0 );
-            __m512 add = _mm512_add_ps( mul, a1 );
-            __m512 y = _mm512_shuffle_ps( px0, px0, _MM_SHUFFLE( 0, 0, 0, 0 ) );
-            __m512 rgb0 = _mm512_add_ps( y, add );
-            __m512 rgb = _mm512_mask_blend_ps( 0x8888, rgb0, px0 );
-            _mm512_storeu_ps( ptr, rgb );
-
-            sz -= 4;
-            ptr += 16;
-        }
-#endif
-#ifdef __AVX2__
-        __m256 abcd8 = _mm256_set_ps( c, d, b, a, c, d, b, a );
-        while( sz >= 2 )
-        {
-            __m256 px0 = _mm256_loadu_ps( ptr );
-            __m256 px1 = _mm256_shuffle_ps( px0, px0, _MM_SHUFFLE( 2, 1, 1, 2 ) );
-            __m256 mul = _mm256_mul_ps( px1, abcd8 );
-            __m256 a0 = _mm256_shuffle_ps( mul, mul, _MM_SHUFFLE( 3, 3, 3, 3 ) );
-            __m256 a1 = _mm256_blend_ps( _mm256_setzero_ps(), a0, 0x22 );
-            __m256 add = _mm256_add_ps( mul, a1 );
-            __m256 y = _mm256_shuffle_ps( px0, px0, _MM_SHUFFLE( 0, 0, 0, 0 ) );
-            __m256 rgb0 = _mm256_add_ps( y, add );
-            __m256 rgb = _mm256_blend_ps( rgb0, px0, 0x88 );
-            _mm256_storeu_ps( ptr, rgb );
-
-            sz -= 2;
-            ptr += 8;
-        }
-#endif
-#ifdef __SSE4_1__
-        __m128 abcd4 = _mm_set_ps( c, d, b, a );
-        while( sz > 0 )
+        else
         {
-            __m128 px0 = _mm_loadu_ps( ptr );
-            __m128 px1 = _mm_shuffle_ps( px0, px0, _MM_SHUFFLE( 2, 1, 1, 2 ) );
-            __m128 mul = _mm_mul_ps( px1, abcd4 );
-            __m128 a0 = _mm_insert_ps( _mm_setzero_ps(), mul, 0xdd );
-            __m128 add = _mm_add_ps( mul, a0 );
-            __m128 y = _mm_shuffle_ps( px0, px0, _MM_SHUFFLE( 0, 0, 0, 0 ) );
-            __m128 rgb0 = _mm_add_ps( y, add );
-            __m128 rgb = _mm_blend_ps( rgb0, px0, 8 );
-            _mm_store_ps( ptr, rgb );
-
-            ptr += 4;
-            sz--;
+            // 4:2:0 chroma is sited between luma rows, so each luma row is also affected by the
+            // chroma row on its other side
+            size_t cy = y;
+            const uint8_t* cb1 = nullptr;
+            const uint8_t* cr1 = nullptr;
+            if( m_subsampledY )
+            {
+                cy = y / 2;
+                const auto cy1 = ( y & 1 ) ? cy + 1 : cy - 1;
+                if( cy1 < size_t( m_chromaHeight ) )
+                {
+                    cb1 = m_planeCb + cy1 * m_strideChroma * sample;
+                    cr1 = m_planeCr + cy1 * m_strideChroma * sample;
+                }
+            }
+            const auto cpos = cy * m_strideChroma * sample;
+            m_converter->ConvertSubsampled( ptr, m_planeY + pos, m_planeCb + cpos, m_planeCr + cpos, cb1, cr1, alpha, x, line, m_chromaWidth );
         }
-#else
-        while( sz > 0 )
-        {
-            const auto Y = ptr[0];
-            const auto Cb = ptr[1];
-            const auto Cr = ptr[2];
-
-            const auto r = Y + a * Cr;
-            const auto g = Y + b * Cb + c * Cr;
-            const auto b = Y + d * Cb;
-
-            ptr[0] = r;
-            ptr[1] = g;
-            ptr[2] = b;
 
-            ptr += 4;
-            sz--;
-        }
-#endif
+        ptr += line * 4;
+        sz -= line;
+        x = 0;
+        y++;
     }
 }
 
@@ -931,18 +674,10 @@ void HeifLoader::ApplyTransfer( float* ptr, size_t sz, size_t offset )
         switch( m_nclx->transfer_characteristics )
         {
         case heif_transfer_characteristic_ITU_R_BT_2100_0_PQ:
-            LinearizePq( ptr, sz, NominalLuminanceMul );
+            YCbCr::LinearizePq( ptr, sz, NominalLuminanceMul );
             break;
         case heif_transfer_characteristic_ITU_R_BT_2100_0_HLG:
-            do
-            {
-                ptr[0] = Hlg( ptr[0] ) * 100.f;
-                ptr[1] = Hlg( ptr[1] ) * 100.f;
-                ptr[2] = Hlg( ptr[2] ) * 100.f;
-
-                ptr += 4;
-            }
-            while( --sz );
+            YCbCr::LinearizeHlg( ptr, sz, 100.f );
             break;
         default:
             break;
@@ -950,6 +685,13 @@ void HeifLoader::ApplyTransfer( float* ptr, size_t sz, size_t offset )
     }
 }
 
+void HeifLoader::DecodeHdr( float* ptr, size_t sz, size_t offset )
+{
+    LoadYCbCr( ptr, sz, offset );
+    if( m_transform ) cmsDoTransform( m_transform.get(), ptr, ptr, sz );
+    ApplyTransfer( ptr, sz, offset );
+}
+
 bool HeifLoader::GetGainMapHeadroom( heif_image_handle* handle )
 {
     const auto metanum = heif_image_handle_get_number_of_metadata_blocks( handle, nullptr );
@@ -4,7 +4,9 @@
 #include <stdint.h>
 
 #include "ImageLoader.hpp"
+#include "util/IccCache.hpp"
 #include "util/NoCopy.hpp"
+#include "util/YCbCr.hpp"
 
 class Bitmap;
 class BitmapHdr;
@@ -19,13 +21,7 @@ struct heif_color_profile_nclx;
 
 class HeifLoader : public ImageLoader
 {
-    enum class Conversion
-    {
-        GBR,
-        BT601,
-        BT709,
-        BT2020
-    };
+    friend class HeifStripSource;
 
 public:
     explicit HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td );
@@ -38,7 +34,9 @@ public:
     [[nodiscard]] bool IsHdr() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadScaled( uint32_t targetWidth, uint32_t targetHeight ) override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
+    [[nodiscard]] std::unique_ptr<StripSource> LoadStrips() override;
 
 private:
     [[nodiscard]] bool Open();
@@ -46,8 +44,8 @@ private:
     [[nodiscard]] bool SetupDecode( bool hdr, Colorspace colorspace );
 
     void LoadYCbCr( float* ptr, size_t sz, size_t offset );
-    void ConvertYCbCrToRGB( float* ptr, size_t sz );
     void ApplyTransfer( float* ptr, size_t sz, size_t offset );
+    void DecodeHdr( float* ptr, size_t sz, size_t offset );
 
     [[nodiscard]] bool GetGainMapHeadroom( heif_image_handle* handle );
 
@@ -64,10 +62,13 @@ private:
 
     int m_width, m_height;
     int m_stride, m_bpp;
-    float m_bppDiv;
+    int m_strideChroma, m_strideAlpha;
+    int m_chromaWidth, m_chromaHeight;
+    bool m_subsampledX, m_subsampledY;
     float m_gainMapHeadroom;
 
-    Conversion m_matrix;
+    YCbCr::Matrix m_matrix;
+    std::unique_ptr<YCbCr::Converter> m_converter;
     Colorspace m_colorspace;
 
     size_t m_iccSize;
@@ -80,9 +81,7 @@ private:
     const uint8_t* m_planeCr;
     const uint8_t* m_planeA;
 
-    void* m_profileIn;
-    void* m_profileOut;
-    void* m_transform;
+    IccTransform m_transform;
 
     TaskDispatch* m_td;
 };
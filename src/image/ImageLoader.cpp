@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <concepts>
 #include <stdint.h>
 #include <sys/stat.h>
@@ -20,9 +21,11 @@
 #include "util/Bitmap.hpp"
 #include "util/BitmapAnim.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/CompressedBitmap.hpp"
 #include "util/DataBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Logs.hpp"
+#include "util/StripPipeline.hpp"
 #include "vector/PdfImage.hpp"
 #include "vector/SvgImage.hpp"
 
@@ -58,6 +61,11 @@ static inline std::unique_ptr<ImageLoader> CheckImageLoader( const std::shared_p
     return nullptr;
 }
 
+std::unique_ptr<Bitmap> ImageLoader::LoadScaled( uint32_t targetWidth, uint32_t targetHeight )
+{
+    return Load();
+}
+
 std::unique_ptr<BitmapAnim> ImageLoader::LoadAnim()
 {
     return nullptr;
@@ -68,6 +76,22 @@ std::unique_ptr<BitmapHdr> ImageLoader::LoadHdr( Colorspace colorspace )
     return nullptr;
 }
 
+std::unique_ptr<StripSource> ImageLoader::LoadStrips()
+{
+    return nullptr;
+}
+
+std::unique_ptr<CompressedBitmap> ImageLoader::LoadCompressed()
+{
+    return nullptr;
+}
+
+float ImageLoader::MaxDownscale( uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight )
+{
+    if( targetWidth == 0 || targetHeight == 0 ) return 1;
+    return std::max( { 1.f, float( width ) / targetWidth, float( height ) / targetHeight } );
+}
+
 std::unique_ptr<ImageLoader> GetImageLoader( const char* path, ToneMap::Operator tonemap, TaskDispatch* td, struct timespec* mtime )
 {
     ZoneScoped;
@@ -105,8 +129,8 @@ std::unique_ptr<ImageLoader> GetImageLoader( const char* path, ToneMap::Operator
     if( auto loader = CheckImageLoader<JxlLoader>( buf, sz, file ); loader ) return loader;
     if( auto loader = CheckImageLoader<WebpLoader>( buf, sz, file ); loader ) return loader;
     if( auto loader = CheckImageLoader<HeifLoader>( buf, sz, file, tonemap, td ); loader ) return loader;
-    if( auto loader = CheckImageLoader<PvrLoader>( buf, sz, file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<DdsLoader>( buf, sz, file ); loader ) return loader;
+    if( auto loader = CheckImageLoader<PvrLoader>( buf, sz, file, td ); loader ) return loader;
+    if( auto loader = CheckImageLoader<DdsLoader>( buf, sz, file, td ); loader ) return loader;
     if( auto loader = CheckImageLoader<PcxLoader>( buf, sz, file ); loader ) return loader;
     if( auto loader = CheckImageLoader<StbImageLoader>( file ); loader ) return loader;
     if( auto loader = CheckImageLoader<ExrLoader>( buf, sz, file, tonemap, td ); loader ) return loader;
@@ -123,6 +147,7 @@ std::unique_ptr<ImageLoader> GetImageLoader( const std::shared_ptr<DataBuffer>&
     ZoneScoped;
 
     if( auto loader = CheckImageLoader<PngLoader>( buffer ); loader ) return loader;
+    if( auto loader = CheckImageLoader<JpgLoader>( buffer, td ); loader ) return loader;
     if( auto loader = CheckImageLoader<ExrLoader>( buffer, tonemap, td ); loader ) return loader;
 
     return nullptr;
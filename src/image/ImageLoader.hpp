@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 #include <time.h>
 
 #include "util/Colorspace.hpp"
@@ -9,7 +10,9 @@
 class Bitmap;
 class BitmapAnim;
 class BitmapHdr;
+class CompressedBitmap;
 class DataBuffer;
+class StripSource;
 class TaskDispatch;
 class VectorImage;
 
@@ -24,8 +27,24 @@ public:
     [[nodiscard]] virtual bool PreferHdr() { return false; }
 
     [[nodiscard]] virtual std::unique_ptr<Bitmap> Load() = 0;
+    // Target size hint. The image may be decoded at a reduced resolution, as long as it still
+    // covers targetWidth x targetHeight when fit into it.
+    [[nodiscard]] virtual std::unique_ptr<Bitmap> LoadScaled( uint32_t targetWidth, uint32_t targetHeight );
     [[nodiscard]] virtual std::unique_ptr<BitmapAnim> LoadAnim();
     [[nodiscard]] virtual std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace = Colorspace::BT709 );
+
+    // Band-wise access to HDR image data, for processing without a full size BitmapHdr. The
+    // returned source references the loader, which must outlive it.
+    [[nodiscard]] virtual std::unique_ptr<StripSource> LoadStrips();
+
+    // GPU block compressed image data, for upload to a texture without decoding. Returns nullptr if
+    // the image is not block compressed.
+    [[nodiscard]] virtual std::unique_ptr<CompressedBitmap> LoadCompressed();
+
+protected:
+    // Largest factor by which an image can be downscaled and still cover the target size. Returns 1
+    // if there is no target size, or if the image already fits.
+    [[nodiscard]] static float MaxDownscale( uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight );
 };
 
 std::unique_ptr<ImageLoader> GetImageLoader( const char* path, ToneMap::Operator tonemap, TaskDispatch* td = nullptr, struct timespec* mtime = nullptr );
@@ -17,21 +17,26 @@
 #include "util/EmbedData.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/IccCache.hpp"
 #include "util/Panic.hpp"
 #include "util/Simd.hpp"
 #include "util/TaskDispatch.hpp"
 
 #include "data/CmykIcm.hpp"
 
-JpgLoader::JpgLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td )
-    : m_file( std::move( file ) )
+JpgLoader::JpgLoader( const std::shared_ptr<FileWrapper>& file, TaskDispatch* td )
+    : JpgLoader( std::make_shared<FileBuffer>( file ), td )
+{
+}
+
+JpgLoader::JpgLoader( std::shared_ptr<DataBuffer> buf, TaskDispatch* td )
+    : m_buf( std::move( buf ) )
     , m_td( td )
     , m_cinfo( nullptr )
     , m_iccData( nullptr )
+    , m_orientation( -1 )
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint8_t hdr[2];
-    m_valid = fread( hdr, 1, 2, *m_file ) == 2 && hdr[0] == 0xFF && hdr[1] == 0xD8;
+    m_valid = IsValidSignature( (const uint8_t*)m_buf->data(), m_buf->size() );
 }
 
 JpgLoader::~JpgLoader()
@@ -73,17 +78,9 @@ static void CmsTransform( TaskDispatch* td, cmsHTRANSFORM transform, const TInpu
     }
     else
     {
-        while( size > 0 )
-        {
-            auto chunk = std::min<uint32_t>( size, 16 * 1024 );
-            td->Queue( [input, output, chunk, transform] {
-                cmsDoTransform( transform, input, output, chunk );
-            } );
-            input += chunk * 4;
-            output += chunk * 4;
-            size -= chunk;
-        }
-        td->Sync();
+        td->ParallelFor( size, td->Grain( size, 4 * ( sizeof( TInput ) + sizeof( TOutput ) ) ), [input, output, transform]( size_t begin, size_t end ) {
+            cmsDoTransform( transform, input + begin * 4, output + begin * 4, end - begin );
+        } );
     }
 }
 
@@ -171,32 +168,45 @@ std::unique_ptr<Bitmap> JpgLoader::Load()
     auto bmp = LoadNoColorspace();
     if( !bmp ) return nullptr;
 
-    cmsHTRANSFORM transform = nullptr;
-    cmsHPROFILE profileIn = nullptr;
-    auto profileOut = cmsCreate_sRGBProfile();
+    IccTransform transform;
     if( m_iccData )
     {
         mclog( LogLevel::Info, "ICC profile size: %u", m_iccSz );
-        profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSz );
+        transform = IccCache::Instance().Get( IccProfile::FromMemory( m_iccData, m_iccSz ), m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
     }
     else if( m_cmyk )
     {
         Unembed( CmykIcm );
-        profileIn = cmsOpenProfileFromMem( CmykIcm->data(), CmykIcm->size() );
-    }
-    if( profileIn ) transform = cmsCreateTransform( profileIn, m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, 0 );
-    if( transform )
-    {
-        CmsTransform( m_td, transform, bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
-        cmsDeleteTransform( transform );
+        transform = IccCache::Instance().Get( IccProfile::FromMemory( CmykIcm->data(), CmykIcm->size() ), TYPE_CMYK_8_REV, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
     }
-    if( profileIn ) cmsCloseProfile( profileIn );
-    cmsCloseProfile( profileOut );
+    if( transform ) CmsTransform( m_td, transform.get(), bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
 
     bmp->SetAlpha( 0xFF );
     return bmp;
 }
 
+std::unique_ptr<Bitmap> JpgLoader::LoadScaled( uint32_t targetWidth, uint32_t targetHeight )
+{
+    if( !m_cinfo && !Open() ) return nullptr;
+
+    auto w = m_cinfo->image_width;
+    auto h = m_cinfo->image_height;
+    if( m_orientation > 4 ) std::swap( w, h );
+
+    // DCT scaling, decodes only the needed frequency coefficients
+    const auto scale = MaxDownscale( w, h, targetWidth, targetHeight );
+    unsigned int denom = 1;
+    while( denom < 8 && denom * 2 <= scale ) denom *= 2;
+    if( denom > 1 )
+    {
+        mclog( LogLevel::Info, "JPEG: Decoding at 1/%u scale", denom );
+        m_cinfo->scale_num = 1;
+        m_cinfo->scale_denom = denom;
+    }
+
+    return Load();
+}
+
 #pragma pack( push, 1 )
 struct IsoHeader
 {
@@ -378,53 +388,40 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
 
     auto baseFloat = std::make_unique<BitmapHdr>( base->Width(), base->Height(), colorspace, m_orientation );
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
-    cmsHPROFILE profileIn;
-    auto profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT2020 ? &primaries2020 : &primaries709, linear3 );
+    const auto inFormat = m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8;
+    const auto profileOut = IccProfile::Rgb( white709, colorspace == Colorspace::BT2020 ? primaries2020 : primaries709, 1 );
+    auto profileIn = IccProfile::Srgb();
     if( m_iccData )
     {
         mclog( LogLevel::Info, "ICC profile size: %u", m_iccSz );
-        profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSz );
+        profileIn = IccProfile::FromMemory( m_iccData, m_iccSz );
     }
     else if( m_cmyk )
     {
         Unembed( CmykIcm );
-        profileIn = cmsOpenProfileFromMem( CmykIcm->data(), CmykIcm->size() );
+        profileIn = IccProfile::FromMemory( CmykIcm->data(), CmykIcm->size() );
     }
-    else
-    {
-        profileIn = cmsCreate_sRGBProfile();
-    }
-    auto transform = cmsCreateTransform( profileIn, m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
+
+    auto& cache = IccCache::Instance();
+    auto transform = cache.Get( profileIn, inFormat, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL );
     if( transform )
     {
-        CmsTransform( m_td, transform, base->Data(), baseFloat->Data(), base->Width() * base->Height() );
+        CmsTransform( m_td, transform.get(), base->Data(), baseFloat->Data(), base->Width() * base->Height() );
     }
     else
     {
         auto sz = base->Width() * base->Height();
-        cmsHPROFILE profileSrgb = cmsCreate_sRGBProfile();
-        transform = cmsCreateTransform( profileIn, m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, profileSrgb, TYPE_RGBA_8, INTENT_PERCEPTUAL, 0 );
+        transform = cache.Get( profileIn, inFormat, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
         if( !transform )
         {
-            cmsCloseProfile( profileIn );
-            cmsCloseProfile( profileOut );
-            cmsFreeToneCurve( linear );
             mclog( LogLevel::Error, "JPEG: Failed to create transform to sRGB" );
             return nullptr;
         }
-        CmsTransform( m_td, transform, base->Data(), base->Data(), sz );
-        cmsDeleteTransform( transform );
-        transform = cmsCreateTransform( profileSrgb, TYPE_RGBA_8, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
+        CmsTransform( m_td, transform.get(), base->Data(), base->Data(), sz );
+        transform = cache.Get( IccProfile::Srgb(), TYPE_RGBA_8, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL );
         CheckPanic( transform, "Failed to create sRGB to HDR transform" );
-        CmsTransform( m_td, transform, base->Data(), baseFloat->Data(), sz );
-        cmsCloseProfile( profileSrgb );
+        CmsTransform( m_td, transform.get(), base->Data(), baseFloat->Data(), sz );
     }
-    if( transform ) cmsDeleteTransform( transform );
-    cmsCloseProfile( profileIn );
-    cmsCloseProfile( profileOut );
-    cmsFreeToneCurve( linear );
 
     base.reset();
 
@@ -443,7 +440,11 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
         return baseFloat;
     }
 
-    fseek( *m_file, m_gainMapOffset, SEEK_SET );
+    if( size_t( m_gainMapOffset ) >= m_buf->size() )
+    {
+        mclog( LogLevel::Warning, "JPEG: Gain map offset is out of bounds" );
+        return nullptr;
+    }
 
     uint8_t* gainMap = nullptr;
 
@@ -459,7 +460,7 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
     }
 
     jpeg_create_decompress( &gcinfo );
-    jpeg_stdio_src( &gcinfo, *m_file );
+    jpeg_mem_src( &gcinfo, (const unsigned char*)m_buf->data() + m_gainMapOffset, m_buf->size() - m_gainMapOffset );
     jpeg_save_markers( &gcinfo, JPEG_APP0 + 1, 0xFFFF );
     jpeg_save_markers( &gcinfo, JPEG_APP0 + 2, 0xFFFF );
     jpeg_read_header( &gcinfo, TRUE );
@@ -666,8 +667,7 @@ bool JpgLoader::Open()
     CheckPanic( m_valid, "Invalid JPEG file" );
     CheckPanic( !m_cinfo, "Already opened" );
 
-    fseek( *m_file, 0, SEEK_SET );
-    m_orientation = LoadOrientation();
+    if( m_orientation < 0 ) m_orientation = LoadOrientation();
 
     m_cinfo = new jpeg_decompress_struct();
 
@@ -677,7 +677,7 @@ bool JpgLoader::Open()
     if( setjmp( jerr.setjmp_buffer ) ) return false;
 
     jpeg_create_decompress( m_cinfo );
-    jpeg_stdio_src( m_cinfo, *m_file );
+    jpeg_mem_src( m_cinfo, (const unsigned char*)m_buf->data(), m_buf->size() );
     jpeg_save_markers( m_cinfo, JPEG_APP0 + 1, 0xFFFF );
     jpeg_save_markers( m_cinfo, JPEG_APP0 + 2, 0xFFFF );
     jpeg_read_header( m_cinfo, TRUE );
@@ -807,26 +807,27 @@ bool JpgLoader::Open()
     // Do the incredibly stupid thing and search for it in raw file data.
     if( m_gainMapOffset >= 0 )
     {
-        const auto filePos = ftell( *m_file );
-        fseek( *m_file, 2, SEEK_SET );  // skip Start-Of-Image
-        for(;;)
+        const auto mpfOffset = m_gainMapOffset;
+        m_gainMapOffset = -1;
+
+        size_t pos = 2;     // skip Start-Of-Image
+        while( pos + sizeof( JpgMarker ) <= m_buf->size() )
         {
             JpgMarker marker;
-            fread( &marker, sizeof( JpgMarker ), 1, *m_file );
+            memcpy( &marker, m_buf->data() + pos, sizeof( JpgMarker ) );
             marker.size = ntohs( marker.size );
+            if( marker.size < 6 ) break;
+            pos += sizeof( JpgMarker );
 
             if( marker.marker == 0xE2FF && marker.size > 6 && memcmp( &marker.data, "MPF\0", 4 ) == 0 )
             {
-                m_gainMapOffset += ftell( *m_file );
+                m_gainMapOffset = mpfOffset + pos;
                 mclog( LogLevel::Info, "Gain map offset: %d", m_gainMapOffset );
                 break;
             }
-            else
-            {
-                fseek( *m_file, marker.size - 6, SEEK_CUR );
-            }
+            pos += marker.size - 6;
         }
-        fseek( *m_file, filePos, SEEK_SET );
+        if( m_gainMapOffset < 0 ) mclog( LogLevel::Warning, "JPEG: MPF marker not found" );
     }
 
     return true;
@@ -836,8 +837,7 @@ int JpgLoader::LoadOrientation()
 {
     int orientation = 0;
 
-    FileBuffer buf( m_file );
-    auto exif = exif_data_new_from_data( (const unsigned char*)buf.data(), buf.size() );
+    auto exif = exif_data_new_from_data( (const unsigned char*)m_buf->data(), m_buf->size() );
 
     if( exif )
     {
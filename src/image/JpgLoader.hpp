@@ -8,6 +8,7 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
 class TaskDispatch;
 struct jpeg_decompress_struct;
@@ -15,7 +16,8 @@ struct jpeg_decompress_struct;
 class JpgLoader : public ImageLoader
 {
 public:
-    explicit JpgLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td );
+    explicit JpgLoader( const std::shared_ptr<FileWrapper>& file, TaskDispatch* td );
+    explicit JpgLoader( std::shared_ptr<DataBuffer> buf, TaskDispatch* td );
     ~JpgLoader() override;
     NoCopy( JpgLoader );
 
@@ -25,8 +27,12 @@ public:
     [[nodiscard]] bool IsHdr() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadScaled( uint32_t targetWidth, uint32_t targetHeight ) override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
 
+    // Overrides the EXIF orientation tag
+    void SetOrientation( int orientation ) { m_orientation = orientation; }
+
 private:
     [[nodiscard]] bool Open();
 
@@ -35,7 +41,7 @@ private:
     [[nodiscard]] std::unique_ptr<Bitmap> LoadNoColorspace();
 
     bool m_valid;
-    std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
 
     TaskDispatch* m_td;
 
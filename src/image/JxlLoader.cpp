@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <jxl/cms_interface.h>
 #include <jxl/color_encoding.h>
 #include <jxl/decode.h>
@@ -9,6 +10,8 @@
 #include "util/BitmapHdr.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/IccCache.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
 namespace
@@ -50,9 +53,9 @@ void* CmsInit( void* data, size_t num_threads, size_t pixels_per_thread, const J
         cms->dstBuf[i] = new float[pixels_per_thread * 3];
     }
 
-    cms->profileIn = cmsOpenProfileFromMem( input_profile->icc.data, input_profile->icc.size );
-    cms->profileOut = cmsOpenProfileFromMem( output_profile->icc.data, output_profile->icc.size );
-    cms->transform = cmsCreateTransform( cms->profileIn, TYPE_RGB_FLT, cms->profileOut, TYPE_RGB_FLT, INTENT_PERCEPTUAL, 0 );
+    const auto profileIn = IccProfile::FromMemory( input_profile->icc.data, input_profile->icc.size );
+    const auto profileOut = IccProfile::FromMemory( output_profile->icc.data, output_profile->icc.size );
+    cms->transform = IccCache::Instance().Get( profileIn, TYPE_RGB_FLT, profileOut, TYPE_RGB_FLT, INTENT_PERCEPTUAL );
 
     return cms;
 }
@@ -72,7 +75,7 @@ float* CmsGetDstBuffer( void* data, size_t thread )
 JXL_BOOL CmsRun( void* data, size_t thread, const float* input, float* output, size_t num_pixels )
 {
     auto cms = (JxlLoader::CmsData*)data;
-    cmsDoTransform( cms->transform, input, output, num_pixels );
+    cmsDoTransform( cms->transform.get(), input, output, num_pixels );
     return true;
 }
 
@@ -80,9 +83,7 @@ void CmsDestroy( void* data )
 {
     auto cms = (JxlLoader::CmsData*)data;
 
-    cmsDeleteTransform( cms->transform );
-    cmsCloseProfile( cms->profileOut );
-    cmsCloseProfile( cms->profileIn );
+    cms->transform.reset();
 
     for( auto& buf : cms->srcBuf ) delete[] buf;
     for( auto& buf : cms->dstBuf ) delete[] buf;
@@ -153,6 +154,26 @@ std::unique_ptr<Bitmap> JxlLoader::Load()
     return bmp;
 }
 
+std::unique_ptr<Bitmap> JxlLoader::LoadScaled( uint32_t targetWidth, uint32_t targetHeight )
+{
+    if( !m_dec && !Open() ) return nullptr;
+    if( !m_info.have_preview ) return Load();
+
+    auto w = m_info.xsize;
+    auto h = m_info.ysize;
+    if( m_info.orientation >= JXL_ORIENT_TRANSPOSE ) std::swap( w, h );
+
+    const auto scale = MaxDownscale( w, h, targetWidth, targetHeight );
+    if( m_info.preview.xsize * scale < m_info.xsize || m_info.preview.ysize * scale < m_info.ysize ) return Load();
+
+    mclog( LogLevel::Info, "JPEG XL: Using %ux%u preview image", m_info.preview.xsize, m_info.preview.ysize );
+    if( auto bmp = LoadPreview(); bmp ) return bmp;
+
+    mclog( LogLevel::Warning, "JPEG XL: Failed to decode preview image" );
+    Rewind( JXL_DEC_COLOR_ENCODING | JXL_DEC_FULL_IMAGE );
+    return Load();
+}
+
 std::unique_ptr<BitmapHdr> JxlLoader::LoadHdr( Colorspace colorspace )
 {
     if( !m_dec && !Open() ) return nullptr;
@@ -216,3 +237,34 @@ bool JxlLoader::Open()
         }
     }
 }
+
+void JxlLoader::Rewind( int events )
+{
+    JxlDecoderRewind( m_dec );
+    JxlDecoderSubscribeEvents( m_dec, events );
+    JxlDecoderSetInput( m_dec, (const uint8_t*)m_buf->data(), m_buf->size() );
+    JxlDecoderCloseInput( m_dec );
+}
+
+std::unique_ptr<Bitmap> JxlLoader::LoadPreview()
+{
+    Rewind( JXL_DEC_COLOR_ENCODING | JXL_DEC_PREVIEW_IMAGE );
+
+    auto bmp = std::make_unique<Bitmap>( m_info.preview.xsize, m_info.preview.ysize );
+    JxlPixelFormat format = { 4, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0 };
+
+    for(;;)
+    {
+        const auto res = JxlDecoderProcessInput( m_dec );
+        if( res == JXL_DEC_ERROR || res == JXL_DEC_NEED_MORE_INPUT || res == JXL_DEC_SUCCESS || res == JXL_DEC_FULL_IMAGE ) return nullptr;
+        if( res == JXL_DEC_PREVIEW_IMAGE ) return bmp;
+        if( res == JXL_DEC_COLOR_ENCODING )
+        {
+            JxlDecoderSetOutputColorProfile( m_dec, &srgb, nullptr, 0 );
+        }
+        else if( res == JXL_DEC_NEED_PREVIEW_OUT_BUFFER )
+        {
+            if( JxlDecoderSetPreviewOutBuffer( m_dec, &format, bmp->Data(), bmp->Width() * bmp->Height() * 4 ) != JXL_DEC_SUCCESS ) return nullptr;
+        }
+    }
+}
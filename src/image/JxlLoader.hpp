@@ -7,14 +7,13 @@
 #include <vector>
 
 #include "ImageLoader.hpp"
+#include "util/IccCache.hpp"
 #include "util/NoCopy.hpp"
 
 class Bitmap;
 class BitmapHdr;
 class FileBuffer;
 class FileWrapper;
-typedef void* cmsHPROFILE;
-typedef void* cmsHTRANSFORM;
 
 class JxlLoader : public ImageLoader
 {
@@ -24,9 +23,7 @@ public:
         std::vector<float*> srcBuf;
         std::vector<float*> dstBuf;
 
-        cmsHPROFILE profileIn;
-        cmsHPROFILE profileOut;
-        cmsHTRANSFORM transform;
+        IccTransform transform;
     };
 
     explicit JxlLoader( std::shared_ptr<FileWrapper> file );
@@ -40,10 +37,14 @@ public:
     [[nodiscard]] bool PreferHdr() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadScaled( uint32_t targetWidth, uint32_t targetHeight ) override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
 
 private:
     bool Open();
+    void Rewind( int events );
+
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadPreview();
 
     bool m_valid;
     std::shared_ptr<FileWrapper> m_file;
@@ -1,5 +1,3 @@
-#include <string.h>
-
 #define DR_PCX_IMPLEMENTATION
 #define DR_PCX_NO_STDIO
 #include "contrib/dr_pcx.h"
@@ -56,9 +54,5 @@ std::unique_ptr<Bitmap> PcxLoader::Load()
     auto data = drpcx_load( []( void* f, void* out, size_t sz ) { return fread( out, 1, sz, (FILE*)f ); }, (FILE*)*m_file, false, &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
-    auto bmp = std::make_unique<Bitmap>( w, h );
-    memcpy( bmp->Data(), data, w * h * 4 );
-
-    drpcx_free( data );
-    return bmp;
+    return std::make_unique<Bitmap>( w, h, data, drpcx_free );
 }
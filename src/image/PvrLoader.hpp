@@ -7,22 +7,27 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class CompressedBitmap;
 class FileWrapper;
+class TaskDispatch;
 
 class PvrLoader : public ImageLoader
 {
 public:
-    explicit PvrLoader( std::shared_ptr<FileWrapper> file );
+    explicit PvrLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td );
     NoCopy( PvrLoader );
 
     static bool IsValidSignature( const uint8_t* buf, size_t size );
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<CompressedBitmap> LoadCompressed() override;
 
 private:
     bool m_valid;
     std::shared_ptr<FileWrapper> m_file;
 
     uint32_t m_format;
+
+    TaskDispatch* m_td;
 };
@@ -2,10 +2,13 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "JpgLoader.hpp"
 #include "RawLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/DataBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
 class RawLoaderDataStream : public LibRaw_abstract_datastream
@@ -34,33 +37,15 @@ private:
     int64_t sz;
 };
 
-RawLoader::RawLoader( const std::shared_ptr<FileWrapper>& file )
-    : m_raw( std::make_unique<LibRaw>() )
-    , m_stream( std::make_unique<RawLoaderDataStream>( file ) )
-{
-    m_valid = m_raw->open_datastream( m_stream.get() ) == 0;
-}
-
-RawLoader::~RawLoader()
+// LibRaw flip to EXIF orientation
+static int FlipToOrientation( int flip )
 {
+    constexpr int orientation[] = { 1, 2, 4, 3, 5, 8, 6, 7 };
+    return orientation[flip & 7];
 }
 
-bool RawLoader::IsValid() const
+static std::unique_ptr<Bitmap> ConvertImage( const libraw_processed_image_t* img )
 {
-    return m_valid;
-}
-
-std::unique_ptr<Bitmap> RawLoader::Load()
-{
-    CheckPanic( m_valid, "Invalid RAW file" );
-
-    auto params = m_raw->output_params_ptr();
-    params->use_camera_wb = 1;
-
-    m_raw->unpack();
-    m_raw->dcraw_process();
-    auto img = m_raw->dcraw_make_mem_image();
-
     auto bmp = std::make_unique<Bitmap>( img->width, img->height );
     auto src = img->data;
     auto dst = (uint32_t*)bmp->Data();
@@ -101,10 +86,62 @@ std::unique_ptr<Bitmap> RawLoader::Load()
         break;
     }
 
+    return bmp;
+}
+
+RawLoader::RawLoader( const std::shared_ptr<FileWrapper>& file )
+    : m_raw( std::make_unique<LibRaw>() )
+    , m_stream( std::make_unique<RawLoaderDataStream>( file ) )
+{
+    m_valid = m_raw->open_datastream( m_stream.get() ) == 0;
+}
+
+RawLoader::~RawLoader()
+{
+}
+
+bool RawLoader::IsValid() const
+{
+    return m_valid;
+}
+
+std::unique_ptr<Bitmap> RawLoader::Load()
+{
+    CheckPanic( m_valid, "Invalid RAW file" );
+
+    auto params = m_raw->output_params_ptr();
+    params->use_camera_wb = 1;
+
+    m_raw->unpack();
+    m_raw->dcraw_process();
+    auto img = m_raw->dcraw_make_mem_image();
+
+    auto bmp = ConvertImage( img );
     LibRaw::dcraw_clear_mem( img );
     return bmp;
 }
 
+std::unique_ptr<Bitmap> RawLoader::LoadScaled( uint32_t targetWidth, uint32_t targetHeight )
+{
+    CheckPanic( m_valid, "Invalid RAW file" );
+
+    const auto& sizes = m_raw->imgdata.sizes;
+    const auto swap = sizes.flip & 4;
+    const auto scale = MaxDownscale( swap ? sizes.height : sizes.width, swap ? sizes.width : sizes.height, targetWidth, targetHeight );
+    if( scale > 1 )
+    {
+        if( auto bmp = LoadThumbnail( targetWidth, targetHeight, scale ); bmp ) return bmp;
+
+        if( scale >= 2 )
+        {
+            mclog( LogLevel::Info, "RAW: Processing at half size" );
+            m_raw->output_params_ptr()->half_size = 1;
+        }
+    }
+
+    return Load();
+}
+
 std::unique_ptr<BitmapHdr> RawLoader::LoadHdr( Colorspace colorspace )
 {
     CheckPanic( m_valid, "Invalid RAW file" );
@@ -159,3 +196,41 @@ std::unique_ptr<BitmapHdr> RawLoader::LoadHdr( Colorspace colorspace )
     LibRaw::dcraw_clear_mem( img );
     return bmp;
 }
+
+std::unique_ptr<Bitmap> RawLoader::LoadThumbnail( uint32_t targetWidth, uint32_t targetHeight, float scale )
+{
+    const auto& sizes = m_raw->imgdata.sizes;
+    const auto& thumbnail = m_raw->imgdata.thumbnail;
+    if( thumbnail.twidth * scale < sizes.width || thumbnail.theight * scale < sizes.height ) return nullptr;
+    if( m_raw->unpack_thumb() != LIBRAW_SUCCESS ) return nullptr;
+
+    int err;
+    auto img = m_raw->dcraw_make_mem_thumb( &err );
+    if( !img ) return nullptr;
+
+    // LibRaw writes an EXIF orientation derived from flip into JPEG previews that have none, but
+    // keeps the preview's own EXIF block otherwise. Orient all previews by flip alone, so that the
+    // rotation is applied exactly once.
+    const auto orientation = FlipToOrientation( sizes.flip );
+
+    std::unique_ptr<Bitmap> bmp;
+    if( img->type == LIBRAW_IMAGE_JPEG )
+    {
+        JpgLoader loader( std::make_shared<DataBuffer>( (const char*)img->data, img->data_size ), nullptr );
+        if( loader.IsValid() )
+        {
+            loader.SetOrientation( orientation );
+            bmp = loader.LoadScaled( targetWidth, targetHeight );
+        }
+    }
+    else if( img->type == LIBRAW_IMAGE_BITMAP && img->bits == 8 )
+    {
+        bmp = ConvertImage( img );
+        bmp->SetOrientation( orientation );
+    }
+    LibRaw::dcraw_clear_mem( img );
+
+    if( !bmp ) return nullptr;
+    mclog( LogLevel::Info, "RAW: Using %ux%u embedded preview", bmp->Width(), bmp->Height() );
+    return bmp;
+}
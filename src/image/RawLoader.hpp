@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 
 #include "ImageLoader.hpp"
 #include "util/NoCopy.hpp"
@@ -21,9 +22,12 @@ public:
     [[nodiscard]] bool IsHdr() override { return true; }
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadScaled( uint32_t targetWidth, uint32_t targetHeight ) override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
 
 private:
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadThumbnail( uint32_t targetWidth, uint32_t targetHeight, float scale );
+
     std::unique_ptr<LibRaw> m_raw;
     std::unique_ptr<RawLoaderDataStream> m_stream;
 
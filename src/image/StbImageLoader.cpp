@@ -1,6 +1,3 @@
-#include <lcms2.h>
-#include <string.h>
-
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_JPEG
 #define STBI_NO_PNG
@@ -46,11 +43,7 @@ std::unique_ptr<Bitmap> StbImageLoader::Load()
     auto data = stbi_load_from_file( *m_file, &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
-    auto bmp = std::make_unique<Bitmap>( w, h );
-    memcpy( bmp->Data(), data, w * h * 4 );
-
-    stbi_image_free( data );
-    return bmp;
+    return std::make_unique<Bitmap>( w, h, data, stbi_image_free );
 }
 
 std::unique_ptr<BitmapHdr> StbImageLoader::LoadHdr( Colorspace colorspace )
@@ -64,41 +57,8 @@ std::unique_ptr<BitmapHdr> StbImageLoader::LoadHdr( Colorspace colorspace )
     auto data = stbi_loadf_from_file( *m_file, &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
-    auto hdr = std::make_unique<BitmapHdr>( w, h, colorspace );
-    if( colorspace == Colorspace::BT709 )
-    {
-        memcpy( hdr->Data(), data, w * h * 4 * sizeof( float ) );
-    }
-    else if( colorspace == Colorspace::BT2020 )
-    {
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-        auto profileIn = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-
-        cmsDoTransform( transform, data, hdr->Data(), w * h );
-
-        cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
-
-        auto ptr = hdr->Data() + 3;
-        auto sz = w * h;
-        do
-        {
-            *ptr = 1;
-            ptr += 4;
-        }
-        while( --sz );
-    }
-    else
-    {
-        Panic( "Invalid colorspace" );
-    }
+    auto hdr = std::make_unique<BitmapHdr>( w, h, colorspace, data, stbi_image_free );
+    if( colorspace != Colorspace::BT709 ) ColorMatrix::Get( Colorspace::BT709, colorspace ).Apply( hdr->Data(), w * h );
 
-    stbi_image_free( data );
     return hdr;
 }
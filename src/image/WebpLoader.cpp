@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <math.h>
 #include <string.h>
+#include <webp/decode.h>
 #include <webp/demux.h>
 
 #include "WebpLoader.hpp"
@@ -6,6 +9,7 @@
 #include "util/BitmapAnim.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
 WebpLoader::WebpLoader( std::shared_ptr<FileWrapper> file )
@@ -49,6 +53,13 @@ std::unique_ptr<Bitmap> WebpLoader::Load()
     WebPAnimInfo info;
     WebPAnimDecoderGetInfo( m_dec, &info );
 
+    // Still images are decoded directly into the bitmap, animation frames are composited by
+    // the decoder into its own canvas
+    if( info.frame_count == 1 )
+    {
+        if( auto bmp = DecodeStill( info.canvas_width, info.canvas_height, false ) ) return bmp;
+    }
+
     int delay;
     uint8_t* out;
     if( !WebPAnimDecoderGetNext( m_dec, &out, &delay ) ) return nullptr;
@@ -59,6 +70,27 @@ std::unique_ptr<Bitmap> WebpLoader::Load()
     return bmp;
 }
 
+std::unique_ptr<Bitmap> WebpLoader::LoadScaled( uint32_t targetWidth, uint32_t targetHeight )
+{
+    if( !m_dec && !Open() ) return nullptr;
+
+    WebPAnimInfo info;
+    WebPAnimDecoderGetInfo( m_dec, &info );
+    if( info.frame_count != 1 ) return Load();
+
+    const auto scale = MaxDownscale( info.canvas_width, info.canvas_height, targetWidth, targetHeight );
+    if( scale <= 1 ) return Load();
+
+    // Still images can be decoded directly at the reduced size
+    const auto width = std::max( 1, int( ceil( info.canvas_width / scale ) ) );
+    const auto height = std::max( 1, int( ceil( info.canvas_height / scale ) ) );
+    auto bmp = DecodeStill( width, height, true );
+    if( !bmp ) return Load();
+
+    mclog( LogLevel::Info, "WebP: Decoded at %dx%d", width, height );
+    return bmp;
+}
+
 std::unique_ptr<BitmapAnim> WebpLoader::LoadAnim()
 {
     if( !m_dec && !Open() ) return nullptr;
@@ -85,6 +117,37 @@ std::unique_ptr<BitmapAnim> WebpLoader::LoadAnim()
     return anim;
 }
 
+std::unique_ptr<Bitmap> WebpLoader::DecodeStill( int width, int height, bool scale )
+{
+    WebPDecoderConfig config;
+    if( !WebPInitDecoderConfig( &config ) ) return nullptr;
+
+    const auto data = (const uint8_t*)m_buf->data();
+    const auto size = m_buf->size();
+    if( WebPGetFeatures( data, size, &config.input ) != VP8_STATUS_OK ) return nullptr;
+
+    auto bmp = std::make_unique<Bitmap>( width, height );
+
+    if( scale )
+    {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = width;
+        config.options.scaled_height = height;
+    }
+    config.options.use_threads = 1;
+    config.output.colorspace = MODE_RGBA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = bmp->Data();
+    config.output.u.RGBA.stride = width * 4;
+    config.output.u.RGBA.size = size_t( width ) * height * 4;
+
+    const auto res = WebPDecode( data, size, &config );
+    WebPFreeDecBuffer( &config.output );
+    if( res != VP8_STATUS_OK ) return nullptr;
+
+    return bmp;
+}
+
 bool WebpLoader::Open()
 {
     CheckPanic( m_valid, "Invalid WebP file" );
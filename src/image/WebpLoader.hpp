@@ -25,10 +25,12 @@ public:
     [[nodiscard]] bool IsAnimated() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadScaled( uint32_t targetWidth, uint32_t targetHeight ) override;
     [[nodiscard]] std::unique_ptr<BitmapAnim> LoadAnim() override;
 
 private:
     bool Open();
+    [[nodiscard]] std::unique_ptr<Bitmap> DecodeStill( int width, int height, bool scale );
 
     bool m_valid;
 
@@ -1,6 +1,12 @@
 #include <algorithm>
+#include <atomic>
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "image/ImageLoader.hpp"
 #include "util/Ansi.hpp"
@@ -9,6 +15,7 @@
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
+#include "util/RobinHood.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
 #include "GitRef.hpp"
@@ -16,7 +23,52 @@
 static void PrintHelp()
 {
     printf( ANSI_BOLD ANSI_GREEN "exrconv" ANSI_RESET " — convert HDR image to EXR format, build %s\n\n", GitRef );
-    printf( "Usage: exrconv <input> <output>\n" );
+    printf( "Usage: exrconv [options] <input> <output>\n" );
+    printf( "       exrconv [options] -o <directory> <input>...\n\n" );
+    printf( "Options:\n" );
+    printf( "  -c, --compression <mode>   none, zip, zips, piz, dwaa, dwab, htj2k (default: zip)\n" );
+    printf( "  -l, --line-order <order>   increasing, decreasing, random (default: increasing)\n" );
+    printf( "  -t, --tile <size>          write square tiles instead of scanlines\n" );
+    printf( "  -o, --output <directory>   convert all inputs into directory, processing them concurrently\n" );
+}
+
+static bool Convert( const char* inFile, const char* outFile, const ExrOptions& options, TaskDispatch* td )
+{
+    mclog( LogLevel::Info, "Converting %s to %s", inFile, outFile );
+
+    auto loader = GetImageLoader( inFile, ToneMap::Operator::PbrNeutral, td );
+    if( !loader )
+    {
+        mclog( LogLevel::Error, "Failed to load image %s", inFile );
+        return false;
+    }
+    if( !loader->IsHdr() )
+    {
+        mclog( LogLevel::Error, "Image %s is not HDR", inFile );
+        return false;
+    }
+
+    auto hdr = loader->LoadHdr();
+    if( !hdr )
+    {
+        mclog( LogLevel::Error, "Failed to load image %s", inFile );
+        return false;
+    }
+
+    auto half = std::make_unique<BitmapHdrHalf>( *hdr );
+    hdr.reset();
+    return half->SaveExr( outFile, options, td );
+}
+
+// Output directory, and input file name with the extension replaced
+static std::string OutputPath( const std::string& dir, const std::string& inFile )
+{
+    auto slash = inFile.find_last_of( '/' );
+    auto name = slash == std::string::npos ? inFile : inFile.substr( slash + 1 );
+    auto dot = name.find_last_of( '.' );
+    if( dot != std::string::npos && dot != 0 ) name.resize( dot );
+    if( !dir.empty() && dir.back() != '/' ) return dir + "/" + name + ".exr";
+    return dir + name + ".exr";
 }
 
 int main( int argc, char** argv )
@@ -25,40 +77,132 @@ int main( int argc, char** argv )
     SetLogLevel( LogLevel::Error );
 #endif
 
-    if( argc != 3 )
+    enum { OptHelp };
+
+    struct option longOptions[] = {
+        { "compression", required_argument, nullptr, 'c' },
+        { "line-order", required_argument, nullptr, 'l' },
+        { "tile", required_argument, nullptr, 't' },
+        { "output", required_argument, nullptr, 'o' },
+        { "help", no_argument, nullptr, OptHelp },
+        {}
+    };
+
+    ExrOptions options;
+    const char* outDir = nullptr;
+
+    int opt;
+    while( ( opt = getopt_long( argc, argv, "c:l:t:o:", longOptions, nullptr ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'c':
+            if( strcmp( optarg, "none" ) == 0 ) options.compression = ExrOptions::Compression::None;
+            else if( strcmp( optarg, "zip" ) == 0 ) options.compression = ExrOptions::Compression::Zip;
+            else if( strcmp( optarg, "zips" ) == 0 ) options.compression = ExrOptions::Compression::Zips;
+            else if( strcmp( optarg, "piz" ) == 0 ) options.compression = ExrOptions::Compression::Piz;
+            else if( strcmp( optarg, "dwaa" ) == 0 ) options.compression = ExrOptions::Compression::Dwaa;
+            else if( strcmp( optarg, "dwab" ) == 0 ) options.compression = ExrOptions::Compression::Dwab;
+            else if( strcmp( optarg, "htj2k" ) == 0 ) options.compression = ExrOptions::Compression::Htj2k;
+            else
+            {
+                mclog( LogLevel::Error, "Unknown compression %s", optarg );
+                return 1;
+            }
+            break;
+        case 'l':
+            if( strcmp( optarg, "increasing" ) == 0 ) options.lineOrder = ExrOptions::LineOrder::Increasing;
+            else if( strcmp( optarg, "decreasing" ) == 0 ) options.lineOrder = ExrOptions::LineOrder::Decreasing;
+            else if( strcmp( optarg, "random" ) == 0 ) options.lineOrder = ExrOptions::LineOrder::Random;
+            else
+            {
+                mclog( LogLevel::Error, "Unknown line order %s", optarg );
+                return 1;
+            }
+            break;
+        case 't':
+        {
+            const auto size = atoi( optarg );
+            if( size <= 0 )
+            {
+                mclog( LogLevel::Error, "Invalid tile size %s", optarg );
+                return 1;
+            }
+            options.tileSize = size;
+            break;
+        }
+        case 'o':
+            outDir = optarg;
+            break;
+        default:
+            printf( "\n" );
+            [[fallthrough]];
+        case OptHelp:
+            PrintHelp();
+            return 0;
+        }
+    }
+
+    const auto numFiles = argc - optind;
+    if( outDir ? numFiles < 1 : numFiles != 2 )
     {
         PrintHelp();
         return 1;
     }
+    if( options.lineOrder == ExrOptions::LineOrder::Random && options.tileSize == 0 )
+    {
+        mclog( LogLevel::Error, "Random line order requires tiles" );
+        return 1;
+    }
 
     const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
     TaskDispatch td( workerThreads, "Worker" );
 
-    const auto inFileStr = ExpandHome( argv[1] );
-    const auto inFile = inFileStr.c_str();
-
-    const auto outFileStr = ExpandHome( argv[2] );
-    const auto outFile = outFileStr.c_str();
-
-    mclog( LogLevel::Info, "Converting %s to %s", inFile, outFile );
-
-    auto loader = GetImageLoader( inFile, ToneMap::Operator::PbrNeutral, &td );
-    if( !loader )
+    if( !outDir )
     {
-        mclog( LogLevel::Error, "Failed to load image %s", inFile );
-        return 1;
+        const auto inFile = ExpandHome( argv[optind] );
+        const auto outFile = ExpandHome( argv[optind+1] );
+        return Convert( inFile.c_str(), outFile.c_str(), options, &td ) ? 0 : 1;
     }
-    if( !loader->IsHdr() )
+
+    const auto dir = ExpandHome( outDir );
+    std::vector<std::pair<std::string, std::string>> files;
+    unordered_flat_map<std::string, size_t> outputs;
+    for( int i=optind; i<argc; i++ )
     {
-        mclog( LogLevel::Error, "Image %s is not HDR", inFile );
-        return 1;
-    }
+        auto inFile = ExpandHome( argv[i] );
+        auto outFile = OutputPath( dir, inFile );
+        if( outFile == inFile )
+        {
+            mclog( LogLevel::Error, "Output would overwrite input %s", inFile.c_str() );
+            return 1;
+        }
 
-    auto hdr = loader->LoadHdr();
-    CheckPanic( hdr, "Failed to load image %s", inFile );
+        // Inputs with the same name, such as a/x.hdr and b/x.hdr, or x.hdr and x.exr, would be
+        // written concurrently to the same file
+        auto [it, inserted] = outputs.try_emplace( outFile, files.size() );
+        if( !inserted )
+        {
+            mclog( LogLevel::Error, "Inputs %s and %s would both be converted to %s", files[it->second].first.c_str(), inFile.c_str(), outFile.c_str() );
+            return 1;
+        }
+        files.emplace_back( std::move( inFile ), std::move( outFile ) );
+    }
 
-    auto half = std::make_unique<BitmapHdrHalf>( *hdr );
-    half->SaveExr( outFile );
+    // Each file is converted on its own worker. Loading and saving may use the remaining workers,
+    // and EXR chunks are compressed on the OpenEXR thread pool.
+    std::atomic<size_t> failed = 0;
+    td.ParallelFor( files.size(), 1, [&]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ )
+        {
+            if( !Convert( files[i].first.c_str(), files[i].second.c_str(), options, &td ) ) failed.fetch_add( 1, std::memory_order_relaxed );
+        }
+    } );
 
+    if( failed > 0 )
+    {
+        mclog( LogLevel::Error, "Failed to convert %zu of %zu files", failed.load(), files.size() );
+        return 1;
+    }
     return 0;
 }
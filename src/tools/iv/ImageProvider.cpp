@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <sys/stat.h>
 #include <tracy/Tracy.hpp>
 
 #include "ImageProvider.hpp"
@@ -6,16 +7,38 @@
 #include "image/PngLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/CompressedBitmap.hpp"
+#include "util/Config.hpp"
 #include "util/Logs.hpp"
 #include "util/MemoryBuffer.hpp"
 #include "util/TaskDispatch.hpp"
 
-ImageProvider::ImageProvider( TaskDispatch& td )
-    : m_shutdown( false )
-    , m_currentJob( -1 )
+ImageProvider::CacheConfig::CacheConfig( Config& cfg )
+{
+    size = cfg.Get( "Cache", "Size", size );
+    prefetch = cfg.Get( "Cache", "Prefetch", prefetch );
+}
+
+void ImageProvider::CacheConfig::Write( FILE* f ) const
+{
+    fprintf( f, "[Cache]\n" );
+    fprintf( f, "Size = %u\n", size );
+    fprintf( f, "Prefetch = %u\n", prefetch );
+}
+
+ImageProvider::ImageProvider( TaskDispatch& td, size_t cacheSize )
+    : m_currentJob( -1 )
     , m_nextId( 0 )
-    , m_thread( [this] { Worker(); } )
+    , m_loading( false )
+    , m_currentPrefetch( -1 )
+    , m_prefetching( false )
+    , m_prefetchHdr( false )
+    , m_cacheUsed( 0 )
+    , m_cacheSize( cacheSize )
     , m_td( td )
+    , m_shutdown( false )
+    , m_thread( [this] { Worker(); } )
+    , m_prefetchThread( [this] { PrefetchWorker(); } )
 {
 }
 
@@ -27,6 +50,7 @@ ImageProvider::~ImageProvider()
         m_cv.notify_all();
     }
     m_thread.join();
+    m_prefetchThread.join();
 }
 
 int64_t ImageProvider::LoadImage( const char* path, bool hdr, Callback callback, void* userData, Flags flags )
@@ -43,7 +67,7 @@ int64_t ImageProvider::LoadImage( const char* path, bool hdr, Callback callback,
         .userData = userData,
         .flags = flags
     } );
-    m_cv.notify_one();
+    m_cv.notify_all();
     return id;
 }
 
@@ -61,7 +85,25 @@ int64_t ImageProvider::LoadImage( int fd, bool hdr, Callback callback, void* use
         .userData = userData,
         .flags = flags
     } );
-    m_cv.notify_one();
+    m_cv.notify_all();
+    return id;
+}
+
+int64_t ImageProvider::Prefetch( const char* path, bool hdr )
+{
+    ZoneScoped;
+    const auto id = m_nextId++;
+    std::lock_guard lock( m_lock );
+    m_prefetch.emplace_back( Job {
+        .id = id,
+        .path = path,
+        .fd = -1,
+        .hdr = hdr,
+        .callback = nullptr,
+        .userData = nullptr,
+        .flags = {}
+    } );
+    m_cv.notify_all();
     return id;
 }
 
@@ -73,6 +115,10 @@ void ImageProvider::Cancel( int64_t id )
     {
         m_currentJob = -1;
     }
+    else if( m_currentPrefetch == id )
+    {
+        m_currentPrefetch = -1;
+    }
     else
     {
         auto it = std::ranges::find_if( m_jobs, [id]( const auto& job ) { return job.id == id; } );
@@ -83,6 +129,10 @@ void ImageProvider::Cancel( int64_t id )
             lock.unlock();
             job.callback( job.userData, job.id, Result::Cancelled, { .flags = job.flags } );
         }
+        else
+        {
+            std::erase_if( m_prefetch, [id]( const auto& job ) { return job.id == id; } );
+        }
     }
 }
 
@@ -93,7 +143,9 @@ void ImageProvider::CancelAll()
 
     m_lock.lock();
     std::swap( tmp, m_jobs );
+    m_prefetch.clear();
     m_currentJob = -1;
+    m_currentPrefetch = -1;
     m_lock.unlock();
 
     for( auto& job : tmp )
@@ -109,77 +161,56 @@ void ImageProvider::Worker()
     while( !m_shutdown.load( std::memory_order_acquire ) )
     {
         m_currentJob = -1;
+        m_loading = false;
+        m_cv.notify_all();
         m_cv.wait( lock, [this] { return !m_jobs.empty() || m_shutdown.load( std::memory_order_acquire ); } );
         if( m_shutdown.load( std::memory_order_acquire ) ) return;
 
-        auto job = std::move( m_jobs.back() );
+        Job job = std::move( m_jobs.back() );
         m_jobs.pop_back();
         m_currentJob = job.id;
-        lock.unlock();
-
-        ZoneScopedN( "Image load" );
-        std::unique_ptr<Bitmap> bitmap;
-        std::unique_ptr<BitmapHdr> bitmapHdr;
-        struct timespec mtime = {};
+        m_loading = true;
 
-        std::unique_ptr<ImageLoader> loader;
-        if( job.fd >= 0 )
+        // Image being prefetched will be in the cache soon
+        if( job.fd < 0 )
         {
-            mclog( LogLevel::Info, "Loading image from file descriptor" );
-            auto buffer = job.flags.dndFd == 0 ?
-                std::make_shared<MemoryBuffer>( job.fd ) :
-                std::make_shared<MemoryBuffer>( job.fd, MemoryBuffer::Borrow );
-            loader = GetImageLoader( buffer, ToneMap::Operator::PbrNeutral, &m_td );
-        }
-        else
-        {
-            mclog( LogLevel::Info, "Loading image %s", job.path.c_str() );
-            loader = GetImageLoader( job.path.c_str(), ToneMap::Operator::PbrNeutral, &m_td, &mtime );
+            m_cv.wait( lock, [&] { return !m_prefetching || m_prefetchPath != job.path || m_prefetchHdr != job.hdr || m_shutdown.load( std::memory_order_acquire ); } );
+            if( m_shutdown.load( std::memory_order_acquire ) ) return;
         }
+        lock.unlock();
 
-        if( loader )
-        {
-            if( loader->IsHdr() && ( job.hdr || loader->PreferHdr() ) )
-            {
-                bitmapHdr = loader->LoadHdr( job.hdr ? Colorspace::BT2020 : Colorspace::BT709 );
-                if( !job.hdr )
-                {
-                    bitmap = std::make_unique<Bitmap>( bitmapHdr->Width(), bitmapHdr->Height() );
-                    auto src = bitmapHdr->Data();
-                    auto dst = bitmap->Data();
-                    size_t sz = bitmapHdr->Width() * bitmapHdr->Height();
-                    while( sz > 0 )
-                    {
-                        const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                        m_td.Queue( [src, dst, chunk] {
-                            ToneMap::Process( ToneMap::Operator::PbrNeutral, (uint32_t*)dst, src, chunk );
-                        } );
-                        src += chunk * 4;
-                        dst += chunk * 4;
-                        sz -= chunk;
-                    }
-                    m_td.Sync();
-                }
-            }
-            else
-            {
-                bitmap = loader->Load();
-            }
-        }
+        ZoneScopedN( "Image load" );
+        CacheEntry entry = {};
+        const bool cached = job.fd < 0 && FindCached( job.path, job.hdr, entry );
+        const bool success = cached || Decode( job, entry );
+        if( cached ) mclog( LogLevel::Info, "Image %s found in cache", job.path.c_str() );
 
         lock.lock();
         const bool cancelled = m_currentJob == -1;
         lock.unlock();
 
+        auto bitmap = entry.bitmap;
+        auto bitmapHdr = entry.bitmapHdr;
+        auto compressed = entry.compressed;
+        const auto mtime = entry.mtime;
+        if( success && !cancelled && !cached && job.fd < 0 ) AddToCache( std::move( entry ) );
+
         if( cancelled )
         {
             job.callback( job.userData, job.id, Result::Cancelled, { .flags = job.flags } );
         }
+        else if( compressed )
+        {
+            mclog( LogLevel::Info, "Image loaded: %ux%u, block compressed", compressed->Width(), compressed->Height() );
+            job.callback( job.userData, job.id, Result::Success, {
+                .compressed = std::move( compressed ),
+                .origin = job.path,
+                .flags = job.flags,
+                .mtime = mtime
+            } );
+        }
         else if( bitmap || bitmapHdr )
         {
-            uint32_t width, height;
-            if( bitmap ) bitmap->NormalizeOrientation();
-            if( bitmapHdr ) bitmapHdr->NormalizeOrientation();
             mclog( LogLevel::Info, "Image loaded: %ux%u", bitmap ? bitmap->Width() : bitmapHdr->Width(), bitmap ? bitmap->Height() : bitmapHdr->Height() );
             job.callback( job.userData, job.id, Result::Success, {
                 .bitmap = std::move( bitmap ),
@@ -198,3 +229,128 @@ void ImageProvider::Worker()
         lock.lock();
     }
 }
+
+void ImageProvider::PrefetchWorker()
+{
+    ZoneScoped;
+    std::unique_lock lock( m_lock );
+    while( !m_shutdown.load( std::memory_order_acquire ) )
+    {
+        m_currentPrefetch = -1;
+        m_prefetching = false;
+        m_cv.notify_all();
+        m_cv.wait( lock, [this] { return ( !m_prefetch.empty() && m_jobs.empty() && !m_loading ) || m_shutdown.load( std::memory_order_acquire ); } );
+        if( m_shutdown.load( std::memory_order_acquire ) ) return;
+
+        Job job = std::move( m_prefetch.front() );
+        m_prefetch.erase( m_prefetch.begin() );
+        m_currentPrefetch = job.id;
+        m_prefetching = true;
+        m_prefetchPath = job.path;
+        m_prefetchHdr = job.hdr;
+        lock.unlock();
+
+        ZoneScopedN( "Image prefetch" );
+        CacheEntry entry = {};
+        if( !FindCached( job.path, job.hdr, entry ) )
+        {
+            const bool success = Decode( job, entry );
+
+            lock.lock();
+            const bool cancelled = m_currentPrefetch == -1;
+            lock.unlock();
+
+            if( success && !cancelled ) AddToCache( std::move( entry ) );
+            else if( !success && !cancelled ) mclog( LogLevel::Warning, "Failed to prefetch image %s", job.path.c_str() );
+        }
+
+        lock.lock();
+    }
+}
+
+bool ImageProvider::Decode( const Job& job, CacheEntry& entry )
+{
+    ZoneScoped;
+
+    const bool prefetch = !job.callback;
+    std::unique_ptr<ImageLoader> loader;
+    if( job.fd >= 0 )
+    {
+        mclog( LogLevel::Info, "Loading image from file descriptor" );
+        auto buffer = job.flags.dndFd == 0 ?
+            std::make_shared<MemoryBuffer>( job.fd ) :
+            std::make_shared<MemoryBuffer>( job.fd, MemoryBuffer::Borrow );
+        loader = GetImageLoader( buffer, ToneMap::Operator::PbrNeutral, &m_td );
+    }
+    else
+    {
+        mclog( LogLevel::Info, "%s image %s", prefetch ? "Prefetching" : "Loading", job.path.c_str() );
+        loader = GetImageLoader( job.path.c_str(), ToneMap::Operator::PbrNeutral, &m_td, &entry.mtime );
+    }
+    if( !loader ) return false;
+
+    entry.path = job.path;
+    entry.hdr = job.hdr;
+    if( loader->IsHdr() && ( job.hdr || loader->PreferHdr() ) )
+    {
+        entry.bitmapHdr = loader->LoadHdr( job.hdr ? Colorspace::BT2020 : Colorspace::BT709 );
+        if( entry.bitmapHdr && !job.hdr )
+        {
+            entry.bitmap = entry.bitmapHdr->Tonemap( ToneMap::Operator::PbrNeutral, &m_td );
+        }
+    }
+    else
+    {
+        entry.compressed = loader->LoadCompressed();
+        if( !entry.compressed ) entry.bitmap = loader->Load();
+    }
+    return entry.bitmap || entry.bitmapHdr || entry.compressed;
+}
+
+bool ImageProvider::FindCached( const std::string& path, bool hdr, CacheEntry& entry )
+{
+    std::lock_guard lock( m_cacheLock );
+    auto it = std::ranges::find_if( m_cache, [&]( const auto& v ) { return v.hdr == hdr && v.path == path; } );
+    if( it == m_cache.end() ) return false;
+
+    // Modified files must be loaded again
+    struct stat st;
+    if( stat( path.c_str(), &st ) != 0 || st.st_mtim.tv_sec != it->mtime.tv_sec || st.st_mtim.tv_nsec != it->mtime.tv_nsec )
+    {
+        m_cacheUsed -= it->size;
+        m_cache.erase( it );
+        return false;
+    }
+
+    std::rotate( m_cache.begin(), it, it + 1 );
+    entry = m_cache.front();
+    return true;
+}
+
+void ImageProvider::AddToCache( CacheEntry&& entry )
+{
+    ZoneScoped;
+
+    entry.size = 0;
+    if( entry.bitmap ) entry.size += size_t( entry.bitmap->Width() ) * entry.bitmap->Height() * 4;
+    if( entry.bitmapHdr ) entry.size += size_t( entry.bitmapHdr->Width() ) * entry.bitmapHdr->Height() * 4 * sizeof( float );
+    if( entry.compressed ) entry.size += entry.compressed->Size();
+    if( entry.size > m_cacheSize ) return;
+
+    std::lock_guard lock( m_cacheLock );
+    auto it = std::ranges::find_if( m_cache, [&]( const auto& v ) { return v.hdr == entry.hdr && v.path == entry.path; } );
+    if( it != m_cache.end() )
+    {
+        m_cacheUsed -= it->size;
+        m_cache.erase( it );
+    }
+
+    while( m_cacheUsed + entry.size > m_cacheSize )
+    {
+        m_cacheUsed -= m_cache.back().size;
+        m_cache.pop_back();
+    }
+
+    m_cacheUsed += entry.size;
+    m_cache.insert( m_cache.begin(), std::move( entry ) );
+}
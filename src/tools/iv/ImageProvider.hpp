@@ -5,6 +5,7 @@
 #include <memory>
 #include <mutex>
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
 #include <thread>
 #include <time.h>
@@ -12,6 +13,8 @@
 
 class Bitmap;
 class BitmapHdr;
+class CompressedBitmap;
+class Config;
 class DataBuffer;
 class TaskDispatch;
 
@@ -34,19 +37,38 @@ public:
     {
         std::shared_ptr<Bitmap> bitmap;
         std::shared_ptr<BitmapHdr> bitmapHdr;
+        std::shared_ptr<CompressedBitmap> compressed;
         std::string origin;
         Flags flags;
         struct timespec mtime;
     };
 
+    // Settings of the [Cache] section in the config file
+    struct CacheConfig
+    {
+        CacheConfig() = default;
+        explicit CacheConfig( Config& cfg );
+        void Write( FILE* f ) const;
+
+        uint32_t size = 512;    // MB
+        uint32_t prefetch = 2;  // Images prefetched on each side of the current one
+    };
+
     using Callback = void (*)(void *, int64_t, Result, ReturnData);
 
-    ImageProvider( TaskDispatch& td );
+    // Images loaded from paths are kept in a cache of up to cacheSize bytes.
+    ImageProvider( TaskDispatch& td, size_t cacheSize = 0 );
     ~ImageProvider();
 
     int64_t LoadImage( const char* path, bool hdr, Callback callback, void* userData, Flags flags = {} );
     int64_t LoadImage( int fd, bool hdr, Callback callback, void* userData, const char* origin, Flags flags = {} );
 
+    // Loads the image into the cache on a separate thread, in the order the prefetches were
+    // requested. A prefetch is only started while no LoadImage job is pending or running, and one
+    // already in progress does not delay LoadImage jobs. Loading the image that is being
+    // prefetched waits for the prefetch instead of decoding the image again.
+    int64_t Prefetch( const char* path, bool hdr );
+
     void Cancel( int64_t id );
     void CancelAll();
 
@@ -62,16 +84,49 @@ private:
         Flags flags;
     };
 
+    struct CacheEntry
+    {
+        std::string path;
+        bool hdr;
+        struct timespec mtime;
+        size_t size;
+
+        std::shared_ptr<Bitmap> bitmap;
+        std::shared_ptr<BitmapHdr> bitmapHdr;
+        std::shared_ptr<CompressedBitmap> compressed;
+    };
+
     void Worker();
+    void PrefetchWorker();
+
+    [[nodiscard]] bool Decode( const Job& job, CacheEntry& entry );
+
+    [[nodiscard]] bool FindCached( const std::string& path, bool hdr, CacheEntry& entry );
+    void AddToCache( CacheEntry&& entry );
 
     int64_t m_currentJob;
     int64_t m_nextId;
+    bool m_loading;
     std::vector<Job> m_jobs;
 
+    // Prefetch in progress, if m_prefetching is set. Its id is -1 after it was cancelled.
+    int64_t m_currentPrefetch;
+    bool m_prefetching;
+    std::string m_prefetchPath;
+    bool m_prefetchHdr;
+    std::vector<Job> m_prefetch;
+
+    // Most recently used first
+    std::mutex m_cacheLock;
+    std::vector<CacheEntry> m_cache;
+    size_t m_cacheUsed;
+    size_t m_cacheSize;
+
+    TaskDispatch& m_td;
+
     std::atomic<bool> m_shutdown;
     std::mutex m_lock;
     std::condition_variable m_cv;
     std::thread m_thread;
-
-    TaskDispatch& m_td;
+    std::thread m_prefetchThread;
 };
@@ -8,6 +8,7 @@
 #include "Selection.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/CompressedBitmap.hpp"
 #include "util/EmbedData.hpp"
 #include "vulkan/VlkBuffer.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
@@ -37,10 +38,27 @@ struct PushConstant
     float div;
 };
 
+// Maps upright texture coordinates to a texture stored with the given EXIF orientation
+static Vector2<float> OrientTexCoord( int orientation, float u, float v )
+{
+    switch( orientation )
+    {
+    case 2: return { 1 - u, v };
+    case 3: return { 1 - u, 1 - v };
+    case 4: return { u, 1 - v };
+    case 5: return { v, u };
+    case 6: return { v, 1 - u };
+    case 7: return { 1 - v, 1 - u };
+    case 8: return { 1 - v, u };
+    default: return { u, v };
+    }
+}
+
 ImageView::ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, VkFormat format, const VkExtent2D& extent, float scale, Selection& selection )
     : m_garbage( garbage )
     , m_device( std::move( device ) )
     , m_extent( extent )
+    , m_orientation( 0 )
     , m_filteredNearest( false )
     , m_selection( selection )
     , m_scale( scale )
@@ -279,7 +297,7 @@ std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<Bitmap>& bi
     auto texture = std::make_shared<Texture>( *m_device, *bitmap, SdrFormat, true, texFences, &td );
     for( auto& fence : texFences ) fence->Wait();
 
-    SetTexture( texture, bitmap->Width(), bitmap->Height(), newBitmap );
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), bitmap->Orientation(), newBitmap );
     return texture;
 }
 
@@ -298,11 +316,27 @@ std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapHdr>&
     auto texture = std::make_shared<Texture>( *m_device, *bitmap, HdrFormat, true, texFences, &td );
     for( auto& fence : texFences ) fence->Wait();
 
-    SetTexture( texture, bitmap->Width(), bitmap->Height(), newBitmap );
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), bitmap->Orientation(), newBitmap );
+    return texture;
+}
+
+std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<CompressedBitmap>& bitmap, TaskDispatch& td, bool newBitmap )
+{
+    // Images without a mip chain in the file are decoded, so that mips can be generated
+    const auto format = bitmap && bitmap->Levels().size() > 1 ? Texture::CompressedFormat( *m_device, bitmap->GetFormat() ) : VK_FORMAT_UNDEFINED;
+    if( format == VK_FORMAT_UNDEFINED ) return SetBitmap( bitmap ? std::shared_ptr<Bitmap>( bitmap->Decode( &td ) ) : std::shared_ptr<Bitmap>(), td, newBitmap );
+
+    if( newBitmap ) m_selection.AbortDrag();
+
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    auto texture = std::make_shared<Texture>( *m_device, bitmap, format, texFences );
+    for( auto& fence : texFences ) fence->Wait();
+
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), 0, newBitmap );
     return texture;
 }
 
-void ImageView::SetTexture( std::shared_ptr<Texture> texture, uint32_t width, uint32_t height, bool newBitmap )
+void ImageView::SetTexture( std::shared_ptr<Texture> texture, uint32_t width, uint32_t height, int orientation, bool newBitmap )
 {
     std::lock_guard lock( m_lock );
     Cleanup();
@@ -310,14 +344,17 @@ void ImageView::SetTexture( std::shared_ptr<Texture> texture, uint32_t width, ui
     std::swap( m_texture, texture );
     m_imageInfo.imageView = *m_texture;
 
+    if( orientation >= 5 ) std::swap( width, height );
     if( newBitmap )
     {
         m_bitmapExtent = { width, height };
+        m_orientation = orientation;
         FitToExtent( m_extent );
     }
     else
     {
         CheckPanic( m_bitmapExtent.width == width && m_bitmapExtent.height == height, "Bitmap size changed, but newBitmap is false" );
+        CheckPanic( m_orientation == orientation, "Bitmap orientation changed, but newBitmap is false" );
         UpdateVertexBuffer();
     }
 }
@@ -570,11 +607,16 @@ std::array<ImageView::Vertex, 4> ImageView::SetupVertexBuffer() const
     float x1 = std::round( x0 + m_bitmapExtent.width * m_imgScale );
     float y1 = std::round( y0 + m_bitmapExtent.height * m_imgScale );
 
+    const auto t00 = OrientTexCoord( m_orientation, 0, 0 );
+    const auto t10 = OrientTexCoord( m_orientation, 1, 0 );
+    const auto t11 = OrientTexCoord( m_orientation, 1, 1 );
+    const auto t01 = OrientTexCoord( m_orientation, 0, 1 );
+
     return { {
-        { x0, y0, 0, 0 },
-        { x1, y0, 1, 0 },
-        { x1, y1, 1, 1 },
-        { x0, y1, 0, 1 }
+        { x0, y0, t00.x, t00.y },
+        { x1, y0, t10.x, t10.y },
+        { x1, y1, t11.x, t11.y },
+        { x0, y1, t01.x, t01.y }
     } };
 }
 
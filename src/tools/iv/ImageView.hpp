@@ -9,6 +9,7 @@
 
 class Bitmap;
 class BitmapHdr;
+class CompressedBitmap;
 class GarbageChute;
 class Selection;
 class TaskDispatch;
@@ -47,7 +48,8 @@ public:
 
     std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<Bitmap>& bitmap, TaskDispatch& td, bool newBitmap );      // call with no lock
     std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<BitmapHdr>& bitmap, TaskDispatch& td, bool newBitmap );   // call with no lock
-    void SetTexture( std::shared_ptr<Texture> texture, uint32_t width, uint32_t height, bool newBitmap );               // call with no lock
+    std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<CompressedBitmap>& bitmap, TaskDispatch& td, bool newBitmap );    // call with no lock
+    void SetTexture( std::shared_ptr<Texture> texture, uint32_t width, uint32_t height, int orientation, bool newBitmap );  // call with no lock
     std::shared_ptr<Texture> GetTexture();
 
     void SetScale( float scale, const VkExtent2D& extent );
@@ -62,6 +64,7 @@ public:
 
     [[nodiscard]] bool HasBitmap() const { return m_texture != nullptr; };
     [[nodiscard]] const VkExtent2D& GetBitmapExtent() const { return m_bitmapExtent; }
+    [[nodiscard]] int GetOrientation() const { return m_orientation; }
     [[nodiscard]] float GetImgScale() const { return m_imgScale; }
     [[nodiscard]] const Vector2<float>& GetImgOrigin() const { return m_imgOrigin; }
 
@@ -96,7 +99,9 @@ private:
     std::shared_ptr<VlkSampler> m_samplerNearest;
 
     VkExtent2D m_extent;
+    // Upright extent. The texture is stored as decoded, and the orientation is applied when sampling.
     VkExtent2D m_bitmapExtent;
+    int m_orientation;
 
     Vector2<float> m_imgOrigin;
     float m_imgScale;
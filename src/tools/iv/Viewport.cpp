@@ -25,6 +25,7 @@
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
 #include "util/BitmapHdrHalf.hpp"
+#include "util/CompressedBitmap.hpp"
 #include "util/Config.hpp"
 #include "util/EmbedData.hpp"
 #include "util/Filesystem.hpp"
@@ -32,6 +33,7 @@
 #include "util/Invoke.hpp"
 #include "util/MemoryBuffer.hpp"
 #include "util/Panic.hpp"
+#include "util/PixelBytes.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Url.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
@@ -68,7 +70,6 @@ Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, b
     , m_vkInstance( vkInstance )
     , m_td( std::make_unique<TaskDispatch>( std::thread::hardware_concurrency() - 1, "Worker" ) )
     , m_window( std::make_shared<WaylandWindow>( display, vkInstance ) )
-    , m_provider( std::make_shared<ImageProvider>( *m_td ) )
     , m_hdr( hdr )
 {
     ZoneScoped;
@@ -122,6 +123,9 @@ Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, b
     const auto width = cfg.Get( "Window", "Width", 1280 );
     const auto height = cfg.Get( "Window", "Height", 720 );
     const auto maximized = cfg.Get( "Window", "Maximized", 0 );
+    m_cacheConfig = ImageProvider::CacheConfig( cfg );
+
+    m_provider = std::make_shared<ImageProvider>( *m_td, size_t( m_cacheConfig.size ) * 1024 * 1024 );
 
     m_device = std::make_shared<VlkDevice>( m_vkInstance, physDevice, VlkDevice::RequireGraphic | VlkDevice::RequirePresent, m_window->VkSurface() );
     PrintQueueConfig( *m_device );
@@ -168,6 +172,8 @@ Viewport::~Viewport()
             fprintf( f, "Width = %u\n", winSize.width );
             fprintf( f, "Height = %u\n", winSize.height );
             fprintf( f, "Maximized = %d\n", maximized );
+            fprintf( f, "\n" );
+            m_cacheConfig.Write( f );
             fclose( f );
         }
     }
@@ -209,6 +215,8 @@ void Viewport::LoadImage( const char* path, bool scanDirectory )
         mclog( LogLevel::Info, "Found %zu files", files.size() );
         SetFileList( std::move( files ), origin );
     }
+
+    if( !m_fileList.empty() && m_fileList[m_fileIndex] == path ) PrefetchNeighbors();
 }
 
 void Viewport::LoadImage( int fd, const char* origin, int dndFd )
@@ -216,6 +224,7 @@ void Viewport::LoadImage( int fd, const char* origin, int dndFd )
     ZoneScoped;
     std::lock_guard lock( m_lock );
     m_provider->CancelAll();
+    m_prefetch.clear();
     m_currentJob = m_provider->LoadImage( fd, m_hdr && m_window->HdrCapable(), Method( ImageHandler ), this, origin, { .dndFd = dndFd } );
     ZoneTextF( "id %ld", m_currentJob );
     SetBusy();
@@ -246,6 +255,42 @@ void Viewport::LoadImage( const std::vector<std::string>& paths )
     }
 }
 
+void Viewport::PrefetchNeighbors()
+{
+    ZoneScoped;
+
+    const auto hdr = m_hdr && m_window->HdrCapable();
+    if( hdr != m_prefetchHdr )
+    {
+        for( auto& v : m_prefetch ) m_provider->Cancel( v.second );
+        m_prefetch.clear();
+        m_prefetchHdr = hdr;
+    }
+
+    // Next image is the most likely to be requested, then previous, and so on
+    std::vector<std::string> wanted;
+    const auto size = m_fileList.size();
+    for( size_t i=1; i<=m_cacheConfig.prefetch && i<size; i++ )
+    {
+        for( auto idx : { ( m_fileIndex + i ) % size, ( m_fileIndex + size - i ) % size } )
+        {
+            if( idx != m_fileIndex && std::ranges::find( wanted, m_fileList[idx] ) == wanted.end() ) wanted.emplace_back( m_fileList[idx] );
+        }
+    }
+
+    // Prefetch of the current image is left running, as the load job will wait for it
+    std::erase_if( m_prefetch, [&]( const auto& v ) {
+        if( std::ranges::find( wanted, v.first ) != wanted.end() ) return false;
+        if( v.first != m_fileList[m_fileIndex] ) m_provider->Cancel( v.second );
+        return true;
+    } );
+    for( auto& path : wanted )
+    {
+        if( std::ranges::find( m_prefetch, path, &std::pair<std::string, int64_t>::first ) != m_prefetch.end() ) continue;
+        m_prefetch.emplace_back( path, m_provider->Prefetch( path.c_str(), hdr ) );
+    }
+}
+
 void Viewport::SetBusy()
 {
     if( !m_isBusy )
@@ -326,7 +371,12 @@ bool Viewport::Render()
     std::lock_guard lock( *m_view );
     Update( delta );
 
-    if( !m_render ) return false;
+    if( !m_render )
+    {
+        // Window goes idle. Pooled pixel buffers are only reused while images are decoded.
+        PixelPoolTrim();
+        return false;
+    }
     m_render = false;
 
     FrameMark;
@@ -489,7 +539,7 @@ void Viewport::Drop( int fd, const char* mime )
     m_loadOrigin.clear();
 }
 
-static void SaveImage( const char* path, ImageType type, const std::shared_ptr<Texture>& tex, VlkDevice& device, TaskDispatch* td )
+static void SaveImage( const char* path, ImageType type, const std::shared_ptr<Texture>& tex, int orientation, VlkDevice& device, TaskDispatch* td )
 {
     const auto format = tex->Format();
 
@@ -497,25 +547,28 @@ static void SaveImage( const char* path, ImageType type, const std::shared_ptr<T
     {
         CheckPanic( format == HdrFormat, "Saving EXR, but texture is not HDR!" );
         auto bmp = tex->ReadbackHdr( device );
+        bmp->SetOrientation( orientation );
         bmp->SetColorspace( Colorspace::BT709, td );
-        bmp->SaveExr( path );
+        bmp->SaveExr( path, {}, td );
         return;
     }
 
     std::shared_ptr<Bitmap> bmp;
-    if( format == SdrFormat )
+    if( format != HdrFormat )
     {
         bmp = tex->ReadbackSdr( device );
+        bmp->SetOrientation( orientation );
     }
     else
     {
         auto half = tex->ReadbackHdr( device );
+        half->SetOrientation( orientation );
         half->SetColorspace( Colorspace::BT709, td );
         auto hdr = std::make_shared<BitmapHdr>( *half );
-        bmp = hdr->Tonemap( ToneMap::Operator::PbrNeutral );
+        bmp = hdr->Tonemap( ToneMap::Operator::PbrNeutral, td );
     }
 
-    bmp->SavePng( path );
+    bmp->SavePng( path, PngEncoder::Level::Default, td );
 }
 
 void Viewport::KeyEvent( uint32_t key, int mods, bool pressed )
@@ -551,6 +604,9 @@ void Viewport::KeyDown( uint32_t key, int mods )
     {
         auto tex = m_view->GetTexture();
         if( !tex ) return;
+        m_view->lock();
+        const auto orientation = m_view->GetOrientation();
+        m_view->unlock();
 
         std::vector<nfdu8filteritem_t> filters = {
             nfdu8filteritem_t { "PNG image", "*.png" },
@@ -583,7 +639,7 @@ void Viewport::KeyDown( uint32_t key, int mods )
                 type = ImageType::Png;
             }
 
-            SaveImage( str.c_str(), type, tex, *m_device, m_td.get() );
+            SaveImage( str.c_str(), type, tex, orientation, *m_device, m_td.get() );
         }
     }
     else if( key == KEY_F )
@@ -847,20 +903,22 @@ bool Viewport::SendClipboard( const char* mimeType, int32_t fd )
     if( strcmp( mimeType, "image/png" ) == 0 )
     {
         std::shared_ptr<Bitmap> bmp;
-        if( m_clipboard->Format() == SdrFormat )
+        if( m_clipboard->Format() != HdrFormat )
         {
             bmp = m_clipboard->ReadbackSdr( *m_device );
+            bmp->SetOrientation( m_clipboardOrientation );
         }
         else
         {
             auto half = m_clipboard->ReadbackHdr( *m_device );
+            half->SetOrientation( m_clipboardOrientation );
             half->SetColorspace( Colorspace::BT709, m_td.get() );
             auto hdr = std::make_shared<BitmapHdr>( *half );
-            bmp = hdr->Tonemap( ToneMap::Operator::PbrNeutral );
+            bmp = hdr->Tonemap( ToneMap::Operator::PbrNeutral, m_td.get() );
         }
 
         if( m_clipboardClip.offset.x != 0 || m_clipboardClip.offset.y != 0 ||
-            m_clipboardClip.extent.width != bmp->Width() || m_clipboardClip.extent.height != bmp->Height() )
+            m_clipboardClip.extent.width != bmp->OrientedWidth() || m_clipboardClip.extent.height != bmp->OrientedHeight() )
         {
             bmp->Crop( m_clipboardClip.offset.x, m_clipboardClip.offset.y, m_clipboardClip.extent.width, m_clipboardClip.extent.height );
         }
@@ -868,7 +926,7 @@ bool Viewport::SendClipboard( const char* mimeType, int32_t fd )
         std::thread thread( [bmp = std::move( bmp ), fd]() {
             ZoneScoped;
             signal( SIGPIPE, SIG_IGN );
-            bmp->SavePng( fd );
+            bmp->SavePng( fd, PngEncoder::Level::Fast );
             close( fd );
         } );
         thread.detach();
@@ -882,10 +940,11 @@ bool Viewport::SendClipboard( const char* mimeType, int32_t fd )
         }
 
         auto bmp = m_clipboard->ReadbackHdr( *m_device );
+        bmp->SetOrientation( m_clipboardOrientation );
         bmp->SetColorspace( Colorspace::BT709, m_td.get() );
 
         if( m_clipboardClip.offset.x != 0 || m_clipboardClip.offset.y != 0 ||
-            m_clipboardClip.extent.width != bmp->Width() || m_clipboardClip.extent.height != bmp->Height() )
+            m_clipboardClip.extent.width != bmp->OrientedWidth() || m_clipboardClip.extent.height != bmp->OrientedHeight() )
         {
             bmp->Crop( m_clipboardClip.offset.x, m_clipboardClip.offset.y, m_clipboardClip.extent.width, m_clipboardClip.extent.height );
         }
@@ -930,6 +989,7 @@ bool Viewport::CopyToClipboard()
     if( !m_clipboard ) return false;
     m_view->lock();
     m_clipboardClip = m_selection->GetSelection();
+    m_clipboardOrientation = m_view->GetOrientation();
     m_view->unlock();
 
     static constexpr WaylandDataSource::Listener listener = {
@@ -943,7 +1003,7 @@ bool Viewport::CopyToClipboard()
         mime.emplace_back( "application/x-kde-suggestedfilename" );
         m_clipboardOrigin = m_origin;
     }
-    if( m_clipboard->Format() == SdrFormat )
+    if( m_clipboard->Format() != HdrFormat )
     {
         mime.emplace_back( "image/png" );
     }
@@ -963,15 +1023,17 @@ void Viewport::CutSelection()
 
     const auto sel = m_clipboardClip;
 
-    if( m_clipboard->Format() == SdrFormat )
+    if( m_clipboard->Format() != HdrFormat )
     {
         auto bmp = m_clipboard->ReadbackSdr( *m_device );
+        bmp->SetOrientation( m_clipboardOrientation );
         bmp->FillBlack( sel.offset.x, sel.offset.y, sel.extent.width, sel.extent.height );
         m_view->SetBitmap( bmp, *m_td, false );
     }
     else
     {
         auto half = m_clipboard->ReadbackHdr( *m_device );
+        half->SetOrientation( m_clipboardOrientation );
         half->FillBlack( sel.offset.x, sel.offset.y, sel.extent.width, sel.extent.height );
         auto hdr = std::make_shared<BitmapHdr>( *half );
         m_view->SetBitmap( hdr, *m_td, false );
@@ -995,16 +1057,24 @@ void Viewport::ImageHandler( int64_t id, ImageProvider::Result result, const Ima
         {
             // must not lock m_view here
             m_view->SetBitmap( data.bitmap, *m_td, true );
-            width = data.bitmap->Width();
-            height = data.bitmap->Height();
+            width = data.bitmap->OrientedWidth();
+            height = data.bitmap->OrientedHeight();
+            m_window->EnableHdr( false );
+        }
+        else if( data.compressed )
+        {
+            // must not lock m_view here
+            m_view->SetBitmap( data.compressed, *m_td, true );
+            width = data.compressed->Width();
+            height = data.compressed->Height();
             m_window->EnableHdr( false );
         }
         else
         {
             // must not lock m_view here
             m_view->SetBitmap( data.bitmapHdr, *m_td, true );
-            width = data.bitmapHdr->Width();
-            height = data.bitmapHdr->Height();
+            width = data.bitmapHdr->OrientedWidth();
+            height = data.bitmapHdr->OrientedHeight();
             m_window->EnableHdr( true );
         }
 
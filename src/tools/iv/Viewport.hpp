@@ -76,6 +76,7 @@ private:
     [[nodiscard]] std::vector<std::string> ListDirectory( const std::string& path );
 
     void SetFileList( std::vector<std::string>&& fileList, const std::string& origin );
+    void PrefetchNeighbors();
 
     WaylandDisplay& m_display;
     VlkInstance& m_vkInstance;
@@ -95,6 +96,7 @@ private:
     std::shared_ptr<Texture> m_clipboard;
     std::string m_clipboardOrigin;
     VkRect2D m_clipboardClip;
+    int m_clipboardOrientation;
 
     uint64_t m_lastTime = 0;
     bool m_render = true;
@@ -104,6 +106,10 @@ private:
     std::vector<std::string> m_fileList;
     size_t m_fileIndex = 0;
 
+    ImageProvider::CacheConfig m_cacheConfig;
+    std::vector<std::pair<std::string, int64_t>> m_prefetch;
+    bool m_prefetchHdr = false;
+
     std::recursive_mutex m_lock;
     bool m_isBusy = false;
     int m_currentJob = -1;
@@ -30,6 +30,7 @@ static void PrintHelp()
 int main( int argc, char** argv )
 {
     signal( SIGPIPE, SIG_IGN );
+    SetLogAsync( true );
 
 #ifdef NDEBUG
     SetLogLevel( LogLevel::Warning );
@@ -11,10 +11,7 @@ layout(push_constant) uniform PushConstants {
 vec4 filteredNearest(sampler2D tex, vec2 coord)
 {
     vec2 texSize = vec2( textureSize( tex, 0 ) );
-    vec2 delta = vec2(
-        dFdx( coord.x ) * texSize.x,
-        dFdy( coord.y ) * texSize.y
-    );
+    vec2 delta = ( abs( dFdx( coord ) ) + abs( dFdy( coord ) ) ) * texSize;
     coord = coord * texSize + 0.5;
     vec2 i = floor( coord );
     vec2 f = fract( coord );
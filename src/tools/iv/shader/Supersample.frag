@@ -12,18 +12,19 @@ layout(push_constant) uniform PushConstants {
 
 void main()
 {
-    float texDelta = 1.0 / textureSize( tex, 0 ).x;
-    float dx = dFdx(outTexCoord.x);
-    float dy = dFdy(outTexCoord.y);
+    // Texture axes may be rotated or mirrored relative to the screen
+    vec2 dx = dFdx(outTexCoord);
+    vec2 dy = dFdy(outTexCoord);
+    float texels = length( dx * vec2( textureSize( tex, 0 ) ) );
 
-    const float mul = min( 1.0, ( dx - texDelta ) / ( texDelta * 0.25 ) );
+    const float mul = min( 1.0, ( texels - 1.0 ) / 0.25 );
     const vec2 off = vec2( 0.125, 0.375 ) * mul;
 
     vec4 acc = vec4(0.0);
-    acc += texture(tex, outTexCoord + vec2( dx * off.x,  dy * off.y));
-    acc += texture(tex, outTexCoord + vec2(-dx * off.x, -dy * off.y));
-    acc += texture(tex, outTexCoord + vec2( dx * off.y, -dy * off.x));
-    acc += texture(tex, outTexCoord + vec2(-dx * off.y,  dy * off.x));
+    acc += texture(tex, outTexCoord + dx * off.x + dy * off.y);
+    acc += texture(tex, outTexCoord - dx * off.x - dy * off.y);
+    acc += texture(tex, outTexCoord + dx * off.y - dy * off.x);
+    acc += texture(tex, outTexCoord - dx * off.y + dy * off.x);
     outColor = acc * 0.25;
 
     if( outColor.a < 1.0 )
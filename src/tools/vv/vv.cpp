@@ -24,6 +24,7 @@
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
+#include "util/StripPipeline.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
 #include "util/VectorImage.hpp"
@@ -57,9 +58,32 @@ enum class ScaleMode
     Scale2x,
 };
 
-static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapAnim>& anim, const std::unique_ptr<VectorImage>& vector, TaskDispatch& td, uint32_t col, uint32_t row, ScaleMode scale )
+static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapAnim>& anim, std::unique_ptr<StripSource>& strips, const std::unique_ptr<VectorImage>& vector, ToneMap::Operator tonemap, TaskDispatch& td, uint32_t col, uint32_t row, ScaleMode scale )
 {
-    if( anim )
+    if( strips )
+    {
+        const auto w = strips->Width();
+        const auto h = strips->Height();
+
+        StripPipeline pipeline( *strips, tonemap, &td );
+        if( scale == ScaleMode::Fit || w > col || h > row )
+        {
+            const auto ratio = std::min( float( col ) / w, float( row ) / h );
+            bitmap = pipeline.Process( w * ratio, h * ratio );
+            mclog( LogLevel::Info, "Image resized: %ux%u", bitmap->Width(), bitmap->Height() );
+        }
+        else if( scale == ScaleMode::Scale2x && w * 2 <= col && h * 2 <= row )
+        {
+            bitmap = pipeline.Process( w * 2, h * 2 );
+            mclog( LogLevel::Info, "Image upscaled: %ux%u", bitmap->Width(), bitmap->Height() );
+        }
+        else
+        {
+            bitmap = pipeline.Process();
+        }
+        strips.reset();
+    }
+    else if( anim )
     {
         const auto& bmp = anim->GetFrame( 0 ).bmp;
         const auto w = bmp->Width();
@@ -81,10 +105,9 @@ static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<Bitma
     }
     else if( bitmap )
     {
-        bitmap->NormalizeOrientation();
-
-        const auto w = bitmap->Width();
-        const auto h = bitmap->Height();
+        // Resize applies the orientation to the scaled image
+        const auto w = bitmap->OrientedWidth();
+        const auto h = bitmap->OrientedHeight();
 
         if( scale == ScaleMode::Fit || w > col || h > row )
         {
@@ -97,6 +120,10 @@ static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<Bitma
             bitmap->Resize( w * 2, h * 2, &td );
             mclog( LogLevel::Info, "Image upscaled: %ux%u", bitmap->Width(), bitmap->Height() );
         }
+        else
+        {
+            bitmap->NormalizeOrientation( &td );
+        }
     }
     else
     {
@@ -459,13 +486,33 @@ int main( int argc, char** argv )
     const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
     TaskDispatch td( workerThreads, "Worker" );
 
+    struct winsize ws;
+    ioctl( 0, TIOCGWINSZ, &ws );
+    mclog( LogLevel::Info, "Terminal size: %dx%d", ws.ws_col, ws.ws_row );
+
+    // Decode size hint. Pixel graphics modes may still fall back to block mode, which needs less.
+    uint32_t hintWidth = 0;
+    uint32_t hintHeight = 0;
+    if( gfxMode == GfxMode::Block )
+    {
+        hintWidth = ws.ws_col;
+        hintHeight = std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2;
+    }
+    else if( gfxMode != GfxMode::WriteFile )
+    {
+        hintWidth = ws.ws_xpixel;
+        hintHeight = ws.ws_ypixel;
+    }
+
     const auto imageFileStr = ExpandHome( argv[optind] );
     const auto imageFile = imageFileStr.c_str();
     std::unique_ptr<Bitmap> bitmap;
     std::unique_ptr<BitmapAnim> anim;
+    std::unique_ptr<ImageLoader> stripsLoader;
+    std::unique_ptr<StripSource> strips;
     std::unique_ptr<VectorImage> vectorImage;
 
-    auto imageThread = std::thread( [&bitmap, &anim, &vectorImage, imageFile, disableAnimation, &td, tonemap] {
+    auto imageThread = std::thread( [&bitmap, &anim, &stripsLoader, &strips, &vectorImage, imageFile, disableAnimation, &td, tonemap, hintWidth, hintHeight] {
         mclog( LogLevel::Info, "Loading image %s", imageFile );
         auto loader = GetImageLoader( imageFile, tonemap, &td );
         if( loader )
@@ -477,26 +524,16 @@ int main( int argc, char** argv )
             else if( loader->IsHdr() && loader->PreferHdr() )
             {
                 auto hdr = loader->LoadHdr();
-                bitmap = std::make_unique<Bitmap>( hdr->Width(), hdr->Height() );
-
-                auto src = hdr->Data();
-                auto dst = bitmap->Data();
-                size_t sz = hdr->Width() * hdr->Height();
-                while( sz > 0 )
-                {
-                    const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                    td.Queue( [src, dst, chunk, tonemap] {
-                        ToneMap::Process( tonemap, (uint32_t*)dst, src, chunk );
-                    } );
-                    src += chunk * 4;
-                    dst += chunk * 4;
-                    sz -= chunk;
-                }
-                td.Sync();
+                bitmap = hdr->Tonemap( tonemap, &td );
+            }
+            else if( loader->IsHdr() && ( strips = loader->LoadStrips() ) )
+            {
+                // Tone mapping and resize are deferred until the output size is known
+                stripsLoader = std::move( loader );
             }
             else
             {
-                bitmap = loader->Load();
+                bitmap = loader->LoadScaled( hintWidth, hintHeight );
             }
         }
         if( anim )
@@ -504,6 +541,10 @@ int main( int argc, char** argv )
             mclog( LogLevel::Info, "Animated image with %zu frames", anim->FrameCount() );
             anim->NormalizeSize();
         }
+        else if( strips )
+        {
+            mclog( LogLevel::Info, "HDR image opened: %ux%u", strips->Width(), strips->Height() );
+        }
         else if( bitmap )
         {
             mclog( LogLevel::Info, "Image loaded: %ux%u", bitmap->Width(), bitmap->Height() );
@@ -518,10 +559,6 @@ int main( int argc, char** argv )
         }
     } );
 
-    struct winsize ws;
-    ioctl( 0, TIOCGWINSZ, &ws );
-    mclog( LogLevel::Info, "Terminal size: %dx%d", ws.ws_col, ws.ws_row );
-
     int cw, ch;
     if( gfxMode != GfxMode::Block && gfxMode != GfxMode::WriteFile )
     {
@@ -581,7 +618,7 @@ int main( int argc, char** argv )
     }
 
     imageThread.join();
-    if( !bitmap && !anim && !vectorImage )
+    if( !bitmap && !anim && !strips && !vectorImage )
     {
         mclog( LogLevel::Error, "Failed to load image %s", imageFile );
         return 1;
@@ -595,7 +632,7 @@ int main( int argc, char** argv )
         uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2;
 
         mclog( LogLevel::Info, "Virtual pixels: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, td, col, row, scale );
+        AdjustBitmap( bitmap, anim, strips, vectorImage, tonemap, td, col, row, scale );
 
         if( anim )
         {
@@ -642,7 +679,7 @@ int main( int argc, char** argv )
         uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
 
         mclog( LogLevel::Info, "Pixels available: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, td, col, row, scale );
+        AdjustBitmap( bitmap, anim, strips, vectorImage, tonemap, td, col, row, scale );
 
         if( bg >= 0 ) FillBackground( *bitmap, bg );
         else if( bg == -1 ) FillCheckerboard( *bitmap );
@@ -667,7 +704,7 @@ int main( int argc, char** argv )
         uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
 
         mclog( LogLevel::Info, "Pixels available: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, td, col, row, scale );
+        AdjustBitmap( bitmap, anim, strips, vectorImage, tonemap, td, col, row, scale );
 
         if( anim )
         {
@@ -728,6 +765,10 @@ int main( int argc, char** argv )
         {
             img = anim->GetFrame( 0 ).bmp;
         }
+        else if( strips )
+        {
+            img = StripPipeline( *strips, tonemap, &td ).Process();
+        }
         else if( bitmap )
         {
             img.reset( bitmap.release() );
@@ -741,7 +782,7 @@ int main( int argc, char** argv )
         if( bg >= 0 ) FillBackground( *img, bg );
         else if( bg == -1 ) FillCheckerboard( *img );
 
-        img->SavePng( writeFn );
+        img->SavePng( writeFn, PngEncoder::Level::Default, &td );
     }
     else
     {
@@ -1,21 +1,17 @@
 #include <stb_image_resize2.h>
-#include <errno.h>
-#include <png.h>
+#include <stdio.h>
 #include <string.h>
 #include <tracy/Tracy.hpp>
-#include <unistd.h>
 #include <utility>
 
 #include "Alloca.h"
 #include "Bitmap.hpp"
 #include "Panic.hpp"
 #include "PixelBytes.hpp"
+#include "PixelKernels.hpp"
+#include "PixelTransform.hpp"
 #include "TaskDispatch.hpp"
 
-#if defined __SSE2__
-#  include <x86intrin.h>
-#endif
-
 Bitmap::Bitmap( uint32_t width, uint32_t height, int orientation )
     : m_width( width )
     , m_height( height )
@@ -24,18 +20,29 @@ Bitmap::Bitmap( uint32_t width, uint32_t height, int orientation )
 {
 }
 
+Bitmap::Bitmap( uint32_t width, uint32_t height, uint8_t* data, std::function<void( uint8_t* )> release, int orientation )
+    : m_width( width )
+    , m_height( height )
+    , m_data( data )
+    , m_release( std::move( release ) )
+    , m_orientation( orientation )
+{
+}
+
 Bitmap::~Bitmap()
 {
-    delete[] m_data;
+    SetData( nullptr );
 }
 
 Bitmap::Bitmap( Bitmap&& other ) noexcept
     : m_width( other.m_width )
     , m_height( other.m_height )
     , m_data( other.m_data )
+    , m_release( std::move( other.m_release ) )
     , m_orientation( other.m_orientation )
 {
     other.m_data = nullptr;
+    other.m_release = nullptr;
 }
 
 Bitmap& Bitmap::operator=( Bitmap&& other ) noexcept
@@ -43,12 +50,15 @@ Bitmap& Bitmap::operator=( Bitmap&& other ) noexcept
     std::swap( m_width, other.m_width );
     std::swap( m_height, other.m_height );
     std::swap( m_data, other.m_data );
+    std::swap( m_release, other.m_release );
     std::swap( m_orientation, other.m_orientation );
     return *this;
 }
 
 void Bitmap::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
 {
+    // Resampled in stored layout, so that only the result needs to be reoriented
+    if( PixelTransform::SwapsAxes( m_orientation ) ) std::swap( width, height );
     auto newData = PixelAlloc<uint8_t>( width, height );
     STBIR_RESIZE resize;
     stbir_resize_init( &resize, m_data, m_width, m_height, 0, newData, width, height, 0, STBIR_RGBA, STBIR_TYPE_UINT8_SRGB );
@@ -71,14 +81,15 @@ void Bitmap::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
     {
         CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
     }
-    delete[] m_data;
-    m_data = newData;
+    SetData( newData );
     m_width = width;
     m_height = height;
+    NormalizeOrientation( td );
 }
 
 std::unique_ptr<Bitmap> Bitmap::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td ) const
 {
+    if( PixelTransform::SwapsAxes( m_orientation ) ) std::swap( width, height );
     auto ret = std::make_unique<Bitmap>( width, height, m_orientation );
     STBIR_RESIZE resize;
     stbir_resize_init( &resize, m_data, m_width, m_height, 0, ret->m_data, width, height, 0, STBIR_RGBA, STBIR_TYPE_UINT8_SRGB );
@@ -101,11 +112,14 @@ std::unique_ptr<Bitmap> Bitmap::ResizeNew( uint32_t width, uint32_t height, Task
     {
         CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
     }
+    ret->NormalizeOrientation( td );
     return ret;
 }
 
 void Bitmap::Extend( uint32_t width, uint32_t height )
 {
+    // Padding goes to the right and bottom of the upright image
+    NormalizeOrientation();
     CheckPanic( width >= m_width && height >= m_height, "Invalid extension" );
 
     auto data = PixelAlloc<uint8_t>( width, height );
@@ -124,15 +138,15 @@ void Bitmap::Extend( uint32_t width, uint32_t height )
     }
     memset( dst, 0, PixelChannelCount( width, height - m_height ) );
 
-    delete[] m_data;
-    m_data = data;
+    SetData( data );
     m_width = width;
     m_height = height;
 }
 
 void Bitmap::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
 {
-    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
+    CheckPanic( x + width <= OrientedWidth() && y + height <= OrientedHeight(), "Invalid crop" );
+    PixelTransform::MapRect( m_orientation, m_width, m_height, x, y, width, height );
 
     auto data = PixelAlloc<uint8_t>( width, height );
     auto dst = data;
@@ -145,15 +159,15 @@ void Bitmap::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
         dst += width * 4;
     }
 
-    delete[] m_data;
-    m_data = data;
+    SetData( data );
     m_width = width;
     m_height = height;
 }
 
 void Bitmap::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
 {
-    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid fill" );
+    CheckPanic( x + width <= OrientedWidth() && y + height <= OrientedHeight(), "Invalid fill" );
+    PixelTransform::MapRect( m_orientation, m_width, m_height, x, y, width, height );
 
     constexpr uint32_t black = 0xff000000;
     auto row = (uint32_t*)( m_data + ( size_t( y ) * m_width + x ) * 4 );
@@ -165,213 +179,72 @@ void Bitmap::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height
     }
 }
 
-void Bitmap::FlipVertical()
+void Bitmap::FlipVertical( TaskDispatch* td )
 {
-    auto ptr1 = m_data;
-    auto ptr2 = m_data + size_t( m_height - 1 ) * m_width * 4;
-    auto tmp = PixelAlloc<uint8_t>( m_width, 1 );
-
-    for( uint32_t y=0; y<m_height/2; y++ )
-    {
-        memcpy( tmp, ptr1, m_width * 4 );
-        memcpy( ptr1, ptr2, m_width * 4 );
-        memcpy( ptr2, tmp, m_width * 4 );
-        ptr1 += m_width * 4;
-        ptr2 -= m_width * 4;
-    }
-
-    delete[] tmp;
+    PixelTransform::FlipVertical( m_data, m_width, m_height, 4, td );
 }
 
-void Bitmap::FlipHorizontal()
+void Bitmap::FlipHorizontal( TaskDispatch* td )
 {
-    auto ptr = (uint32_t*)m_data;
-
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        auto ptr1 = ptr;
-        auto ptr2 = ptr + m_width - 1;
-
-        for( uint32_t x=0; x<m_width/2; x++ )
-        {
-            std::swap( *ptr1++, *ptr2-- );
-        }
-
-        ptr += m_width;
-    }
+    PixelTransform::FlipHorizontal( m_data, m_width, m_height, 4, td );
 }
 
-void Bitmap::Rotate90()
+void Bitmap::Rotate90( TaskDispatch* td )
 {
-    auto tmp = PixelAlloc<uint8_t>( m_width, m_height );
-
-    auto src = (uint32_t*)m_data;
-    auto dst = (uint32_t*)tmp;
-
-    for( size_t y=0; y<m_height; y++ )
-    {
-        for( size_t x=0; x<m_width; x++ )
-        {
-            dst[x * m_height + m_height - y - 1] = src[y * m_width + x];
-        }
-    }
-
-    delete[] m_data;
-    m_data = tmp;
-    std::swap( m_width, m_height );
+    Reorient( PixelTransform::Rotate90, td );
 }
 
-void Bitmap::Rotate180()
+void Bitmap::Rotate180( TaskDispatch* td )
 {
-    auto ptr1 = (uint32_t*)m_data;
-    auto ptr2 = (uint32_t*)m_data + PixelCount( m_width, m_height ) - 1;
-
-    for( size_t i=0; i<PixelCount( m_width, m_height ) / 2; i++ )
-    {
-        std::swap( *ptr1++, *ptr2-- );
-    }
+    PixelTransform::Rotate180( m_data, m_width, m_height, 4, td );
 }
 
-void Bitmap::Rotate270()
+void Bitmap::Rotate270( TaskDispatch* td )
 {
-    auto tmp = PixelAlloc<uint8_t>( m_width, m_height );
-
-    auto src = (uint32_t*)m_data;
-    auto dst = (uint32_t*)tmp;
+    Reorient( PixelTransform::Rotate270, td );
+}
 
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        for( uint32_t x=0; x<m_width; x++ )
-        {
-            dst[size_t( m_width - x - 1 ) * m_height + y] = src[size_t( y ) * m_width + x];
-        }
-    }
+void Bitmap::Transpose( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Transpose, td );
+}
 
-    delete[] m_data;
-    m_data = tmp;
-    std::swap( m_width, m_height );
+void Bitmap::Transverse( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Transverse, td );
 }
 
 void Bitmap::SetAlpha( uint8_t alpha )
 {
-    auto ptr = m_data;
-    size_t sz = PixelCount( m_width, m_height );
-
-    if( alpha == 0xFF )
-    {
-#ifdef __AVX512F__
-        const auto alpha16 = _mm512_set1_epi32( alpha << 24 );
-        while( sz >= 16 )
-        {
-            auto v = _mm512_loadu_si512( ptr );
-            v = _mm512_or_si512( v, alpha16 );
-            _mm512_storeu_si512( ptr, v );
-            ptr += 16 * 4;
-            sz -= 16;
-        }
-#endif
-#ifdef __AVX2__
-        const auto alpha8 = _mm256_set1_epi32( alpha << 24 );
-        while( sz >= 8 )
-        {
-            auto v = _mm256_loadu_si256( (const __m256i*)ptr );
-            v = _mm256_or_si256( v, alpha8 );
-            _mm256_storeu_si256( (__m256i*)ptr, v );
-            ptr += 8 * 4;
-            sz -= 8;
-        }
-#endif
-#ifdef __SSE2__
-        const auto alpha4 = _mm_set1_epi32( alpha << 24 );
-        while( sz >= 4 )
-        {
-            auto v = _mm_loadu_si128( (const __m128i*)ptr );
-            v = _mm_or_si128( v, alpha4 );
-            _mm_storeu_si128( (__m128i*)ptr, v );
-            ptr += 4 * 4;
-            sz -= 4;
-        }
-#endif
-    }
-    else
-    {
-#ifdef __AVX512F__
-        const auto alpha16 = _mm512_set1_epi32( alpha << 24 );
-        const auto mask16 = _mm512_set1_epi32( 0x00FFFFFF );
-        while( sz >= 16 )
-        {
-            auto v = _mm512_loadu_si512( ptr );
-            v = _mm512_and_si512( v, mask16 );
-            v = _mm512_or_si512( v, alpha16 );
-            _mm512_storeu_si512( ptr, v );
-            ptr += 16 * 4;
-            sz -= 16;
-        }
-#endif
-#ifdef __AVX2__
-        const auto alpha8 = _mm256_set1_epi32( alpha << 24 );
-        const auto mask8 = _mm256_set1_epi32( 0x00FFFFFF );
-        while( sz >= 8 )
-        {
-            auto v = _mm256_loadu_si256( (const __m256i*)ptr );
-            v = _mm256_and_si256( v, mask8 );
-            v = _mm256_or_si256( v, alpha8 );
-            _mm256_storeu_si256( (__m256i*)ptr, v );
-            ptr += 8 * 4;
-            sz -= 8;
-        }
-#endif
-#ifdef __SSE2__
-        const auto alpha4 = _mm_set1_epi32( alpha << 24 );
-        const auto mask4 = _mm_set1_epi32( 0x00FFFFFF );
-        while( sz >= 4 )
-        {
-            auto v = _mm_loadu_si128( (const __m128i*)ptr );
-            v = _mm_and_si128( v, mask4 );
-            v = _mm_or_si128( v, alpha4 );
-            _mm_storeu_si128( (__m128i*)ptr, v );
-            ptr += 4 * 4;
-            sz -= 4;
-        }
-#endif
-    }
-
-    ptr += 3;
-    while( sz-- )
-    {
-        memset( ptr, alpha, 1 );
-        ptr += 4;
-    }
+    PixelKernels::SetAlpha( (uint32_t*)m_data, PixelCount( m_width, m_height ), alpha );
 }
 
-void Bitmap::NormalizeOrientation()
+void Bitmap::NormalizeOrientation( TaskDispatch* td )
 {
     if( m_orientation <= 1 ) return;
 
     switch( m_orientation )
     {
     case 2:
-        FlipHorizontal();
+        FlipHorizontal( td );
         break;
     case 3:
-        Rotate180();
+        Rotate180( td );
         break;
     case 4:
-        FlipVertical();
+        FlipVertical( td );
         break;
     case 5:
-        Rotate270();
-        FlipVertical();
+        Transpose( td );
         break;
     case 6:
-        Rotate90();
+        Rotate90( td );
         break;
     case 7:
-        Rotate90();
-        FlipVertical();
+        Transverse( td );
         break;
     case 8:
-        Rotate270();
+        Rotate270( td );
         break;
     default:
         Panic( "Invalid orientation value!" );
@@ -382,57 +255,10 @@ void Bitmap::NormalizeOrientation()
 
 void Bitmap::BgrToRgb()
 {
-    auto sz = PixelCount( m_width, m_height );
-    auto ptr = (uint32_t*)m_data;
-
-#ifdef __AVX512F__
-    while( sz >= 16 )
-    {
-        __m512i v = _mm512_loadu_si512( ptr );
-        v = _mm512_shuffle_epi8( v, _mm512_set_epi64(
-            0x3f3c3d3e3b38393a, 0x3734353633303132,
-            0x2f2c2d2e2b28292a, 0x2724252623202122,
-            0x1f1c1d1e1b18191a, 0x1714151613101112,
-            0x0f0c0d0e0b08090a, 0x0704050603000102
-        ) );
-        _mm512_storeu_si512( ptr, v );
-        ptr += 16;
-        sz -= 16;
-    }
-#endif
-#ifdef __AVX2__
-    while( sz >= 8 )
-    {
-        __m256i v = _mm256_loadu_si256( (const __m256i*)ptr );
-        v = _mm256_shuffle_epi8( v, _mm256_set_epi64x(
-            0x1f1c1d1e1b18191a, 0x1714151613101112,
-            0x0f0c0d0e0b08090a, 0x0704050603000102
-        ) );
-        _mm256_storeu_si256( (__m256i*)ptr, v );
-        ptr += 8;
-        sz -= 8;
-    }
-#endif
-#ifdef __SSSE3__
-    while( sz >= 4 )
-    {
-        __m128i v = _mm_loadu_si128( (const __m128i*)ptr );
-        v = _mm_shuffle_epi8( v, _mm_set_epi64x( 0x0f0c0d0e0b08090a, 0x0704050603000102 ) );
-        _mm_storeu_si128( (__m128i*)ptr, v );
-        ptr += 4;
-        sz -= 4;
-    }
-#endif
-
-    while( sz-- )
-    {
-        uint32_t v = *ptr;
-        v = (v & 0xff00ff00) | ((v & 0x00ff0000) >> 16) | ((v & 0x000000ff) << 16);
-        *ptr++ = v;
-    }
+    PixelKernels::BgrToRgb( (uint32_t*)m_data, PixelCount( m_width, m_height ) );
 }
 
-bool Bitmap::SavePng( const char* path ) const
+bool Bitmap::SavePng( const char* path, PngEncoder::Level level, TaskDispatch* td ) const
 {
     FILE* f = fopen( path, "wb" );
     if( !f )
@@ -442,53 +268,46 @@ bool Bitmap::SavePng( const char* path ) const
     }
 
     mclog( LogLevel::Info, "Saving PNG: %s", path );
-    auto res = SavePng( fileno( f ) );
+    auto res = SavePng( fileno( f ), level, td );
     fclose( f );
 
     return res;
 }
 
-bool Bitmap::SavePng( int fd ) const
+bool Bitmap::SavePng( int fd, PngEncoder::Level level, TaskDispatch* td ) const
 {
     ZoneScoped;
 
-    png_structp png_ptr = png_create_write_struct( PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr );
-    png_infop info_ptr = png_create_info_struct( png_ptr );
-    if( setjmp( png_jmpbuf( png_ptr ) ) )
+    auto ptr = (const uint32_t*)m_data;
+    PixelBuffer<uint32_t> oriented;
+    if( m_orientation > 1 )
     {
-        png_destroy_write_struct( &png_ptr, &info_ptr );
-        return false;
+        oriented.reset( PixelAlloc<uint32_t>( m_width, m_height, 1 ) );
+        PixelTransform::Orient( oriented.get(), m_data, m_width, m_height, 4, m_orientation, td );
+        ptr = oriented.get();
     }
 
-    png_set_write_fn( png_ptr, (png_voidp)(ptrdiff_t)fd, []( png_structp png, png_bytep data, size_t length ) {
-        auto ioPtr = (int)(ptrdiff_t)png_get_io_ptr( png );
-        while( length > 0 )
-        {
-            auto cnt = write( ioPtr, data, length );
-            if( cnt < 0 )
-            {
-                if( errno == EINTR ) continue;
-                png_error( png, "Write error" );
-            }
-            if( cnt == 0 ) png_error( png, "Zero-length write" );
-            data += cnt;
-            length -= cnt;
-        }
-    }, nullptr );
-
-    png_set_IHDR( png_ptr, info_ptr, m_width, m_height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE );
-
-    png_write_info( png_ptr, info_ptr );
+    return PngEncoder::Write( fd, ptr, OrientedWidth(), OrientedHeight(), level, td );
+}
 
-    auto ptr = (uint32_t*)m_data;
-    for( int i=0; i<m_height; i++ )
+void Bitmap::SetData( uint8_t* data )
+{
+    if( m_release )
     {
-        png_write_rows( png_ptr, (png_bytepp)(&ptr), 1 );
-        ptr += m_width;
+        m_release( m_data );
+        m_release = nullptr;
     }
+    else
+    {
+        PixelFree( m_data );
+    }
+    m_data = data;
+}
 
-    png_write_end( png_ptr, info_ptr );
-    png_destroy_write_struct( &png_ptr, &info_ptr );
-
-    return true;
+void Bitmap::Reorient( void( *fn )( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* ), TaskDispatch* td )
+{
+    auto tmp = PixelAlloc<uint8_t>( m_width, m_height );
+    fn( tmp, m_data, m_width, m_height, 4, td );
+    SetData( tmp );
+    std::swap( m_width, m_height );
 }
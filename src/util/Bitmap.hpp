@@ -1,14 +1,20 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 
+#include "PngEncoder.hpp"
+
 class TaskDispatch;
 
 class Bitmap
 {
 public:
     Bitmap( uint32_t width, uint32_t height, int orientation = 0 );
+    // Adopts pixel data allocated elsewhere, for example by a decoder library. The data is freed
+    // with the release function, instead of PixelFree.
+    Bitmap( uint32_t width, uint32_t height, uint8_t* data, std::function<void( uint8_t* )> release, int orientation = 0 );
     ~Bitmap();
 
     Bitmap( const Bitmap& ) = delete;
@@ -16,34 +22,46 @@ public:
     Bitmap& operator=( const Bitmap& ) = delete;
     Bitmap& operator=( Bitmap&& other ) noexcept;
 
+    // Orientation is applied lazily. Resizes take upright dimensions and produce an upright image,
+    // crops and fills take upright coordinates, and saved files are upright. Stored pixel data is
+    // only reoriented by NormalizeOrientation, Extend, or the explicit transforms.
     void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
     [[nodiscard]] std::unique_ptr<Bitmap> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr ) const;
     void Extend( uint32_t width, uint32_t height );
     void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
     void FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
     void SetAlpha( uint8_t alpha );
-    void NormalizeOrientation();
+    void NormalizeOrientation( TaskDispatch* td = nullptr );
+    void SetOrientation( int orientation ) { m_orientation = orientation; }
     void BgrToRgb();
 
-    void FlipVertical();
-    void FlipHorizontal();
-    void Rotate90();
-    void Rotate180();
-    void Rotate270();
+    void FlipVertical( TaskDispatch* td = nullptr );
+    void FlipHorizontal( TaskDispatch* td = nullptr );
+    void Rotate90( TaskDispatch* td = nullptr );
+    void Rotate180( TaskDispatch* td = nullptr );
+    void Rotate270( TaskDispatch* td = nullptr );
+    void Transpose( TaskDispatch* td = nullptr );
+    void Transverse( TaskDispatch* td = nullptr );
 
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
     [[nodiscard]] uint8_t* Data() { return m_data; }
     [[nodiscard]] const uint8_t* Data() const { return m_data; }
     [[nodiscard]] int Orientation() const { return m_orientation; }
+    [[nodiscard]] uint32_t OrientedWidth() const { return m_orientation >= 5 ? m_height : m_width; }
+    [[nodiscard]] uint32_t OrientedHeight() const { return m_orientation >= 5 ? m_width : m_height; }
 
-    bool SavePng( const char* path ) const;
-    bool SavePng( int fd ) const;
+    bool SavePng( const char* path, PngEncoder::Level level = PngEncoder::Level::Default, TaskDispatch* td = nullptr ) const;
+    bool SavePng( int fd, PngEncoder::Level level = PngEncoder::Level::Default, TaskDispatch* td = nullptr ) const;
 
 private:
+    void SetData( uint8_t* data );
+    void Reorient( void( *fn )( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* ), TaskDispatch* td );
+
     uint32_t m_width;
     uint32_t m_height;
     uint8_t* m_data;
+    std::function<void( uint8_t* )> m_release;
 
     int m_orientation;
 };
@@ -1,13 +1,8 @@
 #include <cmath>
-#include <lcms2.h>
 #include <stb_image_resize2.h>
 #include <string.h>
 #include <tracy/Tracy.hpp>
 
-#if defined __F16C__
-#  include <x86intrin.h>
-#endif
-
 #include "contrib/half.hpp"
 
 #include "Bitmap.hpp"
@@ -16,42 +11,14 @@
 #include "Logs.hpp"
 #include "Panic.hpp"
 #include "PixelBytes.hpp"
-#include "Simd.hpp"
+#include "PixelKernels.hpp"
+#include "PixelTransform.hpp"
 #include "TaskDispatch.hpp"
 
 static void HalfToFloat( const half_float::half* src, float* dst, size_t sz )
 {
     ZoneScoped;
-
-#ifdef __F16C__
-  #ifdef __AVX512F__
-    while( sz >= 16 )
-    {
-        __m256i h = _mm256_loadu_si256( (__m256i*)src );
-        __m512 f = _mm512_cvtph_ps( h );
-        _mm512_storeu_ps( dst, f );
-        src += 16;
-        dst += 16;
-        sz -= 16;
-    }
-  #endif
-  #ifdef __AVX2__
-    while( sz >= 8 )
-    {
-        __m128i h = _mm_loadu_si128( (__m128i*)src );
-        __m256 f = _mm256_cvtph_ps( h );
-        _mm256_storeu_ps( dst, f );
-        src += 8;
-        dst += 8;
-        sz -= 8;
-    }
-  #endif
-#endif
-
-    while( sz-- > 0 )
-    {
-        *dst++ = *src++;
-    }
+    PixelKernels::HalfToFloat( (const uint16_t*)src, dst, sz );
 }
 
 BitmapHdr::BitmapHdr( const BitmapHdrHalf& bmp )
@@ -77,13 +44,24 @@ BitmapHdr::BitmapHdr( uint32_t width, uint32_t height, Colorspace colorspace, in
 {
 }
 
+BitmapHdr::BitmapHdr( uint32_t width, uint32_t height, Colorspace colorspace, float* data, std::function<void( float* )> release, int orientation )
+    : m_width( width )
+    , m_height( height )
+    , m_data( data )
+    , m_release( std::move( release ) )
+    , m_colorspace( colorspace )
+    , m_orientation( orientation )
+{
+}
+
 BitmapHdr::~BitmapHdr()
 {
-    delete[] m_data;
+    SetData( nullptr );
 }
 
 void BitmapHdr::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
 {
+    if( PixelTransform::SwapsAxes( m_orientation ) ) std::swap( width, height );
     auto newData = PixelAlloc<float>( width, height );
     STBIR_RESIZE resize;
     stbir_resize_init( &resize, m_data, m_width, m_height, 0, newData, width, height, 0, STBIR_RGBA, STBIR_TYPE_FLOAT );
@@ -106,14 +84,15 @@ void BitmapHdr::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
     {
         CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
     }
-    delete[] m_data;
-    m_data = newData;
+    SetData( newData );
     m_width = width;
     m_height = height;
+    NormalizeOrientation( td );
 }
 
 std::unique_ptr<BitmapHdr> BitmapHdr::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td ) const
 {
+    if( PixelTransform::SwapsAxes( m_orientation ) ) std::swap( width, height );
     auto ret = std::make_unique<BitmapHdr>( width, height, m_colorspace, m_orientation );
     STBIR_RESIZE resize;
     stbir_resize_init( &resize, m_data, m_width, m_height, 0, ret->m_data, width, height, 0, STBIR_RGBA, STBIR_TYPE_FLOAT );
@@ -136,12 +115,14 @@ std::unique_ptr<BitmapHdr> BitmapHdr::ResizeNew( uint32_t width, uint32_t height
     {
         CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
     }
+    ret->NormalizeOrientation( td );
     return ret;
 }
 
 void BitmapHdr::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
 {
-    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
+    CheckPanic( x + width <= OrientedWidth() && y + height <= OrientedHeight(), "Invalid crop" );
+    PixelTransform::MapRect( m_orientation, m_width, m_height, x, y, width, height );
 
     auto data = PixelAlloc<float>( width, height );
     auto dst = data;
@@ -154,75 +135,42 @@ void BitmapHdr::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
         dst += width * 4;
     }
 
-    delete[] m_data;
-    m_data = data;
+    SetData( data );
     m_width = width;
     m_height = height;
 }
 
 void BitmapHdr::SetAlpha( float alpha )
 {
-    auto ptr = m_data;
-    auto sz = PixelCount( m_width, m_height );
-
-#ifdef __AVX512F__
-    while( sz >= 4 )
-    {
-        __m512 px = _mm512_loadu_ps( ptr );
-        __m512 pxa = _mm512_mask_blend_ps( 0x8888, px, _mm512_set1_ps( alpha ) );
-        _mm512_storeu_ps( ptr, pxa );
-        ptr += 16;
-        sz -= 4;
-    }
-#endif
-
-#ifdef __AVX2__
-    while( sz >= 2 )
-    {
-        __m256 px = _mm256_loadu_ps( ptr );
-        __m256 pxa = _mm256_blend_ps( px, _mm256_set1_ps( alpha ), 0x88 );
-        _mm256_storeu_ps( ptr, pxa );
-        ptr += 8;
-        sz -= 2;
-    }
-#endif
-
-    ptr += 3;
-    while( sz-- )
-    {
-        *ptr = alpha;
-        ptr += 4;
-    }
+    PixelKernels::SetAlpha( m_data, PixelCount( m_width, m_height ), alpha );
 }
 
-void BitmapHdr::NormalizeOrientation()
+void BitmapHdr::NormalizeOrientation( TaskDispatch* td )
 {
     if( m_orientation <= 1 ) return;
 
     switch( m_orientation )
     {
     case 2:
-        FlipHorizontal();
+        FlipHorizontal( td );
         break;
     case 3:
-        Rotate180();
+        Rotate180( td );
         break;
     case 4:
-        FlipVertical();
+        FlipVertical( td );
         break;
     case 5:
-        Rotate270();
-        FlipVertical();
+        Transpose( td );
         break;
     case 6:
-        Rotate90();
+        Rotate90( td );
         break;
     case 7:
-        Rotate90();
-        FlipVertical();
+        Transverse( td );
         break;
     case 8:
-        Rotate270();
+        Rotate270( td );
         break;
     default:
         Panic( "Invalid orientation value!" );
@@ -239,162 +187,97 @@ void BitmapHdr::SetColorspace( Colorspace colorspace, TaskDispatch* td )
         return;
     }
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-    auto profile709 = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-    auto profile2020 = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
+    const auto& matrix = ColorMatrix::Get( m_colorspace, colorspace );
 
-    cmsHTRANSFORM transform;
-    if( m_colorspace == Colorspace::BT2020 && colorspace == Colorspace::BT709 )
-    {
-        transform = cmsCreateTransform( profile2020, TYPE_RGBA_FLT, profile709, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
-    }
-    else if( m_colorspace == Colorspace::BT709 && colorspace == Colorspace::BT2020 )
-    {
-        transform = cmsCreateTransform( profile709, TYPE_RGBA_FLT, profile2020, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
-    }
-    else
-    {
-        Panic( "Invalid colorspace transform!" );
-    }
-
-    auto sz = PixelCount( m_width, m_height );
+    const auto sz = PixelCount( m_width, m_height );
     auto ptr = m_data;
     if( td )
     {
-        while( sz > 0 )
-        {
-            auto chunk = std::min<size_t>( sz, 16 * 1024 );
-            td->Queue( [ptr, chunk, transform] {
-                cmsDoTransform( transform, ptr, ptr, chunk );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-        }
-        td->Sync();
+        td->ParallelFor( sz, td->Grain( sz, 4 * sizeof( float ) ), [ptr, &matrix]( size_t begin, size_t end ) {
+            matrix.Apply( ptr + begin * 4, end - begin );
+        } );
     }
     else
     {
-        while( sz > 0 )
-        {
-            auto chunk = std::min<size_t>( sz, UINT32_MAX );
-            cmsDoTransform( transform, ptr, ptr, chunk );
-            ptr += chunk * 4;
-            sz -= chunk;
-        }
+        matrix.Apply( ptr, sz );
     }
 
-    cmsDeleteTransform( transform );
-    cmsCloseProfile( profile709 );
-    cmsCloseProfile( profile2020 );
-    cmsFreeToneCurve( linear );
-
     m_colorspace = colorspace;
 }
 
-void BitmapHdr::FlipVertical()
+void BitmapHdr::FlipVertical( TaskDispatch* td )
 {
-    auto ptr1 = m_data;
-    auto ptr2 = m_data + size_t( m_height - 1 ) * m_width * 4;
-    auto tmp = PixelAlloc<float>( m_width, 1 );
-
-    for( uint32_t y=0; y<m_height/2; y++ )
-    {
-        memcpy( tmp, ptr1, m_width * 4 * 4 );
-        memcpy( ptr1, ptr2, m_width * 4 * 4 );
-        memcpy( ptr2, tmp, m_width * 4 * 4 );
-        ptr1 += m_width * 4;
-        ptr2 -= m_width * 4;
-    }
-
-    delete[] tmp;
+    PixelTransform::FlipVertical( m_data, m_width, m_height, 4 * sizeof( float ), td );
 }
 
-void BitmapHdr::FlipHorizontal()
+void BitmapHdr::FlipHorizontal( TaskDispatch* td )
 {
-    auto ptr = m_data;
-
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        auto ptr1 = ptr;
-        auto ptr2 = ptr + ( m_width - 1 ) * 4;
-
-        for( uint32_t x=0; x<m_width/2; x++ )
-        {
-            uint32_t tmp[4];
-            memcpy( tmp, ptr1, 4 * 4 );
-            memcpy( ptr1, ptr2, 4 * 4 );
-            memcpy( ptr2, tmp, 4 * 4 );
-            ptr1 += 4;
-            ptr2 -= 4;
-        }
-
-        ptr += m_width * 4;
-    }
+    PixelTransform::FlipHorizontal( m_data, m_width, m_height, 4 * sizeof( float ), td );
 }
 
-void BitmapHdr::Rotate90()
+void BitmapHdr::Rotate90( TaskDispatch* td )
 {
-    auto tmp = PixelAlloc<float>( m_width, m_height );
+    Reorient( PixelTransform::Rotate90, td );
+}
 
-    auto src = m_data;
-    auto dst = tmp;
+void BitmapHdr::Rotate180( TaskDispatch* td )
+{
+    PixelTransform::Rotate180( m_data, m_width, m_height, 4 * sizeof( float ), td );
+}
 
-    for( size_t y=0; y<m_height; y++ )
-    {
-        for( size_t x=0; x<m_width; x++ )
-        {
-            memcpy( dst + ( x * m_height + m_height - y - 1 ) * 4, src + ( y * m_width + x ) * 4, 4 * 4 );
-        }
-    }
+void BitmapHdr::Rotate270( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Rotate270, td );
+}
 
-    delete[] m_data;
-    m_data = tmp;
-    std::swap( m_width, m_height );
+void BitmapHdr::Transpose( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Transpose, td );
 }
 
-void BitmapHdr::Rotate180()
+void BitmapHdr::Transverse( TaskDispatch* td )
 {
-    auto ptr1 = m_data;
-    auto ptr2 = m_data + ( PixelCount( m_width, m_height ) - 1 ) * 4;
+    Reorient( PixelTransform::Transverse, td );
+}
 
-    for( size_t i=0; i<PixelCount( m_width, m_height ) / 2; i++ )
+std::unique_ptr<Bitmap> BitmapHdr::Tonemap( ToneMap::Operator op, TaskDispatch* td )
+{
+    ZoneScoped;
+    CheckPanic( m_colorspace == Colorspace::BT709, "Tone mapping requires BT.709 colorspace" );
+    auto bmp = std::make_unique<Bitmap>( m_width, m_height, m_orientation );
+    auto dst = (uint32_t*)bmp->Data();
+    const auto sz = PixelCount( m_width, m_height );
+    if( td )
+    {
+        td->ParallelFor( sz, td->Grain( sz, 4 * sizeof( float ) + sizeof( uint32_t ) ), [op, dst, src = m_data]( size_t begin, size_t end ) {
+            ToneMap::Process( op, dst + begin, src + begin * 4, end - begin );
+        } );
+    }
+    else
     {
-        uint32_t tmp[4];
-        memcpy( tmp, ptr1, 4 * 4 );
-        memcpy( ptr1, ptr2, 4 * 4 );
-        memcpy( ptr2, tmp, 4 * 4 );
-        ptr1 += 4;
-        ptr2 -= 4;
+        ToneMap::Process( op, dst, m_data, sz );
     }
+    return bmp;
 }
 
-void BitmapHdr::Rotate270()
+void BitmapHdr::SetData( float* data )
 {
-    auto tmp = PixelAlloc<float>( m_width, m_height );
-
-    auto src = m_data;
-    auto dst = tmp;
-
-    for( size_t y=0; y<m_height; y++ )
+    if( m_release )
     {
-        for( size_t x=0; x<m_width; x++ )
-        {
-            memcpy( dst + ( ( m_width - x - 1 ) * m_height + y ) * 4, src + ( y * m_width + x ) * 4, 4 * 4 );
-        }
+        m_release( m_data );
+        m_release = nullptr;
     }
-
-    delete[] m_data;
-    m_data = tmp;
-    std::swap( m_width, m_height );
+    else
+    {
+        PixelFree( m_data );
+    }
+    m_data = data;
 }
 
-std::unique_ptr<Bitmap> BitmapHdr::Tonemap( ToneMap::Operator op )
+void BitmapHdr::Reorient( void( *fn )( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* ), TaskDispatch* td )
 {
-    ZoneScoped;
-    CheckPanic( m_colorspace == Colorspace::BT709, "Tone mapping requires BT.709 colorspace" );
-    auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-    ToneMap::Process( op, (uint32_t*)bmp->Data(), m_data, PixelCount( m_width, m_height ) );
-    return bmp;
+    auto tmp = PixelAlloc<float>( m_width, m_height );
+    fn( tmp, m_data, m_width, m_height, 4 * sizeof( float ), td );
+    SetData( tmp );
+    std::swap( m_width, m_height );
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 
@@ -16,35 +17,47 @@ class BitmapHdr
 public:
     explicit BitmapHdr( const BitmapHdrHalf& bmp );
     BitmapHdr( uint32_t width, uint32_t height, Colorspace colorspace, int orientation = 0 );
+    // Adopts pixel data allocated elsewhere, freed with the release function instead of PixelFree
+    BitmapHdr( uint32_t width, uint32_t height, Colorspace colorspace, float* data, std::function<void( float* )> release, int orientation = 0 );
     ~BitmapHdr();
     NoCopy( BitmapHdr );
 
+    // Sizes and coordinates are upright, see Bitmap
     void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
     [[nodiscard]] std::unique_ptr<BitmapHdr> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr ) const;
     void SetAlpha( float alpha );
     void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
-    void NormalizeOrientation();
+    void NormalizeOrientation( TaskDispatch* td = nullptr );
+    void SetOrientation( int orientation ) { m_orientation = orientation; }
     void SetColorspace( Colorspace colorspace, TaskDispatch* td = nullptr );
 
-    void FlipVertical();
-    void FlipHorizontal();
-    void Rotate90();
-    void Rotate180();
-    void Rotate270();
+    void FlipVertical( TaskDispatch* td = nullptr );
+    void FlipHorizontal( TaskDispatch* td = nullptr );
+    void Rotate90( TaskDispatch* td = nullptr );
+    void Rotate180( TaskDispatch* td = nullptr );
+    void Rotate270( TaskDispatch* td = nullptr );
+    void Transpose( TaskDispatch* td = nullptr );
+    void Transverse( TaskDispatch* td = nullptr );
 
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
     [[nodiscard]] float* Data() { return m_data; }
     [[nodiscard]] const float* Data() const { return m_data; }
     [[nodiscard]] int Orientation() const { return m_orientation; }
+    [[nodiscard]] uint32_t OrientedWidth() const { return m_orientation >= 5 ? m_height : m_width; }
+    [[nodiscard]] uint32_t OrientedHeight() const { return m_orientation >= 5 ? m_width : m_height; }
     [[nodiscard]] Colorspace GetColorspace() const { return m_colorspace; }
 
-    [[nodiscard]] std::unique_ptr<Bitmap> Tonemap( ToneMap::Operator op );
+    [[nodiscard]] std::unique_ptr<Bitmap> Tonemap( ToneMap::Operator op, TaskDispatch* td = nullptr );
 
 private:
+    void SetData( float* data );
+    void Reorient( void( *fn )( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* ), TaskDispatch* td );
+
     uint32_t m_width;
     uint32_t m_height;
     float* m_data;
+    std::function<void( float* )> m_release;
     Colorspace m_colorspace;
 
     int m_orientation;
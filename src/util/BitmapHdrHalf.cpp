@@ -1,17 +1,17 @@
 #include <cmath>
 #include <exception>
-#include <ImfStdIO.h>
 #include <ImfRgbaFile.h>
-#include <lcms2.h>
+#include <ImfStdIO.h>
+#include <ImfThreading.h>
+#include <ImfTiledRgbaFile.h>
+#include <OpenEXRConfig.h>
+#include <stdexcept>
 #include <stb_image_resize2.h>
 #include <string>
+#include <thread>
 #include <tracy/Tracy.hpp>
 #include <unistd.h>
 
-#if defined __F16C__
-#  include <x86intrin.h>
-#endif
-
 #include "contrib/half.hpp"
 
 #include "BitmapHdr.hpp"
@@ -19,41 +19,14 @@
 #include "Logs.hpp"
 #include "Panic.hpp"
 #include "PixelBytes.hpp"
+#include "PixelKernels.hpp"
+#include "PixelTransform.hpp"
 #include "TaskDispatch.hpp"
 
-static void FloatToHalf( const float* src, half_float::half* dst, size_t sz )
+void FloatToHalf( const float* src, half_float::half* dst, size_t sz )
 {
     ZoneScoped;
-
-#ifdef __F16C__
-  #ifdef __AVX512F__
-    while( sz >= 16 )
-    {
-        __m512 f = _mm512_loadu_ps( src );
-        __m256i h = _mm512_cvtps_ph( f, _MM_FROUND_TO_NEAREST_INT );
-        _mm256_storeu_si256( (__m256i*)dst, h );
-        src += 16;
-        dst += 16;
-        sz -= 16;
-    }
-  #endif
-  #ifdef __AVX2__
-    while( sz >= 8 )
-    {
-        __m256 f = _mm256_loadu_ps( src );
-        __m128i h = _mm256_cvtps_ph( f, _MM_FROUND_TO_NEAREST_INT );
-        _mm_storeu_si128( (__m128i*)dst, h );
-        src += 8;
-        dst += 8;
-        sz -= 8;
-    }
-  #endif
-#endif
-
-    while( sz-- > 0 )
-    {
-        *dst++ = half_float::half( *src++ );
-    }
+    PixelKernels::FloatToHalf( src, (uint16_t*)dst, sz );
 }
 
 BitmapHdrHalf::BitmapHdrHalf( const BitmapHdr& bmp )
@@ -79,13 +52,24 @@ BitmapHdrHalf::BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colors
 {
 }
 
+BitmapHdrHalf::BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace, half_float::half* data, std::function<void( half_float::half* )> release, int orientation )
+    : m_width( width )
+    , m_height( height )
+    , m_data( data )
+    , m_release( std::move( release ) )
+    , m_colorspace( colorspace )
+    , m_orientation( orientation )
+{
+}
+
 BitmapHdrHalf::~BitmapHdrHalf()
 {
-    delete[] m_data;
+    SetData( nullptr );
 }
 
 void BitmapHdrHalf::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
 {
+    if( PixelTransform::SwapsAxes( m_orientation ) ) std::swap( width, height );
     auto newData = PixelAlloc<half_float::half>( width, height );
     STBIR_RESIZE resize;
     stbir_resize_init( &resize, m_data, m_width, m_height, 0, newData, width, height, 0, STBIR_RGBA, STBIR_TYPE_HALF_FLOAT );
@@ -108,14 +92,15 @@ void BitmapHdrHalf::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
     {
         CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
     }
-    delete[] m_data;
-    m_data = newData;
+    SetData( newData );
     m_width = width;
     m_height = height;
+    NormalizeOrientation( td );
 }
 
 std::unique_ptr<BitmapHdrHalf> BitmapHdrHalf::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td ) const
 {
+    if( PixelTransform::SwapsAxes( m_orientation ) ) std::swap( width, height );
     auto ret = std::make_unique<BitmapHdrHalf>( width, height, m_colorspace, m_orientation );
     STBIR_RESIZE resize;
     stbir_resize_init( &resize, m_data, m_width, m_height, 0, ret->m_data, width, height, 0, STBIR_RGBA, STBIR_TYPE_HALF_FLOAT );
@@ -138,12 +123,14 @@ std::unique_ptr<BitmapHdrHalf> BitmapHdrHalf::ResizeNew( uint32_t width, uint32_
     {
         CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
     }
+    ret->NormalizeOrientation( td );
     return ret;
 }
 
 void BitmapHdrHalf::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
 {
-    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
+    CheckPanic( x + width <= OrientedWidth() && y + height <= OrientedHeight(), "Invalid crop" );
+    PixelTransform::MapRect( m_orientation, m_width, m_height, x, y, width, height );
 
     auto data = PixelAlloc<half_float::half>( width, height );
     auto dst = data;
@@ -156,15 +143,15 @@ void BitmapHdrHalf::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t heigh
         dst += width * 4;
     }
 
-    delete[] m_data;
-    m_data = data;
+    SetData( data );
     m_width = width;
     m_height = height;
 }
 
 void BitmapHdrHalf::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
 {
-    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid fill" );
+    CheckPanic( x + width <= OrientedWidth() && y + height <= OrientedHeight(), "Invalid fill" );
+    PixelTransform::MapRect( m_orientation, m_width, m_height, x, y, width, height );
 
     auto row = m_data + ( size_t( y ) * m_width + x ) * 4;
     for( uint32_t i=0; i<height; i++ )
@@ -181,6 +168,40 @@ void BitmapHdrHalf::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t
     }
 }
 
+void BitmapHdrHalf::NormalizeOrientation( TaskDispatch* td )
+{
+    if( m_orientation <= 1 ) return;
+
+    switch( m_orientation )
+    {
+    case 2:
+        FlipHorizontal( td );
+        break;
+    case 3:
+        Rotate180( td );
+        break;
+    case 4:
+        FlipVertical( td );
+        break;
+    case 5:
+        Transpose( td );
+        break;
+    case 6:
+        Rotate90( td );
+        break;
+    case 7:
+        Transverse( td );
+        break;
+    case 8:
+        Rotate270( td );
+        break;
+    default:
+        Panic( "Invalid orientation value!" );
+    }
+
+    m_orientation = 1;
+}
+
 void BitmapHdrHalf::SetColorspace( Colorspace colorspace, TaskDispatch* td )
 {
     if( m_colorspace == colorspace )
@@ -191,67 +212,142 @@ void BitmapHdrHalf::SetColorspace( Colorspace colorspace, TaskDispatch* td )
 
     ZoneScoped;
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
+    const auto& matrix = ColorMatrix::Get( m_colorspace, colorspace );
 
-    auto profile709 = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-    auto profile2020 = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
-
-    cmsHTRANSFORM transform;
-    if( m_colorspace == Colorspace::BT2020 && colorspace == Colorspace::BT709 )
+    const auto sz = PixelCount( m_width, m_height );
+    auto ptr = m_data;
+    if( td )
     {
-        transform = cmsCreateTransform( profile2020, TYPE_RGBA_HALF_FLT, profile709, TYPE_RGBA_HALF_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        td->ParallelFor( sz, td->Grain( sz, 4 * sizeof( half_float::half ) ), [ptr, &matrix]( size_t begin, size_t end ) {
+            matrix.Apply( ptr + begin * 4, end - begin );
+        } );
     }
-    else if( m_colorspace == Colorspace::BT709 && colorspace == Colorspace::BT2020 )
+    else
     {
-        transform = cmsCreateTransform( profile709, TYPE_RGBA_HALF_FLT, profile2020, TYPE_RGBA_HALF_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        matrix.Apply( ptr, sz );
     }
-    else
+
+    m_colorspace = colorspace;
+}
+
+void BitmapHdrHalf::FlipVertical( TaskDispatch* td )
+{
+    PixelTransform::FlipVertical( m_data, m_width, m_height, 4 * sizeof( half_float::half ), td );
+}
+
+void BitmapHdrHalf::FlipHorizontal( TaskDispatch* td )
+{
+    PixelTransform::FlipHorizontal( m_data, m_width, m_height, 4 * sizeof( half_float::half ), td );
+}
+
+void BitmapHdrHalf::Rotate90( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Rotate90, td );
+}
+
+void BitmapHdrHalf::Rotate180( TaskDispatch* td )
+{
+    PixelTransform::Rotate180( m_data, m_width, m_height, 4 * sizeof( half_float::half ), td );
+}
+
+void BitmapHdrHalf::Rotate270( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Rotate270, td );
+}
+
+void BitmapHdrHalf::Transpose( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Transpose, td );
+}
+
+void BitmapHdrHalf::Transverse( TaskDispatch* td )
+{
+    Reorient( PixelTransform::Transverse, td );
+}
+
+// Pixel data as seen with the bitmap orientation, which may be a copy held in tmp
+static const half_float::half* UprightData( const BitmapHdrHalf& bmp, PixelBuffer<half_float::half>& tmp, TaskDispatch* td )
+{
+    if( bmp.Orientation() <= 1 ) return bmp.Data();
+    tmp.reset( PixelAlloc<half_float::half>( bmp.Width(), bmp.Height() ) );
+    PixelTransform::Orient( tmp.get(), bmp.Data(), bmp.Width(), bmp.Height(), 4 * sizeof( half_float::half ), bmp.Orientation(), td );
+    return tmp.get();
+}
+
+static Imf::Compression GetCompression( ExrOptions::Compression compression )
+{
+    switch( compression )
     {
-        Panic( "Invalid colorspace transform!" );
+    case ExrOptions::Compression::None: return Imf::NO_COMPRESSION;
+    case ExrOptions::Compression::Zip: return Imf::ZIP_COMPRESSION;
+    case ExrOptions::Compression::Zips: return Imf::ZIPS_COMPRESSION;
+    case ExrOptions::Compression::Piz: return Imf::PIZ_COMPRESSION;
+    case ExrOptions::Compression::Dwaa: return Imf::DWAA_COMPRESSION;
+    case ExrOptions::Compression::Dwab: return Imf::DWAB_COMPRESSION;
+    case ExrOptions::Compression::Htj2k:
+#if OPENEXR_VERSION_MAJOR > 3 || ( OPENEXR_VERSION_MAJOR == 3 && OPENEXR_VERSION_MINOR >= 4 )
+        return Imf::HTJ2K256_COMPRESSION;
+#else
+        throw std::runtime_error( "HTJ2K compression requires OpenEXR 3.4" );
+#endif
     }
+    Panic( "Invalid EXR compression" );
+}
 
-    auto sz = PixelCount( m_width, m_height );
-    auto ptr = m_data;
-    if( td )
+static Imf::LineOrder GetLineOrder( ExrOptions::LineOrder order )
+{
+    switch( order )
     {
-        while( sz > 0 )
-        {
-            auto chunk = std::min<size_t>( sz, 16 * 1024 );
-            td->Queue( [ptr, chunk, transform] {
-                cmsDoTransform( transform, ptr, ptr, chunk );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-        }
-        td->Sync();
+    case ExrOptions::LineOrder::Increasing: return Imf::INCREASING_Y;
+    case ExrOptions::LineOrder::Decreasing: return Imf::DECREASING_Y;
+    case ExrOptions::LineOrder::Random: return Imf::RANDOM_Y;
     }
-    else
+    Panic( "Invalid EXR line order" );
+}
+
+// Target is a file name, or an output stream. Chunks are compressed on the OpenEXR global thread
+// pool, which is shared with the loader.
+template<typename T>
+static void WriteExr( T& target, const Imf::Rgba* ptr, uint32_t width, uint32_t height, const ExrOptions& options )
+{
+    static struct ExrThreadSetter
     {
-        while( sz > 0 )
+        ExrThreadSetter()
         {
-            auto chunk = std::min<size_t>( sz, UINT32_MAX );
-            cmsDoTransform( transform, ptr, ptr, chunk );
-            ptr += chunk * 4;
-            sz -= chunk;
+            if( Imf::globalThreadCount() == 0 ) Imf::setGlobalThreadCount( std::max( 1u, std::thread::hardware_concurrency() ) );
         }
-    }
+    } setter;
 
-    cmsDeleteTransform( transform );
-    cmsCloseProfile( profile709 );
-    cmsCloseProfile( profile2020 );
-    cmsFreeToneCurve( linear );
+    if( options.tileSize == 0 && options.lineOrder == ExrOptions::LineOrder::Random ) throw std::runtime_error( "Random line order requires tiles" );
 
-    m_colorspace = colorspace;
+    Imf::Header hdr( width, height );
+    hdr.compression() = GetCompression( options.compression );
+    hdr.lineOrder() = GetLineOrder( options.lineOrder );
+
+    if( options.tileSize == 0 )
+    {
+        Imf::RgbaOutputFile output( target, hdr, Imf::WRITE_RGBA );
+        output.setFrameBuffer( ptr, 1, width );
+        output.writePixels( height );
+    }
+    else
+    {
+        Imf::TiledRgbaOutputFile output( target, hdr, Imf::WRITE_RGBA, options.tileSize, options.tileSize, Imf::ONE_LEVEL );
+        output.setFrameBuffer( ptr, 1, width );
+        output.writeTiles( 0, output.numXTiles() - 1, 0, output.numYTiles() - 1 );
+    }
 }
 
-bool BitmapHdrHalf::SaveExr( const char* path ) const
+bool BitmapHdrHalf::SaveExr( const char* path, const ExrOptions& options, TaskDispatch* td ) const
 {
+    ZoneScoped;
+
+    PixelBuffer<half_float::half> tmp;
+    const auto ptr = UprightData( *this, tmp, td );
+
     try
     {
-        Imf::RgbaOutputFile output( path, m_width, m_height, Imf::WRITE_RGBA );
-        output.setFrameBuffer( (const Imf::Rgba*)m_data, 1, m_width );
-        output.writePixels( m_height );
+        WriteExr( path, (const Imf::Rgba*)ptr, OrientedWidth(), OrientedHeight(), options );
     }
     catch( const std::exception& e )
     {
@@ -261,17 +357,18 @@ bool BitmapHdrHalf::SaveExr( const char* path ) const
     return true;
 }
 
-bool BitmapHdrHalf::SaveExr( int fd ) const
+bool BitmapHdrHalf::SaveExr( int fd, const ExrOptions& options, TaskDispatch* td ) const
 {
+    ZoneScoped;
+
+    PixelBuffer<half_float::half> tmp;
+    const auto ptr = UprightData( *this, tmp, td );
+
     std::string str;
     try
     {
         Imf::StdOSStream buf;
-        Imf::Header hdr( m_width, m_height );
-        Imf::RgbaOutputFile output( buf, hdr );
-        output.setFrameBuffer( (const Imf::Rgba*)m_data, 1, m_width );
-        output.writePixels( m_height );
-
+        WriteExr( buf, (const Imf::Rgba*)ptr, OrientedWidth(), OrientedHeight(), options );
         str = buf.str();
     }
     catch( const std::exception& e )
@@ -294,3 +391,25 @@ bool BitmapHdrHalf::SaveExr( int fd ) const
 
     return true;
 }
+
+void BitmapHdrHalf::SetData( half_float::half* data )
+{
+    if( m_release )
+    {
+        m_release( m_data );
+        m_release = nullptr;
+    }
+    else
+    {
+        PixelFree( m_data );
+    }
+    m_data = data;
+}
+
+void BitmapHdrHalf::Reorient( void( *fn )( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* ), TaskDispatch* td )
+{
+    auto tmp = PixelAlloc<half_float::half>( m_width, m_height );
+    fn( tmp, m_data, m_width, m_height, 4 * sizeof( half_float::half ), td );
+    SetData( tmp );
+    std::swap( m_width, m_height );
+}
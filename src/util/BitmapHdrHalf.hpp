@@ -1,6 +1,8 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "Colorspace.hpp"
@@ -12,34 +14,83 @@ namespace half_float { class half; }
 class BitmapHdr;
 class TaskDispatch;
 
+void FloatToHalf( const float* src, half_float::half* dst, size_t sz );
+
+struct ExrOptions
+{
+    enum class Compression
+    {
+        None,
+        Zip,
+        Zips,
+        Piz,
+        Dwaa,
+        Dwab,
+        Htj2k       // requires OpenEXR 3.4
+    };
+
+    // Random order is only valid for tiled images
+    enum class LineOrder
+    {
+        Increasing,
+        Decreasing,
+        Random
+    };
+
+    Compression compression = Compression::Zip;
+    LineOrder lineOrder = LineOrder::Increasing;
+    uint32_t tileSize = 0;      // scanlines if zero
+};
+
 class BitmapHdrHalf
 {
 public:
     explicit BitmapHdrHalf( const BitmapHdr& bmp );
     BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace, int orientation = 0 );
+    // Adopts pixel data allocated elsewhere, freed with the release function instead of PixelFree
+    BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace, half_float::half* data, std::function<void( half_float::half* )> release, int orientation = 0 );
     ~BitmapHdrHalf();
     NoCopy( BitmapHdrHalf );
 
+    // Sizes and coordinates are upright, see Bitmap
     void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
     [[nodiscard]] std::unique_ptr<BitmapHdrHalf> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr ) const;
     void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
     void FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
+    void NormalizeOrientation( TaskDispatch* td = nullptr );
+    void SetOrientation( int orientation ) { m_orientation = orientation; }
     void SetColorspace( Colorspace colorspace, TaskDispatch* td = nullptr );
 
+    void FlipVertical( TaskDispatch* td = nullptr );
+    void FlipHorizontal( TaskDispatch* td = nullptr );
+    void Rotate90( TaskDispatch* td = nullptr );
+    void Rotate180( TaskDispatch* td = nullptr );
+    void Rotate270( TaskDispatch* td = nullptr );
+    void Transpose( TaskDispatch* td = nullptr );
+    void Transverse( TaskDispatch* td = nullptr );
+
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
     [[nodiscard]] half_float::half* Data() { return m_data; }
     [[nodiscard]] const half_float::half* Data() const { return m_data; }
     [[nodiscard]] int Orientation() const { return m_orientation; }
+    [[nodiscard]] uint32_t OrientedWidth() const { return m_orientation >= 5 ? m_height : m_width; }
+    [[nodiscard]] uint32_t OrientedHeight() const { return m_orientation >= 5 ? m_width : m_height; }
     [[nodiscard]] Colorspace GetColorspace() const { return m_colorspace; }
 
-    bool SaveExr( const char* path ) const;
-    bool SaveExr( int fd ) const;
+    // Compression runs on the OpenEXR global thread pool, td only parallelises reorienting the
+    // pixel data to upright.
+    bool SaveExr( const char* path, const ExrOptions& options = {}, TaskDispatch* td = nullptr ) const;
+    bool SaveExr( int fd, const ExrOptions& options = {}, TaskDispatch* td = nullptr ) const;
 
 private:
+    void SetData( half_float::half* data );
+    void Reorient( void( *fn )( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* ), TaskDispatch* td );
+
     uint32_t m_width;
     uint32_t m_height;
     half_float::half* m_data;
+    std::function<void( half_float::half* )> m_release;
     Colorspace m_colorspace;
 
     int m_orientation;
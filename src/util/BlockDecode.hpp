@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+// Decoders of GPU block compressed image data to RGBA8. The source is width/4 x height/4 blocks in
+// row order, with each block being one 64-bit word (BC1, BC4, ETC, EAC R11), or two.
+namespace BlockDecode
+{
+
+void Bc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void Bc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void Bc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void Bc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void Bc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+
+void Etc2Rgb( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void Etc2Rgba( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void EacR11( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void EacRg11( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+
+}
@@ -0,0 +1,657 @@
+#include <string.h>
+
+#include "BlockDecode.hpp"
+#include "SimdLevel.hpp"
+#include "contrib/bcdec.h"
+
+#if defined __AVX2__
+#  include <immintrin.h>
+#endif
+
+static void DecodeBc1Part( uint64_t d, uint32_t* dst, uint32_t w )
+{
+    uint8_t* in = (uint8_t*)&d;
+    uint16_t c0, c1;
+    uint32_t idx;
+    memcpy( &c0, in, 2 );
+    memcpy( &c1, in+2, 2 );
+    memcpy( &idx, in+4, 4 );
+
+    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
+    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
+    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
+
+    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
+    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
+    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
+
+    uint32_t dict[4];
+
+    dict[0] = 0xFF000000 | ( b0 << 16 ) | ( g0 << 8 ) | r0;
+    dict[1] = 0xFF000000 | ( b1 << 16 ) | ( g1 << 8 ) | r1;
+
+    uint32_t r, g, b;
+    if( c0 > c1 )
+    {
+        r = (2*r0+r1)/3;
+        g = (2*g0+g1)/3;
+        b = (2*b0+b1)/3;
+        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+        r = (2*r1+r0)/3;
+        g = (2*g1+g0)/3;
+        b = (2*b1+b0)/3;
+        dict[3] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+    }
+    else
+    {
+        r = (int(r0)+r1)/2;
+        g = (int(g0)+g1)/2;
+        b = (int(b0)+b1)/2;
+        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+        dict[3] = 0xFF000000;
+    }
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    dst += w;
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    dst += w;
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    dst += w;
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+}
+
+static void DecodeBc3Part( uint64_t a, uint64_t d, uint32_t* dst, uint32_t w )
+{
+    uint8_t* ain = (uint8_t*)&a;
+    uint8_t a0, a1;
+    uint64_t aidx = 0;
+    memcpy( &a0, ain, 1 );
+    memcpy( &a1, ain+1, 1 );
+    memcpy( &aidx, ain+2, 6 );
+
+    uint8_t* in = (uint8_t*)&d;
+    uint16_t c0, c1;
+    uint32_t idx;
+    memcpy( &c0, in, 2 );
+    memcpy( &c1, in+2, 2 );
+    memcpy( &idx, in+4, 4 );
+
+    uint32_t adict[8];
+    adict[0] = a0 << 24;
+    adict[1] = a1 << 24;
+    if( a0 > a1 )
+    {
+        adict[2] = ( (6*a0+1*a1)/7 ) << 24;
+        adict[3] = ( (5*a0+2*a1)/7 ) << 24;
+        adict[4] = ( (4*a0+3*a1)/7 ) << 24;
+        adict[5] = ( (3*a0+4*a1)/7 ) << 24;
+        adict[6] = ( (2*a0+5*a1)/7 ) << 24;
+        adict[7] = ( (1*a0+6*a1)/7 ) << 24;
+    }
+    else
+    {
+        adict[2] = ( (4*a0+1*a1)/5 ) << 24;
+        adict[3] = ( (3*a0+2*a1)/5 ) << 24;
+        adict[4] = ( (2*a0+3*a1)/5 ) << 24;
+        adict[5] = ( (1*a0+4*a1)/5 ) << 24;
+        adict[6] = 0;
+        adict[7] = 0xFF000000;
+    }
+
+    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
+    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
+    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
+
+    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
+    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
+    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
+
+    uint32_t dict[4];
+
+    dict[0] = ( b0 << 16 ) | ( g0 << 8 ) | r0;
+    dict[1] = ( b1 << 16 ) | ( g1 << 8 ) | r1;
+
+    uint32_t r, g, b;
+    if( c0 > c1 )
+    {
+        r = (2*r0+r1)/3;
+        g = (2*g0+g1)/3;
+        b = (2*b0+b1)/3;
+        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
+        r = (2*r1+r0)/3;
+        g = (2*g1+g0)/3;
+        b = (2*b1+b0)/3;
+        dict[3] = ( b << 16 ) | ( g << 8 ) | r;
+    }
+    else
+    {
+        r = (int(r0)+r1)/2;
+        g = (int(g0)+g1)/2;
+        b = (int(b0)+b1)/2;
+        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
+        dict[3] = 0;
+    }
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+}
+
+static void DecodeBc4Part( uint64_t a, uint32_t* dst, uint32_t w )
+{
+    uint8_t* ain = (uint8_t*)&a;
+    uint8_t a0, a1;
+    uint64_t aidx = 0;
+    memcpy( &a0, ain, 1 );
+    memcpy( &a1, ain+1, 1 );
+    memcpy( &aidx, ain+2, 6 );
+
+    uint32_t adict[8];
+    adict[0] = a0;
+    adict[1] = a1;
+    if(a0 > a1)
+    {
+        adict[2] = ( (6*a0+1*a1)/7 );
+        adict[3] = ( (5*a0+2*a1)/7 );
+        adict[4] = ( (4*a0+3*a1)/7 );
+        adict[5] = ( (3*a0+4*a1)/7 );
+        adict[6] = ( (2*a0+5*a1)/7 );
+        adict[7] = ( (1*a0+6*a1)/7 );
+    }
+    else
+    {
+        adict[2] = ( (4*a0+1*a1)/5 );
+        adict[3] = ( (3*a0+2*a1)/5 );
+        adict[4] = ( (2*a0+3*a1)/5 );
+        adict[5] = ( (1*a0+4*a1)/5 );
+        adict[6] = 0;
+        adict[7] = 0xFF;
+    }
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+}
+
+static void DecodeBc5Part( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
+{
+    uint8_t* rin = (uint8_t*)&r;
+    uint8_t r0, r1;
+    uint64_t ridx = 0;
+    memcpy( &r0, rin, 1 );
+    memcpy( &r1, rin+1, 1 );
+    memcpy( &ridx, rin+2, 6 );
+
+    uint8_t* gin = (uint8_t*)&g;
+    uint8_t g0, g1;
+    uint64_t gidx = 0;
+    memcpy( &g0, gin, 1 );
+    memcpy( &g1, gin+1, 1 );
+    memcpy( &gidx, gin+2, 6 );
+
+    uint32_t rdict[8];
+    rdict[0] = r0;
+    rdict[1] = r1;
+    if(r0 > r1)
+    {
+        rdict[2] = ( (6*r0+1*r1)/7 );
+        rdict[3] = ( (5*r0+2*r1)/7 );
+        rdict[4] = ( (4*r0+3*r1)/7 );
+        rdict[5] = ( (3*r0+4*r1)/7 );
+        rdict[6] = ( (2*r0+5*r1)/7 );
+        rdict[7] = ( (1*r0+6*r1)/7 );
+    }
+    else
+    {
+        rdict[2] = ( (4*r0+1*r1)/5 );
+        rdict[3] = ( (3*r0+2*r1)/5 );
+        rdict[4] = ( (2*r0+3*r1)/5 );
+        rdict[5] = ( (1*r0+4*r1)/5 );
+        rdict[6] = 0;
+        rdict[7] = 0xFF;
+    }
+
+    uint32_t gdict[8];
+    gdict[0] = g0 << 8;
+    gdict[1] = g1 << 8;
+    if(g0 > g1)
+    {
+        gdict[2] = ( (6*g0+1*g1)/7 ) << 8;
+        gdict[3] = ( (5*g0+2*g1)/7 ) << 8;
+        gdict[4] = ( (4*g0+3*g1)/7 ) << 8;
+        gdict[5] = ( (3*g0+4*g1)/7 ) << 8;
+        gdict[6] = ( (2*g0+5*g1)/7 ) << 8;
+        gdict[7] = ( (1*g0+6*g1)/7 ) << 8;
+    }
+    else
+    {
+        gdict[2] = ( (4*g0+1*g1)/5 ) << 8;
+        gdict[3] = ( (3*g0+2*g1)/5 ) << 8;
+        gdict[4] = ( (2*g0+3*g1)/5 ) << 8;
+        gdict[5] = ( (1*g0+4*g1)/5 ) << 8;
+        gdict[6] = 0;
+        gdict[7] = 0xFF00;
+    }
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst += w;
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst += w;
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst += w;
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+}
+
+#if defined __AVX2__
+static void Expand565( __m128i c, __m128i& r, __m128i& g, __m128i& b )
+{
+    const auto cr = _mm_and_si128( c, _mm_set1_epi32( 0xF800 ) );
+    const auto cg = _mm_and_si128( c, _mm_set1_epi32( 0x07E0 ) );
+    const auto cb = _mm_and_si128( c, _mm_set1_epi32( 0x001F ) );
+    r = _mm_or_si128( _mm_srli_epi32( cr, 8 ), _mm_srli_epi32( cr, 13 ) );
+    g = _mm_or_si128( _mm_srli_epi32( cg, 3 ), _mm_srli_epi32( cg, 9 ) );
+    b = _mm_or_si128( _mm_slli_epi32( cb, 3 ), _mm_srli_epi32( cb, 2 ) );
+}
+
+static __m128i PackRgb( __m128i r, __m128i g, __m128i b )
+{
+    return _mm_or_si128( _mm_or_si128( r, _mm_slli_epi32( g, 8 ) ), _mm_or_si128( _mm_slli_epi32( b, 16 ), _mm_set1_epi32( 0xFF000000 ) ) );
+}
+
+// x / 3 for x < 65536, with x in the low half of each 32-bit lane
+static __m128i Div3( __m128i x )
+{
+    return _mm_srli_epi32( _mm_mulhi_epu16( x, _mm_set1_epi32( 0xAAAB ) ), 1 );
+}
+
+// Decodes four horizontally adjacent BC1 blocks. Palettes are computed for all four blocks at
+// once, then each row of pixels is a single table lookup.
+static void DecodeBc1Part4( const uint64_t* src, uint32_t* dst, uint32_t w )
+{
+    const auto data = _mm256_permutevar8x32_epi32( _mm256_loadu_si256( (const __m256i*)src ), _mm256_setr_epi32( 0, 2, 4, 6, 1, 3, 5, 7 ) );
+    const auto c = _mm256_castsi256_si128( data );
+    const auto c0 = _mm_and_si128( c, _mm_set1_epi32( 0xFFFF ) );
+    const auto c1 = _mm_srli_epi32( c, 16 );
+
+    __m128i r0, g0, b0, r1, g1, b1;
+    Expand565( c0, r0, g0, b0 );
+    Expand565( c1, r1, g1, b1 );
+
+    const auto r2 = _mm_add_epi32( r0, r0 );
+    const auto g2 = _mm_add_epi32( g0, g0 );
+    const auto b2 = _mm_add_epi32( b0, b0 );
+    const auto r3 = _mm_add_epi32( r1, r1 );
+    const auto g3 = _mm_add_epi32( g1, g1 );
+    const auto b3 = _mm_add_epi32( b1, b1 );
+
+    const auto opaque = _mm_cmpgt_epi32( c0, c1 );
+    const auto dict2 = _mm_blendv_epi8(
+        PackRgb( _mm_srli_epi32( _mm_add_epi32( r0, r1 ), 1 ), _mm_srli_epi32( _mm_add_epi32( g0, g1 ), 1 ), _mm_srli_epi32( _mm_add_epi32( b0, b1 ), 1 ) ),
+        PackRgb( Div3( _mm_add_epi32( r2, r1 ) ), Div3( _mm_add_epi32( g2, g1 ) ), Div3( _mm_add_epi32( b2, b1 ) ) ),
+        opaque );
+    const auto dict3 = _mm_blendv_epi8(
+        _mm_set1_epi32( 0xFF000000 ),
+        PackRgb( Div3( _mm_add_epi32( r3, r0 ) ), Div3( _mm_add_epi32( g3, g0 ) ), Div3( _mm_add_epi32( b3, b0 ) ) ),
+        opaque );
+
+    __m128 dict[4] = {
+        _mm_castsi128_ps( PackRgb( r0, g0, b0 ) ),
+        _mm_castsi128_ps( PackRgb( r1, g1, b1 ) ),
+        _mm_castsi128_ps( dict2 ),
+        _mm_castsi128_ps( dict3 )
+    };
+    _MM_TRANSPOSE4_PS( dict[0], dict[1], dict[2], dict[3] );
+
+    alignas( 16 ) uint32_t idx[4];
+    _mm_store_si128( (__m128i*)idx, _mm256_extracti128_si256( data, 1 ) );
+
+    for( int i=0; i<4; i++ )
+    {
+        const auto v = _mm_set1_epi32( idx[i] );
+        auto shift = _mm_setr_epi32( 0, 2, 4, 6 );
+        for( int j=0; j<4; j++ )
+        {
+            _mm_storeu_si128( (__m128i*)( dst + i*4 + j*w ), _mm_castps_si128( _mm_permutevar_ps( dict[i], _mm_srlv_epi32( v, shift ) ) ) );
+            shift = _mm_add_epi32( shift, _mm_set1_epi32( 8 ) );
+        }
+    }
+}
+
+// Computes the 8-entry palettes of two consecutive BC4 blocks, returned in bytes 0-7 and 8-15.
+static __m128i DecodeBc4Palette2( const uint64_t* src )
+{
+    const auto data = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)src ) );
+    const auto a0 = _mm256_shuffle_epi8( data, _mm256_setr_epi8( 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1, 8, -1 ) );
+    const auto a1 = _mm256_shuffle_epi8( data, _mm256_setr_epi8( 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 1, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1, 9, -1 ) );
+
+    // Division by 7 and 5 is exact for the possible input range
+    const auto w7a = _mm256_setr_epi16( 7, 0, 6, 5, 4, 3, 2, 1, 7, 0, 6, 5, 4, 3, 2, 1 );
+    const auto w7b = _mm256_setr_epi16( 0, 7, 1, 2, 3, 4, 5, 6, 0, 7, 1, 2, 3, 4, 5, 6 );
+    const auto p7 = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_mullo_epi16( a0, w7a ), _mm256_mullo_epi16( a1, w7b ) ), _mm256_set1_epi16( 9363 ) );
+
+    const auto w5a = _mm256_setr_epi16( 5, 0, 4, 3, 2, 1, 0, 0, 5, 0, 4, 3, 2, 1, 0, 0 );
+    const auto w5b = _mm256_setr_epi16( 0, 5, 1, 2, 3, 4, 0, 0, 0, 5, 1, 2, 3, 4, 0, 0 );
+    const auto p5 = _mm256_add_epi16(
+        _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_mullo_epi16( a0, w5a ), _mm256_mullo_epi16( a1, w5b ) ), _mm256_set1_epi16( 13108 ) ),
+        _mm256_setr_epi16( 0, 0, 0, 0, 0, 0, 0, 0xFF, 0, 0, 0, 0, 0, 0, 0, 0xFF ) );
+
+    const auto pal = _mm256_blendv_epi8( p5, p7, _mm256_cmpgt_epi16( a0, a1 ) );
+    return _mm_packus_epi16( _mm256_castsi256_si128( pal ), _mm256_extracti128_si256( pal, 1 ) );
+}
+
+// Extracts the sixteen 3-bit indices of a BC4 block, one per byte.
+static __m128i DecodeBc4Indices( uint64_t block )
+{
+    const auto shift = _mm256_setr_epi32( 0, 3, 6, 9, 12, 15, 18, 21 );
+    const auto mask = _mm256_set1_epi32( 0x7 );
+    const auto lo = _mm256_and_si256( _mm256_srlv_epi32( _mm256_set1_epi32( uint32_t( block >> 16 ) ), shift ), mask );
+    const auto hi = _mm256_and_si256( _mm256_srlv_epi32( _mm256_set1_epi32( uint32_t( block >> 40 ) ), shift ), mask );
+    const auto idx = _mm256_permute4x64_epi64( _mm256_packus_epi32( lo, hi ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    return _mm_packus_epi16( _mm256_castsi256_si128( idx ), _mm256_extracti128_si256( idx, 1 ) );
+}
+
+static void StoreRg( __m128i r, __m128i g, uint32_t* dst, uint32_t w )
+{
+    const auto alpha = _mm_set1_epi16( (short)0xFF00 );
+    const auto lo = _mm_unpacklo_epi8( r, g );
+    const auto hi = _mm_unpackhi_epi8( r, g );
+    _mm_storeu_si128( (__m128i*)dst, _mm_unpacklo_epi16( lo, alpha ) );
+    _mm_storeu_si128( (__m128i*)( dst + w ), _mm_unpackhi_epi16( lo, alpha ) );
+    _mm_storeu_si128( (__m128i*)( dst + w*2 ), _mm_unpacklo_epi16( hi, alpha ) );
+    _mm_storeu_si128( (__m128i*)( dst + w*3 ), _mm_unpackhi_epi16( hi, alpha ) );
+}
+
+static void DecodeBc4Part2( const uint64_t* src, uint32_t* dst, uint32_t w )
+{
+    const auto pal = DecodeBc4Palette2( src );
+    const auto zero = _mm_setzero_si128();
+    StoreRg( _mm_shuffle_epi8( pal, DecodeBc4Indices( src[0] ) ), zero, dst, w );
+    StoreRg( _mm_shuffle_epi8( pal, _mm_add_epi8( DecodeBc4Indices( src[1] ), _mm_set1_epi8( 8 ) ) ), zero, dst + 4, w );
+}
+
+static void DecodeBc5PartSimd( const uint64_t* src, uint32_t* dst, uint32_t w )
+{
+    const auto pal = DecodeBc4Palette2( src );
+    const auto r = _mm_shuffle_epi8( pal, DecodeBc4Indices( src[0] ) );
+    const auto g = _mm_shuffle_epi8( pal, _mm_add_epi8( DecodeBc4Indices( src[1] ), _mm_set1_epi8( 8 ) ) );
+    StoreRg( r, g, dst, w );
+}
+#endif
+
+// Vector paths are built in when the compiler targets AVX2. They can still be turned off at run time
+// with SetSimdLevel, which lets tests compare them with the scalar code.
+static bool UseSimd()
+{
+#if defined __AVX2__
+    return GetSimdLevel() >= SimdLevel::Avx2;
+#else
+    return false;
+#endif
+}
+
+namespace BlockDecode
+{
+
+void Bc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    [[maybe_unused]] const bool simd = UseSimd();
+    for( int y=0; y<height/4; y++ )
+    {
+        int x = 0;
+#if defined __AVX2__
+        for( ; simd && x+4<=width/4; x+=4 )
+        {
+            DecodeBc1Part4( src, dst, width );
+            src += 4;
+            dst += 16;
+        }
+#endif
+        for( ; x<width/4; x++ )
+        {
+            uint64_t d = *src++;
+            DecodeBc1Part( d, dst, width );
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void Bc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            uint64_t a = *src++;
+            uint64_t d = *src++;
+            DecodeBc3Part( a, d, dst, width );
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void Bc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    [[maybe_unused]] const bool simd = UseSimd();
+    for( int y=0; y<height/4; y++ )
+    {
+        int x = 0;
+#if defined __AVX2__
+        for( ; simd && x+2<=width/4; x+=2 )
+        {
+            DecodeBc4Part2( src, dst, width );
+            src += 2;
+            dst += 8;
+        }
+#endif
+        for( ; x<width/4; x++ )
+        {
+            uint64_t r = *src++;
+            DecodeBc4Part( r, dst, width );
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void Bc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    [[maybe_unused]] const bool simd = UseSimd();
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+#if defined __AVX2__
+            if( simd )
+            {
+                DecodeBc5PartSimd( src, dst, width );
+                src += 2;
+                dst += 4;
+                continue;
+            }
+#endif
+            uint64_t r = *src++;
+            uint64_t g = *src++;
+            DecodeBc5Part( r, g, dst, width );
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void Bc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            bcdec_bc7( src, dst, width * 4 );
+            src += 2;
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+}
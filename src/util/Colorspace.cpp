@@ -0,0 +1,210 @@
+#include <tracy/Tracy.hpp>
+
+#if defined __AVX2__ || defined __F16C__
+#  include <x86intrin.h>
+#endif
+
+#include "contrib/half.hpp"
+
+#include "Colorspace.hpp"
+
+namespace
+{
+
+struct Mat3
+{
+    double m[3][3];
+};
+
+constexpr Mat3 Multiply( const Mat3& a, const Mat3& b )
+{
+    Mat3 ret = {};
+    for( int i=0; i<3; i++ )
+    {
+        for( int j=0; j<3; j++ )
+        {
+            for( int k=0; k<3; k++ ) ret.m[i][j] += a.m[i][k] * b.m[k][j];
+        }
+    }
+    return ret;
+}
+
+constexpr Mat3 Inverse( const Mat3& a )
+{
+    const auto& m = a.m;
+    const auto c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    const auto c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    const auto c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    const auto det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    return { {
+        { c00 / det, ( m[0][2] * m[2][1] - m[0][1] * m[2][2] ) / det, ( m[0][1] * m[1][2] - m[0][2] * m[1][1] ) / det },
+        { c01 / det, ( m[0][0] * m[2][2] - m[0][2] * m[2][0] ) / det, ( m[0][2] * m[1][0] - m[0][0] * m[1][2] ) / det },
+        { c02 / det, ( m[0][1] * m[2][0] - m[0][0] * m[2][1] ) / det, ( m[0][0] * m[1][1] - m[0][1] * m[1][0] ) / det }
+    } };
+}
+
+// Linear RGB to CIE XYZ, scaled so that RGB white maps to the white point
+constexpr Mat3 RgbToXyz( const cmsCIExyY& white, const cmsCIExyYTRIPLE& primaries )
+{
+    const cmsCIExyY* p[3] = { &primaries.Red, &primaries.Green, &primaries.Blue };
+    Mat3 m = {};
+    for( int i=0; i<3; i++ )
+    {
+        m.m[0][i] = p[i]->x / p[i]->y;
+        m.m[1][i] = 1;
+        m.m[2][i] = ( 1 - p[i]->x - p[i]->y ) / p[i]->y;
+    }
+
+    const Mat3 w = { {
+        { white.x / white.y, 0, 0 },
+        { 1, 0, 0 },
+        { ( 1 - white.x - white.y ) / white.y, 0, 0 }
+    } };
+    const auto s = Multiply( Inverse( m ), w );
+    for( int i=0; i<3; i++ )
+    {
+        for( int j=0; j<3; j++ ) m.m[i][j] *= s.m[j][0];
+    }
+    return m;
+}
+
+constexpr ColorMatrix MakeMatrix( const cmsCIExyYTRIPLE& from, const cmsCIExyYTRIPLE& to )
+{
+    const auto m = Multiply( Inverse( RgbToXyz( white709, to ) ), RgbToXyz( white709, from ) );
+    ColorMatrix ret = {};
+    for( int i=0; i<3; i++ )
+    {
+        for( int j=0; j<3; j++ ) ret.m[i][j] = float( m.m[i][j] );
+    }
+    return ret;
+}
+
+constexpr ColorMatrix Identity = { { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } } };
+constexpr ColorMatrix BT709ToBT2020 = MakeMatrix( primaries709, primaries2020 );
+constexpr ColorMatrix BT2020ToBT709 = MakeMatrix( primaries2020, primaries709 );
+
+#ifdef __AVX2__
+struct Columns256
+{
+    explicit Columns256( const float (&m)[3][3] )
+        : r( _mm256_setr_ps( m[0][0], m[1][0], m[2][0], 0, m[0][0], m[1][0], m[2][0], 0 ) )
+        , g( _mm256_setr_ps( m[0][1], m[1][1], m[2][1], 0, m[0][1], m[1][1], m[2][1], 0 ) )
+        , b( _mm256_setr_ps( m[0][2], m[1][2], m[2][2], 0, m[0][2], m[1][2], m[2][2], 0 ) )
+    {
+    }
+
+    // Two RGBA pixels
+    [[nodiscard]] __m256 Apply( __m256 px ) const
+    {
+        __m256 o = _mm256_mul_ps( _mm256_permute_ps( px, _MM_SHUFFLE( 0, 0, 0, 0 ) ), r );
+        o = _mm256_add_ps( o, _mm256_mul_ps( _mm256_permute_ps( px, _MM_SHUFFLE( 1, 1, 1, 1 ) ), g ) );
+        o = _mm256_add_ps( o, _mm256_mul_ps( _mm256_permute_ps( px, _MM_SHUFFLE( 2, 2, 2, 2 ) ), b ) );
+        return _mm256_blend_ps( o, px, 0x88 );
+    }
+
+    __m256 r, g, b;
+};
+#endif
+
+#ifdef __AVX512F__
+struct Columns512
+{
+    explicit Columns512( const Columns256& c )
+        : r( _mm512_broadcast_f32x8( c.r ) )
+        , g( _mm512_broadcast_f32x8( c.g ) )
+        , b( _mm512_broadcast_f32x8( c.b ) )
+    {
+    }
+
+    // Four RGBA pixels
+    [[nodiscard]] __m512 Apply( __m512 px ) const
+    {
+        __m512 o = _mm512_mul_ps( _mm512_permute_ps( px, _MM_SHUFFLE( 0, 0, 0, 0 ) ), r );
+        o = _mm512_add_ps( o, _mm512_mul_ps( _mm512_permute_ps( px, _MM_SHUFFLE( 1, 1, 1, 1 ) ), g ) );
+        o = _mm512_add_ps( o, _mm512_mul_ps( _mm512_permute_ps( px, _MM_SHUFFLE( 2, 2, 2, 2 ) ), b ) );
+        return _mm512_mask_blend_ps( 0x8888, o, px );
+    }
+
+    __m512 r, g, b;
+};
+#endif
+
+}
+
+const ColorMatrix& ColorMatrix::Get( Colorspace from, Colorspace to )
+{
+    if( from == to ) return Identity;
+    return from == Colorspace::BT709 ? BT709ToBT2020 : BT2020ToBT709;
+}
+
+void ColorMatrix::Apply( float* ptr, size_t count ) const
+{
+    ZoneScoped;
+
+#ifdef __AVX2__
+    const Columns256 c256( m );
+#  ifdef __AVX512F__
+    const Columns512 c512( c256 );
+    while( count >= 4 )
+    {
+        _mm512_storeu_ps( ptr, c512.Apply( _mm512_loadu_ps( ptr ) ) );
+        ptr += 16;
+        count -= 4;
+    }
+#  endif
+    while( count >= 2 )
+    {
+        _mm256_storeu_ps( ptr, c256.Apply( _mm256_loadu_ps( ptr ) ) );
+        ptr += 8;
+        count -= 2;
+    }
+#endif
+
+    while( count-- > 0 )
+    {
+        const auto r = ptr[0];
+        const auto g = ptr[1];
+        const auto b = ptr[2];
+        ptr[0] = m[0][0] * r + m[0][1] * g + m[0][2] * b;
+        ptr[1] = m[1][0] * r + m[1][1] * g + m[1][2] * b;
+        ptr[2] = m[2][0] * r + m[2][1] * g + m[2][2] * b;
+        ptr += 4;
+    }
+}
+
+void ColorMatrix::Apply( half_float::half* ptr, size_t count ) const
+{
+    ZoneScoped;
+
+#if defined __AVX2__ && defined __F16C__
+    const Columns256 c256( m );
+#  ifdef __AVX512F__
+    const Columns512 c512( c256 );
+    while( count >= 4 )
+    {
+        __m512 px = _mm512_cvtph_ps( _mm256_loadu_si256( (const __m256i*)ptr ) );
+        _mm256_storeu_si256( (__m256i*)ptr, _mm512_cvtps_ph( c512.Apply( px ), _MM_FROUND_TO_NEAREST_INT ) );
+        ptr += 16;
+        count -= 4;
+    }
+#  endif
+    while( count >= 2 )
+    {
+        __m256 px = _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)ptr ) );
+        _mm_storeu_si128( (__m128i*)ptr, _mm256_cvtps_ph( c256.Apply( px ), _MM_FROUND_TO_NEAREST_INT ) );
+        ptr += 8;
+        count -= 2;
+    }
+#endif
+
+    while( count-- > 0 )
+    {
+        const float r = ptr[0];
+        const float g = ptr[1];
+        const float b = ptr[2];
+        ptr[0] = half_float::half( m[0][0] * r + m[0][1] * g + m[0][2] * b );
+        ptr[1] = half_float::half( m[1][0] * r + m[1][1] * g + m[1][2] * b );
+        ptr[2] = half_float::half( m[2][0] * r + m[2][1] * g + m[2][2] * b );
+        ptr += 4;
+    }
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <lcms2.h>
+#include <stddef.h>
+
+namespace half_float { class half; }
 
 enum class Colorspace
 {
@@ -19,3 +22,19 @@ inline constexpr cmsCIExyYTRIPLE primaries2020 = {
     { 0.170f, 0.797f, 1 },
     { 0.131f, 0.046f, 1 }
 };
+
+// Conversion of linear RGB data between colorspaces. All supported colorspaces share the D65
+// white point, so this is a plain 3x3 matrix and doesn't need a color management engine. Data
+// described by ICC profiles still has to go through LittleCMS.
+struct ColorMatrix
+{
+    // Returns the matrix converting from one colorspace to the other
+    [[nodiscard]] static const ColorMatrix& Get( Colorspace from, Colorspace to );
+
+    // In-place conversion of RGBA pixels. Alpha is preserved, values are not clamped.
+    void Apply( float* ptr, size_t count ) const;
+    void Apply( half_float::half* ptr, size_t count ) const;
+
+    // Row-major, out = m * in
+    float m[3][3];
+};
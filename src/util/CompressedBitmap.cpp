@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "Bitmap.hpp"
+#include "BlockDecode.hpp"
+#include "CompressedBitmap.hpp"
+#include "DataBuffer.hpp"
+#include "Panic.hpp"
+#include "TaskDispatch.hpp"
+
+CompressedBitmap::CompressedBitmap( std::shared_ptr<DataBuffer> buffer, size_t offset, Format format, uint32_t width, uint32_t height, uint32_t levels )
+    : m_buffer( std::move( buffer ) )
+    , m_data( (const uint8_t*)m_buffer->data() + offset )
+    , m_format( format )
+{
+    CheckPanic( width > 0 && height > 0, "Invalid compressed image size" );
+    CheckPanic( offset + LevelSize( format, width, height ) <= m_buffer->size(), "Compressed image data is truncated" );
+
+    const auto available = m_buffer->size() - offset;
+    size_t pos = 0;
+    do
+    {
+        const auto size = LevelSize( format, width, height );
+        if( pos + size > available ) break;
+        m_levels.emplace_back( width, height, pos, size );
+        pos += size;
+        if( width == 1 && height == 1 ) break;
+        width = std::max( 1u, width / 2 );
+        height = std::max( 1u, height / 2 );
+    }
+    while( m_levels.size() < levels );
+}
+
+std::unique_ptr<Bitmap> CompressedBitmap::Decode( TaskDispatch* td ) const
+{
+    ZoneScoped;
+
+    void(*decode)( uint32_t*, const uint64_t*, uint32_t, uint32_t );
+    switch( m_format )
+    {
+    case Format::Bc1: decode = BlockDecode::Bc1; break;
+    case Format::Bc3: decode = BlockDecode::Bc3; break;
+    case Format::Bc4: decode = BlockDecode::Bc4; break;
+    case Format::Bc5: decode = BlockDecode::Bc5; break;
+    case Format::Bc7: decode = BlockDecode::Bc7; break;
+    case Format::Etc1:
+    case Format::Etc2Rgb: decode = BlockDecode::Etc2Rgb; break;
+    case Format::Etc2Rgba: decode = BlockDecode::Etc2Rgba; break;
+    case Format::EacR11: decode = BlockDecode::EacR11; break;
+    case Format::EacRg11: decode = BlockDecode::EacRg11; break;
+    default: Panic( "Invalid compressed image format" );
+    }
+
+    const auto width = Width();
+    const auto height = Height();
+    auto bmp = std::make_unique<Bitmap>( width, height );
+    const auto dst = (uint32_t*)bmp->Data();
+    const auto src = (const uint64_t*)m_data;
+
+    if( !td )
+    {
+        decode( dst, src, width, height );
+    }
+    else
+    {
+        // Block rows are independent, both in the source and in the output
+        const auto rows = height / 4;
+        const auto blockSize = BlockSize( m_format );
+        const auto rowWords = size_t( width / 4 ) * blockSize / 8;
+        td->ParallelFor( rows, td->Grain( rows, size_t( width ) * ( 16 + blockSize / 4 ) ), [=]( size_t begin, size_t end ) {
+            decode( dst + begin * width * 4, src + begin * rowWords, width, ( end - begin ) * 4 );
+        } );
+    }
+
+    return bmp;
+}
+
+uint32_t CompressedBitmap::BlockSize( Format format )
+{
+    switch( format )
+    {
+    case Format::Bc1:
+    case Format::Bc4:
+    case Format::Etc1:
+    case Format::Etc2Rgb:
+    case Format::EacR11:
+        return 8;
+    default:
+        return 16;
+    }
+}
+
+size_t CompressedBitmap::LevelSize( Format format, uint32_t width, uint32_t height )
+{
+    return size_t( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * BlockSize( format );
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+class Bitmap;
+class DataBuffer;
+class TaskDispatch;
+
+// GPU block compressed image, referencing the data in place in the buffer it was loaded from.
+class CompressedBitmap
+{
+public:
+    enum class Format
+    {
+        Bc1,
+        Bc3,
+        Bc4,
+        Bc5,
+        Bc7,
+        Etc1,
+        Etc2Rgb,
+        Etc2Rgba,
+        EacR11,
+        EacRg11
+    };
+
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        size_t offset;
+        size_t size;
+    };
+
+    // Image data starts at offset in the buffer, with mip levels stored consecutively, largest
+    // first. Levels that are not fully contained in the buffer are dropped.
+    CompressedBitmap( std::shared_ptr<DataBuffer> buffer, size_t offset, Format format, uint32_t width, uint32_t height, uint32_t levels = 1 );
+    NoCopy( CompressedBitmap );
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Decode( TaskDispatch* td = nullptr ) const;
+
+    [[nodiscard]] uint32_t Width() const { return m_levels[0].width; }
+    [[nodiscard]] uint32_t Height() const { return m_levels[0].height; }
+    [[nodiscard]] Format GetFormat() const { return m_format; }
+    [[nodiscard]] const std::vector<Level>& Levels() const { return m_levels; }
+
+    // Data of all levels, level offsets are relative to it.
+    [[nodiscard]] const uint8_t* Data() const { return m_data; }
+    [[nodiscard]] size_t Size() const { return m_levels.back().offset + m_levels.back().size; }
+
+    // Size of a 4x4 pixel block in bytes.
+    [[nodiscard]] static uint32_t BlockSize( Format format );
+    [[nodiscard]] static size_t LevelSize( Format format, uint32_t width, uint32_t height );
+
+private:
+    std::shared_ptr<DataBuffer> m_buffer;
+    const uint8_t* m_data;
+
+    Format m_format;
+    std::vector<Level> m_levels;
+};
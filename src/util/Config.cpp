@@ -21,7 +21,7 @@ Config::~Config()
 
 std::string Config::GetPath( const char* name )
 {
-    if( strncmp( name, "./", 2 ) == 0 ) return name;
+    if( name[0] == '/' || strncmp( name, "./", 2 ) == 0 ) return name;
 
     std::string path;
     const auto xdgConfig = getenv( "XDG_CONFIG_HOME" );
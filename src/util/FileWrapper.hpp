@@ -12,6 +12,12 @@ public:
     {
     }
 
+    // Takes ownership of an already opened file
+    explicit FileWrapper( FILE* file )
+        : m_file( file )
+    {
+    }
+
     ~FileWrapper()
     {
         if( m_file ) fclose( m_file );
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <string.h>
+#include <string_view>
+#include <tracy/Tracy.hpp>
+
+#include "IccCache.hpp"
+
+IccProfile IccProfile::FromMemory( const void* data, size_t size )
+{
+    return IccProfile( Type::Memory, std::string( (const char*)data, size ) );
+}
+
+IccProfile IccProfile::Srgb()
+{
+    return IccProfile( Type::Srgb, {} );
+}
+
+IccProfile IccProfile::Rgb( const cmsCIExyY& white, const cmsCIExyYTRIPLE& primaries, double gamma )
+{
+    const double v[] = {
+        white.x, white.y, white.Y,
+        primaries.Red.x, primaries.Red.y, primaries.Red.Y,
+        primaries.Green.x, primaries.Green.y, primaries.Green.Y,
+        primaries.Blue.x, primaries.Blue.y, primaries.Blue.Y,
+        gamma
+    };
+    return IccProfile( Type::Rgb, std::string( (const char*)v, sizeof( v ) ) );
+}
+
+cmsHPROFILE IccProfile::Open() const
+{
+    switch( m_type )
+    {
+    case Type::Memory:
+        return cmsOpenProfileFromMem( m_data.data(), m_data.size() );
+    case Type::Srgb:
+        return cmsCreate_sRGBProfile();
+    case Type::Rgb:
+    {
+        double v[13];
+        memcpy( v, m_data.data(), sizeof( v ) );
+        const cmsCIExyY white = { v[0], v[1], v[2] };
+        const cmsCIExyYTRIPLE primaries = { { v[3], v[4], v[5] }, { v[6], v[7], v[8] }, { v[9], v[10], v[11] } };
+
+        auto curve = cmsBuildGamma( nullptr, v[12] );
+        cmsToneCurve* curve3[3] = { curve, curve, curve };
+        auto profile = cmsCreateRGBProfile( &white, &primaries, curve3 );
+        cmsFreeToneCurve( curve );
+        return profile;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+size_t IccProfile::Hash() const
+{
+    return std::hash<std::string_view>()( m_data ) ^ size_t( m_type );
+}
+
+IccCache::IccCache( size_t capacity )
+    : m_capacity( capacity )
+    , m_hits( 0 )
+    , m_misses( 0 )
+{
+}
+
+IccCache& IccCache::Instance()
+{
+    static IccCache cache( 32 );
+    return cache;
+}
+
+IccTransform IccCache::Get( const IccProfile& in, uint32_t inFormat, const IccProfile& out, uint32_t outFormat, uint32_t intent, uint32_t flags )
+{
+    ZoneScoped;
+
+    size_t hash = in.Hash();
+    for( auto v : { out.Hash(), size_t( inFormat ), size_t( outFormat ), size_t( intent ), size_t( flags ) } )
+    {
+        hash ^= v + 0x9e3779b97f4a7c15 + ( hash << 6 ) + ( hash >> 2 );
+    }
+
+    {
+        std::lock_guard lock( m_lock );
+        if( auto transform = Find( hash, in, inFormat, out, outFormat, intent, flags ) )
+        {
+            m_hits++;
+            TracyPlot( "ICC cache hits", int64_t( m_hits ) );
+            return transform;
+        }
+        m_misses++;
+        TracyPlot( "ICC cache misses", int64_t( m_misses ) );
+    }
+
+    // Transform creation is slow, it is done without holding the lock. If another thread creates
+    // the same transform in the meantime, its result is used.
+    auto profileIn = in.Open();
+    auto profileOut = out.Open();
+    cmsHTRANSFORM created = nullptr;
+    if( profileIn && profileOut ) created = cmsCreateTransform( profileIn, inFormat, profileOut, outFormat, intent, flags );
+    if( profileOut ) cmsCloseProfile( profileOut );
+    if( profileIn ) cmsCloseProfile( profileIn );
+    if( !created ) return nullptr;
+
+    IccTransform transform( created, []( void* ptr ) { cmsDeleteTransform( ptr ); } );
+
+    std::lock_guard lock( m_lock );
+    if( auto existing = Find( hash, in, inFormat, out, outFormat, intent, flags ) ) return existing;
+    if( m_capacity == 0 ) return transform;
+    if( m_entries.size() >= m_capacity ) m_entries.pop_back();
+    m_entries.insert( m_entries.begin(), Entry { hash, in, out, inFormat, outFormat, intent, flags, transform } );
+    return transform;
+}
+
+void IccCache::Clear()
+{
+    std::lock_guard lock( m_lock );
+    m_entries.clear();
+}
+
+size_t IccCache::Size() const
+{
+    std::lock_guard lock( m_lock );
+    return m_entries.size();
+}
+
+size_t IccCache::Hits() const
+{
+    std::lock_guard lock( m_lock );
+    return m_hits;
+}
+
+size_t IccCache::Misses() const
+{
+    std::lock_guard lock( m_lock );
+    return m_misses;
+}
+
+IccTransform IccCache::Find( size_t hash, const IccProfile& in, uint32_t inFormat, const IccProfile& out, uint32_t outFormat, uint32_t intent, uint32_t flags )
+{
+    auto it = std::find_if( m_entries.begin(), m_entries.end(), [&]( const Entry& e ) {
+        return e.hash == hash && e.inFormat == inFormat && e.outFormat == outFormat && e.intent == intent && e.flags == flags && e.in == in && e.out == out;
+    } );
+    if( it == m_entries.end() ) return nullptr;
+    std::rotate( m_entries.begin(), it, it + 1 );
+    return m_entries.front().transform;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <lcms2.h>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+// Description of a color profile transforms are created from. Profiles are identified by their
+// contents, so the same profile embedded in different images yields the same transform.
+class IccProfile
+{
+public:
+    // Embedded ICC profile data
+    static IccProfile FromMemory( const void* data, size_t size );
+
+    // sRGB, as provided by LittleCMS
+    static IccProfile Srgb();
+
+    // RGB with the given white point and primaries, and pure gamma transfer function
+    static IccProfile Rgb( const cmsCIExyY& white, const cmsCIExyYTRIPLE& primaries, double gamma );
+
+    // Returns a new LittleCMS profile, to be closed by the caller
+    [[nodiscard]] cmsHPROFILE Open() const;
+
+    [[nodiscard]] bool operator==( const IccProfile& other ) const { return m_type == other.m_type && m_data == other.m_data; }
+    [[nodiscard]] size_t Hash() const;
+
+private:
+    enum class Type : uint8_t
+    {
+        Memory,
+        Srgb,
+        Rgb
+    };
+
+    IccProfile( Type type, std::string data ) : m_type( type ), m_data( std::move( data ) ) {}
+
+    Type m_type;
+    std::string m_data;
+};
+
+// Transforms are shared between users of the cache, and may be used from multiple threads at once.
+// The transform stays valid after eviction from the cache, until the last reference is released.
+using IccTransform = std::shared_ptr<void>;
+
+// Bounded cache of LittleCMS transforms, to avoid creating the same transform for each image
+// loaded. Least recently used transforms are evicted first. Thread safe.
+class IccCache
+{
+public:
+    explicit IccCache( size_t capacity );
+    NoCopy( IccCache );
+
+    // Process-wide cache, used by the image loaders
+    [[nodiscard]] static IccCache& Instance();
+
+    // Returns nullptr if the transform can't be created. Failures are not cached.
+    [[nodiscard]] IccTransform Get( const IccProfile& in, uint32_t inFormat, const IccProfile& out, uint32_t outFormat, uint32_t intent, uint32_t flags = 0 );
+
+    void Clear();
+
+    [[nodiscard]] size_t Size() const;
+    [[nodiscard]] size_t Hits() const;
+    [[nodiscard]] size_t Misses() const;
+
+private:
+    struct Entry
+    {
+        size_t hash;
+        IccProfile in;
+        IccProfile out;
+        uint32_t inFormat;
+        uint32_t outFormat;
+        uint32_t intent;
+        uint32_t flags;
+        IccTransform transform;
+    };
+
+    [[nodiscard]] IccTransform Find( size_t hash, const IccProfile& in, uint32_t inFormat, const IccProfile& out, uint32_t outFormat, uint32_t intent, uint32_t flags );
+
+    size_t m_capacity;
+
+    // Most recently used first
+    std::vector<Entry> m_entries;
+    size_t m_hits;
+    size_t m_misses;
+    mutable std::mutex m_lock;
+};
@@ -0,0 +1,552 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "Ansi.hpp"
+#include "LogRecord.hpp"
+
+namespace LogRecord
+{
+
+namespace
+{
+
+enum class Kind : uint8_t
+{
+    String = 1,
+    Message,
+    Text
+};
+
+struct Header
+{
+    const char* fmt;
+    const char* fileName;
+    uint32_t line;
+    uint8_t level;
+    uint8_t count;
+};
+
+struct FileHeader
+{
+    uint32_t fmt;
+    uint32_t fileName;
+    uint32_t line;
+    uint8_t level;
+    uint8_t count;
+} __attribute__(( packed ));
+
+enum class Length
+{
+    None,
+    Char,
+    Short,
+    Long
+};
+
+// Single conversion of a format string. The text keeps flags, width and precision, including the
+// '*' markers, but not the length modifier and conversion character.
+struct Spec
+{
+    char text[32];
+    size_t len;
+    int stars;
+    bool starPrecision;
+    int precision;
+    Length length;
+    char conv;
+};
+
+// Parses a conversion, fmt points after the '%' and is moved past the conversion character.
+bool ParseSpec( const char*& fmt, Spec& spec )
+{
+    auto ptr = fmt;
+    spec.len = 0;
+    spec.stars = 0;
+    spec.starPrecision = false;
+    spec.precision = -1;
+    spec.length = Length::None;
+
+    auto put = [&spec]( char c ) {
+        if( spec.len == sizeof( spec.text ) - 4 ) return false;
+        spec.text[spec.len++] = c;
+        return true;
+    };
+
+    put( '%' );
+    while( *ptr && strchr( "-+ #0'", *ptr ) ) if( !put( *ptr++ ) ) return false;
+    if( *ptr == '*' )
+    {
+        put( *ptr++ );
+        spec.stars++;
+    }
+    else
+    {
+        while( *ptr >= '0' && *ptr <= '9' ) if( !put( *ptr++ ) ) return false;
+    }
+    if( *ptr == '.' )
+    {
+        if( !put( *ptr++ ) ) return false;
+        if( *ptr == '*' )
+        {
+            if( !put( *ptr++ ) ) return false;
+            spec.stars++;
+            spec.starPrecision = true;
+        }
+        else
+        {
+            spec.precision = 0;
+            while( *ptr >= '0' && *ptr <= '9' )
+            {
+                spec.precision = spec.precision * 10 + *ptr - '0';
+                if( !put( *ptr++ ) ) return false;
+            }
+        }
+    }
+
+    switch( *ptr )
+    {
+    case 'h':
+        ptr++;
+        if( *ptr == 'h' )
+        {
+            ptr++;
+            spec.length = Length::Char;
+        }
+        else
+        {
+            spec.length = Length::Short;
+        }
+        break;
+    case 'l':
+        ptr++;
+        if( *ptr == 'l' ) ptr++;
+        spec.length = Length::Long;
+        break;
+    case 'j':
+    case 'z':
+    case 't':
+    case 'q':
+    case 'L':
+        ptr++;
+        spec.length = Length::Long;
+        break;
+    default:
+        break;
+    }
+
+    if( !*ptr ) return false;
+    spec.conv = *ptr++;
+    fmt = ptr;
+    return true;
+}
+
+bool Consumes( char conv )
+{
+    return strchr( "diouxXceEfFgGaAspn", conv );
+}
+
+int64_t AsInt( const LogArg& arg )
+{
+    switch( arg.type )
+    {
+    case LogArg::Type::Int: return arg.i;
+    case LogArg::Type::UInt: return int64_t( arg.u );
+    case LogArg::Type::Double: return int64_t( arg.d );
+    default: return int64_t( intptr_t( arg.p ) );
+    }
+}
+
+uint64_t AsUInt( const LogArg& arg )
+{
+    return arg.type == LogArg::Type::UInt ? arg.u : uint64_t( AsInt( arg ) );
+}
+
+double AsDouble( const LogArg& arg )
+{
+    switch( arg.type )
+    {
+    case LogArg::Type::Int: return double( arg.i );
+    case LogArg::Type::UInt: return double( arg.u );
+    case LogArg::Type::Double: return arg.d;
+    default: return 0;
+    }
+}
+
+void AppendF( std::string& out, const char* fmt, ... )
+{
+    va_list args, copy;
+    va_start( args, fmt );
+    va_copy( copy, args );
+
+    char tmp[256];
+    const auto res = vsnprintf( tmp, sizeof( tmp ), fmt, args );
+    if( res >= 0 && size_t( res ) < sizeof( tmp ) )
+    {
+        out.append( tmp, res );
+    }
+    else if( res >= 0 )
+    {
+        const auto pos = out.size();
+        out.resize( pos + res );
+        vsnprintf( out.data() + pos, res + 1, fmt, copy );
+    }
+
+    va_end( copy );
+    va_end( args );
+}
+
+template<typename T>
+void AppendSpec( std::string& out, const Spec& spec, const char* suffix, const int* stars, T value )
+{
+    char fmt[40];
+    memcpy( fmt, spec.text, spec.len );
+    strcpy( fmt + spec.len, suffix );
+
+    switch( spec.stars )
+    {
+    case 0: AppendF( out, fmt, value ); break;
+    case 1: AppendF( out, fmt, stars[0], value ); break;
+    default: AppendF( out, fmt, stars[0], stars[1], value ); break;
+    }
+}
+
+void Put( std::string& out, const void* data, size_t size )
+{
+    out.append( (const char*)data, size );
+}
+
+template<typename T>
+void Put( std::string& out, T value )
+{
+    out.append( (const char*)&value, sizeof( T ) );
+}
+
+template<typename T>
+bool Get( const char*& ptr, const char* end, T& value )
+{
+    if( size_t( end - ptr ) < sizeof( T ) ) return false;
+    memcpy( &value, ptr, sizeof( T ) );
+    ptr += sizeof( T );
+    return true;
+}
+
+void EncodeArg( std::string& out, const LogArg& arg )
+{
+    Put( out, arg.type );
+    Put( out, arg.size );
+    Put( out, arg.u );
+}
+
+// Strings are stored with a terminator, so the decoded argument can point into the record
+void EncodeString( std::string& out, const LogArg& arg, int precision )
+{
+    if( arg.type != LogArg::Type::Pointer || !arg.p )
+    {
+        EncodeArg( out, arg );
+        return;
+    }
+
+    const auto str = (const char*)arg.p;
+    const auto len = uint32_t( precision >= 0 ? strnlen( str, precision ) : strlen( str ) );
+    Put( out, LogArg::Type::String );
+    Put( out, uint8_t( 0 ) );
+    Put( out, len );
+    Put( out, str, len );
+    out.push_back( '\0' );
+}
+
+bool ReadArgs( const char*& ptr, const char* end, LogArg* args, size_t count )
+{
+    for( size_t i=0; i<count; i++ )
+    {
+        auto& arg = args[i];
+        if( !Get( ptr, end, arg.type ) || !Get( ptr, end, arg.size ) ) return false;
+        if( arg.type == LogArg::Type::String )
+        {
+            uint32_t len;
+            if( !Get( ptr, end, len ) || size_t( end - ptr ) <= len || ptr[len] != '\0' ) return false;
+            arg.p = ptr;
+            ptr += len + 1;
+        }
+        else if( arg.type <= LogArg::Type::Pointer )
+        {
+            if( !Get( ptr, end, arg.u ) ) return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool FormatPrefix( std::string& out, LogLevel level, const char* fileName, size_t line )
+{
+    switch( level )
+    {
+    case LogLevel::Callstack: out += ANSI_CYAN "[STACK] "; break;
+    case LogLevel::Debug: out += ANSI_BOLD ANSI_BLACK "[DEBUG] "; break;
+    case LogLevel::Info: out += " [INFO] "; break;
+    case LogLevel::Warning: out += ANSI_BOLD ANSI_YELLOW " [WARN] "; break;
+    case LogLevel::Error:
+    case LogLevel::ErrorTrace: out += ANSI_BOLD ANSI_RED "[ERROR] "; break;
+    case LogLevel::Fatal: out += ANSI_BOLD ANSI_MAGENTA "[FATAL] "; break;
+    default: return false;
+    }
+
+    constexpr int FnLen = 20;
+    const auto len = strlen( fileName );
+    if( len > FnLen )
+    {
+        AppendF( out, "…%s:%-4zu│ ", fileName + len - FnLen - 1, line );
+    }
+    else
+    {
+        AppendF( out, "%*s:%-4zu%*s│ ", FnLen, fileName, line, int( FnLen - len + 2 ), "" );
+    }
+    return true;
+}
+
+void FormatMessage( std::string& out, const char* fmt, const LogArg* args, size_t count )
+{
+    size_t idx = 0;
+    while( *fmt )
+    {
+        const auto pct = strchr( fmt, '%' );
+        if( !pct )
+        {
+            out.append( fmt );
+            break;
+        }
+        out.append( fmt, pct - fmt );
+        if( pct[1] == '%' )
+        {
+            out.push_back( '%' );
+            fmt = pct + 2;
+            continue;
+        }
+
+        fmt = pct + 1;
+        Spec spec;
+        if( !ParseSpec( fmt, spec ) )
+        {
+            out.append( pct );
+            break;
+        }
+        if( !Consumes( spec.conv ) || idx + spec.stars >= count )
+        {
+            // Unknown conversion or missing argument
+            out.append( pct, fmt - pct );
+            continue;
+        }
+
+        int stars[2];
+        for( int i=0; i<spec.stars; i++ ) stars[i] = int( AsInt( args[idx++] ) );
+        const auto& arg = args[idx++];
+
+        // Integers are printed at full width after reducing them to the size the conversion reads
+        switch( spec.conv )
+        {
+        case 'd':
+        case 'i':
+        {
+            auto v = AsInt( arg );
+            switch( spec.length )
+            {
+            case Length::Char: v = int8_t( v ); break;
+            case Length::Short: v = int16_t( v ); break;
+            case Length::None: v = int32_t( v ); break;
+            default: break;
+            }
+            AppendSpec( out, spec, spec.conv == 'd' ? "lld" : "lli", stars, (long long)v );
+            break;
+        }
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        {
+            auto v = AsUInt( arg );
+            switch( spec.length )
+            {
+            case Length::Char: v = uint8_t( v ); break;
+            case Length::Short: v = uint16_t( v ); break;
+            case Length::None: v = uint32_t( v ); break;
+            default: break;
+            }
+            const char suffix[] = { 'l', 'l', spec.conv, '\0' };
+            AppendSpec( out, spec, suffix, stars, (unsigned long long)v );
+            break;
+        }
+        case 'c':
+            AppendSpec( out, spec, "c", stars, int( AsInt( arg ) ) );
+            break;
+        case 's':
+        {
+            const auto str = arg.type >= LogArg::Type::Pointer && arg.p ? (const char*)arg.p : "(null)";
+            AppendSpec( out, spec, "s", stars, str );
+            break;
+        }
+        case 'p':
+            AppendSpec( out, spec, "p", stars, arg.p );
+            break;
+        case 'n':
+            break;
+        default:
+        {
+            const char suffix[] = { spec.conv, '\0' };
+            AppendSpec( out, spec, suffix, stars, AsDouble( arg ) );
+            break;
+        }
+        }
+    }
+}
+
+void Encode( std::string& out, LogLevel level, const char* fileName, size_t line, const char* fmt, const LogArg* args, size_t count )
+{
+    const Header hdr = { fmt, fileName, uint32_t( line ), uint8_t( level ), uint8_t( count ) };
+    Put( out, hdr );
+
+    // Follows FormatMessage, to know which arguments are strings and how much of them is printed
+    size_t idx = 0;
+    auto ptr = fmt;
+    while( idx < count && ( ptr = strchr( ptr, '%' ) ) )
+    {
+        ptr++;
+        if( *ptr == '%' )
+        {
+            ptr++;
+            continue;
+        }
+
+        Spec spec;
+        if( !ParseSpec( ptr, spec ) ) break;
+        if( !Consumes( spec.conv ) || idx + spec.stars >= count ) continue;
+
+        auto precision = spec.precision;
+        for( int i=0; i<spec.stars; i++ )
+        {
+            if( spec.starPrecision && i == spec.stars - 1 ) precision = int( AsInt( args[idx] ) );
+            EncodeArg( out, args[idx++] );
+        }
+        if( spec.conv == 's' ) EncodeString( out, args[idx++], precision );
+        else EncodeArg( out, args[idx++] );
+    }
+    while( idx < count ) EncodeArg( out, args[idx++] );
+}
+
+bool Format( std::string& out, const char* data, size_t size )
+{
+    Header hdr;
+    auto ptr = data;
+    const auto end = data + size;
+    if( !Get( ptr, end, hdr ) ) return false;
+
+    LogArg args[256];
+    if( !ReadArgs( ptr, end, args, hdr.count ) ) return false;
+    if( !FormatPrefix( out, LogLevel( hdr.level ), hdr.fileName, hdr.line ) ) return false;
+    FormatMessage( out, hdr.fmt, args, hdr.count );
+    out += ANSI_RESET "\n";
+    return true;
+}
+
+void FileWriter::Begin( std::string& out )
+{
+    m_strings.clear();
+    Put( out, FileMagic, sizeof( FileMagic ) );
+    Put( out, FileVersion );
+}
+
+bool FileWriter::Write( std::string& out, const char* data, size_t size )
+{
+    Header hdr;
+    auto ptr = data;
+    if( !Get( ptr, data + size, hdr ) ) return false;
+
+    const FileHeader fhdr = { Intern( out, hdr.fmt ), Intern( out, hdr.fileName ), hdr.line, hdr.level, hdr.count };
+    Put( out, Kind::Message );
+    Put( out, fhdr );
+    Put( out, ptr, data + size - ptr );
+    return true;
+}
+
+void FileWriter::WriteText( std::string& out, const char* text, size_t size )
+{
+    Put( out, Kind::Text );
+    Put( out, uint32_t( size ) );
+    Put( out, text, size );
+}
+
+uint32_t FileWriter::Intern( std::string& out, const char* str )
+{
+    auto it = m_strings.find( str );
+    if( it != m_strings.end() ) return it->second;
+
+    const auto id = uint32_t( m_strings.size() );
+    const auto len = uint32_t( strlen( str ) );
+    m_strings.emplace( str, id );
+    Put( out, Kind::String );
+    Put( out, id );
+    Put( out, len );
+    Put( out, str, len );
+    return id;
+}
+
+bool Decode( std::string& out, const char* data, size_t size )
+{
+    auto ptr = data;
+    const auto end = data + size;
+
+    char magic[sizeof( FileMagic )];
+    uint32_t version;
+    if( !Get( ptr, end, magic ) || memcmp( magic, FileMagic, sizeof( FileMagic ) ) != 0 ) return false;
+    if( !Get( ptr, end, version ) || version != FileVersion ) return false;
+
+    std::vector<std::string> strings;
+    LogArg args[256];
+    while( ptr < end )
+    {
+        Kind kind;
+        Get( ptr, end, kind );
+        switch( kind )
+        {
+        case Kind::String:
+        {
+            uint32_t id, len;
+            if( !Get( ptr, end, id ) || !Get( ptr, end, len ) ) return false;
+            if( id != strings.size() || size_t( end - ptr ) < len ) return false;
+            strings.emplace_back( ptr, len );
+            ptr += len;
+            break;
+        }
+        case Kind::Message:
+        {
+            FileHeader hdr;
+            if( !Get( ptr, end, hdr ) ) return false;
+            if( hdr.fmt >= strings.size() || hdr.fileName >= strings.size() ) return false;
+            if( !ReadArgs( ptr, end, args, hdr.count ) ) return false;
+            if( !FormatPrefix( out, LogLevel( hdr.level ), strings[hdr.fileName].c_str(), hdr.line ) ) return false;
+            FormatMessage( out, strings[hdr.fmt].c_str(), args, hdr.count );
+            out += ANSI_RESET "\n";
+            break;
+        }
+        case Kind::Text:
+        {
+            uint32_t len;
+            if( !Get( ptr, end, len ) || size_t( end - ptr ) < len ) return false;
+            out.append( ptr, len );
+            ptr += len;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include "Logs.hpp"
+
+// Log messages with deferred formatting. The calling thread only captures the arguments, the text
+// is produced by the log writer, or offline from a binary log file.
+namespace LogRecord
+{
+
+constexpr char FileMagic[8] = { 'm', 'c', 'o', 'r', 'e', 'l', 'o', 'g' };
+constexpr uint32_t FileVersion = 1;
+
+// Level marker and source location, as printed in front of each message. Fails on invalid level.
+bool FormatPrefix( std::string& out, LogLevel level, const char* fileName, size_t line );
+
+// Appends printf style text, taking the values from captured arguments
+void FormatMessage( std::string& out, const char* fmt, const LogArg* args, size_t count );
+
+// In-process record. Format string and file name are kept as pointers, strings printed with %s
+// are copied.
+void Encode( std::string& out, LogLevel level, const char* fileName, size_t line, const char* fmt, const LogArg* args, size_t count );
+
+// Appends the full output line of an in-process record
+bool Format( std::string& out, const char* data, size_t size );
+
+// Converts records to the binary file format. Format strings and file names are written once, on
+// first use, and then referenced by index.
+class FileWriter
+{
+public:
+    void Begin( std::string& out );
+    bool Write( std::string& out, const char* data, size_t size );
+    void WriteText( std::string& out, const char* text, size_t size );
+
+private:
+    uint32_t Intern( std::string& out, const char* str );
+
+    std::unordered_map<const char*, uint32_t> m_strings;
+};
+
+// Appends text of a binary log file. Returns false if the data is not a log, or if it is damaged or
+// truncated, in which case everything before the bad record is still decoded.
+bool Decode( std::string& out, const char* data, size_t size );
+
+}
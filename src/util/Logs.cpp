@@ -1,12 +1,16 @@
 #include <assert.h>
+#include <atomic>
 #include <mutex>
-#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <thread>
 #include <tracy/Tracy.hpp>
 
 #include "Ansi.hpp"
 #include "Callstack.hpp"
+#include "LogRecord.hpp"
 #include "Logs.hpp"
 #include "Panic.hpp"
 
@@ -15,7 +19,55 @@ namespace
 LogLevel s_logLevel = LogLevel::Info;
 bool s_logSynchronized = false;
 FILE* s_logFile = nullptr;
+LogFileFormat s_logFileFormat = LogFileFormat::Text;
+LogRecord::FileWriter s_logFileWriter;
 TracyLockableN( std::recursive_mutex, s_logLock, "Logger" );
+
+// Set while the thread writes output directly, under the log lock
+thread_local int t_direct = 0;
+
+// Formatted line or record, reused by all messages of a thread
+thread_local std::string t_line;
+thread_local std::string t_record;
+
+// Multi-producer, single consumer ring of records. Producers only touch atomics. The
+// consumer role belongs to whoever holds the log lock, which is normally the writer thread.
+constexpr size_t RingSize = 1024;
+constexpr size_t SlotInline = 240;
+
+struct Slot
+{
+    std::atomic<size_t> seq;
+    uint32_t size;
+    char* ext;
+    char text[SlotInline];
+};
+
+struct Ring
+{
+    Ring()
+    {
+        for( size_t i=0; i<RingSize; i++ ) slots[i].seq.store( i, std::memory_order_relaxed );
+    }
+
+    alignas( 64 ) std::atomic<size_t> head = 0;
+    alignas( 64 ) size_t tail = 0;
+    Slot slots[RingSize];
+};
+
+Ring s_ring;
+std::atomic<bool> s_async = false;
+std::atomic<size_t> s_dropped = 0;
+
+std::thread s_writer;
+std::atomic<bool> s_writerStop = false;
+std::atomic<bool> s_writerIdle = false;
+std::atomic<uint32_t> s_writerWake = 0;
+
+// Only used by the consumer
+constexpr size_t BatchSize = 64 * 1024;
+std::string s_batch;
+std::string s_fileBatch;
 }
 
 void SetLogLevel( LogLevel level )
@@ -28,13 +80,21 @@ void SetLogSynchronized( bool sync )
     s_logSynchronized = sync;
 }
 
-void SetLogToFile( bool enabled )
+void SetLogToFile( bool enabled, LogFileFormat format )
 {
     std::lock_guard lock( s_logLock );
+    LogFlush();
     if( enabled )
     {
         assert( !s_logFile );
-        s_logFile = fopen( "mcore.log", "w" );
+        s_logFile = fopen( "mcore.log", "wb" );
+        s_logFileFormat = format;
+        if( s_logFile && format == LogFileFormat::Binary )
+        {
+            std::string header;
+            s_logFileWriter.Begin( header );
+            fwrite( header.data(), 1, header.size(), s_logFile );
+        }
     }
     else
     {
@@ -61,96 +121,291 @@ void LogBlockEnd()
 
 namespace
 {
-void PrintLevel( LogLevel level )
+// Writes a formatted line, must be called with the log lock held
+void WriteOut( const char* text, size_t size )
+{
+    fwrite( text, 1, size, stdout );
+    fflush( stdout );
+    if( s_logFile )
+    {
+        if( s_logFileFormat == LogFileFormat::Binary )
+        {
+            s_logFileWriter.WriteText( s_fileBatch, text, size );
+            fwrite( s_fileBatch.data(), 1, s_fileBatch.size(), s_logFile );
+            s_fileBatch.clear();
+        }
+        else
+        {
+            fwrite( text, 1, size, s_logFile );
+        }
+        fflush( s_logFile );
+    }
+}
+
+void WriteBatch( bool flush )
+{
+    fwrite( s_batch.data(), 1, s_batch.size(), stdout );
+    if( s_logFile ) fwrite( s_fileBatch.data(), 1, s_fileBatch.size(), s_logFile );
+    s_batch.clear();
+    s_fileBatch.clear();
+    if( flush )
+    {
+        fflush( stdout );
+        if( s_logFile ) fflush( s_logFile );
+    }
+}
+
+// Must be called with the log lock held. Formats and writes out everything that is ready in the ring.
+// Slots below the until position that were claimed, but not yet published, are waited for.
+void Drain( size_t until = 0 )
 {
-    const char* str = nullptr;
+    bool any = false;
+    for(;;)
+    {
+        auto& slot = s_ring.slots[s_ring.tail % RingSize];
+        if( slot.seq.load( std::memory_order_acquire ) != s_ring.tail + 1 )
+        {
+            if( s_ring.tail >= until ) break;
+            std::this_thread::yield();
+            continue;
+        }
 
-    switch( level )
+        const auto data = slot.ext ? slot.ext : slot.text;
+        const auto offset = s_batch.size();
+        LogRecord::Format( s_batch, data, slot.size );
+        if( s_logFile )
+        {
+            if( s_logFileFormat == LogFileFormat::Binary ) s_logFileWriter.Write( s_fileBatch, data, slot.size );
+            else s_fileBatch.append( s_batch, offset );
+        }
+        free( slot.ext );
+
+        slot.seq.store( s_ring.tail + RingSize, std::memory_order_release );
+        s_ring.tail++;
+        any = true;
+        if( s_batch.size() >= BatchSize ) WriteBatch( false );
+    }
+
+    if( const auto dropped = s_dropped.exchange( 0, std::memory_order_relaxed ); dropped != 0 )
     {
-    case LogLevel::Callstack: str = ANSI_CYAN "[STACK] "; break;
-    case LogLevel::Debug: str = ANSI_BOLD ANSI_BLACK "[DEBUG] "; break;
-    case LogLevel::Info: str = " [INFO] "; break;
-    case LogLevel::Warning: str = ANSI_BOLD ANSI_YELLOW " [WARN] "; break;
-    case LogLevel::Error:
-    case LogLevel::ErrorTrace: str = ANSI_BOLD ANSI_RED "[ERROR] "; break;
-    case LogLevel::Fatal: str = ANSI_BOLD ANSI_MAGENTA "[FATAL] "; break;
-    default: Panic( "Invalid log level %d", int( level ) );
+        char tmp[128];
+        const auto len = snprintf( tmp, sizeof( tmp ), ANSI_BOLD ANSI_YELLOW " [WARN] " ANSI_RESET "%zu log messages dropped\n", dropped );
+        s_batch.append( tmp, len );
+        if( s_logFile )
+        {
+            if( s_logFileFormat == LogFileFormat::Binary ) s_logFileWriter.WriteText( s_fileBatch, tmp, len );
+            else s_fileBatch.append( tmp, len );
+        }
+        any = true;
     }
 
-    printf( "%s", str );
-    if( s_logFile ) fprintf( s_logFile, "%s", str );
+    if( any ) WriteBatch( true );
 }
 
-void PrintSourceLocation( FILE* f, const char* fileName, size_t len, size_t line )
+// Returns false if the ring is full
+bool Enqueue( const char* text, size_t size )
 {
-    constexpr int FnLen = 20;
-    if( len > FnLen )
+    auto pos = s_ring.head.load( std::memory_order_relaxed );
+    Slot* slot;
+    for(;;)
     {
-        fprintf( f, "…%s:%-4zu│ ", fileName + len - FnLen - 1, line );
+        slot = &s_ring.slots[pos % RingSize];
+        const auto seq = slot->seq.load( std::memory_order_acquire );
+        const auto diff = intptr_t( seq ) - intptr_t( pos );
+        if( diff == 0 )
+        {
+            if( s_ring.head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) break;
+        }
+        else if( diff < 0 )
+        {
+            return false;
+        }
+        else
+        {
+            pos = s_ring.head.load( std::memory_order_relaxed );
+        }
+    }
+
+    slot->size = uint32_t( size );
+    if( size > SlotInline )
+    {
+        slot->ext = (char*)malloc( size );
+        memcpy( slot->ext, text, size );
     }
     else
     {
-        fprintf( f, "%*s:%-4zu%*s│ ", FnLen, fileName, line, int( FnLen - len + 2 ), "" );
+        slot->ext = nullptr;
+        memcpy( slot->text, text, size );
     }
+    slot->seq.store( pos + 1, std::memory_order_release );
+
+    // Pairs with the fence in the writer, so either the writer sees this message or we see it idle
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if( s_writerIdle.load( std::memory_order_relaxed ) && s_writerIdle.exchange( false, std::memory_order_relaxed ) )
+    {
+        s_writerWake.fetch_add( 1, std::memory_order_relaxed );
+        s_writerWake.notify_one();
+    }
+    return true;
 }
+
+bool RingEmpty()
+{
+    const auto& slot = s_ring.slots[s_ring.tail % RingSize];
+    return slot.seq.load( std::memory_order_acquire ) != s_ring.tail + 1;
 }
 
-void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char *fmt, ... )
+void Writer()
 {
-    if( level != LogLevel::Callstack && level < s_logLevel ) return;
+    tracy::SetThreadName( "Log writer" );
+    for(;;)
+    {
+        {
+            std::lock_guard lock( s_logLock );
+            Drain();
+        }
+
+        const auto wake = s_writerWake.load( std::memory_order_relaxed );
+        s_writerIdle.store( true, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        // Recheck after announcing idle, a producer that did not see the flag has published already
+        bool empty;
+        {
+            std::lock_guard lock( s_logLock );
+            empty = RingEmpty();
+        }
+        if( s_writerStop.load( std::memory_order_relaxed ) ) break;
+        if( empty ) s_writerWake.wait( wake, std::memory_order_relaxed );
+        s_writerIdle.store( false, std::memory_order_relaxed );
+    }
+
+    std::lock_guard lock( s_logLock );
+    Drain();
+}
+
+void StopWriter()
+{
+    if( !s_writer.joinable() ) return;
+    s_writerStop.store( true, std::memory_order_relaxed );
+    s_writerWake.fetch_add( 1, std::memory_order_relaxed );
+    s_writerWake.notify_one();
+    s_writer.join();
+    s_writerStop.store( false, std::memory_order_relaxed );
+}
 
-    va_list args;
-    va_start( args, fmt );
-    const auto len = strlen( fileName );
+// Anything still queued at exit is written out
+struct WriterGuard
+{
+    ~WriterGuard()
+    {
+        SetLogAsync( false );
+        LogFlush();
+    }
+} s_writerGuard;
+}
+
+void SetLogAsync( bool async )
+{
+    if( async == s_async.load( std::memory_order_relaxed ) ) return;
+    if( async )
+    {
+        s_async.store( true, std::memory_order_relaxed );
+        s_writer = std::thread( Writer );
+    }
+    else
+    {
+        s_async.store( false, std::memory_order_relaxed );
+        StopWriter();
+    }
+}
+
+void LogFlush()
+{
+    std::lock_guard lock( s_logLock );
+    Drain( s_ring.head.load( std::memory_order_acquire ) );
+}
+
+void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char* fmt, const LogArg* args, size_t count )
+{
+    if( level != LogLevel::Callstack && level < s_logLevel ) return;
+    if( level > LogLevel::Fatal ) Panic( "Invalid log level %d", int( level ) );
 
 #ifndef DISABLE_CALLSTACK
     // Get callstack outside of lock
     const bool printCallstack = level >= LogLevel::ErrorTrace || ( level >= LogLevel::Error && s_logLevel <= LogLevel::Callstack );
     CallstackData stack;
     if( printCallstack ) stack.count = backtrace( stack.addr, 64 );
+#else
+    constexpr bool printCallstack = false;
 #endif
 
-    s_logLock.lock();
-    PrintLevel( level );
-    PrintSourceLocation( stdout, fileName, len, line );
-    vprintf( fmt, args );
-    printf( ANSI_RESET "\n" );
-    fflush( stdout );
-    if( s_logFile )
+    const bool deferred = s_async.load( std::memory_order_relaxed ) && !t_direct && !printCallstack && level != LogLevel::Fatal;
+
+    [[maybe_unused]] size_t msgOffset = 0;
+    t_line.clear();
+    if( !deferred )
     {
-        va_end( args );
-        va_start( args, fmt );
-        PrintSourceLocation( s_logFile, fileName, len, line );
-        vfprintf( s_logFile, fmt, args );
-        fprintf( s_logFile, ANSI_RESET "\n" );
-        fflush( s_logFile );
+        LogRecord::FormatPrefix( t_line, level, fileName, line );
+        msgOffset = t_line.size();
+        LogRecord::FormatMessage( t_line, fmt, args, count );
+    }
+#ifdef TRACY_ENABLE
+    else if( level != LogLevel::Callstack )
+    {
+        // Tracy needs the text right away
+        LogRecord::FormatMessage( t_line, fmt, args, count );
+    }
+
+    if( level != LogLevel::Callstack && t_line.size() > msgOffset )
+    {
+        const auto tmp = t_line.data() + msgOffset;
+        const auto res = t_line.size() - msgOffset;
+        switch( level )
+        {
+        case LogLevel::Debug: TracyMessageC( tmp, res, 0x888888 ); break;
+        case LogLevel::Info: TracyMessage( tmp, res ); break;
+        case LogLevel::Warning: TracyMessageC( tmp, res, 0xFFFF00 ); break;
+        case LogLevel::Error: TracyMessageCS( tmp, res, 0xFF0000, 64 ); break;
+        case LogLevel::ErrorTrace: TracyMessageCS( tmp, res, 0xFF0000, 64 ); break;
+        case LogLevel::Fatal: TracyMessageCS( tmp, res, 0xFF00FF, 64 ); break;
+        default: break;
+        }
     }
-#ifndef DISABLE_CALLSTACK
-    if( printCallstack ) PrintCallstack( stack, 1 );
 #endif
-    s_logLock.unlock();
-    va_end( args );
 
-#ifdef TRACY_ENABLE
-    if( level != LogLevel::Callstack )
+    if( deferred )
     {
-        va_start( args, fmt );
-        char tmp[8*1024];
-        const auto res = vsnprintf( tmp, sizeof( tmp ), fmt, args );
-        if( res > 0 )
+        t_record.clear();
+        LogRecord::Encode( t_record, level, fileName, line, fmt, args, count );
+
+        // Synchronized mode must still block while another thread is inside a log block
+        std::unique_lock<decltype( s_logLock )> lock;
+        if( s_logSynchronized ) lock = std::unique_lock( s_logLock );
+
+        while( !Enqueue( t_record.data(), t_record.size() ) )
         {
-            switch( level )
+            if( level < LogLevel::Warning )
             {
-            case LogLevel::Debug: TracyMessageC( tmp, res, 0x888888 ); break;
-            case LogLevel::Info: TracyMessage( tmp, res ); break;
-            case LogLevel::Warning: TracyMessageC( tmp, res, 0xFFFF00 ); break;
-            case LogLevel::Error: TracyMessageCS( tmp, res, 0xFF0000, 64 ); break;
-            case LogLevel::ErrorTrace: TracyMessageCS( tmp, res, 0xFF0000, 64 ); break;
-            case LogLevel::Fatal: TracyMessageCS( tmp, res, 0xFF00FF, 64 ); break;
-            default: Panic( "Invalid log level %d", int( level ) );
+                s_dropped.fetch_add( 1, std::memory_order_relaxed );
+                break;
             }
+            LogFlush();
         }
-        va_end( args );
     }
+    else
+    {
+        t_line += ANSI_RESET "\n";
+
+        // Queued messages go first, so the output stays in order. This includes the ones still being
+        // copied into the ring by other threads, as they may be ahead of messages this thread queued.
+        std::lock_guard lock( s_logLock );
+        Drain( s_ring.head.load( std::memory_order_acquire ) );
+        t_direct++;
+        WriteOut( t_line.data(), t_line.size() );
+#ifndef DISABLE_CALLSTACK
+        if( printCallstack ) PrintCallstack( stack, 1 );
 #endif
+        t_direct--;
+    }
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
 
 enum class LogLevel
 {
@@ -13,15 +15,88 @@ enum class LogLevel
     Fatal
 };
 
+enum class LogFileFormat
+{
+    Text,
+    Binary      // Decoded with the logdecode tool. Outside of async mode messages are formatted
+                // before they are logged, and stored as text records
+};
+
 void SetLogLevel( LogLevel level );
 void SetLogSynchronized( bool sync );
-void SetLogToFile( bool enabled );
+void SetLogToFile( bool enabled, LogFileFormat format = LogFileFormat::Text );
+
+// In async mode the calling thread only captures the message arguments. Formatting and output is
+// done in batches by a background thread. Order is kept per thread. Debug and info messages are
+// dropped when the queue is full, fatal messages and callstacks are written directly, after
+// everything queued before.
+void SetLogAsync( bool async );
+void LogFlush();
 
 LogLevel GetLogLevel();
 
 void LogBlockBegin();
 void LogBlockEnd();
 
-void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char* fmt, ... );
+// Captured printf argument
+struct LogArg
+{
+    enum class Type : uint8_t
+    {
+        Int,
+        UInt,
+        Double,
+        Pointer,
+        String
+    };
+
+    template<typename T>
+    static LogArg Make( T v )
+    {
+        if constexpr( std::is_enum_v<T> ) return Make( std::underlying_type_t<T>( v ) );
+        else if constexpr( std::is_floating_point_v<T> ) return { .type = Type::Double, .size = sizeof( T ), .d = double( v ) };
+        else if constexpr( std::is_integral_v<T> && std::is_signed_v<T> ) return { .type = Type::Int, .size = sizeof( T ), .i = v };
+        else if constexpr( std::is_integral_v<T> ) return { .type = Type::UInt, .size = sizeof( T ), .u = v };
+        else if constexpr( std::is_pointer_v<T> || std::is_null_pointer_v<T> ) return { .type = Type::Pointer, .size = sizeof( T ), .p = (const void*)v };
+        else static_assert( !sizeof( T ), "Unsupported log argument type" );
+    }
+
+    Type type;
+    uint8_t size;
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const void* p;
+    };
+};
+
+void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char* fmt, const LogArg* args, size_t count );
+
+template<typename... Args>
+inline void MCoreLog( LogLevel level, const char* fileName, size_t line, const char* fmt, Args... args )
+{
+    static_assert( sizeof...( Args ) < 256, "Too many log arguments" );
+    if constexpr( sizeof...( Args ) == 0 )
+    {
+        MCoreLogMessage( level, fileName, line, fmt, nullptr, 0 );
+    }
+    else
+    {
+        const LogArg list[] = { LogArg::Make( args )... };
+        MCoreLogMessage( level, fileName, line, fmt, list, sizeof...( Args ) );
+    }
+}
+
+// Only used to have the compiler check format strings against the arguments
+[[gnu::format( printf, 1, 2 )]] inline void MCoreLogCheckFormat( const char*, ... ) {}
 
-#define mclog(level, fmt, ...) MCoreLogMessage( level, __FILE__, __LINE__, fmt, ##__VA_ARGS__ )
+// Format strings must be literals, binary logs reference them by address
+#define mclog( level, fmt, ... ) \
+    do \
+    { \
+        if( false ) MCoreLogCheckFormat( fmt, ##__VA_ARGS__ ); \
+        MCoreLog( level, __FILE__, __LINE__, "" fmt, ##__VA_ARGS__ ); \
+    } \
+    while( 0 )
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
+
+#include "Bitmap.hpp"
+#include "BitmapHdr.hpp"
+#include "BitmapHdrHalf.hpp"
+#include "MipChainBuilder.hpp"
+#include "Panic.hpp"
+#include "PixelBytes.hpp"
+#include "TaskDispatch.hpp"
+
+// Number of levels a band of source rows is reduced through before the remaining levels are built
+// from the last one. Bands are aligned to 2^BandLevels rows.
+constexpr uint32_t BandLevels = 5;
+
+namespace
+{
+
+struct SrgbTables
+{
+    float linear[256];
+
+    // Linear value at which encoding rounds up to the given sRGB value
+    float threshold[257];
+
+    // Lowest sRGB value in each 1/4096 wide range of linear values. Thresholds are further apart
+    // than that, so at most one of them falls within a range.
+    uint8_t start[4096];
+
+    [[nodiscard]] uint8_t Encode( float v ) const
+    {
+        const auto idx = std::min( uint32_t( std::clamp( v, 0.f, 1.f ) * 4096.f ), 4095u );
+        const auto c = start[idx];
+        return c + ( v >= threshold[c+1] );
+    }
+};
+
+const SrgbTables& Srgb()
+{
+    static const SrgbTables tables = [] {
+        auto toLinear = []( double v ) { return v <= 0.04045 ? v / 12.92 : std::pow( ( v + 0.055 ) / 1.055, 2.4 ); };
+
+        SrgbTables t;
+        for( int i=0; i<256; i++ ) t.linear[i] = float( toLinear( i / 255.0 ) );
+        t.threshold[0] = 0;
+        for( int i=1; i<256; i++ ) t.threshold[i] = float( toLinear( ( i - 0.5 ) / 255.0 ) );
+        t.threshold[256] = std::numeric_limits<float>::infinity();
+
+        int c = 0;
+        for( int i=0; i<4096; i++ )
+        {
+            while( i / 4096.f >= t.threshold[c+1] ) c++;
+            t.start[i] = uint8_t( c );
+        }
+        return t;
+    }();
+    return tables;
+}
+
+void DecodeSrgb( float* dst, const uint8_t* src, uint32_t width, const SrgbTables& srgb )
+{
+    for( size_t i=0; i<size_t( width ) * 4; i+=4 )
+    {
+        dst[i+0] = srgb.linear[src[i+0]];
+        dst[i+1] = srgb.linear[src[i+1]];
+        dst[i+2] = srgb.linear[src[i+2]];
+        dst[i+3] = src[i+3] * ( 1.f / 255.f );
+    }
+}
+
+void EncodeSrgb( uint8_t* dst, const float* src, uint32_t width, const SrgbTables& srgb )
+{
+    for( size_t i=0; i<size_t( width ) * 4; i+=4 )
+    {
+        dst[i+0] = srgb.Encode( src[i+0] );
+        dst[i+1] = srgb.Encode( src[i+1] );
+        dst[i+2] = srgb.Encode( src[i+2] );
+        dst[i+3] = uint8_t( std::clamp( src[i+3], 0.f, 1.f ) * 255.f + 0.5f );
+    }
+}
+
+void StoreHdr( uint8_t* dst, const float* src, size_t pixels, bool half )
+{
+    if( half )
+    {
+        FloatToHalf( src, (half_float::half*)dst, pixels * 4 );
+    }
+    else
+    {
+        memcpy( dst, src, pixels * 4 * sizeof( float ) );
+    }
+}
+
+// Reduces a row horizontally and adds it, scaled by weight, to the destination row.
+template<bool Accumulate>
+void Reduce( float* dst, const float* src, uint32_t srcWidth, uint32_t dstWidth, float weight )
+{
+    if( srcWidth == 1 )
+    {
+        for( int c=0; c<4; c++ ) dst[c] = ( Accumulate ? dst[c] : 0.f ) + src[c] * weight;
+        return;
+    }
+
+    const auto pairs = ( srcWidth & 1 ) ? dstWidth - 1 : dstWidth;
+    const auto w2 = weight * 0.5f;
+    uint32_t x = 0;
+#ifdef __AVX2__
+    const auto vw = _mm256_set1_ps( w2 );
+    for( ; x+2<=pairs; x+=2 )
+    {
+        const auto a = _mm256_loadu_ps( src + x*8 );
+        const auto b = _mm256_loadu_ps( src + x*8 + 8 );
+        auto s = _mm256_add_ps( _mm256_permute2f128_ps( a, b, 0x20 ), _mm256_permute2f128_ps( a, b, 0x31 ) );
+        s = _mm256_mul_ps( s, vw );
+        if constexpr( Accumulate ) s = _mm256_add_ps( s, _mm256_loadu_ps( dst + x*4 ) );
+        _mm256_storeu_ps( dst + x*4, s );
+    }
+#endif
+    for( ; x<pairs; x++ )
+    {
+        for( int c=0; c<4; c++ )
+        {
+            const auto v = ( src[x*8+c] + src[x*8+4+c] ) * w2;
+            dst[x*4+c] = Accumulate ? dst[x*4+c] + v : v;
+        }
+    }
+    if( srcWidth & 1 )
+    {
+        x = dstWidth - 1;
+        const auto w3 = weight / 3.f;
+        for( int c=0; c<4; c++ )
+        {
+            const auto v = ( src[x*8+c] + src[x*8+4+c] + src[x*8+8+c] ) * w3;
+            dst[x*4+c] = Accumulate ? dst[x*4+c] + v : v;
+        }
+    }
+}
+
+// Pushes rows [y0, y1) of level first through levels first+1 to last. Each level accumulates the
+// rows needed for its next output row, so only a single row per level is held. Rows of the last
+// level are also copied to tail, if given.
+template<typename Load, typename Store>
+void ReduceBand( const std::vector<MipChainBuilder::Level>& levels, uint32_t first, uint32_t last, uint32_t y0, uint32_t y1, Load& load, Store& store, float* tail )
+{
+    ZoneScoped;
+
+    struct State
+    {
+        PixelBuffer<float> row;
+        uint32_t y;
+        uint32_t count;
+    };
+
+    std::vector<State> state( last - first );
+    for( uint32_t i=0; i<state.size(); i++ )
+    {
+        state[i].row.reset( PixelAlloc<float>( levels[first+i+1].width, 1 ) );
+        state[i].y = y0 >> ( i + 1 );
+        state[i].count = 0;
+    }
+    PixelBuffer<float> tmp( PixelAlloc<float>( levels[first].width, 1 ) );
+
+    for( uint32_t y=y0; y<y1; y++ )
+    {
+        const float* row = load( y, tmp.get() );
+        for( uint32_t l=first+1; l<=last; l++ )
+        {
+            auto& s = state[l-first-1];
+            const auto& src = levels[l-1];
+            const auto& dst = levels[l];
+
+            const uint32_t need = src.height == 1 ? 1 : ( s.y == dst.height - 1 && ( src.height & 1 ) ) ? 3 : 2;
+            if( s.count == 0 )
+            {
+                Reduce<false>( s.row.get(), row, src.width, dst.width, 1.f / need );
+            }
+            else
+            {
+                Reduce<true>( s.row.get(), row, src.width, dst.width, 1.f / need );
+            }
+            if( ++s.count < need ) break;
+
+            store( l, s.y, s.row.get() );
+            if( tail && l == last ) memcpy( tail + size_t( s.y ) * dst.width * 4, s.row.get(), dst.width * 4 * sizeof( float ) );
+            s.count = 0;
+            s.y++;
+            row = s.row.get();
+        }
+    }
+}
+
+// Loads row y of the source level as linear float data, copying it to level 0 of the output.
+// Stores a finished row of a reduced level.
+template<typename Load, typename Store>
+void BuildChain( const std::vector<MipChainBuilder::Level>& levels, TaskDispatch* td, Load&& load, Store&& store )
+{
+    const auto last = uint32_t( levels.size() - 1 );
+    const auto height = levels[0].height;
+    const auto bandLevels = std::min( last, BandLevels );
+    const auto groups = height >> bandLevels;
+
+    if( !td || td->NumWorkers() == 0 || groups < 2 )
+    {
+        ReduceBand( levels, 0, last, 0, height, load, store, nullptr );
+        return;
+    }
+
+    // Band boundaries are multiples of 2^bandLevels rows, so that no output row in the band levels
+    // needs rows from two bands. The last band takes the remaining rows.
+    PixelBuffer<float> tail;
+    if( bandLevels < last ) tail.reset( PixelAlloc<float>( levels[bandLevels].width, levels[bandLevels].height ) );
+
+    const auto grain = std::max<size_t>( 1, groups / ( ( td->NumWorkers() + 1 ) * 2 ) );
+    td->ParallelFor( groups, grain, [&]( size_t begin, size_t end ) {
+        ReduceBand( levels, 0, bandLevels, begin << bandLevels, end == groups ? height : end << bandLevels, load, store, tail.get() );
+    } );
+
+    if( tail )
+    {
+        const auto width = levels[bandLevels].width;
+        auto loadTail = [&tail, width]( uint32_t y, float* ) -> const float* { return tail.get() + size_t( y ) * width * 4; };
+        ReduceBand( levels, bandLevels, last, 0, levels[bandLevels].height, loadTail, store, nullptr );
+    }
+}
+
+}
+
+MipChainBuilder::MipChainBuilder( uint32_t width, uint32_t height, uint32_t bpp, bool mips, TaskDispatch* td )
+    : m_bpp( bpp )
+    , m_td( td )
+{
+    CheckPanic( width > 0 && height > 0, "Invalid image size" );
+    CheckPanic( bpp == 4 || bpp == 8 || bpp == 16, "Invalid output pixel size" );
+
+    size_t offset = 0;
+    for(;;)
+    {
+        const auto size = PixelCount( width, height ) * bpp;
+        m_levels.emplace_back( width, height, offset, size );
+        offset += size;
+        if( !mips || ( width == 1 && height == 1 ) ) break;
+        width = std::max( 1u, width / 2 );
+        height = std::max( 1u, height / 2 );
+    }
+}
+
+void MipChainBuilder::Build( const Bitmap& bitmap, void* dst ) const
+{
+    ZoneScoped;
+    CheckPanic( m_bpp == 4, "Bitmap mip chain must have 4 bytes per pixel" );
+    CheckPanic( bitmap.Width() == m_levels[0].width && bitmap.Height() == m_levels[0].height, "Invalid bitmap size" );
+
+    auto out = (uint8_t*)dst;
+    if( m_levels.size() == 1 )
+    {
+        memcpy( out, bitmap.Data(), m_levels[0].size );
+        return;
+    }
+
+    const auto& srgb = Srgb();
+    const auto width = m_levels[0].width;
+    BuildChain( m_levels, m_td, [&]( uint32_t y, float* tmp ) -> const float* {
+        const auto offset = size_t( y ) * width * 4;
+        memcpy( out + offset, bitmap.Data() + offset, width * 4 );
+        DecodeSrgb( tmp, bitmap.Data() + offset, width, srgb );
+        return tmp;
+    }, [&]( uint32_t level, uint32_t y, const float* row ) {
+        const auto& l = m_levels[level];
+        EncodeSrgb( out + l.offset + size_t( y ) * l.width * 4, row, l.width, srgb );
+    } );
+}
+
+void MipChainBuilder::Build( const BitmapHdr& bitmap, void* dst ) const
+{
+    ZoneScoped;
+    CheckPanic( m_bpp == 8 || m_bpp == 16, "HDR bitmap mip chain must have 8 or 16 bytes per pixel" );
+    CheckPanic( bitmap.Width() == m_levels[0].width && bitmap.Height() == m_levels[0].height, "Invalid bitmap size" );
+
+    auto out = (uint8_t*)dst;
+    const auto half = m_bpp == 8;
+    if( m_levels.size() == 1 )
+    {
+        StoreHdr( out, bitmap.Data(), PixelCount( bitmap.Width(), bitmap.Height() ), half );
+        return;
+    }
+
+    const auto width = m_levels[0].width;
+    BuildChain( m_levels, m_td, [&]( uint32_t y, float* ) -> const float* {
+        auto src = bitmap.Data() + size_t( y ) * width * 4;
+        StoreHdr( out + size_t( y ) * width * m_bpp, src, width, half );
+        return src;
+    }, [&]( uint32_t level, uint32_t y, const float* row ) {
+        const auto& l = m_levels[level];
+        StoreHdr( out + l.offset + size_t( y ) * l.width * m_bpp, row, l.width, half );
+    } );
+}
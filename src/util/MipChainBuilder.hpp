@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+class Bitmap;
+class BitmapHdr;
+class TaskDispatch;
+
+// Generates all mip levels of an image in a single pass over the source. Bands of source rows are
+// reduced through several levels while they are still in cache, and each level is written directly
+// to the destination buffer. Levels are stored consecutively, largest first, starting with a copy of
+// the source image. Every level halves the size of the previous one, rounding down. Pixels are box
+// filtered in linear light, with three taps at the edge of odd sized levels.
+class MipChainBuilder
+{
+public:
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        size_t offset;
+        size_t size;
+    };
+
+    // Output bytes per pixel are 4 for sRGB RGBA8 from Bitmap, 8 for half float or 16 for float
+    // RGBA from BitmapHdr. Without mips, only the source image is converted to the output format.
+    MipChainBuilder( uint32_t width, uint32_t height, uint32_t bpp, bool mips = true, TaskDispatch* td = nullptr );
+    NoCopy( MipChainBuilder );
+
+    // dst must hold Size() bytes.
+    void Build( const Bitmap& bitmap, void* dst ) const;
+    void Build( const BitmapHdr& bitmap, void* dst ) const;
+
+    [[nodiscard]] const std::vector<Level>& Levels() const { return m_levels; }
+    [[nodiscard]] size_t Size() const { return m_levels.back().offset + m_levels.back().size; }
+    [[nodiscard]] uint32_t Bpp() const { return m_bpp; }
+
+private:
+    std::vector<Level> m_levels;
+    uint32_t m_bpp;
+    TaskDispatch* m_td;
+};
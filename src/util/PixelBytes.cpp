@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <tracy/Tracy.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "Panic.hpp"
+#include "PixelBytes.hpp"
+
+namespace
+{
+
+// Smaller buffers are not pooled
+constexpr size_t PoolMinSize = 256 * 1024;
+
+// Limit of memory held in the pool
+constexpr size_t PoolCapacity = 256 * 1024 * 1024;
+
+// Buffers of at least this size start on a huge page boundary and are advised to use transparent
+// huge pages. The data follows the header, so it is PixelAlignment bytes past the boundary.
+constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+// Precedes each buffer, keeping the data aligned
+struct alignas( PixelAlignment ) Header
+{
+    size_t capacity;
+};
+
+// Pooled buffer sizes are rounded up to one of four steps per power of two, wasting at most 25%
+size_t SizeClass( size_t size )
+{
+    if( size < PoolMinSize ) return size;
+    const auto bits = 63 - __builtin_clzll( size - 1 );
+    const auto step = size_t( 1 ) << ( bits - 2 );
+    return ( size + step - 1 ) & ~( step - 1 );
+}
+
+Header* Allocate( size_t capacity )
+{
+    // Size is not rounded up to a huge page, as that would double the memory of a 2 MB size class
+    const auto align = capacity >= HugePageSize ? HugePageSize : PixelAlignment;
+    const auto total = ( sizeof( Header ) + capacity + PixelAlignment - 1 ) & ~( PixelAlignment - 1 );
+    Header* hdr;
+    CheckPanic( posix_memalign( (void**)&hdr, align, total ) == 0, "Failed to allocate %zu bytes of pixel memory", total );
+#ifdef MADV_HUGEPAGE
+    if( align == HugePageSize ) madvise( hdr, total, MADV_HUGEPAGE );
+#endif
+    hdr->capacity = capacity;
+    return hdr;
+}
+
+class PixelPool
+{
+public:
+    void* Alloc( size_t size )
+    {
+        const auto capacity = SizeClass( size );
+        Header* hdr = nullptr;
+        {
+            std::lock_guard lock( m_lock );
+            if( capacity >= PoolMinSize )
+            {
+                auto it = m_free.find( capacity );
+                if( it != m_free.end() && !it->second.empty() )
+                {
+                    hdr = it->second.back();
+                    it->second.pop_back();
+                    m_stats.pooled -= capacity;
+                    m_stats.poolHits++;
+                    TracyPlot( "Pixel pool", int64_t( m_stats.pooled ) );
+                }
+                else
+                {
+                    m_stats.poolMisses++;
+                }
+            }
+            m_stats.live += capacity;
+            m_stats.peak = std::max( m_stats.peak, m_stats.live );
+            TracyPlot( "Pixel memory", int64_t( m_stats.live ) );
+        }
+        if( !hdr ) hdr = Allocate( capacity );
+        return hdr + 1;
+    }
+
+    void Free( void* ptr )
+    {
+        auto hdr = (Header*)ptr - 1;
+        const auto capacity = hdr->capacity;
+        {
+            std::lock_guard lock( m_lock );
+            m_stats.live -= capacity;
+            TracyPlot( "Pixel memory", int64_t( m_stats.live ) );
+            if( capacity >= PoolMinSize && m_stats.pooled + capacity <= PoolCapacity )
+            {
+                m_free[capacity].push_back( hdr );
+                m_stats.pooled += capacity;
+                TracyPlot( "Pixel pool", int64_t( m_stats.pooled ) );
+                return;
+            }
+        }
+        free( hdr );
+    }
+
+    PixelAllocStats Stats()
+    {
+        std::lock_guard lock( m_lock );
+        return m_stats;
+    }
+
+    void Trim()
+    {
+        std::unordered_map<size_t, std::vector<Header*>> pooled;
+        {
+            std::lock_guard lock( m_lock );
+            std::swap( pooled, m_free );
+            m_stats.pooled = 0;
+            TracyPlot( "Pixel pool", int64_t( 0 ) );
+        }
+        for( auto& it : pooled )
+        {
+            for( auto hdr : it.second ) free( hdr );
+        }
+    }
+
+private:
+    std::mutex m_lock;
+    std::unordered_map<size_t, std::vector<Header*>> m_free;
+    PixelAllocStats m_stats = {};
+};
+
+PixelPool& Pool()
+{
+    // Never destroyed, as bitmaps with static storage may be released after it
+    static auto pool = new PixelPool;
+    return *pool;
+}
+
+}
+
+void* PixelAllocBytes( size_t size )
+{
+    return Pool().Alloc( size );
+}
+
+void PixelFree( void* ptr )
+{
+    if( ptr ) Pool().Free( ptr );
+}
+
+PixelAllocStats GetPixelAllocStats()
+{
+    return Pool().Stats();
+}
+
+void PixelPoolTrim()
+{
+    Pool().Trim();
+}
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <memory>
 #include <stddef.h>
+#include <type_traits>
+
+// Alignment of pixel buffers returned by PixelAlloc
+constexpr size_t PixelAlignment = 64;
 
 static inline size_t PixelCount( size_t width, size_t height )
 {
@@ -12,9 +17,37 @@ static inline size_t PixelChannelCount( size_t width, size_t height, size_t chan
     return PixelCount( width, height ) * channels;
 }
 
+// Pixel buffers are aligned to PixelAlignment and must be released with PixelFree. Large buffers
+// are recycled through a pool of size classes, and are backed by huge pages, where available.
+void* PixelAllocBytes( size_t size );
+void PixelFree( void* ptr );
+
 template<typename T>
 static inline T* PixelAlloc( size_t width, size_t height, size_t channels = 4 )
 {
+    static_assert( std::is_trivially_destructible_v<T> );
     const auto size = PixelChannelCount( width, height, channels );
-    return new T[size];
+    return (T*)PixelAllocBytes( size * sizeof( T ) );
 }
+
+struct PixelDeleter
+{
+    void operator()( void* ptr ) const { PixelFree( ptr ); }
+};
+
+template<typename T>
+using PixelBuffer = std::unique_ptr<T[], PixelDeleter>;
+
+struct PixelAllocStats
+{
+    size_t live;        // bytes in buffers currently allocated
+    size_t peak;        // maximum of live bytes
+    size_t pooled;      // bytes in freed buffers kept for reuse
+    size_t poolHits;
+    size_t poolMisses;
+};
+
+PixelAllocStats GetPixelAllocStats();
+
+// Releases all buffers kept in the pool
+void PixelPoolTrim();
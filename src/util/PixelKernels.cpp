@@ -0,0 +1,98 @@
+#include "contrib/half.hpp"
+
+#include "PixelKernels.hpp"
+#include "PixelKernelsImpl.hpp"
+#include "SimdLevel.hpp"
+
+namespace PixelKernels
+{
+
+static const PixelKernelTable* Table()
+{
+#if defined __x86_64__ || defined __i386__
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: return &PixelKernelsAvx512;
+    case SimdLevel::Avx2: return &PixelKernelsAvx2;
+    case SimdLevel::Sse41: return &PixelKernelsSse41;
+    default: break;
+    }
+#endif
+    return nullptr;
+}
+
+void SetAlpha( uint32_t* ptr, size_t count, uint8_t alpha )
+{
+    if( auto table = Table() )
+    {
+        const auto done = table->setAlpha( ptr, count, alpha );
+        ptr += done;
+        count -= done;
+    }
+    auto p = (uint8_t*)ptr + 3;
+    while( count-- )
+    {
+        *p = alpha;
+        p += 4;
+    }
+}
+
+void BgrToRgb( uint32_t* ptr, size_t count )
+{
+    if( auto table = Table() )
+    {
+        const auto done = table->bgrToRgb( ptr, count );
+        ptr += done;
+        count -= done;
+    }
+    while( count-- )
+    {
+        uint32_t v = *ptr;
+        v = (v & 0xff00ff00) | ((v & 0x00ff0000) >> 16) | ((v & 0x000000ff) << 16);
+        *ptr++ = v;
+    }
+}
+
+void SetAlpha( float* ptr, size_t count, float alpha )
+{
+    if( auto table = Table() )
+    {
+        const auto done = table->setAlphaFloat( ptr, count, alpha );
+        ptr += done * 4;
+        count -= done;
+    }
+    ptr += 3;
+    while( count-- )
+    {
+        *ptr = alpha;
+        ptr += 4;
+    }
+}
+
+void HalfToFloat( const uint16_t* src, float* dst, size_t count )
+{
+    if( auto table = Table() )
+    {
+        const auto done = table->halfToFloat( src, dst, count );
+        src += done;
+        dst += done;
+        count -= done;
+    }
+    auto hsrc = (const half_float::half*)src;
+    while( count-- ) *dst++ = *hsrc++;
+}
+
+void FloatToHalf( const float* src, uint16_t* dst, size_t count )
+{
+    if( auto table = Table() )
+    {
+        const auto done = table->floatToHalf( src, dst, count );
+        src += done;
+        dst += done;
+        count -= done;
+    }
+    auto hdst = (half_float::half*)dst;
+    while( count-- ) *hdst++ = half_float::half( *src++ );
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pixel loops with SIMD variants, selected at run time by GetSimdLevel. Each instruction set level
+// is built in its own translation unit, so portable builds still run the vector paths.
+namespace PixelKernels
+{
+
+// 8-bit RGBA pixels
+void SetAlpha( uint32_t* ptr, size_t count, uint8_t alpha );
+void BgrToRgb( uint32_t* ptr, size_t count );
+
+// Float RGBA pixels
+void SetAlpha( float* ptr, size_t count, float alpha );
+
+// Count is in values, half precision values are raw bits
+void HalfToFloat( const uint16_t* src, float* dst, size_t count );
+void FloatToHalf( const float* src, uint16_t* dst, size_t count );
+
+}
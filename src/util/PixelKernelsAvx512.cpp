@@ -0,0 +1,8 @@
+#if defined __x86_64__ || defined __i386__
+
+#define PIXEL_KERNELS_LEVEL 3
+#include "PixelKernelsImpl.hpp"
+
+const PixelKernelTable PixelKernelsAvx512 = { SetAlpha, BgrToRgb, SetAlphaFloat, HalfToFloat, FloatToHalf };
+
+#endif
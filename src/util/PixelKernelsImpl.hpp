@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vector parts of PixelKernels. Each function processes what fits in whole vectors and returns the
+// number of items done, leaving the rest to the scalar code.
+struct PixelKernelTable
+{
+    size_t (*setAlpha)( uint32_t* ptr, size_t count, uint8_t alpha );
+    size_t (*bgrToRgb)( uint32_t* ptr, size_t count );
+    size_t (*setAlphaFloat)( float* ptr, size_t count, float alpha );
+    size_t (*halfToFloat)( const uint16_t* src, float* dst, size_t count );
+    size_t (*floatToHalf)( const float* src, uint16_t* dst, size_t count );
+};
+
+extern const PixelKernelTable PixelKernelsSse41;
+extern const PixelKernelTable PixelKernelsAvx2;
+extern const PixelKernelTable PixelKernelsAvx512;
+
+// Included by the translation unit of each level, with PIXEL_KERNELS_LEVEL set to 1 for SSE4.1, 2
+// for AVX2, 3 for AVX-512. Everything has internal linkage and uses no inline functions from
+// other headers, as those could be merged with copies built for another level.
+#ifdef PIXEL_KERNELS_LEVEL
+
+#if PIXEL_KERNELS_LEVEL >= 3 && !( defined __AVX512F__ && defined __AVX512BW__ )
+#  error AVX-512 kernels must be built with -mavx512f -mavx512bw
+#endif
+#if PIXEL_KERNELS_LEVEL >= 2 && !( defined __AVX2__ && defined __F16C__ )
+#  error AVX2 kernels must be built with -mavx2 -mf16c
+#endif
+#if !defined __SSE4_1__
+#  error SSE4.1 kernels must be built with -msse4.1
+#endif
+
+#include <immintrin.h>
+
+namespace
+{
+
+size_t SetAlpha( uint32_t* ptr, size_t count, uint8_t alpha )
+{
+    size_t i = 0;
+#if PIXEL_KERNELS_LEVEL >= 3
+    const auto alpha16 = _mm512_set1_epi32( alpha << 24 );
+    const auto mask16 = _mm512_set1_epi32( 0x00FFFFFF );
+    for( ; i + 16 <= count; i += 16 )
+    {
+        auto v = _mm512_loadu_si512( ptr + i );
+        v = _mm512_or_si512( _mm512_and_si512( v, mask16 ), alpha16 );
+        _mm512_storeu_si512( ptr + i, v );
+    }
+#endif
+#if PIXEL_KERNELS_LEVEL >= 2
+    const auto alpha8 = _mm256_set1_epi32( alpha << 24 );
+    const auto mask8 = _mm256_set1_epi32( 0x00FFFFFF );
+    for( ; i + 8 <= count; i += 8 )
+    {
+        auto v = _mm256_loadu_si256( (const __m256i*)( ptr + i ) );
+        v = _mm256_or_si256( _mm256_and_si256( v, mask8 ), alpha8 );
+        _mm256_storeu_si256( (__m256i*)( ptr + i ), v );
+    }
+#endif
+    const auto alpha4 = _mm_set1_epi32( alpha << 24 );
+    const auto mask4 = _mm_set1_epi32( 0x00FFFFFF );
+    for( ; i + 4 <= count; i += 4 )
+    {
+        auto v = _mm_loadu_si128( (const __m128i*)( ptr + i ) );
+        v = _mm_or_si128( _mm_and_si128( v, mask4 ), alpha4 );
+        _mm_storeu_si128( (__m128i*)( ptr + i ), v );
+    }
+    return i;
+}
+
+size_t BgrToRgb( uint32_t* ptr, size_t count )
+{
+    size_t i = 0;
+#if PIXEL_KERNELS_LEVEL >= 3
+    const auto shuf16 = _mm512_set_epi64(
+        0x3f3c3d3e3b38393a, 0x3734353633303132,
+        0x2f2c2d2e2b28292a, 0x2724252623202122,
+        0x1f1c1d1e1b18191a, 0x1714151613101112,
+        0x0f0c0d0e0b08090a, 0x0704050603000102
+    );
+    for( ; i + 16 <= count; i += 16 )
+    {
+        _mm512_storeu_si512( ptr + i, _mm512_shuffle_epi8( _mm512_loadu_si512( ptr + i ), shuf16 ) );
+    }
+#endif
+#if PIXEL_KERNELS_LEVEL >= 2
+    const auto shuf8 = _mm256_set_epi64x(
+        0x1f1c1d1e1b18191a, 0x1714151613101112,
+        0x0f0c0d0e0b08090a, 0x0704050603000102
+    );
+    for( ; i + 8 <= count; i += 8 )
+    {
+        const auto v = _mm256_loadu_si256( (const __m256i*)( ptr + i ) );
+        _mm256_storeu_si256( (__m256i*)( ptr + i ), _mm256_shuffle_epi8( v, shuf8 ) );
+    }
+#endif
+    const auto shuf4 = _mm_set_epi64x( 0x0f0c0d0e0b08090a, 0x0704050603000102 );
+    for( ; i + 4 <= count; i += 4 )
+    {
+        const auto v = _mm_loadu_si128( (const __m128i*)( ptr + i ) );
+        _mm_storeu_si128( (__m128i*)( ptr + i ), _mm_shuffle_epi8( v, shuf4 ) );
+    }
+    return i;
+}
+
+// Count is in pixels
+size_t SetAlphaFloat( float* ptr, size_t count, float alpha )
+{
+    size_t i = 0;
+#if PIXEL_KERNELS_LEVEL >= 3
+    for( ; i + 4 <= count; i += 4 )
+    {
+        const auto px = _mm512_loadu_ps( ptr + i * 4 );
+        _mm512_storeu_ps( ptr + i * 4, _mm512_mask_blend_ps( 0x8888, px, _mm512_set1_ps( alpha ) ) );
+    }
+#endif
+#if PIXEL_KERNELS_LEVEL >= 2
+    for( ; i + 2 <= count; i += 2 )
+    {
+        const auto px = _mm256_loadu_ps( ptr + i * 4 );
+        _mm256_storeu_ps( ptr + i * 4, _mm256_blend_ps( px, _mm256_set1_ps( alpha ), 0x88 ) );
+    }
+#endif
+    for( ; i < count; i++ )
+    {
+        const auto px = _mm_loadu_ps( ptr + i * 4 );
+        _mm_storeu_ps( ptr + i * 4, _mm_blend_ps( px, _mm_set1_ps( alpha ), 0x8 ) );
+    }
+    return i;
+}
+
+size_t HalfToFloat( const uint16_t* src, float* dst, size_t count )
+{
+    size_t i = 0;
+#if PIXEL_KERNELS_LEVEL >= 3
+    for( ; i + 16 <= count; i += 16 )
+    {
+        _mm512_storeu_ps( dst + i, _mm512_cvtph_ps( _mm256_loadu_si256( (const __m256i*)( src + i ) ) ) );
+    }
+#endif
+#if PIXEL_KERNELS_LEVEL >= 2
+    for( ; i + 8 <= count; i += 8 )
+    {
+        _mm256_storeu_ps( dst + i, _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)( src + i ) ) ) );
+    }
+#endif
+    return i;
+}
+
+size_t FloatToHalf( const float* src, uint16_t* dst, size_t count )
+{
+    size_t i = 0;
+#if PIXEL_KERNELS_LEVEL >= 3
+    for( ; i + 16 <= count; i += 16 )
+    {
+        _mm256_storeu_si256( (__m256i*)( dst + i ), _mm512_cvtps_ph( _mm512_loadu_ps( src + i ), _MM_FROUND_TO_NEAREST_INT ) );
+    }
+#endif
+#if PIXEL_KERNELS_LEVEL >= 2
+    for( ; i + 8 <= count; i += 8 )
+    {
+        _mm_storeu_si128( (__m128i*)( dst + i ), _mm256_cvtps_ph( _mm256_loadu_ps( src + i ), _MM_FROUND_TO_NEAREST_INT ) );
+    }
+#endif
+    return i;
+}
+
+}
+
+#endif
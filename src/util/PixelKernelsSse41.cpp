@@ -0,0 +1,8 @@
+#if defined __x86_64__ || defined __i386__
+
+#define PIXEL_KERNELS_LEVEL 1
+#include "PixelKernelsImpl.hpp"
+
+const PixelKernelTable PixelKernelsSse41 = { SetAlpha, BgrToRgb, SetAlphaFloat, HalfToFloat, FloatToHalf };
+
+#endif
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+#include <utility>
+
+#include "Panic.hpp"
+#include "PixelBytes.hpp"
+#include "PixelTransform.hpp"
+#include "TaskDispatch.hpp"
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
+
+namespace PixelTransform
+{
+
+namespace
+{
+
+struct Pixel16
+{
+    uint64_t v[2];
+};
+
+// Square tiles of this many pixels keep the source and destination lines of a tile in L1 cache
+constexpr uint32_t TileSize = 64;
+
+// Smaller images are processed on the calling thread
+constexpr size_t ParallelThreshold = 1024 * 1024;
+
+// Transposes a square block of Size pixels. Destination row i is at dst + i * step, and is
+// written in reverse order if Reverse is set.
+template<typename T>
+struct Kernel
+{
+    static constexpr uint32_t Size = 1;
+
+    template<bool Reverse>
+    static void Run( T* dst, ptrdiff_t step, const T* src, size_t stride )
+    {
+        *dst = *src;
+    }
+};
+
+#ifdef __AVX2__
+template<>
+struct Kernel<uint32_t>
+{
+    static constexpr uint32_t Size = 8;
+
+    template<bool Reverse>
+    static void Run( uint32_t* dst, ptrdiff_t step, const uint32_t* src, size_t stride )
+    {
+        __m256i r[8];
+        for( int i=0; i<8; i++ ) r[i] = _mm256_loadu_si256( (const __m256i*)( src + i * stride ) );
+
+        const auto t0 = _mm256_unpacklo_epi32( r[0], r[1] );
+        const auto t1 = _mm256_unpackhi_epi32( r[0], r[1] );
+        const auto t2 = _mm256_unpacklo_epi32( r[2], r[3] );
+        const auto t3 = _mm256_unpackhi_epi32( r[2], r[3] );
+        const auto t4 = _mm256_unpacklo_epi32( r[4], r[5] );
+        const auto t5 = _mm256_unpackhi_epi32( r[4], r[5] );
+        const auto t6 = _mm256_unpacklo_epi32( r[6], r[7] );
+        const auto t7 = _mm256_unpackhi_epi32( r[6], r[7] );
+
+        const auto u0 = _mm256_unpacklo_epi64( t0, t2 );
+        const auto u1 = _mm256_unpackhi_epi64( t0, t2 );
+        const auto u2 = _mm256_unpacklo_epi64( t1, t3 );
+        const auto u3 = _mm256_unpackhi_epi64( t1, t3 );
+        const auto u4 = _mm256_unpacklo_epi64( t4, t6 );
+        const auto u5 = _mm256_unpackhi_epi64( t4, t6 );
+        const auto u6 = _mm256_unpacklo_epi64( t5, t7 );
+        const auto u7 = _mm256_unpackhi_epi64( t5, t7 );
+
+        r[0] = _mm256_permute2x128_si256( u0, u4, 0x20 );
+        r[1] = _mm256_permute2x128_si256( u1, u5, 0x20 );
+        r[2] = _mm256_permute2x128_si256( u2, u6, 0x20 );
+        r[3] = _mm256_permute2x128_si256( u3, u7, 0x20 );
+        r[4] = _mm256_permute2x128_si256( u0, u4, 0x31 );
+        r[5] = _mm256_permute2x128_si256( u1, u5, 0x31 );
+        r[6] = _mm256_permute2x128_si256( u2, u6, 0x31 );
+        r[7] = _mm256_permute2x128_si256( u3, u7, 0x31 );
+
+        for( int i=0; i<8; i++ )
+        {
+            if constexpr( Reverse ) r[i] = _mm256_permutevar8x32_epi32( r[i], _mm256_setr_epi32( 7, 6, 5, 4, 3, 2, 1, 0 ) );
+            _mm256_storeu_si256( (__m256i*)( dst + i * step ), r[i] );
+        }
+    }
+};
+
+template<>
+struct Kernel<uint64_t>
+{
+    static constexpr uint32_t Size = 4;
+
+    template<bool Reverse>
+    static void Run( uint64_t* dst, ptrdiff_t step, const uint64_t* src, size_t stride )
+    {
+        const auto r0 = _mm256_loadu_si256( (const __m256i*)( src ) );
+        const auto r1 = _mm256_loadu_si256( (const __m256i*)( src + stride ) );
+        const auto r2 = _mm256_loadu_si256( (const __m256i*)( src + stride * 2 ) );
+        const auto r3 = _mm256_loadu_si256( (const __m256i*)( src + stride * 3 ) );
+
+        const auto t0 = _mm256_unpacklo_epi64( r0, r1 );
+        const auto t1 = _mm256_unpackhi_epi64( r0, r1 );
+        const auto t2 = _mm256_unpacklo_epi64( r2, r3 );
+        const auto t3 = _mm256_unpackhi_epi64( r2, r3 );
+
+        __m256i c[4] = {
+            _mm256_permute2x128_si256( t0, t2, 0x20 ),
+            _mm256_permute2x128_si256( t1, t3, 0x20 ),
+            _mm256_permute2x128_si256( t0, t2, 0x31 ),
+            _mm256_permute2x128_si256( t1, t3, 0x31 )
+        };
+
+        for( int i=0; i<4; i++ )
+        {
+            if constexpr( Reverse ) c[i] = _mm256_permute4x64_epi64( c[i], _MM_SHUFFLE( 0, 1, 2, 3 ) );
+            _mm256_storeu_si256( (__m256i*)( dst + i * step ), c[i] );
+        }
+    }
+};
+
+template<>
+struct Kernel<Pixel16>
+{
+    static constexpr uint32_t Size = 2;
+
+    template<bool Reverse>
+    static void Run( Pixel16* dst, ptrdiff_t step, const Pixel16* src, size_t stride )
+    {
+        const auto r0 = _mm256_loadu_si256( (const __m256i*)( src ) );
+        const auto r1 = _mm256_loadu_si256( (const __m256i*)( src + stride ) );
+
+        if constexpr( Reverse )
+        {
+            _mm256_storeu_si256( (__m256i*)( dst ), _mm256_permute2x128_si256( r1, r0, 0x20 ) );
+            _mm256_storeu_si256( (__m256i*)( dst + step ), _mm256_permute2x128_si256( r1, r0, 0x31 ) );
+        }
+        else
+        {
+            _mm256_storeu_si256( (__m256i*)( dst ), _mm256_permute2x128_si256( r0, r1, 0x20 ) );
+            _mm256_storeu_si256( (__m256i*)( dst + step ), _mm256_permute2x128_si256( r0, r1, 0x31 ) );
+        }
+    }
+};
+
+template<typename T> __m256i ReverseVector( __m256i v );
+template<> __m256i ReverseVector<uint32_t>( __m256i v ) { return _mm256_permutevar8x32_epi32( v, _mm256_setr_epi32( 7, 6, 5, 4, 3, 2, 1, 0 ) ); }
+template<> __m256i ReverseVector<uint64_t>( __m256i v ) { return _mm256_permute4x64_epi64( v, _MM_SHUFFLE( 0, 1, 2, 3 ) ); }
+template<> __m256i ReverseVector<Pixel16>( __m256i v ) { return _mm256_permute2x128_si256( v, v, 0x01 ); }
+#endif
+
+// Source pixel (x, y) goes to destination row x and column y, which are counted from the end
+// if RevRows or RevCols are set.
+template<typename T, bool RevRows, bool RevCols>
+void TransposeEdge( T* dst, const T* src, uint32_t width, uint32_t height, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1 )
+{
+    for( uint32_t y=y0; y<y1; y++ )
+    {
+        const auto col = RevCols ? height - 1 - y : y;
+        auto s = src + size_t( y ) * width;
+        for( uint32_t x=x0; x<x1; x++ )
+        {
+            const auto row = RevRows ? width - 1 - x : x;
+            dst[size_t( row ) * height + col] = s[x];
+        }
+    }
+}
+
+template<typename T, bool RevRows, bool RevCols>
+void TransposeRange( T* dst, const T* src, uint32_t width, uint32_t height, uint32_t x0, uint32_t x1 )
+{
+    constexpr auto B = Kernel<T>::Size;
+    const auto step = RevRows ? -ptrdiff_t( height ) : ptrdiff_t( height );
+
+    for( uint32_t tx=x0; tx<x1; tx+=TileSize )
+    {
+        const auto tx1 = std::min( x1, tx + TileSize );
+        for( uint32_t ty=0; ty<height; ty+=TileSize )
+        {
+            const auto ty1 = std::min( height, ty + TileSize );
+            uint32_t y = ty;
+            for( ; y + B <= ty1; y += B )
+            {
+                const auto col = RevCols ? height - y - B : y;
+                uint32_t x = tx;
+                for( ; x + B <= tx1; x += B )
+                {
+                    const auto row = RevRows ? width - 1 - x : x;
+                    Kernel<T>::template Run<RevCols>( dst + size_t( row ) * height + col, step, src + size_t( y ) * width + x, width );
+                }
+                if( x < tx1 ) TransposeEdge<T, RevRows, RevCols>( dst, src, width, height, x, tx1, y, y + B );
+            }
+            if( y < ty1 ) TransposeEdge<T, RevRows, RevCols>( dst, src, width, height, tx, tx1, y, ty1 );
+        }
+    }
+}
+
+template<typename T, bool RevRows, bool RevCols>
+void TransposeImpl( void* dst, const void* src, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    auto d = (T*)dst;
+    auto s = (const T*)src;
+    if( !td || PixelCount( width, height ) < ParallelThreshold )
+    {
+        TransposeRange<T, RevRows, RevCols>( d, s, width, height, 0, width );
+        return;
+    }
+
+    const auto tiles = ( width + TileSize - 1 ) / TileSize;
+    td->ParallelFor( tiles, 1, [d, s, width, height]( size_t begin, size_t end ) {
+        TransposeRange<T, RevRows, RevCols>( d, s, width, height, uint32_t( begin * TileSize ), uint32_t( std::min<size_t>( width, end * TileSize ) ) );
+    } );
+}
+
+template<bool RevRows, bool RevCols>
+void Dispatch( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    switch( pixelSize )
+    {
+    case 4:
+        TransposeImpl<uint32_t, RevRows, RevCols>( dst, src, width, height, td );
+        break;
+    case 8:
+        TransposeImpl<uint64_t, RevRows, RevCols>( dst, src, width, height, td );
+        break;
+    case 16:
+        TransposeImpl<Pixel16, RevRows, RevCols>( dst, src, width, height, td );
+        break;
+    default:
+        Panic( "Unsupported pixel size %zu", pixelSize );
+    }
+}
+
+// Exchanges a[i] with b[-i] for count pixels, reversing the order of both ranges. The ranges
+// must not overlap.
+template<typename T>
+void SwapReversed( T* a, T* b, size_t count )
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    constexpr size_t N = 32 / sizeof( T );
+    for( ; i + N <= count; i += N )
+    {
+        auto pa = (__m256i*)( a + i );
+        auto pb = (__m256i*)( b - i - ( N - 1 ) );
+        const auto va = _mm256_loadu_si256( pa );
+        const auto vb = _mm256_loadu_si256( pb );
+        _mm256_storeu_si256( pa, ReverseVector<T>( vb ) );
+        _mm256_storeu_si256( pb, ReverseVector<T>( va ) );
+    }
+#endif
+    for( ; i<count; i++ ) std::swap( a[i], *( b - i ) );
+}
+
+template<typename T>
+void Rotate180Impl( void* ptr, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    auto p = (T*)ptr;
+    const auto sz = PixelCount( width, height );
+    const auto half = sz / 2;
+    if( !td || sz < ParallelThreshold )
+    {
+        SwapReversed( p, p + sz - 1, half );
+        return;
+    }
+
+    td->ParallelFor( half, td->Grain( half, sizeof( T ) * 2 ), [p, sz]( size_t begin, size_t end ) {
+        SwapReversed( p + begin, p + sz - 1 - begin, end - begin );
+    } );
+}
+
+template<typename T>
+void FlipHorizontalImpl( void* ptr, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    auto p = (T*)ptr;
+    auto flip = [p, width]( size_t begin, size_t end ) {
+        for( size_t y=begin; y<end; y++ )
+        {
+            auto row = p + y * width;
+            SwapReversed( row, row + width - 1, width / 2 );
+        }
+    };
+
+    if( !td || PixelCount( width, height ) < ParallelThreshold )
+    {
+        flip( 0, height );
+        return;
+    }
+
+    td->ParallelFor( height, std::max<size_t>( 1, height / ( ( td->NumWorkers() + 1 ) * 4 ) ), flip );
+}
+
+}
+
+void Transpose( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    Dispatch<false, false>( dst, src, width, height, pixelSize, td );
+}
+
+void Transverse( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    Dispatch<true, true>( dst, src, width, height, pixelSize, td );
+}
+
+void Rotate90( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    Dispatch<false, true>( dst, src, width, height, pixelSize, td );
+}
+
+void Rotate270( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    Dispatch<true, false>( dst, src, width, height, pixelSize, td );
+}
+
+void Rotate180( void* ptr, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    switch( pixelSize )
+    {
+    case 4:
+        Rotate180Impl<uint32_t>( ptr, width, height, td );
+        break;
+    case 8:
+        Rotate180Impl<uint64_t>( ptr, width, height, td );
+        break;
+    case 16:
+        Rotate180Impl<Pixel16>( ptr, width, height, td );
+        break;
+    default:
+        Panic( "Unsupported pixel size %zu", pixelSize );
+    }
+}
+
+void FlipHorizontal( void* ptr, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    switch( pixelSize )
+    {
+    case 4:
+        FlipHorizontalImpl<uint32_t>( ptr, width, height, td );
+        break;
+    case 8:
+        FlipHorizontalImpl<uint64_t>( ptr, width, height, td );
+        break;
+    case 16:
+        FlipHorizontalImpl<Pixel16>( ptr, width, height, td );
+        break;
+    default:
+        Panic( "Unsupported pixel size %zu", pixelSize );
+    }
+}
+
+void FlipVertical( void* ptr, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    const auto stride = size_t( width ) * pixelSize;
+    auto flip = [ptr = (uint8_t*)ptr, stride, height]( size_t begin, size_t end ) {
+        uint8_t tmp[4096];
+        for( size_t y=begin; y<end; y++ )
+        {
+            auto a = ptr + y * stride;
+            auto b = ptr + ( height - 1 - y ) * stride;
+            for( size_t i=0; i<stride; i+=sizeof( tmp ) )
+            {
+                const auto sz = std::min( sizeof( tmp ), stride - i );
+                memcpy( tmp, a + i, sz );
+                memcpy( a + i, b + i, sz );
+                memcpy( b + i, tmp, sz );
+            }
+        }
+    };
+
+    const auto rows = height / 2;
+    if( !td || PixelCount( width, height ) < ParallelThreshold )
+    {
+        flip( 0, rows );
+        return;
+    }
+
+    td->ParallelFor( rows, std::max<size_t>( 1, rows / ( ( td->NumWorkers() + 1 ) * 4 ) ), flip );
+}
+
+void Orient( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, int orientation, TaskDispatch* td )
+{
+    switch( orientation )
+    {
+    case 5:
+        Transpose( dst, src, width, height, pixelSize, td );
+        return;
+    case 6:
+        Rotate90( dst, src, width, height, pixelSize, td );
+        return;
+    case 7:
+        Transverse( dst, src, width, height, pixelSize, td );
+        return;
+    case 8:
+        Rotate270( dst, src, width, height, pixelSize, td );
+        return;
+    default:
+        break;
+    }
+
+    memcpy( dst, src, PixelCount( width, height ) * pixelSize );
+    switch( orientation )
+    {
+    case 0:
+    case 1:
+        break;
+    case 2:
+        FlipHorizontal( dst, width, height, pixelSize, td );
+        break;
+    case 3:
+        Rotate180( dst, width, height, pixelSize, td );
+        break;
+    case 4:
+        FlipVertical( dst, width, height, pixelSize, td );
+        break;
+    default:
+        Panic( "Invalid orientation value!" );
+    }
+}
+
+void MapRect( int orientation, uint32_t width, uint32_t height, uint32_t& x, uint32_t& y, uint32_t& w, uint32_t& h )
+{
+    const auto ux = x;
+    const auto uy = y;
+    const auto uw = w;
+    const auto uh = h;
+
+    switch( orientation )
+    {
+    case 0:
+    case 1:
+        break;
+    case 2:
+        x = width - ux - uw;
+        break;
+    case 3:
+        x = width - ux - uw;
+        y = height - uy - uh;
+        break;
+    case 4:
+        y = height - uy - uh;
+        break;
+    case 5:
+        x = uy;
+        y = ux;
+        break;
+    case 6:
+        x = uy;
+        y = height - ux - uw;
+        break;
+    case 7:
+        x = width - uy - uh;
+        y = height - ux - uw;
+        break;
+    case 8:
+        x = width - uy - uh;
+        y = ux;
+        break;
+    default:
+        Panic( "Invalid orientation value!" );
+    }
+
+    if( SwapsAxes( orientation ) )
+    {
+        w = uh;
+        h = uw;
+    }
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+class TaskDispatch;
+
+// Geometric transforms of interleaved pixel data, for pixels of 4, 8 or 16 bytes. Transposes and
+// rotations by 90 degrees write a height x width image to dst, which must not overlap src. The
+// work is done in cache sized tiles, which are split among workers if td is given.
+namespace PixelTransform
+{
+
+// Mirrors along the main diagonal, as in EXIF orientation 5
+void Transpose( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+// Mirrors along the anti-diagonal, as in EXIF orientation 7
+void Transverse( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+// Clockwise
+void Rotate90( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+void Rotate270( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+
+// In place
+void Rotate180( void* ptr, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+void FlipHorizontal( void* ptr, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+void FlipVertical( void* ptr, uint32_t width, uint32_t height, size_t pixelSize, TaskDispatch* td = nullptr );
+
+// Writes src to dst upright, as seen with the given EXIF orientation. Orientations 5 to 8 produce
+// a height x width image.
+void Orient( void* dst, const void* src, uint32_t width, uint32_t height, size_t pixelSize, int orientation, TaskDispatch* td = nullptr );
+
+// Maps a rectangle in upright coordinates to the stored image of width x height, which is seen
+// with the given EXIF orientation
+void MapRect( int orientation, uint32_t width, uint32_t height, uint32_t& x, uint32_t& y, uint32_t& w, uint32_t& h );
+
+static inline bool SwapsAxes( int orientation ) { return orientation >= 5; }
+
+}
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
+
+#include "Panic.hpp"
+#include "PixelBytes.hpp"
+#include "PngEncoder.hpp"
+#include "TaskDispatch.hpp"
+
+namespace PngEncoder
+{
+
+namespace
+{
+
+// Filtered data deflated by a single task
+constexpr size_t BandSize = 1024 * 1024;
+
+// Deflate window size, which is also how much of the previous band primes the next one
+constexpr size_t WindowSize = 32 * 1024;
+
+enum Filter : uint8_t
+{
+    FilterNone,
+    FilterSub,
+    FilterUp,
+    FilterAverage,
+    FilterPaeth
+};
+
+struct Band
+{
+    std::vector<uint8_t> chunk;     // complete IDAT chunk, except the crc of the last band
+    uint32_t adler;
+    size_t size;
+};
+
+void Put32( uint8_t* ptr, uint32_t v )
+{
+    ptr[0] = v >> 24;
+    ptr[1] = v >> 16;
+    ptr[2] = v >> 8;
+    ptr[3] = v;
+}
+
+// Residuals are taken as signed, so that small negative values are cheap
+static inline size_t Cost( uint8_t v )
+{
+    return v < 128 ? v : 256 - v;
+}
+
+#ifdef __AVX2__
+static inline __m256i CostAvx2( __m256i acc, __m256i v )
+{
+    return _mm256_add_epi64( acc, _mm256_sad_epu8( _mm256_abs_epi8( v ), _mm256_setzero_si256() ) );
+}
+
+static inline size_t SumAvx2( __m256i acc )
+{
+    const auto sum = _mm_add_epi64( _mm256_castsi256_si128( acc ), _mm256_extracti128_si256( acc, 1 ) );
+    return size_t( _mm_cvtsi128_si64( sum ) + _mm_extract_epi64( sum, 1 ) );
+}
+
+static inline __m256i Paeth16( __m256i a, __m256i b, __m256i c )
+{
+    const auto bc = _mm256_sub_epi16( b, c );
+    const auto ac = _mm256_sub_epi16( a, c );
+    const auto pa = _mm256_abs_epi16( bc );
+    const auto pb = _mm256_abs_epi16( ac );
+    const auto pc = _mm256_abs_epi16( _mm256_add_epi16( bc, ac ) );
+    const auto bOrC = _mm256_blendv_epi8( b, c, _mm256_cmpgt_epi16( pb, pc ) );
+    return _mm256_blendv_epi8( a, bOrC, _mm256_cmpgt_epi16( pa, _mm256_min_epi16( pb, pc ) ) );
+}
+#endif
+
+static inline uint8_t PaethPredictor( int a, int b, int c )
+{
+    const auto pa = abs( b - c );
+    const auto pb = abs( a - c );
+    const auto pc = abs( a + b - 2 * c );
+    if( pa <= pb && pa <= pc ) return a;
+    if( pb <= pc ) return b;
+    return c;
+}
+
+size_t CostNone( const uint8_t* row, size_t size )
+{
+    size_t i = 0;
+    size_t cost = 0;
+#ifdef __AVX2__
+    auto acc = _mm256_setzero_si256();
+    for( ; i + 32 <= size; i += 32 ) acc = CostAvx2( acc, _mm256_loadu_si256( (const __m256i*)( row + i ) ) );
+    cost = SumAvx2( acc );
+#endif
+    for( ; i<size; i++ ) cost += Cost( row[i] );
+    return cost;
+}
+
+// Filters write size bytes of residuals to dst and return their cost
+size_t Sub( uint8_t* dst, const uint8_t* row, size_t size )
+{
+    size_t cost = 0;
+    for( size_t i=0; i<4; i++ )
+    {
+        dst[i] = row[i];
+        cost += Cost( row[i] );
+    }
+    size_t i = 4;
+#ifdef __AVX2__
+    auto acc = _mm256_setzero_si256();
+    for( ; i + 32 <= size; i += 32 )
+    {
+        const auto x = _mm256_loadu_si256( (const __m256i*)( row + i ) );
+        const auto a = _mm256_loadu_si256( (const __m256i*)( row + i - 4 ) );
+        const auto d = _mm256_sub_epi8( x, a );
+        _mm256_storeu_si256( (__m256i*)( dst + i ), d );
+        acc = CostAvx2( acc, d );
+    }
+    cost += SumAvx2( acc );
+#endif
+    for( ; i<size; i++ )
+    {
+        dst[i] = row[i] - row[i-4];
+        cost += Cost( dst[i] );
+    }
+    return cost;
+}
+
+size_t Up( uint8_t* dst, const uint8_t* row, const uint8_t* prev, size_t size )
+{
+    size_t i = 0;
+    size_t cost = 0;
+#ifdef __AVX2__
+    auto acc = _mm256_setzero_si256();
+    for( ; i + 32 <= size; i += 32 )
+    {
+        const auto x = _mm256_loadu_si256( (const __m256i*)( row + i ) );
+        const auto b = _mm256_loadu_si256( (const __m256i*)( prev + i ) );
+        const auto d = _mm256_sub_epi8( x, b );
+        _mm256_storeu_si256( (__m256i*)( dst + i ), d );
+        acc = CostAvx2( acc, d );
+    }
+    cost = SumAvx2( acc );
+#endif
+    for( ; i<size; i++ )
+    {
+        dst[i] = row[i] - prev[i];
+        cost += Cost( dst[i] );
+    }
+    return cost;
+}
+
+size_t Paeth( uint8_t* dst, const uint8_t* row, const uint8_t* prev, size_t size )
+{
+    // Left and upper left neighbors of the first pixel are zero, which always predicts up
+    size_t cost = 0;
+    for( size_t i=0; i<4; i++ )
+    {
+        dst[i] = row[i] - prev[i];
+        cost += Cost( dst[i] );
+    }
+    size_t i = 4;
+#ifdef __AVX2__
+    const auto zero = _mm256_setzero_si256();
+    auto acc = _mm256_setzero_si256();
+    for( ; i + 32 <= size; i += 32 )
+    {
+        const auto x = _mm256_loadu_si256( (const __m256i*)( row + i ) );
+        const auto a = _mm256_loadu_si256( (const __m256i*)( row + i - 4 ) );
+        const auto b = _mm256_loadu_si256( (const __m256i*)( prev + i ) );
+        const auto c = _mm256_loadu_si256( (const __m256i*)( prev + i - 4 ) );
+        const auto lo = Paeth16( _mm256_unpacklo_epi8( a, zero ), _mm256_unpacklo_epi8( b, zero ), _mm256_unpacklo_epi8( c, zero ) );
+        const auto hi = Paeth16( _mm256_unpackhi_epi8( a, zero ), _mm256_unpackhi_epi8( b, zero ), _mm256_unpackhi_epi8( c, zero ) );
+        const auto d = _mm256_sub_epi8( x, _mm256_packus_epi16( lo, hi ) );
+        _mm256_storeu_si256( (__m256i*)( dst + i ), d );
+        acc = CostAvx2( acc, d );
+    }
+    cost += SumAvx2( acc );
+#endif
+    for( ; i<size; i++ )
+    {
+        dst[i] = row[i] - PaethPredictor( row[i-4], prev[i], prev[i-4] );
+        cost += Cost( dst[i] );
+    }
+    return cost;
+}
+
+// Writes the filter type byte, followed by the row filtered with the cheapest filter. Scratch must
+// hold two rows. Without a previous row, Up is the same as None, and Paeth the same as Sub.
+void FilterRow( uint8_t* dst, const uint8_t* row, const uint8_t* prev, size_t size, uint8_t* scratch )
+{
+    auto best = scratch;
+    auto other = scratch + size;
+
+    uint8_t type = FilterSub;
+    auto cost = Sub( best, row, size );
+    if( prev )
+    {
+        auto c = Up( other, row, prev, size );
+        if( c < cost )
+        {
+            std::swap( best, other );
+            cost = c;
+            type = FilterUp;
+        }
+        c = Paeth( other, row, prev, size );
+        if( c < cost )
+        {
+            std::swap( best, other );
+            cost = c;
+            type = FilterPaeth;
+        }
+    }
+
+    dst[0] = type;
+    if( CostNone( row, size ) <= cost )
+    {
+        dst[0] = FilterNone;
+        memcpy( dst + 1, row, size );
+    }
+    else
+    {
+        memcpy( dst + 1, best, size );
+    }
+}
+
+bool WriteAll( int fd, const uint8_t* data, size_t size )
+{
+    while( size > 0 )
+    {
+        const auto cnt = write( fd, data, size );
+        if( cnt < 0 )
+        {
+            if( errno == EINTR ) continue;
+            return false;
+        }
+        if( cnt == 0 ) return false;
+        data += cnt;
+        size -= cnt;
+    }
+    return true;
+}
+
+bool WriteChunk( int fd, const char* type, const uint8_t* data, uint32_t size )
+{
+    uint8_t hdr[8];
+    Put32( hdr, size );
+    memcpy( hdr + 4, type, 4 );
+    auto sum = crc32( 0, hdr + 4, 4 );
+    if( size > 0 ) sum = crc32( sum, data, size );
+    uint8_t crc[4];
+    Put32( crc, sum );
+    return WriteAll( fd, hdr, 8 ) && WriteAll( fd, data, size ) && WriteAll( fd, crc, 4 );
+}
+
+}
+
+bool Write( int fd, const uint32_t* data, uint32_t width, uint32_t height, Level level, TaskDispatch* td )
+{
+    ZoneScoped;
+    CheckPanic( width > 0 && height > 0, "Invalid PNG size %ux%u", width, height );
+
+    int zlevel, flevel;
+    switch( level )
+    {
+    case Level::Fast:
+        zlevel = 1;
+        flevel = 0;
+        break;
+    case Level::Small:
+        zlevel = 9;
+        flevel = 3;
+        break;
+    default:
+        zlevel = 6;
+        flevel = 2;
+        break;
+    }
+
+    const auto rowSize = size_t( width ) * 4;
+    const auto stride = rowSize + 1;
+    const auto bandRows = std::max<size_t>( 1, BandSize / stride );
+    const auto numBands = ( height + bandRows - 1 ) / bandRows;
+    const auto dictRows = ( WindowSize + stride - 1 ) / stride;
+    const auto src = (const uint8_t*)data;
+
+    // Each band filters its rows, and again the rows at the end of the previous band it is primed with
+    std::vector<Band> bands( numBands );
+    auto encode = [&]( size_t begin, size_t end ) {
+        ZoneScopedN( "Deflate band" );
+        std::vector<uint8_t> scratch( rowSize * 2 );
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto y0 = i * bandRows;
+            const auto y1 = std::min<size_t>( height, y0 + bandRows );
+            const auto d0 = y0 - std::min( y0, dictRows );
+            PixelBuffer<uint8_t> buf( PixelAlloc<uint8_t>( stride, y1 - d0, 1 ) );
+            for( size_t y=d0; y<y1; y++ )
+            {
+                FilterRow( buf.get() + ( y - d0 ) * stride, src + y * rowSize, y > 0 ? src + ( y - 1 ) * rowSize : nullptr, rowSize, scratch.data() );
+            }
+
+            const auto in = buf.get() + ( y0 - d0 ) * stride;
+            const auto inSize = ( y1 - y0 ) * stride;
+            const auto dictSize = std::min( WindowSize, ( y0 - d0 ) * stride );
+            const auto last = i == numBands - 1;
+
+            z_stream strm = {};
+            CheckPanic( deflateInit2( &strm, zlevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) == Z_OK, "Failed to initialize deflate" );
+            if( dictSize > 0 ) deflateSetDictionary( &strm, in - dictSize, dictSize );
+
+            auto& band = bands[i];
+            const size_t header = i == 0 ? 2 : 0;
+            band.chunk.resize( 8 + header + deflateBound( &strm, inSize ) + 16 + 4 + 4 );
+            auto out = band.chunk.data() + 8;
+            memcpy( out - 4, "IDAT", 4 );
+            // The zlib stream header declares a 32 KB window and hints at the compression level
+            if( i == 0 )
+            {
+                out[0] = 0x78;
+                out[1] = flevel << 6;
+                out[1] += 31 - ( out[0] * 256 + out[1] ) % 31;
+                out += 2;
+            }
+
+            strm.next_in = in;
+            strm.avail_in = inSize;
+            strm.next_out = out;
+            strm.avail_out = band.chunk.size() - ( out - band.chunk.data() ) - 8;
+            const auto res = deflate( &strm, last ? Z_FINISH : Z_SYNC_FLUSH );
+            CheckPanic( res == ( last ? Z_STREAM_END : Z_OK ) && strm.avail_in == 0 && strm.avail_out > 0, "Deflate failed" );
+            out = strm.next_out;
+            deflateEnd( &strm );
+
+            band.adler = adler32( 1, in, inSize );
+            band.size = inSize;
+            band.chunk.resize( out - band.chunk.data() + ( last ? 8 : 4 ) );
+            Put32( band.chunk.data(), band.chunk.size() - 12 );
+            if( !last ) Put32( out, crc32( 0, band.chunk.data() + 4, out - band.chunk.data() - 4 ) );
+        }
+    };
+    if( td ) td->ParallelFor( numBands, 1, encode );
+    else encode( 0, numBands );
+
+    // The stream ends with the checksum of all filtered data
+    auto adler = bands[0].adler;
+    for( size_t i=1; i<numBands; i++ ) adler = adler32_combine( adler, bands[i].adler, bands[i].size );
+    auto& last = bands.back();
+    const auto end = last.chunk.data() + last.chunk.size() - 8;
+    Put32( end, adler );
+    Put32( end + 4, crc32( 0, last.chunk.data() + 4, end + 4 - last.chunk.data() - 4 ) );
+
+    static constexpr uint8_t Signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t ihdr[13];
+    Put32( ihdr, width );
+    Put32( ihdr + 4, height );
+    ihdr[8] = 8;        // bit depth
+    ihdr[9] = 6;        // RGBA
+    ihdr[10] = 0;       // deflate
+    ihdr[11] = 0;       // adaptive filtering
+    ihdr[12] = 0;       // no interlace
+
+    if( !WriteAll( fd, Signature, sizeof( Signature ) ) ) return false;
+    if( !WriteChunk( fd, "IHDR", ihdr, sizeof( ihdr ) ) ) return false;
+    for( auto& band : bands )
+    {
+        if( !WriteAll( fd, band.chunk.data(), band.chunk.size() ) ) return false;
+    }
+    return WriteChunk( fd, "IEND", nullptr, 0 );
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+class TaskDispatch;
+
+// Writes 8-bit RGBA images as PNG. Each row is filtered with whichever of None, Sub, Up and Paeth
+// gives the smallest residuals. Rows are then split into bands of about a megabyte, which are
+// deflated independently, each primed with the tail of the previous band, and written as separate
+// IDAT chunks. The output does not depend on the number of workers.
+namespace PngEncoder
+{
+
+enum class Level
+{
+    Fast,       // for transient data, such as clipboard transfers
+    Default,
+    Small
+};
+
+bool Write( int fd, const uint32_t* data, uint32_t width, uint32_t height, Level level = Level::Default, TaskDispatch* td = nullptr );
+
+}
@@ -0,0 +1,89 @@
+#include <atomic>
+#include <stdint.h>
+
+#if defined __x86_64__ || defined __i386__
+#  include <cpuid.h>
+#endif
+
+#include "Logs.hpp"
+#include "SimdLevel.hpp"
+
+namespace
+{
+
+#if defined __x86_64__ || defined __i386__
+// Register state enabled by the operating system
+uint64_t Xcr0()
+{
+    uint32_t lo, hi;
+    asm volatile( "xgetbv" : "=a"( lo ), "=d"( hi ) : "c"( 0 ) );
+    return ( uint64_t( hi ) << 32 ) | lo;
+}
+#endif
+
+SimdLevel Detect()
+{
+#if defined __x86_64__ || defined __i386__
+    uint32_t a, b, c, d;
+    if( !__get_cpuid( 1, &a, &b, &c, &d ) ) return SimdLevel::Scalar;
+    if( !( c & bit_SSSE3 ) || !( c & bit_SSE4_1 ) || !( c & bit_SSE4_2 ) || !( c & bit_POPCNT ) ) return SimdLevel::Scalar;
+
+    constexpr uint32_t Avx2Features = bit_AVX | bit_FMA | bit_F16C | bit_OSXSAVE;
+    if( ( c & Avx2Features ) != Avx2Features ) return SimdLevel::Sse41;
+
+    // SSE and AVX state
+    const auto xcr0 = Xcr0();
+    if( ( xcr0 & 0x6 ) != 0x6 ) return SimdLevel::Sse41;
+    if( !__get_cpuid_count( 7, 0, &a, &b, &c, &d ) ) return SimdLevel::Sse41;
+    if( !( b & bit_AVX2 ) || !( b & bit_BMI ) || !( b & bit_BMI2 ) ) return SimdLevel::Sse41;
+
+    // Opmask and upper ZMM state
+    constexpr uint32_t Avx512Features = bit_AVX512F | bit_AVX512BW | bit_AVX512DQ | bit_AVX512VL;
+    if( ( b & Avx512Features ) != Avx512Features || ( xcr0 & 0xE6 ) != 0xE6 ) return SimdLevel::Avx2;
+    return SimdLevel::Avx512;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+std::atomic<SimdLevel>& Level()
+{
+    static std::atomic<SimdLevel> level = [] {
+        const auto detected = DetectSimdLevel();
+        mclog( LogLevel::Info, "SIMD level: %s", SimdLevelName( detected ) );
+        return detected;
+    }();
+    return level;
+}
+
+}
+
+SimdLevel DetectSimdLevel()
+{
+    static const auto level = Detect();
+    return level;
+}
+
+SimdLevel GetSimdLevel()
+{
+    return Level().load( std::memory_order_relaxed );
+}
+
+SimdLevel SetSimdLevel( SimdLevel level )
+{
+    if( level > DetectSimdLevel() ) level = DetectSimdLevel();
+    Level().store( level, std::memory_order_relaxed );
+    return level;
+}
+
+const char* SimdLevelName( SimdLevel level )
+{
+    switch( level )
+    {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::Sse41: return "SSE4.1";
+    case SimdLevel::Avx2: return "AVX2";
+    case SimdLevel::Avx512: return "AVX-512";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Instruction set levels of dispatched kernels. Sse41 is x86-64-v2, Avx2 is x86-64-v3 (with FMA and
+// F16C), Avx512 is x86-64-v4 (F, BW, DQ and VL).
+enum class SimdLevel
+{
+    Scalar,
+    Sse41,
+    Avx2,
+    Avx512
+};
+
+// Best level supported by the CPU and the operating system
+[[nodiscard]] SimdLevel DetectSimdLevel();
+
+// Level used by dispatched kernels. Defaults to the detected level.
+[[nodiscard]] SimdLevel GetSimdLevel();
+
+// Forces a lower level, for testing and benchmarking. Levels above the detected one are clamped.
+// Returns the level that was set.
+SimdLevel SetSimdLevel( SimdLevel level );
+
+[[nodiscard]] const char* SimdLevelName( SimdLevel level );
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <stb_image_resize2.h>
+#include <tracy/Tracy.hpp>
+
+#include "Bitmap.hpp"
+#include "Panic.hpp"
+#include "PixelBytes.hpp"
+#include "StripPipeline.hpp"
+#include "TaskDispatch.hpp"
+
+// Size of the float band buffer. Small enough to stay in the last level cache while the band is
+// decoded, converted and tone mapped.
+constexpr size_t BandBytes = 4 * 1024 * 1024;
+
+StripPipeline::StripPipeline( StripSource& source, ToneMap::Operator op, TaskDispatch* td )
+    : m_source( source )
+    , m_op( op )
+    , m_td( td )
+    , m_width( source.Width() )
+    , m_height( source.Height() )
+    , m_bands {}
+    , m_nextBand( 0 )
+{
+    CheckPanic( m_width > 0 && m_height > 0, "Invalid strip source size" );
+
+    const auto rowBytes = size_t( m_width ) * 4 * sizeof( float );
+    m_bandRows = uint32_t( std::clamp<size_t>( BandBytes / rowBytes, 1, m_height ) );
+    m_hdr.reset( PixelAlloc<float>( m_width, m_bandRows ) );
+}
+
+StripPipeline::~StripPipeline()
+{
+}
+
+std::unique_ptr<Bitmap> StripPipeline::Process()
+{
+    ZoneScoped;
+
+    auto bmp = std::make_unique<Bitmap>( m_width, m_height );
+    auto dst = (uint32_t*)bmp->Data();
+    for( uint32_t y=0; y<m_height; y+=m_bandRows )
+    {
+        const auto rows = std::min( m_bandRows, m_height - y );
+        Produce( dst + size_t( y ) * m_width, y, rows );
+    }
+    return bmp;
+}
+
+std::unique_ptr<Bitmap> StripPipeline::Process( uint32_t width, uint32_t height )
+{
+    if( width == m_width && height == m_height ) return Process();
+
+    ZoneScoped;
+
+    // The resizer pulls input rows through a callback. Two bands are kept, so that filter
+    // windows straddling a band boundary do not cause bands to be produced again.
+    for( auto& band : m_bands )
+    {
+        band.data.reset( PixelAlloc<uint32_t>( m_width, m_bandRows, 1 ) );
+        band.rows = 0;
+    }
+
+    auto bmp = std::make_unique<Bitmap>( width, height );
+    STBIR_RESIZE resize;
+    stbir_resize_init( &resize, m_bands[0].data.get(), m_width, m_height, 0, bmp->Data(), width, height, 0, STBIR_RGBA, STBIR_TYPE_UINT8_SRGB );
+    stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
+    stbir_set_pixel_callbacks( &resize, []( void*, const void*, int, int x, int y, void* context ) -> const void* {
+        return ( (StripPipeline*)context )->Row( x, y );
+    }, nullptr );
+    stbir_set_user_data( &resize, this );
+    CheckPanic( stbir_resize_extended( &resize ), "Failed to resize image" );
+
+    for( auto& band : m_bands ) band.data.reset();
+    return bmp;
+}
+
+void StripPipeline::Produce( uint32_t* dst, uint32_t y, uint32_t rows )
+{
+    ZoneScoped;
+
+    m_source.Read( m_hdr.get(), y, rows );
+
+    const auto sz = PixelCount( m_width, rows );
+    if( m_td )
+    {
+        m_td->ParallelFor( sz, m_td->Grain( sz, 4 * sizeof( float ) + sizeof( uint32_t ) ), [op = m_op, dst, src = m_hdr.get()]( size_t begin, size_t end ) {
+            ToneMap::Process( op, dst + begin, src + begin * 4, end - begin );
+        } );
+    }
+    else
+    {
+        ToneMap::Process( m_op, dst, m_hdr.get(), sz );
+    }
+}
+
+const uint32_t* StripPipeline::Row( uint32_t x, uint32_t y )
+{
+    for( auto& band : m_bands )
+    {
+        if( y >= band.y && y < band.y + band.rows ) return band.data.get() + size_t( y - band.y ) * m_width + x;
+    }
+
+    auto& band = m_bands[m_nextBand];
+    m_nextBand ^= 1;
+
+    band.y = y;
+    band.rows = std::min( m_bandRows, m_height - y );
+    Produce( band.data.get(), band.y, band.rows );
+
+    return band.data.get() + x;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "NoCopy.hpp"
+#include "PixelBytes.hpp"
+#include "Tonemapper.hpp"
+
+class Bitmap;
+class TaskDispatch;
+
+// Produces linear BT.709 RGBA float image data in horizontal bands of rows, without holding the
+// whole decoded image. Read() is called from one thread at a time, usually with increasing y.
+class StripSource
+{
+public:
+    virtual ~StripSource() = default;
+
+    [[nodiscard]] virtual uint32_t Width() const = 0;
+    [[nodiscard]] virtual uint32_t Height() const = 0;
+
+    virtual void Read( float* dst, uint32_t y, uint32_t rows ) = 0;
+};
+
+// Tone maps, and optionally resizes, a strip source into a bitmap. Each band of rows goes through
+// all stages while it is still in cache, so the full resolution HDR image is never materialized.
+class StripPipeline
+{
+public:
+    StripPipeline( StripSource& source, ToneMap::Operator op, TaskDispatch* td = nullptr );
+    ~StripPipeline();
+    NoCopy( StripPipeline );
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Process();
+    [[nodiscard]] std::unique_ptr<Bitmap> Process( uint32_t width, uint32_t height );
+
+    [[nodiscard]] uint32_t BandRows() const { return m_bandRows; }
+
+private:
+    struct Band
+    {
+        PixelBuffer<uint32_t> data;
+        uint32_t y;
+        uint32_t rows;
+    };
+
+    void Produce( uint32_t* dst, uint32_t y, uint32_t rows );
+    [[nodiscard]] const uint32_t* Row( uint32_t x, uint32_t y );
+
+    StripSource& m_source;
+    ToneMap::Operator m_op;
+    TaskDispatch* m_td;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_bandRows;
+
+    PixelBuffer<float> m_hdr;
+
+    Band m_bands[2];
+    int m_nextBand;
+};
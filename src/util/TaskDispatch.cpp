@@ -1,24 +1,303 @@
+#include <mutex>
 #include <stdio.h>
+#include <unistd.h>
 #include <tracy/Tracy.hpp>
 
 #include "TaskDispatch.hpp"
 #include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+struct TaskDispatch::Task
+{
+    Job job;
+    Group* group;
+    std::atomic<uint32_t> next;
+    uint32_t idx;
+};
+
+// Per-worker cache of free tasks, only accessed by the owning worker thread
+struct alignas( 64 ) TaskDispatch::FreeList
+{
+    uint32_t head = 0;
+    uint32_t count = 0;
+};
+
+// Chase-Lev work-stealing deque. The owning worker pushes and pops at the bottom,
+// other threads steal from the top. See "Correct and Efficient Work-Stealing for
+// Weak Memory Models", Lê et al., 2013.
+class TaskDispatch::WorkQueue
+{
+public:
+    WorkQueue()
+        : m_top( 0 )
+        , m_bottom( 0 )
+    {
+    }
+
+    [[nodiscard]] bool Push( Task* task )
+    {
+        const auto b = m_bottom.load( std::memory_order_relaxed );
+        const auto t = m_top.load( std::memory_order_acquire );
+        if( b - t >= Size ) return false;
+        m_data[b & Mask].store( task, std::memory_order_relaxed );
+        m_bottom.store( b + 1, std::memory_order_release );
+        return true;
+    }
+
+    [[nodiscard]] Task* Pop()
+    {
+        const auto b = m_bottom.load( std::memory_order_relaxed ) - 1;
+        m_bottom.store( b, std::memory_order_seq_cst );
+        auto t = m_top.load( std::memory_order_seq_cst );
+        if( t > b )
+        {
+            m_bottom.store( b + 1, std::memory_order_relaxed );
+            return nullptr;
+        }
+        auto task = m_data[b & Mask].load( std::memory_order_relaxed );
+        if( t == b )
+        {
+            if( !m_top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) ) task = nullptr;
+            m_bottom.store( b + 1, std::memory_order_relaxed );
+        }
+        return task;
+    }
+
+    [[nodiscard]] Task* Steal()
+    {
+        for(;;)
+        {
+            auto t = m_top.load( std::memory_order_seq_cst );
+            const auto b = m_bottom.load( std::memory_order_seq_cst );
+            if( t >= b ) return nullptr;
+            auto task = m_data[t & Mask].load( std::memory_order_relaxed );
+            if( m_top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) ) return task;
+        }
+    }
+
+private:
+    static constexpr int64_t Size = 4096;
+    static constexpr int64_t Mask = Size - 1;
+
+    alignas( 64 ) std::atomic<int64_t> m_top;
+    alignas( 64 ) std::atomic<int64_t> m_bottom;
+    alignas( 64 ) std::atomic<Task*> m_data[Size];
+};
+
+// Bounded MPMC queue for tasks submitted from outside of the worker threads.
+// See https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+class TaskDispatch::InjectQueue
+{
+public:
+    InjectQueue()
+        : m_enqueue( 0 )
+        , m_dequeue( 0 )
+    {
+        for( size_t i=0; i<Size; i++ ) m_cells[i].seq.store( i, std::memory_order_relaxed );
+    }
+
+    [[nodiscard]] bool Push( Task* task )
+    {
+        auto pos = m_enqueue.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            auto& cell = m_cells[pos & Mask];
+            const auto seq = cell.seq.load( std::memory_order_acquire );
+            const auto diff = intptr_t( seq ) - intptr_t( pos );
+            if( diff == 0 )
+            {
+                if( m_enqueue.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    cell.task = task;
+                    cell.seq.store( pos + 1, std::memory_order_release );
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue.load( std::memory_order_relaxed );
+            }
+        }
+    }
+
+    [[nodiscard]] Task* Pop()
+    {
+        auto pos = m_dequeue.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            auto& cell = m_cells[pos & Mask];
+            const auto seq = cell.seq.load( std::memory_order_acquire );
+            const auto diff = intptr_t( seq ) - intptr_t( pos + 1 );
+            if( diff == 0 )
+            {
+                if( m_dequeue.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    auto task = cell.task;
+                    cell.seq.store( pos + Mask + 1, std::memory_order_release );
+                    return task;
+                }
+            }
+            else if( diff < 0 )
+            {
+                return nullptr;
+            }
+            else
+            {
+                pos = m_dequeue.load( std::memory_order_relaxed );
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        Task* task;
+    };
+
+    static constexpr size_t Size = 16 * 1024;
+    static constexpr size_t Mask = Size - 1;
+
+    alignas( 64 ) std::atomic<size_t> m_enqueue;
+    alignas( 64 ) std::atomic<size_t> m_dequeue;
+    alignas( 64 ) Cell m_cells[Size];
+};
+
+// Task storage. Tasks are allocated in chunks that are never released until the dispatch is
+// destroyed, which allows addressing them with 32-bit indices and keeping the free list in a
+// lock-free stack with an ABA tag. Links hold index + 1, with zero being the end of list.
+class TaskDispatch::TaskPool
+{
+public:
+    static constexpr uint32_t ChunkBits = 10;
+    static constexpr uint32_t ChunkSize = 1 << ChunkBits;
+    static constexpr uint32_t MaxChunks = 4096;
+
+    explicit TaskPool( std::atomic<size_t>& allocations )
+        : m_head( 0 )
+        , m_numChunks( 0 )
+        , m_allocations( allocations )
+    {
+        for( auto& chunk : m_chunks ) chunk.store( nullptr, std::memory_order_relaxed );
+    }
+
+    ~TaskPool()
+    {
+        for( uint32_t i=0; i<m_numChunks; i++ ) delete[] m_chunks[i].load( std::memory_order_relaxed );
+    }
+
+    NoCopy( TaskPool );
+
+    [[nodiscard]] Task* Get( uint32_t link ) const
+    {
+        const auto idx = link - 1;
+        return m_chunks[idx >> ChunkBits].load( std::memory_order_acquire ) + ( idx & ( ChunkSize - 1 ) );
+    }
+
+    [[nodiscard]] Task* Pop()
+    {
+        auto head = m_head.load( std::memory_order_acquire );
+        while( uint32_t( head ) != 0 )
+        {
+            const auto next = Get( uint32_t( head ) )->next.load( std::memory_order_relaxed );
+            const auto newHead = ( ( ( head >> 32 ) + 1 ) << 32 ) | next;
+            if( m_head.compare_exchange_weak( head, newHead, std::memory_order_acquire, std::memory_order_acquire ) ) return Get( uint32_t( head ) );
+        }
+        return Grow();
+    }
+
+    // Pushes a chain of tasks, already linked from first to last
+    void Push( Task* first, Task* last )
+    {
+        auto head = m_head.load( std::memory_order_relaxed );
+        uint64_t newHead;
+        do
+        {
+            last->next.store( uint32_t( head ), std::memory_order_relaxed );
+            newHead = ( ( ( head >> 32 ) + 1 ) << 32 ) | ( first->idx + 1 );
+        }
+        while( !m_head.compare_exchange_weak( head, newHead, std::memory_order_release, std::memory_order_relaxed ) );
+    }
+
+private:
+    [[nodiscard]] Task* Grow()
+    {
+        std::lock_guard lock( m_lock );
+        CheckPanic( m_numChunks < MaxChunks, "Too many tasks in flight" );
+
+        auto chunk = new Task[ChunkSize];
+        const auto base = m_numChunks << ChunkBits;
+        for( uint32_t i=0; i<ChunkSize; i++ )
+        {
+            chunk[i].idx = base + i;
+            chunk[i].next.store( i + 1 < ChunkSize ? base + i + 2 : 0, std::memory_order_relaxed );
+        }
+        m_chunks[m_numChunks++].store( chunk, std::memory_order_release );
+        m_allocations.fetch_add( 1, std::memory_order_relaxed );
+
+        Push( chunk + 1, chunk + ChunkSize - 1 );
+        return chunk;
+    }
+
+    alignas( 64 ) std::atomic<uint64_t> m_head;
+    std::atomic<Task*> m_chunks[MaxChunks];
+    uint32_t m_numChunks;
+    std::mutex m_lock;
+    std::atomic<size_t>& m_allocations;
+};
+
+namespace
+{
+struct Frame
+{
+    TaskDispatch* td;
+    TaskDispatch::Group* group;
+};
+
+struct WorkerId
+{
+    TaskDispatch* td;
+    size_t idx;
+};
+
+constexpr size_t NoWorker = SIZE_MAX;
+constexpr int SpinCount = 16;
+constexpr uint32_t FreeListSize = 256;
+constexpr size_t MinGrain = 4 * 1024;
+constexpr size_t DefaultL2Size = 512 * 1024;
+
+thread_local Frame* t_frame = nullptr;
+thread_local WorkerId t_worker = { nullptr, NoWorker };
+}
 
 TaskDispatch::TaskDispatch( size_t workers, const char* name )
-    : m_exit( false )
-    , m_jobs( 0 )
+    : m_inject( std::make_unique<InjectQueue>() )
+    , m_pool( std::make_unique<TaskPool>( m_allocations ) )
+    , m_freeLists( std::make_unique<FreeList[]>( workers ) )
+    , m_epoch( 0 )
+    , m_sleeping( 0 )
+    , m_exit( false )
+    , m_allocations( 0 )
+    , m_allocationsReported( 0 )
     , m_numWorkers( workers )
     , m_initDone( false )
 {
     ZoneScoped;
 
+    m_queues.reserve( workers );
+    for( size_t i=0; i<workers; i++ ) m_queues.emplace_back( std::make_unique<WorkQueue>() );
+
     m_init = std::thread( [this, workers, name] {
         mclog( LogLevel::Info, "Creating %zu worker threads named '%s'", workers, name );
 
         m_workers.reserve( workers );
         for( size_t i=0; i<workers; i++ )
         {
-            m_workers.emplace_back( [this, name, i]{ SetName( name, i ); Worker(); } );
+            m_workers.emplace_back( [this, name, i]{ SetName( name, i ); Worker( i ); } );
         }
     } );
 }
@@ -28,14 +307,19 @@ TaskDispatch::~TaskDispatch()
     WaitInit();
 
     m_exit.store( true, std::memory_order_release );
-    m_queueLock.lock();
-    m_cvWork.notify_all();
-    m_queueLock.unlock();
+    m_epoch.fetch_add( 1 );
+    m_epoch.notify_all();
 
     for( auto& worker : m_workers )
     {
         worker.join();
     }
+
+    while( auto task = m_inject->Pop() ) task->job.Reset();
+    for( auto& queue : m_queues )
+    {
+        while( auto task = queue->Steal() ) task->job.Reset();
+    }
 }
 
 void TaskDispatch::WaitInit()
@@ -50,50 +334,54 @@ void TaskDispatch::WaitInit()
     }
 }
 
-void TaskDispatch::Queue( const std::function<void(void)>& f )
+size_t TaskDispatch::Grain( size_t count, size_t itemSize ) const
 {
-    std::lock_guard lock( m_queueLock );
-    m_queue.emplace_back( f );
-    m_cvWork.notify_one();
+    static const size_t l2 = [] {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        const auto size = sysconf( _SC_LEVEL2_CACHE_SIZE );
+        if( size > 0 ) return size_t( size );
+#endif
+        return DefaultL2Size;
+    }();
+
+    const auto cache = l2 / 2 / std::max<size_t>( itemSize, 1 );
+    const auto share = ( count + m_numWorkers ) / ( m_numWorkers + 1 );
+    return std::max( std::min( cache, share ), MinGrain );
 }
 
-void TaskDispatch::Queue( std::function<void(void)>&& f )
+void TaskDispatch::Sync()
 {
-    std::lock_guard lock( m_queueLock );
-    m_queue.emplace_back( std::move( f ) );
-    m_cvWork.notify_one();
+    Join( CurrentGroup() );
+    ReportAllocations();
 }
 
-void TaskDispatch::Sync()
+void TaskDispatch::Sync( Group& group )
 {
-    std::unique_lock lock( m_queueLock );
-    while( !m_queue.empty() )
-    {
-        auto f = m_queue.back();
-        m_queue.pop_back();
-        lock.unlock();
-        f();
-        lock.lock();
-    }
-    m_cvJobs.wait( lock, [this]{ return m_jobs == 0; } );
+    Join( group );
+    ReportAllocations();
 }
 
-void TaskDispatch::Worker()
+void TaskDispatch::Worker( size_t idx )
 {
-    for(;;)
+    t_worker = { this, idx };
+
+    while( !m_exit.load( std::memory_order_acquire ) )
     {
-        std::unique_lock lock( m_queueLock );
-        m_cvWork.wait( lock, [this]{ return !m_queue.empty() || m_exit.load( std::memory_order_acquire ); } );
-        if( m_exit.load( std::memory_order_acquire ) ) return;
-        auto f = m_queue.back();
-        m_queue.pop_back();
-        m_jobs++;
-        lock.unlock();
-        f();
-        lock.lock();
-        m_jobs--;
-        if( m_jobs == 0 && m_queue.empty() ) m_cvJobs.notify_all();
-        lock.unlock();
+        auto task = GetTask( idx );
+        for( int i=0; !task && i<SpinCount; i++ )
+        {
+            std::this_thread::yield();
+            task = GetTask( idx );
+        }
+        if( !task )
+        {
+            m_sleeping.fetch_add( 1 );
+            const auto epoch = m_epoch.load( std::memory_order_acquire );
+            task = GetTask( idx );
+            if( !task && !m_exit.load( std::memory_order_acquire ) ) m_epoch.wait( epoch, std::memory_order_acquire );
+            m_sleeping.fetch_sub( 1 );
+        }
+        if( task ) Execute( task );
     }
 }
 
@@ -103,3 +391,163 @@ void TaskDispatch::SetName( const char* name, size_t num )
     snprintf( tmp, sizeof( tmp ), "%s #%zu", name, num );
     tracy::SetThreadName( tmp );
 }
+
+void TaskDispatch::Enqueue( Group& group, Job&& job )
+{
+    auto task = AllocTask();
+    task->job = std::move( job );
+    task->group = &group;
+    group.m_pending.fetch_add( 1, std::memory_order_relaxed );
+    Push( task );
+}
+
+void TaskDispatch::Push( Task* task )
+{
+    if( t_worker.td == this && m_queues[t_worker.idx]->Push( task ) )
+    {
+        Wake( false );
+        return;
+    }
+    while( !m_inject->Push( task ) )
+    {
+        if( auto other = m_inject->Pop() ) Execute( other );
+    }
+    Wake( false );
+}
+
+TaskDispatch::Task* TaskDispatch::GetTask( size_t idx )
+{
+    const auto num = m_queues.size();
+    if( idx < num )
+    {
+        if( auto task = m_queues[idx]->Pop() ) return task;
+    }
+    if( auto task = m_inject->Pop() ) return task;
+    for( size_t i=1; i<=num; i++ )
+    {
+        if( auto task = m_queues[( idx + i ) % num]->Steal() ) return task;
+    }
+    return nullptr;
+}
+
+void TaskDispatch::Execute( Task* task )
+{
+    Group nested;
+    Frame frame = { this, &nested };
+    auto prev = t_frame;
+    t_frame = &frame;
+
+    task->job();
+    task->job.Reset();
+    Join( nested );
+
+    t_frame = prev;
+
+    auto group = task->group;
+    FreeTask( task );
+    if( group->m_pending.fetch_sub( 1 ) == 1 ) Wake( true );
+}
+
+void TaskDispatch::Join( Group& group )
+{
+    const auto idx = t_worker.td == this ? t_worker.idx : NoWorker;
+    bool slept = false;
+
+    while( group.m_pending.load( std::memory_order_acquire ) != 0 )
+    {
+        auto task = GetTask( idx );
+        for( int i=0; !task && i<SpinCount && group.m_pending.load( std::memory_order_acquire ) != 0; i++ )
+        {
+            std::this_thread::yield();
+            task = GetTask( idx );
+        }
+        if( !task )
+        {
+            m_sleeping.fetch_add( 1 );
+            const auto epoch = m_epoch.load( std::memory_order_acquire );
+            if( group.m_pending.load( std::memory_order_acquire ) != 0 )
+            {
+                task = GetTask( idx );
+                if( !task )
+                {
+                    m_epoch.wait( epoch, std::memory_order_acquire );
+                    slept = true;
+                }
+            }
+            m_sleeping.fetch_sub( 1 );
+        }
+        if( task ) Execute( task );
+    }
+
+    // The wakeup may have been meant for a new task, pass it on to someone else
+    if( slept ) Wake( false );
+}
+
+void TaskDispatch::Wake( bool all )
+{
+    // Read-modify-write pairs with the increment done by sleeping threads: either the
+    // sleeper will see the new work, or the sleeper count will be seen here.
+    if( m_sleeping.fetch_add( 0 ) == 0 ) return;
+    m_epoch.fetch_add( 1, std::memory_order_release );
+    if( all )
+    {
+        m_epoch.notify_all();
+    }
+    else
+    {
+        m_epoch.notify_one();
+    }
+}
+
+void TaskDispatch::ReportAllocations()
+{
+#ifdef TRACY_ENABLE
+    const auto total = m_allocations.load( std::memory_order_relaxed );
+    const auto prev = m_allocationsReported.exchange( total, std::memory_order_relaxed );
+    TracyPlot( "Task allocations per sync", int64_t( total - prev ) );
+#endif
+}
+
+TaskDispatch::Task* TaskDispatch::AllocTask()
+{
+    if( t_worker.td == this )
+    {
+        auto& list = m_freeLists[t_worker.idx];
+        if( list.head != 0 )
+        {
+            auto task = m_pool->Get( list.head );
+            list.head = task->next.load( std::memory_order_relaxed );
+            list.count--;
+            return task;
+        }
+    }
+    return m_pool->Pop();
+}
+
+void TaskDispatch::FreeTask( Task* task )
+{
+    if( t_worker.td != this )
+    {
+        m_pool->Push( task, task );
+        return;
+    }
+
+    auto& list = m_freeLists[t_worker.idx];
+    task->next.store( list.head, std::memory_order_relaxed );
+    list.head = task->idx + 1;
+    if( ++list.count == FreeListSize )
+    {
+        // Give half of the cache back to the shared pool
+        auto last = task;
+        for( uint32_t i=1; i<FreeListSize/2; i++ ) last = m_pool->Get( last->next.load( std::memory_order_relaxed ) );
+        list.head = last->next.load( std::memory_order_relaxed );
+        list.count -= FreeListSize/2;
+        m_pool->Push( task, last );
+    }
+}
+
+TaskDispatch::Group& TaskDispatch::CurrentGroup()
+{
+    if( t_frame && t_frame->td == this ) return *t_frame->group;
+    return m_root;
+}
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
-#include <condition_variable>
-#include <functional>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "util/NoCopy.hpp"
@@ -12,6 +17,87 @@
 class TaskDispatch
 {
 public:
+    class Group
+    {
+    public:
+        Group() : m_pending( 0 ) {}
+        NoCopy( Group );
+
+        [[nodiscard]] bool Done() const { return m_pending.load( std::memory_order_acquire ) == 0; }
+
+    private:
+        friend class TaskDispatch;
+        std::atomic<uint32_t> m_pending;
+    };
+
+    // Move-only callable with fixed inline storage. Never allocates.
+    class Job
+    {
+    public:
+        static constexpr size_t Capacity = 48;
+
+        Job() : m_invoke( nullptr ), m_manage( nullptr ) {}
+
+        template<typename F>
+        requires ( !std::is_same_v<std::decay_t<F>, Job> && std::is_invocable_v<std::decay_t<F>&> )
+        Job( F&& f )
+        {
+            using T = std::decay_t<F>;
+            static_assert( sizeof( T ) <= Capacity, "Job callable is too large, capture less or by reference" );
+            static_assert( alignof( T ) <= alignof( max_align_t ), "Job callable is overaligned" );
+            static_assert( std::is_nothrow_move_constructible_v<T>, "Job callable must be nothrow movable" );
+
+            new( m_storage ) T( std::forward<F>( f ) );
+            m_invoke = []( void* self ) { ( *(T*)self )(); };
+            m_manage = []( void* self, void* dst ) {
+                if( dst ) new( dst ) T( std::move( *(T*)self ) );
+                ( (T*)self )->~T();
+            };
+        }
+
+        Job( Job&& other ) noexcept
+            : m_invoke( other.m_invoke )
+            , m_manage( other.m_manage )
+        {
+            if( m_manage ) m_manage( other.m_storage, m_storage );
+            other.m_invoke = nullptr;
+            other.m_manage = nullptr;
+        }
+
+        Job& operator=( Job&& other ) noexcept
+        {
+            if( this != &other )
+            {
+                Reset();
+                m_invoke = other.m_invoke;
+                m_manage = other.m_manage;
+                if( m_manage ) m_manage( other.m_storage, m_storage );
+                other.m_invoke = nullptr;
+                other.m_manage = nullptr;
+            }
+            return *this;
+        }
+
+        ~Job() { Reset(); }
+
+        NoCopy( Job );
+
+        void operator()() { m_invoke( m_storage ); }
+        explicit operator bool() const { return m_invoke != nullptr; }
+
+        void Reset()
+        {
+            if( m_manage ) m_manage( m_storage, nullptr );
+            m_invoke = nullptr;
+            m_manage = nullptr;
+        }
+
+    private:
+        alignas( max_align_t ) char m_storage[Capacity];
+        void (*m_invoke)( void* );
+        void (*m_manage)( void*, void* );
+    };
+
     TaskDispatch( size_t workers, const char* name );
     ~TaskDispatch();
 
@@ -19,22 +105,93 @@ public:
 
     void WaitInit();
 
-    void Queue( const std::function<void(void)>& f );
-    void Queue( std::function<void(void)>&& f );
+    // Tasks queued without an explicit group belong to the calling context: the currently
+    // running task when called from within a task, or the dispatch-wide root group otherwise.
+    void Queue( Job&& job ) { Enqueue( CurrentGroup(), std::move( job ) ); }
+    void Queue( Group& group, Job&& job ) { Enqueue( group, std::move( job ) ); }
 
+    // Waits for completion of the group, running pending tasks on the calling thread meanwhile.
     void Sync();
+    void Sync( Group& group );
+
+    // Calls fn( begin, end ) for consecutive sub-ranges of [0, count), which are at least grain items
+    // long. The calling thread takes part in processing and returns when the whole range is done.
+    // Ranges too small to split are processed inline.
+    template<typename F>
+    void ParallelFor( size_t count, size_t grain, F&& fn )
+    {
+        grain = std::max<size_t>( grain, 1 );
+        const auto chunks = count / grain;
+        if( chunks < 2 || m_numWorkers == 0 )
+        {
+            if( count > 0 ) fn( size_t( 0 ), count );
+            return;
+        }
+
+        const auto base = count / chunks;
+        const auto rem = count % chunks;
+        std::atomic<size_t> next = 0;
+        auto run = [&next, &fn, chunks, base, rem] {
+            size_t i;
+            while( ( i = next.fetch_add( 1, std::memory_order_relaxed ) ) < chunks )
+            {
+                const auto begin = i * base + std::min( i, rem );
+                fn( begin, begin + base + ( i < rem ? 1 : 0 ) );
+            }
+        };
+
+        Group group;
+        const auto tasks = std::min( m_numWorkers, chunks - 1 );
+        for( size_t i=0; i<tasks; i++ ) Queue( group, run );
+        run();
+        Sync( group );
+    }
+
+    // Grain for ParallelFor that keeps the working set of a sub-range within half of the L2 cache,
+    // while still giving each worker something to do.
+    [[nodiscard]] size_t Grain( size_t count, size_t itemSize ) const;
 
     [[nodiscard]] size_t NumWorkers() const { return m_numWorkers; }
 
+    // Number of task storage allocations made so far. Stops growing once the task pool is warmed up.
+    [[nodiscard]] size_t Allocations() const { return m_allocations.load( std::memory_order_relaxed ); }
+
 private:
-    void Worker();
+    struct Task;
+    struct FreeList;
+    class WorkQueue;
+    class InjectQueue;
+    class TaskPool;
+
+    void Worker( size_t idx );
     void SetName( const char* name, size_t num );
 
-    std::vector<std::function<void(void)>> m_queue;
-    std::mutex m_queueLock;
-    std::condition_variable m_cvWork, m_cvJobs;
+    void Enqueue( Group& group, Job&& job );
+    void Push( Task* task );
+    [[nodiscard]] Task* GetTask( size_t idx );
+    void Execute( Task* task );
+    void Join( Group& group );
+    void Wake( bool all );
+    void ReportAllocations();
+
+    [[nodiscard]] Task* AllocTask();
+    void FreeTask( Task* task );
+
+    [[nodiscard]] Group& CurrentGroup();
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::unique_ptr<InjectQueue> m_inject;
+    std::unique_ptr<TaskPool> m_pool;
+    std::unique_ptr<FreeList[]> m_freeLists;
+
+    std::atomic<uint32_t> m_epoch;
+    std::atomic<uint32_t> m_sleeping;
     std::atomic<bool> m_exit;
-    size_t m_jobs;
+
+    std::atomic<size_t> m_allocations;
+    std::atomic<size_t> m_allocationsReported;
+
+    Group m_root;
 
     std::vector<std::thread> m_workers;
     size_t m_numWorkers;
@@ -1,6 +1,8 @@
 #include <cmath>
 
+#include "SimdLevel.hpp"
 #include "Tonemapper.hpp"
+#include "TonemapperImpl.hpp"
 #include "util/Panic.hpp"
 
 namespace ToneMap
@@ -27,6 +29,19 @@ void Process( Operator op, uint32_t* dst, float* src, size_t sz )
     }
 }
 
+const TonemapKernelTable* Kernels()
+{
+#if defined __x86_64__ || defined __i386__
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: return &TonemapKernelsAvx512;
+    case SimdLevel::Avx2: return &TonemapKernelsAvx2;
+    default: break;
+    }
+#endif
+    return nullptr;
+}
+
 float LinearToSrgb( float x )
 {
     if( x <= 0.0031308f ) return 12.92f * x;
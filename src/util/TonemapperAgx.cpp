@@ -5,6 +5,7 @@
 #include <cmath>
 
 #include "Tonemapper.hpp"
+#include "TonemapperImpl.hpp"
 
 namespace ToneMap
 {
@@ -108,34 +109,30 @@ static HdrColor AgxLookPunchy( const HdrColor& color )
     };
 }
 
-void AgX( uint32_t* dst, float* src, size_t sz )
+enum class Look
 {
-    do
-    {
-        auto color = AgxTransform( { src[0], src[1], src[2] } );
-        color = AgxOutset( color );
+    None,
+    Golden,
+    Punchy
+};
 
-        const auto r = color.r;
-        const auto g = color.g;
-        const auto b = color.b;
-        const auto a = src[3];
-
-        *dst++ = (uint32_t( std::clamp( a, 0.0f, 1.0f ) * 255.0f ) << 24) |
-                 (uint32_t( std::clamp( b, 0.0f, 1.0f ) * 255.0f ) << 16) |
-                 (uint32_t( std::clamp( g, 0.0f, 1.0f ) * 255.0f ) << 8) |
-                  uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
-
-        src += 4;
+template<Look look>
+static void AgxProcess( uint32_t* dst, float* src, size_t sz )
+{
+    if( auto kernels = Kernels() )
+    {
+        const auto kernel = look == Look::None ? kernels->agx : look == Look::Golden ? kernels->agxGolden : kernels->agxPunchy;
+        const auto done = kernel( dst, src, sz );
+        dst += done;
+        src += done * 4;
+        sz -= done;
     }
-    while( --sz );
-}
 
-void AgXGolden( uint32_t* dst, float* src, size_t sz )
-{
-    do
+    while( sz > 0 )
     {
         auto color = AgxTransform( { src[0], src[1], src[2] } );
-        color = AgxLookGolden( color );
+        if constexpr( look == Look::Golden ) color = AgxLookGolden( color );
+        if constexpr( look == Look::Punchy ) color = AgxLookPunchy( color );
         color = AgxOutset( color );
 
         const auto r = color.r;
@@ -149,31 +146,23 @@ void AgXGolden( uint32_t* dst, float* src, size_t sz )
                   uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
 
         src += 4;
+        sz--;
     }
-    while( --sz );
 }
 
-void AgXPunchy( uint32_t* dst, float* src, size_t sz )
+void AgX( uint32_t* dst, float* src, size_t sz )
 {
-    do
-    {
-        auto color = AgxTransform( { src[0], src[1], src[2] } );
-        color = AgxLookPunchy( color );
-        color = AgxOutset( color );
-
-        const auto r = color.r;
-        const auto g = color.g;
-        const auto b = color.b;
-        const auto a = src[3];
+    AgxProcess<Look::None>( dst, src, sz );
+}
 
-        *dst++ = (uint32_t( std::clamp( a, 0.0f, 1.0f ) * 255.0f ) << 24) |
-                 (uint32_t( std::clamp( b, 0.0f, 1.0f ) * 255.0f ) << 16) |
-                 (uint32_t( std::clamp( g, 0.0f, 1.0f ) * 255.0f ) << 8) |
-                  uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
+void AgXGolden( uint32_t* dst, float* src, size_t sz )
+{
+    AgxProcess<Look::Golden>( dst, src, sz );
+}
 
-        src += 4;
-    }
-    while( --sz );
+void AgXPunchy( uint32_t* dst, float* src, size_t sz )
+{
+    AgxProcess<Look::Punchy>( dst, src, sz );
 }
 
 }
@@ -0,0 +1,8 @@
+#if defined __x86_64__ || defined __i386__
+
+#define TONEMAP_KERNELS_LEVEL 2
+#include "TonemapperImpl.hpp"
+
+const TonemapKernelTable TonemapKernelsAvx2 = { Agx<Look::None>, Agx<Look::Golden>, Agx<Look::Punchy>, PbrNeutral };
+
+#endif
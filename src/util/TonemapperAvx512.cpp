@@ -0,0 +1,8 @@
+#if defined __x86_64__ || defined __i386__
+
+#define TONEMAP_KERNELS_LEVEL 3
+#include "TonemapperImpl.hpp"
+
+const TonemapKernelTable TonemapKernelsAvx512 = { Agx<Look::None>, Agx<Look::Golden>, Agx<Look::Punchy>, PbrNeutral };
+
+#endif
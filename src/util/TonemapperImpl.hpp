@@ -0,0 +1,537 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vector parts of the tonemappers. AgX functions process what fits in whole vectors and return the
+// number of pixels done, leaving the rest to the scalar code. PBR Neutral has a single pixel vector
+// path and always processes everything.
+struct TonemapKernelTable
+{
+    size_t (*agx)( uint32_t* dst, const float* src, size_t sz );
+    size_t (*agxGolden)( uint32_t* dst, const float* src, size_t sz );
+    size_t (*agxPunchy)( uint32_t* dst, const float* src, size_t sz );
+    size_t (*pbrNeutral)( uint32_t* dst, const float* src, size_t sz );
+};
+
+extern const TonemapKernelTable TonemapKernelsAvx2;
+extern const TonemapKernelTable TonemapKernelsAvx512;
+
+namespace ToneMap
+{
+
+// Table for the current SIMD level, or null if only the scalar code can be used
+const TonemapKernelTable* Kernels();
+
+}
+
+// Included by the translation unit of each level, with TONEMAP_KERNELS_LEVEL set to 2 for AVX2, 3
+// for AVX-512. There is no SSE4.1 level, as all vector paths depend on FMA. Everything has internal
+// linkage and uses no inline functions from other headers, as those could be merged with copies
+// built for another level.
+#ifdef TONEMAP_KERNELS_LEVEL
+
+#if TONEMAP_KERNELS_LEVEL >= 3 && !defined __AVX512F__
+#  error AVX-512 tonemap kernels must be built with -mavx512f
+#endif
+#if !( defined __AVX2__ && defined __FMA__ )
+#  error AVX2 tonemap kernels must be built with -mavx2 -mfma
+#endif
+
+#include <float.h>
+
+#include "Simd.hpp"
+
+namespace
+{
+
+constexpr float AgxMat[] = {
+    0.8424010709504686f, 0.04240107095046854f, 0.04240107095046854f,
+    0.07843650156180276f, 0.8784365015618028f, 0.07843650156180276f,
+    0.0791624274877287f, 0.0791624274877287f, 0.8791624274877287f
+};
+
+constexpr float AgxMatInv[] = {
+    1.1969986613119143f, -0.053001338688085674f, -0.053001338688085674f,
+    -0.09804562695225345f, 1.1519543730477466f, -0.09804562695225345f,
+    -0.09895303435966087f, -0.09895303435966087f, 1.151046965640339f
+};
+
+constexpr auto AgxMinEv = -12.473931188332413f;
+constexpr auto AgxMaxEv = 4.026068811667588f;
+constexpr auto AgxThreshold = 0.6060606060606061f;
+
+constexpr auto startCompression = 0.8f - 0.04f;
+constexpr auto desaturation = 0.15f;
+constexpr auto d = 1.f - startCompression;
+constexpr auto d2 = d * d;
+constexpr auto dsc = d - startCompression;
+
+enum class Look
+{
+    None,
+    Golden,
+    Punchy
+};
+
+// Exponent is clamped, so that pow( 0, y ) underflows to zero instead of wrapping around
+__m256 AgxPow256( __m256 x, __m256 y )
+{
+    return _mm256_exp_ps( _mm256_max_ps( _mm256_mul_ps( y, _mm256_log_ps( x ) ), _mm256_set1_ps( -126.f ) ) );
+}
+
+__m256 AgxEncode256( __m256 x )
+{
+    constexpr auto invrange = 1.f / ( AgxMaxEv - AgxMinEv );
+
+    __m256 v0 = _mm256_fmadd_ps( _mm256_log_ps( x ), _mm256_set1_ps( invrange ), _mm256_set1_ps( -AgxMinEv * invrange ) );
+    __m256 v1 = _mm256_min_ps( _mm256_max_ps( v0, _mm256_setzero_ps() ), _mm256_set1_ps( 1.f ) );
+    __m256 v2 = _mm256_cmp_ps( x, _mm256_setzero_ps(), _CMP_GT_OQ );
+    return _mm256_and_ps( v1, v2 );
+}
+
+__m256 AgxCurve256( __m256 x )
+{
+    __m256 m = _mm256_cmp_ps( x, _mm256_set1_ps( AgxThreshold ), _CMP_LT_OQ );
+    __m256 a = _mm256_blendv_ps( _mm256_set1_ps( 59.507875f ), _mm256_set1_ps( 69.86278913545539f ), m );
+    __m256 b = _mm256_blendv_ps( _mm256_set1_ps( 3.0f ), _mm256_set1_ps( 13.0f / 4.0f ), m );
+    __m256 c = _mm256_blendv_ps( _mm256_set1_ps( -1.0f / 3.0f ), _mm256_set1_ps( -4.0f / 13.0f ), m );
+
+    __m256 v0 = _mm256_andnot_ps( _mm256_set1_ps( -0.f ), _mm256_sub_ps( x, _mm256_set1_ps( AgxThreshold ) ) );
+    __m256 v1 = _mm256_fmadd_ps( a, AgxPow256( v0, b ), _mm256_set1_ps( 1.f ) );
+    __m256 v2 = AgxPow256( v1, c );
+    __m256 v3 = _mm256_fmadd_ps( x, _mm256_set1_ps( 2.f ), _mm256_set1_ps( -2.f * AgxThreshold ) );
+    return _mm256_fmadd_ps( v3, v2, _mm256_set1_ps( 0.5f ) );
+}
+
+// Deinterleaves 8 RGBA pixels. Lanes hold pixels in 0, 2, 4, 6, 1, 3, 5, 7 order.
+void Load256( const float* src, __m256& r, __m256& g, __m256& b, __m256& a )
+{
+    __m256 s0 = _mm256_loadu_ps( src );
+    __m256 s1 = _mm256_loadu_ps( src + 8 );
+    __m256 s2 = _mm256_loadu_ps( src + 16 );
+    __m256 s3 = _mm256_loadu_ps( src + 24 );
+
+    __m256 t0 = _mm256_unpacklo_ps( s0, s1 );
+    __m256 t1 = _mm256_unpackhi_ps( s0, s1 );
+    __m256 t2 = _mm256_unpacklo_ps( s2, s3 );
+    __m256 t3 = _mm256_unpackhi_ps( s2, s3 );
+
+    r = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    g = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    b = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    a = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+}
+
+// Packs channels of pixels deinterleaved by Load256
+void Store256( uint32_t* dst, __m256i r, __m256i g, __m256i b, __m256i a )
+{
+    __m256i v0 = _mm256_or_si256( r, _mm256_slli_epi32( g, 8 ) );
+    __m256i v1 = _mm256_or_si256( _mm256_slli_epi32( b, 16 ), _mm256_slli_epi32( a, 24 ) );
+    __m256i v2 = _mm256_or_si256( v0, v1 );
+    __m256i v3 = _mm256_permutevar8x32_epi32( v2, _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 ) );
+    _mm256_storeu_si256( (__m256i*)dst, v3 );
+}
+
+__m256i AgxQuantize256( __m256 v )
+{
+    __m256 v0 = _mm256_min_ps( _mm256_max_ps( v, _mm256_setzero_ps() ), _mm256_set1_ps( 1.f ) );
+    return _mm256_cvttps_epi32( _mm256_mul_ps( v0, _mm256_set1_ps( 255.f ) ) );
+}
+
+#if TONEMAP_KERNELS_LEVEL >= 3
+__m512 AgxPow512( __m512 x, __m512 y )
+{
+    return _mm512_exp_ps( _mm512_max_ps( _mm512_mul_ps( y, _mm512_log_ps( x ) ), _mm512_set1_ps( -126.f ) ) );
+}
+
+__m512 AgxEncode512( __m512 x )
+{
+    constexpr auto invrange = 1.f / ( AgxMaxEv - AgxMinEv );
+
+    __m512 v0 = _mm512_fmadd_ps( _mm512_log_ps( x ), _mm512_set1_ps( invrange ), _mm512_set1_ps( -AgxMinEv * invrange ) );
+    __m512 v1 = _mm512_min_ps( _mm512_max_ps( v0, _mm512_setzero_ps() ), _mm512_set1_ps( 1.f ) );
+    __mmask16 v2 = _mm512_cmp_ps_mask( x, _mm512_setzero_ps(), _CMP_GT_OQ );
+    return _mm512_maskz_mov_ps( v2, v1 );
+}
+
+__m512 AgxCurve512( __m512 x )
+{
+    __mmask16 m = _mm512_cmp_ps_mask( x, _mm512_set1_ps( AgxThreshold ), _CMP_LT_OQ );
+    __m512 a = _mm512_mask_blend_ps( m, _mm512_set1_ps( 59.507875f ), _mm512_set1_ps( 69.86278913545539f ) );
+    __m512 b = _mm512_mask_blend_ps( m, _mm512_set1_ps( 3.0f ), _mm512_set1_ps( 13.0f / 4.0f ) );
+    __m512 c = _mm512_mask_blend_ps( m, _mm512_set1_ps( -1.0f / 3.0f ), _mm512_set1_ps( -4.0f / 13.0f ) );
+
+    __m512 v0 = _mm512_abs_ps( _mm512_sub_ps( x, _mm512_set1_ps( AgxThreshold ) ) );
+    __m512 v1 = _mm512_fmadd_ps( a, AgxPow512( v0, b ), _mm512_set1_ps( 1.f ) );
+    __m512 v2 = AgxPow512( v1, c );
+    __m512 v3 = _mm512_fmadd_ps( x, _mm512_set1_ps( 2.f ), _mm512_set1_ps( -2.f * AgxThreshold ) );
+    return _mm512_fmadd_ps( v3, v2, _mm512_set1_ps( 0.5f ) );
+}
+
+// Deinterleaves 16 RGBA pixels. Lane 4 * i + j holds pixel i + 4 * j.
+void Load512( const float* src, __m512& r, __m512& g, __m512& b, __m512& a )
+{
+    __m512 s0 = _mm512_loadu_ps( src );
+    __m512 s1 = _mm512_loadu_ps( src + 16 );
+    __m512 s2 = _mm512_loadu_ps( src + 32 );
+    __m512 s3 = _mm512_loadu_ps( src + 48 );
+
+    __m512 t0 = _mm512_unpacklo_ps( s0, s1 );
+    __m512 t1 = _mm512_unpackhi_ps( s0, s1 );
+    __m512 t2 = _mm512_unpacklo_ps( s2, s3 );
+    __m512 t3 = _mm512_unpackhi_ps( s2, s3 );
+
+    r = _mm512_shuffle_ps( t0, t2, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    g = _mm512_shuffle_ps( t0, t2, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    b = _mm512_shuffle_ps( t1, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    a = _mm512_shuffle_ps( t1, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+}
+
+// Packs channels of pixels deinterleaved by Load512
+void Store512( uint32_t* dst, __m512i r, __m512i g, __m512i b, __m512i a )
+{
+    __m512i v0 = _mm512_or_si512( r, _mm512_slli_epi32( g, 8 ) );
+    __m512i v1 = _mm512_or_si512( _mm512_slli_epi32( b, 16 ), _mm512_slli_epi32( a, 24 ) );
+    __m512i v2 = _mm512_or_si512( v0, v1 );
+    __m512i v3 = _mm512_permutexvar_epi32( _mm512_setr_epi32( 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 ), v2 );
+    _mm512_storeu_si512( dst, v3 );
+}
+
+__m512i AgxQuantize512( __m512 v )
+{
+    __m512 v0 = _mm512_min_ps( _mm512_max_ps( v, _mm512_setzero_ps() ), _mm512_set1_ps( 1.f ) );
+    return _mm512_cvttps_epi32( _mm512_mul_ps( v0, _mm512_set1_ps( 255.f ) ) );
+}
+#endif
+
+template<Look look>
+size_t Agx( uint32_t* dst, const float* src, size_t sz )
+{
+    constexpr auto lookScale = look == Look::Golden ? 0.8f : 1.4f;
+    constexpr auto lookPower = look == Look::Golden ? 0.8f : 1.35f;
+
+    size_t i = 0;
+#if TONEMAP_KERNELS_LEVEL >= 3
+    for( ; i+16<=sz; i+=16 )
+    {
+        __m512 r, g, b, a;
+        Load512( src + i*4, r, g, b, a );
+
+        __m512 r0 = _mm512_fmadd_ps( _mm512_set1_ps( AgxMat[0] ), r, _mm512_fmadd_ps( _mm512_set1_ps( AgxMat[1] ), g, _mm512_mul_ps( _mm512_set1_ps( AgxMat[2] ), b ) ) );
+        __m512 g0 = _mm512_fmadd_ps( _mm512_set1_ps( AgxMat[3] ), r, _mm512_fmadd_ps( _mm512_set1_ps( AgxMat[4] ), g, _mm512_mul_ps( _mm512_set1_ps( AgxMat[5] ), b ) ) );
+        __m512 b0 = _mm512_fmadd_ps( _mm512_set1_ps( AgxMat[6] ), r, _mm512_fmadd_ps( _mm512_set1_ps( AgxMat[7] ), g, _mm512_mul_ps( _mm512_set1_ps( AgxMat[8] ), b ) ) );
+
+        __m512 r1 = AgxCurve512( AgxEncode512( r0 ) );
+        __m512 g1 = AgxCurve512( AgxEncode512( g0 ) );
+        __m512 b1 = AgxCurve512( AgxEncode512( b0 ) );
+
+        if constexpr( look != Look::None )
+        {
+            __m512 luma = _mm512_fmadd_ps( _mm512_set1_ps( 0.2126f ), r1, _mm512_fmadd_ps( _mm512_set1_ps( 0.7152f ), g1, _mm512_mul_ps( _mm512_set1_ps( 0.0722f ), b1 ) ) );
+            if constexpr( look == Look::Golden )
+            {
+                g1 = _mm512_mul_ps( g1, _mm512_set1_ps( 0.9f ) );
+                b1 = _mm512_mul_ps( b1, _mm512_set1_ps( 0.5f ) );
+            }
+            __m512 vr = AgxPow512( _mm512_max_ps( r1, _mm512_setzero_ps() ), _mm512_set1_ps( lookPower ) );
+            __m512 vg = AgxPow512( _mm512_max_ps( g1, _mm512_setzero_ps() ), _mm512_set1_ps( lookPower ) );
+            __m512 vb = AgxPow512( _mm512_max_ps( b1, _mm512_setzero_ps() ), _mm512_set1_ps( lookPower ) );
+            r1 = _mm512_fmadd_ps( _mm512_set1_ps( lookScale ), _mm512_sub_ps( vr, luma ), luma );
+            g1 = _mm512_fmadd_ps( _mm512_set1_ps( lookScale ), _mm512_sub_ps( vg, luma ), luma );
+            b1 = _mm512_fmadd_ps( _mm512_set1_ps( lookScale ), _mm512_sub_ps( vb, luma ), luma );
+        }
+
+        __m512 r2 = _mm512_fmadd_ps( _mm512_set1_ps( AgxMatInv[0] ), r1, _mm512_fmadd_ps( _mm512_set1_ps( AgxMatInv[1] ), g1, _mm512_mul_ps( _mm512_set1_ps( AgxMatInv[2] ), b1 ) ) );
+        __m512 g2 = _mm512_fmadd_ps( _mm512_set1_ps( AgxMatInv[3] ), r1, _mm512_fmadd_ps( _mm512_set1_ps( AgxMatInv[4] ), g1, _mm512_mul_ps( _mm512_set1_ps( AgxMatInv[5] ), b1 ) ) );
+        __m512 b2 = _mm512_fmadd_ps( _mm512_set1_ps( AgxMatInv[6] ), r1, _mm512_fmadd_ps( _mm512_set1_ps( AgxMatInv[7] ), g1, _mm512_mul_ps( _mm512_set1_ps( AgxMatInv[8] ), b1 ) ) );
+
+        Store512( dst + i, AgxQuantize512( r2 ), AgxQuantize512( g2 ), AgxQuantize512( b2 ), AgxQuantize512( a ) );
+    }
+#endif
+    for( ; i+8<=sz; i+=8 )
+    {
+        __m256 r, g, b, a;
+        Load256( src + i*4, r, g, b, a );
+
+        __m256 r0 = _mm256_fmadd_ps( _mm256_set1_ps( AgxMat[0] ), r, _mm256_fmadd_ps( _mm256_set1_ps( AgxMat[1] ), g, _mm256_mul_ps( _mm256_set1_ps( AgxMat[2] ), b ) ) );
+        __m256 g0 = _mm256_fmadd_ps( _mm256_set1_ps( AgxMat[3] ), r, _mm256_fmadd_ps( _mm256_set1_ps( AgxMat[4] ), g, _mm256_mul_ps( _mm256_set1_ps( AgxMat[5] ), b ) ) );
+        __m256 b0 = _mm256_fmadd_ps( _mm256_set1_ps( AgxMat[6] ), r, _mm256_fmadd_ps( _mm256_set1_ps( AgxMat[7] ), g, _mm256_mul_ps( _mm256_set1_ps( AgxMat[8] ), b ) ) );
+
+        __m256 r1 = AgxCurve256( AgxEncode256( r0 ) );
+        __m256 g1 = AgxCurve256( AgxEncode256( g0 ) );
+        __m256 b1 = AgxCurve256( AgxEncode256( b0 ) );
+
+        if constexpr( look != Look::None )
+        {
+            __m256 luma = _mm256_fmadd_ps( _mm256_set1_ps( 0.2126f ), r1, _mm256_fmadd_ps( _mm256_set1_ps( 0.7152f ), g1, _mm256_mul_ps( _mm256_set1_ps( 0.0722f ), b1 ) ) );
+            if constexpr( look == Look::Golden )
+            {
+                g1 = _mm256_mul_ps( g1, _mm256_set1_ps( 0.9f ) );
+                b1 = _mm256_mul_ps( b1, _mm256_set1_ps( 0.5f ) );
+            }
+            __m256 vr = AgxPow256( _mm256_max_ps( r1, _mm256_setzero_ps() ), _mm256_set1_ps( lookPower ) );
+            __m256 vg = AgxPow256( _mm256_max_ps( g1, _mm256_setzero_ps() ), _mm256_set1_ps( lookPower ) );
+            __m256 vb = AgxPow256( _mm256_max_ps( b1, _mm256_setzero_ps() ), _mm256_set1_ps( lookPower ) );
+            r1 = _mm256_fmadd_ps( _mm256_set1_ps( lookScale ), _mm256_sub_ps( vr, luma ), luma );
+            g1 = _mm256_fmadd_ps( _mm256_set1_ps( lookScale ), _mm256_sub_ps( vg, luma ), luma );
+            b1 = _mm256_fmadd_ps( _mm256_set1_ps( lookScale ), _mm256_sub_ps( vb, luma ), luma );
+        }
+
+        __m256 r2 = _mm256_fmadd_ps( _mm256_set1_ps( AgxMatInv[0] ), r1, _mm256_fmadd_ps( _mm256_set1_ps( AgxMatInv[1] ), g1, _mm256_mul_ps( _mm256_set1_ps( AgxMatInv[2] ), b1 ) ) );
+        __m256 g2 = _mm256_fmadd_ps( _mm256_set1_ps( AgxMatInv[3] ), r1, _mm256_fmadd_ps( _mm256_set1_ps( AgxMatInv[4] ), g1, _mm256_mul_ps( _mm256_set1_ps( AgxMatInv[5] ), b1 ) ) );
+        __m256 b2 = _mm256_fmadd_ps( _mm256_set1_ps( AgxMatInv[6] ), r1, _mm256_fmadd_ps( _mm256_set1_ps( AgxMatInv[7] ), g1, _mm256_mul_ps( _mm256_set1_ps( AgxMatInv[8] ), b1 ) ) );
+
+        Store256( dst + i, AgxQuantize256( r2 ), AgxQuantize256( g2 ), AgxQuantize256( b2 ), AgxQuantize256( a ) );
+    }
+    return i;
+}
+
+__m128 PbrNeutral128( __m128 hdr )
+{
+    __m128 vx0 = _mm_blend_ps( hdr, _mm_set1_ps( FLT_MAX ), 0x8 );
+    __m128 vx1 = _mm_shuffle_ps( vx0, vx0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m128 vx2 = _mm_min_ps( vx0, vx1 );
+    __m128 vx3 = _mm_shuffle_ps( vx2, vx2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    __m128 vx = _mm_min_ps( vx2, vx3 );
+
+    __m128 vo0 = _mm_cmplt_ps( vx, _mm_set1_ps( 0.08f ) );
+    __m128 vo1 = _mm_mul_ps( vx, vx );
+    __m128 vo2 = _mm_fnmadd_ps( vo1, _mm_set1_ps( 6.25f ), vx );
+    __m128 vo = _mm_blendv_ps( _mm_set1_ps( 0.04f ), vo2, vo0 );
+
+    __m128 vc0 = _mm_sub_ps( vx0, vo );
+
+    __m128 vp0 = _mm_blend_ps( vc0, _mm_set1_ps( FLT_MIN ), 0x8 );
+    __m128 vp1 = _mm_shuffle_ps( vp0, vp0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m128 vp2 = _mm_max_ps( vp0, vp1 );
+    __m128 vp3 = _mm_shuffle_ps( vp2, vp2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    __m128 vp = _mm_max_ps( vp2, vp3 );
+
+    __m128 rc = _mm_cmplt_ps( vp, _mm_set1_ps( startCompression ) );
+
+    __m128 vnp1 = _mm_add_ps( vp, _mm_set1_ps( dsc ) );
+    __m128 vnp2 = _mm_div_ps( _mm_set1_ps( d2 ), vnp1 );
+    __m128 vnp = _mm_sub_ps( _mm_set1_ps( 1.0f ), vnp2 );
+    __m128 vnp3 = _mm_div_ps( vnp, vp );
+
+    __m128 vc1 = _mm_mul_ps( vc0, vnp3 );
+
+    __m128 vg0 = _mm_sub_ps( vp, vnp );
+    __m128 vg1 = _mm_fmadd_ps( _mm_set1_ps( desaturation ), vg0, _mm_set1_ps( 1.0f ) );
+    __m128 vg2 = _mm_rcp_ps( vg1 );
+    __m128 vg = _mm_sub_ps( _mm_set1_ps( 1.0f ), vg2 );
+
+    __m128 vr0 = _mm_fnmadd_ps( vg, vc1, vc1 );
+    __m128 vr1 = _mm_fmadd_ps( vg, vnp, vr0 );
+    __m128 vr = _mm_blendv_ps( vr1, vc0, rc );
+
+    return vr;
+}
+
+__m256 PbrNeutral256( __m256 hdr )
+{
+    __m256 vx0 = _mm256_blend_ps( hdr, _mm256_set1_ps( FLT_MAX ), 0x88 );
+    __m256 vx1 = _mm256_shuffle_ps( vx0, vx0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m256 vx2 = _mm256_min_ps( vx0, vx1 );
+    __m256 vx3 = _mm256_shuffle_ps( vx2, vx2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    __m256 vx = _mm256_min_ps( vx2, vx3 );
+
+    __m256 vo0 = _mm256_cmp_ps( vx, _mm256_set1_ps( 0.08f ), _CMP_LT_OQ );
+    __m256 vo1 = _mm256_mul_ps( vx, vx );
+    __m256 vo2 = _mm256_fnmadd_ps( vo1, _mm256_set1_ps( 6.25f ), vx );
+    __m256 vo = _mm256_blendv_ps( _mm256_set1_ps( 0.04f ), vo2, vo0 );
+
+    __m256 vc0 = _mm256_sub_ps( vx0, vo );
+
+    __m256 vp0 = _mm256_blend_ps( vc0, _mm256_set1_ps( FLT_MIN ), 0x88 );
+    __m256 vp1 = _mm256_shuffle_ps( vp0, vp0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m256 vp2 = _mm256_max_ps( vp0, vp1 );
+    __m256 vp3 = _mm256_shuffle_ps( vp2, vp2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    __m256 vp = _mm256_max_ps( vp2, vp3 );
+
+    __m256 rc = _mm256_cmp_ps( vp, _mm256_set1_ps( startCompression ), _CMP_LT_OQ );
+
+    __m256 vnp1 = _mm256_add_ps( vp, _mm256_set1_ps( dsc ) );
+    __m256 vnp2 = _mm256_div_ps( _mm256_set1_ps( d2 ), vnp1 );
+    __m256 vnp = _mm256_sub_ps( _mm256_set1_ps( 1.0f ), vnp2 );
+    __m256 vnp3 = _mm256_div_ps( vnp, vp );
+
+    __m256 vc1 = _mm256_mul_ps( vc0, vnp3 );
+
+    __m256 vg0 = _mm256_sub_ps( vp, vnp );
+    __m256 vg1 = _mm256_fmadd_ps( _mm256_set1_ps( desaturation ), vg0, _mm256_set1_ps( 1.0f ) );
+    __m256 vg2 = _mm256_rcp_ps( vg1 );
+    __m256 vg = _mm256_sub_ps( _mm256_set1_ps( 1.0f ), vg2 );
+
+    __m256 vr0 = _mm256_fnmadd_ps( vg, vc1, vc1 );
+    __m256 vr1 = _mm256_fmadd_ps( vg, vnp, vr0 );
+    __m256 vr = _mm256_blendv_ps( vr1, vc0, rc );
+
+    return vr;
+}
+
+// Operates on 8 pixels at once, with each channel in its own register
+void PbrNeutralPlanar256( __m256& r, __m256& g, __m256& b )
+{
+    __m256 vx = _mm256_min_ps( _mm256_min_ps( r, g ), b );
+
+    __m256 vo0 = _mm256_cmp_ps( vx, _mm256_set1_ps( 0.08f ), _CMP_LT_OQ );
+    __m256 vo1 = _mm256_fnmadd_ps( _mm256_mul_ps( vx, vx ), _mm256_set1_ps( 6.25f ), vx );
+    __m256 vo = _mm256_blendv_ps( _mm256_set1_ps( 0.04f ), vo1, vo0 );
+
+    __m256 vr0 = _mm256_sub_ps( r, vo );
+    __m256 vg0 = _mm256_sub_ps( g, vo );
+    __m256 vb0 = _mm256_sub_ps( b, vo );
+
+    __m256 vp = _mm256_max_ps( _mm256_max_ps( vr0, vg0 ), vb0 );
+    __m256 rc = _mm256_cmp_ps( vp, _mm256_set1_ps( startCompression ), _CMP_LT_OQ );
+
+    __m256 vnp0 = _mm256_div_ps( _mm256_set1_ps( d2 ), _mm256_add_ps( vp, _mm256_set1_ps( dsc ) ) );
+    __m256 vnp = _mm256_sub_ps( _mm256_set1_ps( 1.0f ), vnp0 );
+    __m256 vs = _mm256_div_ps( vnp, vp );
+
+    __m256 vg1 = _mm256_fmadd_ps( _mm256_set1_ps( desaturation ), _mm256_sub_ps( vp, vnp ), _mm256_set1_ps( 1.0f ) );
+    __m256 vd = _mm256_sub_ps( _mm256_set1_ps( 1.0f ), _mm256_rcp_ps( vg1 ) );
+    __m256 vdn = _mm256_mul_ps( vd, vnp );
+
+    __m256 vr1 = _mm256_mul_ps( vr0, vs );
+    __m256 vg2 = _mm256_mul_ps( vg0, vs );
+    __m256 vb1 = _mm256_mul_ps( vb0, vs );
+
+    r = _mm256_blendv_ps( _mm256_add_ps( _mm256_fnmadd_ps( vd, vr1, vr1 ), vdn ), vr0, rc );
+    g = _mm256_blendv_ps( _mm256_add_ps( _mm256_fnmadd_ps( vd, vg2, vg2 ), vdn ), vg0, rc );
+    b = _mm256_blendv_ps( _mm256_add_ps( _mm256_fnmadd_ps( vd, vb1, vb1 ), vdn ), vb0, rc );
+}
+
+__m256i PbrEncode256( __m256 v )
+{
+    __m256 v0 = _mm256_cmp_ps( v, _mm256_set1_ps( 0.0031308f ), _CMP_LE_OQ );
+    __m256 v1 = _mm256_mul_ps( v, _mm256_set1_ps( 12.92f ) );
+    __m256 v2 = _mm256_pow_ps( v, _mm256_set1_ps( 1.0f / 2.4f ) );
+    __m256 v3 = _mm256_fmsub_ps( v2, _mm256_set1_ps( 1.055f ), _mm256_set1_ps( 0.055f ) );
+    __m256 v4 = _mm256_blendv_ps( v3, v1, v0 );
+    __m256 v5 = _mm256_min_ps( _mm256_max_ps( v4, _mm256_setzero_ps() ), _mm256_set1_ps( 1.0f ) );
+    return _mm256_cvtps_epi32( _mm256_mul_ps( v5, _mm256_set1_ps( 255.0f ) ) );
+}
+
+#if TONEMAP_KERNELS_LEVEL >= 3
+// Operates on 16 pixels at once, with each channel in its own register
+void PbrNeutralPlanar512( __m512& r, __m512& g, __m512& b )
+{
+    __m512 vx = _mm512_min_ps( _mm512_min_ps( r, g ), b );
+
+    __mmask16 vo0 = _mm512_cmp_ps_mask( vx, _mm512_set1_ps( 0.08f ), _CMP_LT_OQ );
+    __m512 vo1 = _mm512_fnmadd_ps( _mm512_mul_ps( vx, vx ), _mm512_set1_ps( 6.25f ), vx );
+    __m512 vo = _mm512_mask_blend_ps( vo0, _mm512_set1_ps( 0.04f ), vo1 );
+
+    __m512 vr0 = _mm512_sub_ps( r, vo );
+    __m512 vg0 = _mm512_sub_ps( g, vo );
+    __m512 vb0 = _mm512_sub_ps( b, vo );
+
+    __m512 vp = _mm512_max_ps( _mm512_max_ps( vr0, vg0 ), vb0 );
+    __mmask16 rc = _mm512_cmp_ps_mask( vp, _mm512_set1_ps( startCompression ), _CMP_LT_OQ );
+
+    __m512 vnp0 = _mm512_div_ps( _mm512_set1_ps( d2 ), _mm512_add_ps( vp, _mm512_set1_ps( dsc ) ) );
+    __m512 vnp = _mm512_sub_ps( _mm512_set1_ps( 1.0f ), vnp0 );
+    __m512 vs = _mm512_div_ps( vnp, vp );
+
+    __m512 vg1 = _mm512_fmadd_ps( _mm512_set1_ps( desaturation ), _mm512_sub_ps( vp, vnp ), _mm512_set1_ps( 1.0f ) );
+    __m512 vd = _mm512_sub_ps( _mm512_set1_ps( 1.0f ), _mm512_rcp14_ps( vg1 ) );
+    __m512 vdn = _mm512_mul_ps( vd, vnp );
+
+    __m512 vr1 = _mm512_mul_ps( vr0, vs );
+    __m512 vg2 = _mm512_mul_ps( vg0, vs );
+    __m512 vb1 = _mm512_mul_ps( vb0, vs );
+
+    r = _mm512_mask_blend_ps( rc, _mm512_add_ps( _mm512_fnmadd_ps( vd, vr1, vr1 ), vdn ), vr0 );
+    g = _mm512_mask_blend_ps( rc, _mm512_add_ps( _mm512_fnmadd_ps( vd, vg2, vg2 ), vdn ), vg0 );
+    b = _mm512_mask_blend_ps( rc, _mm512_add_ps( _mm512_fnmadd_ps( vd, vb1, vb1 ), vdn ), vb0 );
+}
+
+__m512i PbrEncode512( __m512 v )
+{
+    __mmask16 v0 = _mm512_cmp_ps_mask( v, _mm512_set1_ps( 0.0031308f ), _CMP_LE_OQ );
+    __m512 v1 = _mm512_mul_ps( v, _mm512_set1_ps( 12.92f ) );
+    __m512 v2 = _mm512_pow_ps( v, _mm512_set1_ps( 1.0f / 2.4f ) );
+    __m512 v3 = _mm512_fmsub_ps( v2, _mm512_set1_ps( 1.055f ), _mm512_set1_ps( 0.055f ) );
+    __m512 v4 = _mm512_mask_blend_ps( v0, v3, v1 );
+    __m512 v5 = _mm512_min_ps( _mm512_max_ps( v4, _mm512_setzero_ps() ), _mm512_set1_ps( 1.0f ) );
+    return _mm512_cvtps_epi32( _mm512_mul_ps( v5, _mm512_set1_ps( 255.0f ) ) );
+}
+#endif
+
+size_t PbrNeutral( uint32_t* dst, const float* src, size_t sz )
+{
+    size_t i = 0;
+#if TONEMAP_KERNELS_LEVEL >= 3
+    for( ; i+16<=sz; i+=16 )
+    {
+        __m512 r, g, b, a;
+        Load512( src + i*4, r, g, b, a );
+
+        PbrNeutralPlanar512( r, g, b );
+
+        __m512 a0 = _mm512_min_ps( _mm512_max_ps( a, _mm512_setzero_ps() ), _mm512_set1_ps( 1.0f ) );
+        __m512i a1 = _mm512_cvtps_epi32( _mm512_mul_ps( a0, _mm512_set1_ps( 255.0f ) ) );
+
+        Store512( dst + i, PbrEncode512( r ), PbrEncode512( g ), PbrEncode512( b ), a1 );
+    }
+#endif
+    for( ; i+8<=sz; i+=8 )
+    {
+        __m256 r, g, b, a;
+        Load256( src + i*4, r, g, b, a );
+
+        PbrNeutralPlanar256( r, g, b );
+
+        __m256 a0 = _mm256_min_ps( _mm256_max_ps( a, _mm256_setzero_ps() ), _mm256_set1_ps( 1.0f ) );
+        __m256i a1 = _mm256_cvtps_epi32( _mm256_mul_ps( a0, _mm256_set1_ps( 255.0f ) ) );
+
+        Store256( dst + i, PbrEncode256( r ), PbrEncode256( g ), PbrEncode256( b ), a1 );
+    }
+    for( ; i+2<=sz; i+=2 )
+    {
+        __m256 s0 = _mm256_loadu_ps( src + i*4 );
+        __m256 v0 = PbrNeutral256( s0 );
+        __m256 v1 = _mm256_cmp_ps( v0, _mm256_set1_ps( 0.0031308f ), _CMP_LE_OQ );
+        __m256 v2 = _mm256_mul_ps( v0, _mm256_set1_ps( 12.92f ) );
+        __m256 v3 = _mm256_pow_ps( v0, _mm256_set1_ps( 1.0f / 2.4f ) );
+        __m256 v4 = _mm256_mul_ps( v3, _mm256_set1_ps( 1.055f ) );
+        __m256 v5 = _mm256_sub_ps( v4, _mm256_set1_ps( 0.055f ) );
+        __m256 v6 = _mm256_blendv_ps( v5, v2, v1 );
+        __m256 v7 = _mm256_blend_ps( v6, s0, 0x88 );
+        __m256 v8 = _mm256_min_ps( v7, _mm256_set1_ps( 1.0f ) );
+        __m256 v9 = _mm256_max_ps( v8, _mm256_setzero_ps() );
+        __m256 v10 = _mm256_mul_ps( v9, _mm256_set1_ps( 255.0f ) );
+        __m256i v11 = _mm256_cvtps_epi32( v10 );
+        __m256i v12 = _mm256_packus_epi32( v11, v11 );
+        __m256i v13 = _mm256_packus_epi16( v12, v12 );
+        dst[i] = _mm_cvtsi128_si32( _mm256_castsi256_si128( v13 ) );
+        dst[i+1] = _mm_cvtsi128_si32( _mm256_extracti128_si256( v13, 1 ) );
+    }
+    for( ; i<sz; i++ )
+    {
+        __m128 s0 = _mm_loadu_ps( src + i*4 );
+        __m128 v0 = PbrNeutral128( s0 );
+        __m128 v1 = _mm_cmple_ps( v0, _mm_set1_ps( 0.0031308f ) );
+        __m128 v2 = _mm_mul_ps( v0, _mm_set1_ps( 12.92f ) );
+        __m128 v3 = _mm_pow_ps( v0, _mm_set1_ps( 1.0f / 2.4f ) );
+        __m128 v4 = _mm_mul_ps( v3, _mm_set1_ps( 1.055f ) );
+        __m128 v5 = _mm_sub_ps( v4, _mm_set1_ps( 0.055f ) );
+        __m128 v6 = _mm_blendv_ps( v5, v2, v1 );
+        __m128 v7 = _mm_blend_ps( v6, s0, 0x8 );
+        __m128 v8 = _mm_min_ps( v7, _mm_set1_ps( 1.0f ) );
+        __m128 v9 = _mm_max_ps( v8, _mm_setzero_ps() );
+        __m128 v10 = _mm_mul_ps( v9, _mm_set1_ps( 255.0f ) );
+        __m128i v11 = _mm_cvtps_epi32( v10 );
+        __m128i v12 = _mm_packus_epi32( v11, v11 );
+        __m128i v13 = _mm_packus_epi16( v12, v12 );
+        dst[i] = _mm_cvtsi128_si32( v13 );
+    }
+    return sz;
+}
+
+}
+
+#endif
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <cmath>
+#include <tracy/Tracy.hpp>
+
+#include "Panic.hpp"
+#include "SimdLevel.hpp"
+#include "YCbCr.hpp"
+#include "YCbCrImpl.hpp"
+
+namespace YCbCr
+{
+
+Converter::Converter( uint32_t bpp, bool fullRange, Matrix matrix )
+    : m_bpp( bpp )
+    , m_mask( ( 1u << bpp ) - 1 )
+    , m_matrix( matrix )
+{
+    CheckPanic( bpp >= 8 && bpp <= 16, "Invalid YCbCr bit depth" );
+
+    float a, b, c, d;
+    switch( matrix )
+    {
+    case Matrix::GBR:
+        a = b = c = d = 0;
+        break;
+    case Matrix::BT601:
+        a = 1.402f;
+        b = -0.344136f;
+        c = -0.714136f;
+        d = 1.772f;
+        break;
+    case Matrix::BT709:
+        a = 1.5748f;
+        b = -0.1873f;
+        c = -0.4681f;
+        d = 1.8556f;
+        break;
+    case Matrix::BT2020:
+        a = 1.4746f;
+        b = -0.16455312684366f;
+        c = -0.57135312684366f;
+        d = 1.8814f;
+        break;
+    default:
+        Panic( "Invalid conversion matrix" );
+        break;
+    }
+
+    const auto size = m_mask + 1;
+    m_y.resize( size );
+    m_crR.resize( size );
+    m_cbG.resize( size );
+    m_crG.resize( size );
+    m_cbB.resize( size );
+    m_a.resize( size );
+
+    // H.273, 8.3, limited range luma is expanded to full range
+    constexpr float scale = 255.f / 219.f;
+    constexpr float offset = 16.f / 255.f;
+    const float div = 1.f / m_mask;
+
+    // Sample values are calculated in a separate pass, which keeps the compiler from contracting the
+    // following operations to fma, with results depending on the target
+    for( uint32_t v=0; v<size; v++ ) m_a[v] = float( v ) * div;
+
+    for( uint32_t v=0; v<size; v++ )
+    {
+        const auto value = m_a[v];
+        m_y[v] = fullRange ? value : ( value - offset ) * scale;
+
+        const float chroma = value - 0.5f;
+        if( matrix == Matrix::GBR )
+        {
+            m_crR[v] = chroma + 0.5f;
+            m_cbB[v] = chroma + 0.5f;
+        }
+        else
+        {
+            m_crR[v] = a * chroma;
+            m_cbG[v] = b * chroma;
+            m_crG[v] = c * chroma;
+            m_cbB[v] = d * chroma;
+        }
+    }
+}
+
+void Converter::Convert( float* dst, const void* y, const void* cb, const void* cr, const void* a, size_t count ) const
+{
+    if( m_bpp > 8 )
+    {
+        ConvertImpl( dst, (const uint16_t*)y, (const uint16_t*)cb, (const uint16_t*)cr, (const uint16_t*)a, count );
+    }
+    else
+    {
+        ConvertImpl( dst, (const uint8_t*)y, (const uint8_t*)cb, (const uint8_t*)cr, (const uint8_t*)a, count );
+    }
+}
+
+void Converter::ConvertSubsampled( float* dst, const void* y, const void* cb, const void* cr, const void* cb1, const void* cr1, const void* a, size_t x, size_t count, size_t chromaWidth ) const
+{
+    if( m_bpp > 8 )
+    {
+        ConvertSubsampledImpl( dst, (const uint16_t*)y, (const uint16_t*)cb, (const uint16_t*)cr, (const uint16_t*)cb1, (const uint16_t*)cr1, (const uint16_t*)a, x, count, chromaWidth );
+    }
+    else
+    {
+        ConvertSubsampledImpl( dst, (const uint8_t*)y, (const uint8_t*)cb, (const uint8_t*)cr, (const uint8_t*)cb1, (const uint8_t*)cr1, (const uint8_t*)a, x, count, chromaWidth );
+    }
+}
+
+static const YCbCrKernelTable* Kernels()
+{
+#if defined __x86_64__ || defined __i386__
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: return &YCbCrKernelsAvx512;
+    case SimdLevel::Avx2: return &YCbCrKernelsAvx2;
+    default: break;
+    }
+#endif
+    return nullptr;
+}
+
+YCbCrTables Converter::Tables() const
+{
+    return { m_y.data(), m_crR.data(), m_cbG.data(), m_crG.data(), m_cbB.data(), m_a.data(), m_mask, m_matrix == Matrix::GBR };
+}
+
+template<typename T>
+void Converter::ConvertImpl( float* dst, const T* y, const T* cb, const T* cr, const T* a, size_t count ) const
+{
+    const auto gbr = m_matrix == Matrix::GBR;
+    const auto mask = m_mask;
+    const auto ty = m_y.data();
+    const auto tcrR = m_crR.data();
+    const auto tcbG = m_cbG.data();
+    const auto tcrG = m_crG.data();
+    const auto tcbB = m_cbB.data();
+    const auto ta = m_a.data();
+
+    size_t i = 0;
+    if( auto kernels = Kernels() )
+    {
+        if constexpr( sizeof( T ) == 1 ) i = kernels->convert8( Tables(), dst, y, cb, cr, a, count );
+        else i = kernels->convert16( Tables(), dst, y, cb, cr, a, count );
+    }
+
+    dst += i*4;
+    for( ; i<count; i++ )
+    {
+        const auto vy = ty[y[i] & mask];
+        const auto vcb = cb[i] & mask;
+        const auto vcr = cr[i] & mask;
+        if( gbr )
+        {
+            dst[0] = tcrR[vcr];
+            dst[1] = vy;
+            dst[2] = tcbB[vcb];
+        }
+        else
+        {
+            dst[0] = vy + tcrR[vcr];
+            dst[1] = vy + ( tcbG[vcb] + tcrG[vcr] );
+            dst[2] = vy + tcbB[vcb];
+        }
+        dst[3] = a ? ta[a[i] & mask] : 1.f;
+        dst += 4;
+    }
+}
+
+// Number of luma columns converted at once by ConvertSubsampled, must be even
+constexpr size_t SubsampledBlock = 1024;
+
+template<typename T>
+void Converter::ChromaImpl( float* r, float* g, float* b, const T* cb, const T* cr, size_t count ) const
+{
+    const auto mask = m_mask;
+    const auto tcrR = m_crR.data();
+    const auto tcbG = m_cbG.data();
+    const auto tcrG = m_crG.data();
+    const auto tcbB = m_cbB.data();
+
+    size_t i = 0;
+    if( auto kernels = Kernels() )
+    {
+        if constexpr( sizeof( T ) == 1 ) i = kernels->chroma8( Tables(), r, g, b, cb, cr, count );
+        else i = kernels->chroma16( Tables(), r, g, b, cb, cr, count );
+    }
+    for( ; i<count; i++ )
+    {
+        const auto vcb = cb[i] & mask;
+        const auto vcr = cr[i] & mask;
+        r[i] = tcrR[vcr];
+        g[i] = tcbG[vcb] + tcrG[vcr];
+        b[i] = tcbB[vcb];
+    }
+}
+
+template<typename T>
+void Converter::UpsampleImpl( float* dst, const T* y, const T* a, const float* r, const float* g, const float* b, bool odd, size_t count ) const
+{
+    const auto mask = m_mask;
+    const auto ty = m_y.data();
+    const auto ta = m_a.data();
+    const auto yrb = m_matrix == Matrix::GBR ? 0.f : 1.f;
+
+    // Even columns are co-sited with chroma samples, odd columns are halfway between them
+    auto pixel = [&]( size_t i, size_t k, bool mid ) {
+        const auto vy = ty[y[i] & mask];
+        const auto cr = mid ? ( r[k] + r[k+1] ) * 0.5f : r[k];
+        const auto cg = mid ? ( g[k] + g[k+1] ) * 0.5f : g[k];
+        const auto cb = mid ? ( b[k] + b[k+1] ) * 0.5f : b[k];
+        dst[i*4+0] = vy * yrb + cr;
+        dst[i*4+1] = vy + cg;
+        dst[i*4+2] = vy * yrb + cb;
+        dst[i*4+3] = a ? ta[a[i] & mask] : 1.f;
+    };
+
+    size_t i = 0;
+    if( odd && count > 0 )
+    {
+        pixel( 0, 0, true );
+        i = 1;
+    }
+
+    if( auto kernels = Kernels() )
+    {
+        // Vector loop starts at a column co-sited with chroma
+        const auto k = ( i + odd ) / 2;
+        const auto ai = a ? a + i : nullptr;
+        if constexpr( sizeof( T ) == 1 ) i += kernels->upsample8( Tables(), dst + i*4, y + i, ai, r + k, g + k, b + k, count - i );
+        else i += kernels->upsample16( Tables(), dst + i*4, y + i, ai, r + k, g + k, b + k, count - i );
+    }
+
+    for( ; i<count; i++ )
+    {
+        const auto col = i + odd;
+        pixel( i, col / 2, col & 1 );
+    }
+}
+
+template<typename T>
+void Converter::ConvertSubsampledImpl( float* dst, const T* y, const T* cb, const T* cr, const T* cb1, const T* cr1, const T* a, size_t x, size_t count, size_t chromaWidth ) const
+{
+    // One extra chroma sample is needed for interpolation of the last odd column, and the vector
+    // loop reads up to three past it
+    constexpr size_t Size = SubsampledBlock / 2 + 4;
+    float r[Size], g[Size], b[Size];
+    float r1[Size], g1[Size], b1[Size];
+
+    while( count > 0 )
+    {
+        const auto n = std::min( count, SubsampledBlock );
+        const auto c0 = x / 2;
+        const auto needed = ( x + n ) / 2 - c0 + 1;
+        const auto available = std::min( needed, chromaWidth - c0 );
+
+        ChromaImpl( r, g, b, cb + c0, cr + c0, available );
+        if( cb1 )
+        {
+            ChromaImpl( r1, g1, b1, cb1 + c0, cr1 + c0, available );
+            size_t i = 0;
+            if( auto kernels = Kernels() )
+            {
+                kernels->blendRows( r, r1, available );
+                kernels->blendRows( g, g1, available );
+                i = kernels->blendRows( b, b1, available );
+            }
+            for( ; i<available; i++ )
+            {
+                r[i] = r[i] * 0.75f + r1[i] * 0.25f;
+                g[i] = g[i] * 0.75f + g1[i] * 0.25f;
+                b[i] = b[i] * 0.75f + b1[i] * 0.25f;
+            }
+        }
+        for( size_t i=available; i<Size; i++ )
+        {
+            r[i] = r[available-1];
+            g[i] = g[available-1];
+            b[i] = b[available-1];
+        }
+
+        UpsampleImpl( dst, y, a, r, g, b, x & 1, n );
+
+        dst += n * 4;
+        y += n;
+        if( a ) a += n;
+        x += n;
+        count -= n;
+    }
+}
+
+constexpr float HlgA = 0.17883277f;
+constexpr float HlgB = 0.28466892f;
+constexpr float HlgC = 0.55991073f;
+
+static float Pq( float N )
+{
+    constexpr float m1 = 0.1593017578125f;
+    constexpr float m1inv = 1.f / m1;
+    constexpr float m2 = 78.84375f;
+    constexpr float m2inv = 1.f / m2;
+    constexpr float c1 = 0.8359375f;
+    constexpr float c2 = 18.8515625f;
+    constexpr float c3 = 18.6875f;
+
+    const auto Nm2 = std::pow( std::max( N, 0.f ), m2inv );
+    return 10000.f * std::pow( std::max( 0.f, Nm2 - c1 ) / ( c2 - c3 * Nm2 ), m1inv );
+}
+
+static float Hlg( float E )
+{
+    if( E < 0 )
+    {
+        return -1.f * Hlg( -1.f * E );
+    }
+    else if( E <= 0.5f )
+    {
+        return E * E / 3.f;
+    }
+    else
+    {
+        return ( std::exp( ( E - HlgC ) / HlgA ) + HlgB ) / 12.f;
+    }
+}
+
+template<float(*Scalar)( float )>
+static inline void ScalarTail( float* ptr, size_t sz, float mul )
+{
+    while( sz-- > 0 )
+    {
+        ptr[0] = Scalar( ptr[0] ) * mul;
+        ptr[1] = Scalar( ptr[1] ) * mul;
+        ptr[2] = Scalar( ptr[2] ) * mul;
+        ptr += 4;
+    }
+}
+
+void LinearizePq( float* ptr, size_t sz, float mul )
+{
+    ZoneScoped;
+
+    if( auto kernels = Kernels() )
+    {
+        const auto done = kernels->linearizePq( ptr, sz, mul );
+        ptr += done * 4;
+        sz -= done;
+    }
+    ScalarTail<Pq>( ptr, sz, mul );
+}
+
+void LinearizeHlg( float* ptr, size_t sz, float mul )
+{
+    ZoneScoped;
+
+    if( auto kernels = Kernels() )
+    {
+        const auto done = kernels->linearizeHlg( ptr, sz, mul );
+        ptr += done * 4;
+        sz -= done;
+    }
+    ScalarTail<Hlg>( ptr, sz, mul );
+}
+
+}
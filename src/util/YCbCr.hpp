@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+struct YCbCrTables;
+
+// Decoding of planar YCbCr video signal data, as found in HEIF and AVIF images, to linear RGBA
+// float.
+namespace YCbCr
+{
+
+enum class Matrix
+{
+    GBR,
+    BT601,
+    BT709,
+    BT2020
+};
+
+// Converts rows of planar samples to interleaved RGBA float in a single pass, applying range
+// expansion and the color matrix. Each sample value is looked up in precomputed tables, so the
+// output is identical regardless of the code path taken.
+class Converter
+{
+public:
+    // Samples are uint8_t for bpp 8 and uint16_t for higher bit depths.
+    Converter( uint32_t bpp, bool fullRange, Matrix matrix );
+    NoCopy( Converter );
+
+    // Alpha plane is optional, output alpha is 1 if not present.
+    void Convert( float* dst, const void* y, const void* cb, const void* cr, const void* a, size_t count ) const;
+
+    // Converts a row with chroma planes subsampled horizontally by two, as in 4:2:2 and 4:2:0,
+    // upsampling chroma on the fly. Chroma rows have chromaWidth samples and are co-sited with
+    // even luma columns. Conversion starts at luma column x, at which y and a point. For 4:2:0,
+    // the second nearest chroma row is given in cb1 and cr1, and is blended in with weight 1/4.
+    void ConvertSubsampled( float* dst, const void* y, const void* cb, const void* cr, const void* cb1, const void* cr1, const void* a, size_t x, size_t count, size_t chromaWidth ) const;
+
+    [[nodiscard]] uint32_t Bpp() const { return m_bpp; }
+
+private:
+    [[nodiscard]] YCbCrTables Tables() const;
+
+    template<typename T> void ConvertImpl( float* dst, const T* y, const T* cb, const T* cr, const T* a, size_t count ) const;
+    template<typename T> void ConvertSubsampledImpl( float* dst, const T* y, const T* cb, const T* cr, const T* cb1, const T* cr1, const T* a, size_t x, size_t count, size_t chromaWidth ) const;
+    template<typename T> void ChromaImpl( float* r, float* g, float* b, const T* cb, const T* cr, size_t count ) const;
+    template<typename T> void UpsampleImpl( float* dst, const T* y, const T* a, const float* r, const float* g, const float* b, bool odd, size_t count ) const;
+
+    uint32_t m_bpp;
+    uint32_t m_mask;
+    Matrix m_matrix;
+
+    // Y, contribution of Cr to R, Cb and Cr to G, Cb to B, and alpha. With the GBR matrix the
+    // contributions are the plain R and B values.
+    std::vector<float> m_y;
+    std::vector<float> m_crR;
+    std::vector<float> m_cbG;
+    std::vector<float> m_crG;
+    std::vector<float> m_cbB;
+    std::vector<float> m_a;
+};
+
+// In-place transfer functions, operating on RGB channels of RGBA float data. Alpha is preserved.
+void LinearizePq( float* ptr, size_t sz, float mul );
+void LinearizeHlg( float* ptr, size_t sz, float mul );
+
+}
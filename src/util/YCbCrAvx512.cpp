@@ -0,0 +1,14 @@
+#if defined __x86_64__ || defined __i386__
+
+#define YCBCR_KERNELS_LEVEL 3
+#include "YCbCrImpl.hpp"
+
+const YCbCrKernelTable YCbCrKernelsAvx512 = {
+    Convert<uint8_t>, Convert<uint16_t>,
+    Chroma<uint8_t>, Chroma<uint16_t>,
+    Upsample<uint8_t>, Upsample<uint16_t>,
+    BlendRows,
+    LinearizePq, LinearizeHlg
+};
+
+#endif
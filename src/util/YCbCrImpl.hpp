@@ -0,0 +1,387 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sample value lookup tables of YCbCr::Converter
+struct YCbCrTables
+{
+    const float* y;
+    const float* crR;
+    const float* cbG;
+    const float* crG;
+    const float* cbB;
+    const float* a;
+    uint32_t mask;
+    bool gbr;
+};
+
+// Vector parts of YCbCr conversion. Each function processes what fits in whole vectors and returns
+// the number of pixels or samples done, leaving the rest to the scalar code. Upsampling starts at a
+// luma column co-sited with the first chroma sample and reads up to four samples past the last one
+// used. Row blending and the transfer functions always process everything.
+struct YCbCrKernelTable
+{
+    size_t (*convert8)( const YCbCrTables& t, float* dst, const uint8_t* y, const uint8_t* cb, const uint8_t* cr, const uint8_t* a, size_t count );
+    size_t (*convert16)( const YCbCrTables& t, float* dst, const uint16_t* y, const uint16_t* cb, const uint16_t* cr, const uint16_t* a, size_t count );
+    size_t (*chroma8)( const YCbCrTables& t, float* r, float* g, float* b, const uint8_t* cb, const uint8_t* cr, size_t count );
+    size_t (*chroma16)( const YCbCrTables& t, float* r, float* g, float* b, const uint16_t* cb, const uint16_t* cr, size_t count );
+    size_t (*upsample8)( const YCbCrTables& t, float* dst, const uint8_t* y, const uint8_t* a, const float* r, const float* g, const float* b, size_t count );
+    size_t (*upsample16)( const YCbCrTables& t, float* dst, const uint16_t* y, const uint16_t* a, const float* r, const float* g, const float* b, size_t count );
+    size_t (*blendRows)( float* c, const float* c1, size_t count );
+    size_t (*linearizePq)( float* ptr, size_t sz, float mul );
+    size_t (*linearizeHlg)( float* ptr, size_t sz, float mul );
+};
+
+extern const YCbCrKernelTable YCbCrKernelsAvx2;
+extern const YCbCrKernelTable YCbCrKernelsAvx512;
+
+// Included by the translation unit of each level, with YCBCR_KERNELS_LEVEL set to 2 for AVX2, 3 for
+// AVX-512. There is no SSE4.1 level, as table lookups need gathers and the transfer functions need
+// FMA. Everything has internal linkage and uses no inline functions from other headers, as those
+// could be merged with copies built for another level.
+#ifdef YCBCR_KERNELS_LEVEL
+
+#if YCBCR_KERNELS_LEVEL >= 3 && !defined __AVX512F__
+#  error AVX-512 YCbCr kernels must be built with -mavx512f
+#endif
+#if !( defined __AVX2__ && defined __FMA__ )
+#  error AVX2 YCbCr kernels must be built with -mavx2 -mfma
+#endif
+
+#include "Simd.hpp"
+
+namespace
+{
+
+constexpr float HlgA = 0.17883277f;
+constexpr float HlgB = 0.28466892f;
+constexpr float HlgC = 0.55991073f;
+
+// Exponent of the HLG curve, rescaled for exp2
+constexpr float HlgExp2 = 1.4426950408889634f / HlgA;
+
+template<typename T>
+__m256i Load8( const T* ptr, __m256i mask )
+{
+    if constexpr( sizeof( T ) == 1 )
+    {
+        return _mm256_and_si256( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)ptr ) ), mask );
+    }
+    else
+    {
+        return _mm256_and_si256( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)ptr ) ), mask );
+    }
+}
+
+// Interleaves planar channels of 8 pixels
+void Store8( float* dst, __m256 r, __m256 g, __m256 b, __m256 a )
+{
+    __m256 rg0 = _mm256_unpacklo_ps( r, g );
+    __m256 rg1 = _mm256_unpackhi_ps( r, g );
+    __m256 ba0 = _mm256_unpacklo_ps( b, a );
+    __m256 ba1 = _mm256_unpackhi_ps( b, a );
+
+    __m256 p04 = _mm256_shuffle_ps( rg0, ba0, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m256 p15 = _mm256_shuffle_ps( rg0, ba0, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    __m256 p26 = _mm256_shuffle_ps( rg1, ba1, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m256 p37 = _mm256_shuffle_ps( rg1, ba1, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+
+    _mm256_storeu_ps( dst,      _mm256_permute2f128_ps( p04, p15, 0x20 ) );
+    _mm256_storeu_ps( dst + 8,  _mm256_permute2f128_ps( p26, p37, 0x20 ) );
+    _mm256_storeu_ps( dst + 16, _mm256_permute2f128_ps( p04, p15, 0x31 ) );
+    _mm256_storeu_ps( dst + 24, _mm256_permute2f128_ps( p26, p37, 0x31 ) );
+}
+
+#if YCBCR_KERNELS_LEVEL >= 3
+template<typename T>
+__m512i Load16( const T* ptr, __m512i mask )
+{
+    if constexpr( sizeof( T ) == 1 )
+    {
+        return _mm512_and_si512( _mm512_cvtepu8_epi32( _mm_loadu_si128( (const __m128i*)ptr ) ), mask );
+    }
+    else
+    {
+        return _mm512_and_si512( _mm512_cvtepu16_epi32( _mm256_loadu_si256( (const __m256i*)ptr ) ), mask );
+    }
+}
+
+// Interleaves planar channels of 16 pixels
+void Store16( float* dst, __m512 r, __m512 g, __m512 b, __m512 a )
+{
+    __m512 rg0 = _mm512_unpacklo_ps( r, g );
+    __m512 rg1 = _mm512_unpackhi_ps( r, g );
+    __m512 ba0 = _mm512_unpacklo_ps( b, a );
+    __m512 ba1 = _mm512_unpackhi_ps( b, a );
+
+    // Each 128-bit lane holds one pixel, in order 0 4 8 12, 1 5 9 13, and so on
+    __m512 p0 = _mm512_shuffle_ps( rg0, ba0, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m512 p1 = _mm512_shuffle_ps( rg0, ba0, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    __m512 p2 = _mm512_shuffle_ps( rg1, ba1, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m512 p3 = _mm512_shuffle_ps( rg1, ba1, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+
+    __m512 q0 = _mm512_shuffle_f32x4( p0, p1, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m512 q1 = _mm512_shuffle_f32x4( p2, p3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m512 q2 = _mm512_shuffle_f32x4( p0, p1, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    __m512 q3 = _mm512_shuffle_f32x4( p2, p3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+
+    _mm512_storeu_ps( dst,      _mm512_shuffle_f32x4( q0, q1, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+    _mm512_storeu_ps( dst + 16, _mm512_shuffle_f32x4( q0, q1, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+    _mm512_storeu_ps( dst + 32, _mm512_shuffle_f32x4( q2, q3, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+    _mm512_storeu_ps( dst + 48, _mm512_shuffle_f32x4( q2, q3, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+}
+#endif
+
+template<typename T>
+size_t Convert( const YCbCrTables& t, float* dst, const T* y, const T* cb, const T* cr, const T* a, size_t count )
+{
+    size_t i = 0;
+#if YCBCR_KERNELS_LEVEL >= 3
+    const auto mask16 = _mm512_set1_epi32( t.mask );
+    for( ; i+16<=count; i+=16 )
+    {
+        __m512i iy = Load16( y + i, mask16 );
+        __m512i icb = Load16( cb + i, mask16 );
+        __m512i icr = Load16( cr + i, mask16 );
+
+        __m512 vy = _mm512_i32gather_ps( iy, t.y, 4 );
+        __m512 vr = _mm512_i32gather_ps( icr, t.crR, 4 );
+        __m512 vb = _mm512_i32gather_ps( icb, t.cbB, 4 );
+        __m512 va = a ? _mm512_i32gather_ps( Load16( a + i, mask16 ), t.a, 4 ) : _mm512_set1_ps( 1.f );
+
+        if( t.gbr )
+        {
+            Store16( dst + i*4, vr, vy, vb, va );
+        }
+        else
+        {
+            __m512 vg = _mm512_add_ps( _mm512_i32gather_ps( icb, t.cbG, 4 ), _mm512_i32gather_ps( icr, t.crG, 4 ) );
+            Store16( dst + i*4, _mm512_add_ps( vy, vr ), _mm512_add_ps( vy, vg ), _mm512_add_ps( vy, vb ), va );
+        }
+    }
+#endif
+    const auto mask8 = _mm256_set1_epi32( t.mask );
+    for( ; i+8<=count; i+=8 )
+    {
+        __m256i iy = Load8( y + i, mask8 );
+        __m256i icb = Load8( cb + i, mask8 );
+        __m256i icr = Load8( cr + i, mask8 );
+
+        __m256 vy = _mm256_i32gather_ps( t.y, iy, 4 );
+        __m256 vr = _mm256_i32gather_ps( t.crR, icr, 4 );
+        __m256 vb = _mm256_i32gather_ps( t.cbB, icb, 4 );
+        __m256 va = a ? _mm256_i32gather_ps( t.a, Load8( a + i, mask8 ), 4 ) : _mm256_set1_ps( 1.f );
+
+        if( t.gbr )
+        {
+            Store8( dst + i*4, vr, vy, vb, va );
+        }
+        else
+        {
+            __m256 vg = _mm256_add_ps( _mm256_i32gather_ps( t.cbG, icb, 4 ), _mm256_i32gather_ps( t.crG, icr, 4 ) );
+            Store8( dst + i*4, _mm256_add_ps( vy, vr ), _mm256_add_ps( vy, vg ), _mm256_add_ps( vy, vb ), va );
+        }
+    }
+    return i;
+}
+
+template<typename T>
+size_t Chroma( const YCbCrTables& t, float* r, float* g, float* b, const T* cb, const T* cr, size_t count )
+{
+    size_t i = 0;
+    const auto mask8 = _mm256_set1_epi32( t.mask );
+    for( ; i+8<=count; i+=8 )
+    {
+        __m256i icb = Load8( cb + i, mask8 );
+        __m256i icr = Load8( cr + i, mask8 );
+
+        _mm256_storeu_ps( r + i, _mm256_i32gather_ps( t.crR, icr, 4 ) );
+        _mm256_storeu_ps( g + i, _mm256_add_ps( _mm256_i32gather_ps( t.cbG, icb, 4 ), _mm256_i32gather_ps( t.crG, icr, 4 ) ) );
+        _mm256_storeu_ps( b + i, _mm256_i32gather_ps( t.cbB, icb, 4 ) );
+    }
+    return i;
+}
+
+// Even columns are co-sited with chroma samples, odd columns are halfway between them
+__m256 UpsampleChroma( const float* c )
+{
+    __m128 e = _mm_loadu_ps( c );
+    __m128 o = _mm_mul_ps( _mm_add_ps( e, _mm_loadu_ps( c + 1 ) ), _mm_set1_ps( 0.5f ) );
+    return _mm256_set_m128( _mm_unpackhi_ps( e, o ), _mm_unpacklo_ps( e, o ) );
+}
+
+template<typename T>
+size_t Upsample( const YCbCrTables& t, float* dst, const T* y, const T* a, const float* r, const float* g, const float* b, size_t count )
+{
+    size_t i = 0;
+    const auto mask8 = _mm256_set1_epi32( t.mask );
+    const auto yrb8 = _mm256_set1_ps( t.gbr ? 0.f : 1.f );
+    for( ; i+8<=count; i+=8 )
+    {
+        const auto k = i / 2;
+        __m256 vy = _mm256_i32gather_ps( t.y, Load8( y + i, mask8 ), 4 );
+        __m256 vyrb = _mm256_mul_ps( vy, yrb8 );
+        __m256 va = a ? _mm256_i32gather_ps( t.a, Load8( a + i, mask8 ), 4 ) : _mm256_set1_ps( 1.f );
+        Store8( dst + i*4, _mm256_add_ps( vyrb, UpsampleChroma( r + k ) ), _mm256_add_ps( vy, UpsampleChroma( g + k ) ), _mm256_add_ps( vyrb, UpsampleChroma( b + k ) ), va );
+    }
+    return i;
+}
+
+// The tail is masked, so that all samples go through the same operations, regardless of the
+// position of the converted columns
+size_t BlendRows( float* c, const float* c1, size_t count )
+{
+    const auto w0 = _mm256_set1_ps( 0.75f );
+    const auto w1 = _mm256_set1_ps( 0.25f );
+    for( size_t i=0; i<count; i+=8 )
+    {
+        const auto mask = _mm256_cmpgt_epi32( _mm256_set1_epi32( int( count - i ) ), _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+        __m256 v = _mm256_add_ps( _mm256_mul_ps( _mm256_maskload_ps( c + i, mask ), w0 ), _mm256_mul_ps( _mm256_maskload_ps( c1 + i, mask ), w1 ) );
+        _mm256_maskstore_ps( c + i, mask, v );
+    }
+    return count;
+}
+
+__m128 Pq128( __m128 px, __m128 mul )
+{
+    __m128 px1 = _mm_max_ps( px, _mm_setzero_ps() );
+    __m128 Nm2 = _mm_pow_ps( px1, _mm_set1_ps( 1.f / 78.84375f ) );
+
+    __m128 px2 = _mm_sub_ps( Nm2, _mm_set1_ps( 0.8359375f ) );
+    __m128 px3 = _mm_max_ps( px2, _mm_setzero_ps() );
+
+    __m128 px4 = _mm_fnmadd_ps( _mm_set1_ps( 18.6875f ), Nm2, _mm_set1_ps( 18.8515625f ) );
+    __m128 px5 = _mm_div_ps( px3, px4 );
+
+    __m128 px6 = _mm_pow_ps( px5, _mm_set1_ps( 1.f / 0.1593017578125f ) );
+    return _mm_mul_ps( px6, mul );
+}
+
+__m128 Hlg128( __m128 px, __m128 mul )
+{
+    __m128 sign = _mm_and_ps( px, _mm_set1_ps( -0.f ) );
+    __m128 ax = _mm_andnot_ps( _mm_set1_ps( -0.f ), px );
+
+    __m128 lo = _mm_mul_ps( _mm_mul_ps( ax, ax ), _mm_set1_ps( 1.f / 3.f ) );
+    __m128 e = _mm_exp_ps( _mm_mul_ps( _mm_sub_ps( ax, _mm_set1_ps( HlgC ) ), _mm_set1_ps( HlgExp2 ) ) );
+    __m128 hi = _mm_mul_ps( _mm_add_ps( e, _mm_set1_ps( HlgB ) ), _mm_set1_ps( 1.f / 12.f ) );
+
+    __m128 ret = _mm_blendv_ps( lo, hi, _mm_cmpgt_ps( ax, _mm_set1_ps( 0.5f ) ) );
+    return _mm_mul_ps( _mm_or_ps( ret, sign ), mul );
+}
+
+__m256 Pq256( __m256 px, __m256 mul )
+{
+    __m256 px1 = _mm256_max_ps( px, _mm256_setzero_ps() );
+    __m256 Nm2 = _mm256_pow_ps( px1, _mm256_set1_ps( 1.f / 78.84375f ) );
+
+    __m256 px2 = _mm256_sub_ps( Nm2, _mm256_set1_ps( 0.8359375f ) );
+    __m256 px3 = _mm256_max_ps( px2, _mm256_setzero_ps() );
+
+    __m256 px4 = _mm256_fnmadd_ps( _mm256_set1_ps( 18.6875f ), Nm2, _mm256_set1_ps( 18.8515625f ) );
+    __m256 px5 = _mm256_div_ps( px3, px4 );
+
+    __m256 px6 = _mm256_pow_ps( px5, _mm256_set1_ps( 1.f / 0.1593017578125f ) );
+    return _mm256_mul_ps( px6, mul );
+}
+
+__m256 Hlg256( __m256 px, __m256 mul )
+{
+    __m256 sign = _mm256_and_ps( px, _mm256_set1_ps( -0.f ) );
+    __m256 ax = _mm256_andnot_ps( _mm256_set1_ps( -0.f ), px );
+
+    __m256 lo = _mm256_mul_ps( _mm256_mul_ps( ax, ax ), _mm256_set1_ps( 1.f / 3.f ) );
+    __m256 e = _mm256_exp_ps( _mm256_mul_ps( _mm256_sub_ps( ax, _mm256_set1_ps( HlgC ) ), _mm256_set1_ps( HlgExp2 ) ) );
+    __m256 hi = _mm256_mul_ps( _mm256_add_ps( e, _mm256_set1_ps( HlgB ) ), _mm256_set1_ps( 1.f / 12.f ) );
+
+    __m256 ret = _mm256_blendv_ps( lo, hi, _mm256_cmp_ps( ax, _mm256_set1_ps( 0.5f ), _CMP_GT_OQ ) );
+    return _mm256_mul_ps( _mm256_or_ps( ret, sign ), mul );
+}
+
+#if YCBCR_KERNELS_LEVEL >= 3
+__m512 Pq512( __m512 px, __m512 mul )
+{
+    __m512 px1 = _mm512_max_ps( px, _mm512_setzero_ps() );
+    __m512 Nm2 = _mm512_pow_ps( px1, _mm512_set1_ps( 1.f / 78.84375f ) );
+
+    __m512 px2 = _mm512_sub_ps( Nm2, _mm512_set1_ps( 0.8359375f ) );
+    __m512 px3 = _mm512_max_ps( px2, _mm512_setzero_ps() );
+
+    __m512 px4 = _mm512_fnmadd_ps( _mm512_set1_ps( 18.6875f ), Nm2, _mm512_set1_ps( 18.8515625f ) );
+    __m512 px5 = _mm512_div_ps( px3, px4 );
+
+    __m512 px6 = _mm512_pow_ps( px5, _mm512_set1_ps( 1.f / 0.1593017578125f ) );
+    return _mm512_mul_ps( px6, mul );
+}
+
+__m512 Hlg512( __m512 px, __m512 mul )
+{
+    __m512i sign = _mm512_and_epi32( _mm512_castps_si512( px ), _mm512_set1_epi32( 0x80000000 ) );
+    __m512 ax = _mm512_abs_ps( px );
+
+    __m512 lo = _mm512_mul_ps( _mm512_mul_ps( ax, ax ), _mm512_set1_ps( 1.f / 3.f ) );
+    __m512 e = _mm512_exp_ps( _mm512_mul_ps( _mm512_sub_ps( ax, _mm512_set1_ps( HlgC ) ), _mm512_set1_ps( HlgExp2 ) ) );
+    __m512 hi = _mm512_mul_ps( _mm512_add_ps( e, _mm512_set1_ps( HlgB ) ), _mm512_set1_ps( 1.f / 12.f ) );
+
+    __m512 ret = _mm512_mask_blend_ps( _mm512_cmp_ps_mask( ax, _mm512_set1_ps( 0.5f ), _CMP_GT_OQ ), lo, hi );
+    ret = _mm512_castsi512_ps( _mm512_or_epi32( _mm512_castps_si512( ret ), sign ) );
+    return _mm512_mul_ps( ret, mul );
+}
+#endif
+
+size_t LinearizePq( float* ptr, size_t sz, float mul )
+{
+    size_t i = 0;
+#if YCBCR_KERNELS_LEVEL >= 3
+    const auto mul16 = _mm512_set1_ps( 10000.f * mul );
+    for( ; i+4<=sz; i+=4 )
+    {
+        __m512 px = _mm512_loadu_ps( ptr + i*4 );
+        _mm512_storeu_ps( ptr + i*4, _mm512_mask_blend_ps( 0x8888, Pq512( px, mul16 ), px ) );
+    }
+#endif
+    const auto mul8 = _mm256_set1_ps( 10000.f * mul );
+    for( ; i+2<=sz; i+=2 )
+    {
+        __m256 px = _mm256_loadu_ps( ptr + i*4 );
+        _mm256_storeu_ps( ptr + i*4, _mm256_blend_ps( Pq256( px, mul8 ), px, 0x88 ) );
+    }
+    const auto mul4 = _mm_set1_ps( 10000.f * mul );
+    for( ; i<sz; i++ )
+    {
+        __m128 px = _mm_loadu_ps( ptr + i*4 );
+        _mm_storeu_ps( ptr + i*4, _mm_blend_ps( Pq128( px, mul4 ), px, 0x8 ) );
+    }
+    return sz;
+}
+
+size_t LinearizeHlg( float* ptr, size_t sz, float mul )
+{
+    size_t i = 0;
+#if YCBCR_KERNELS_LEVEL >= 3
+    const auto mul16 = _mm512_set1_ps( mul );
+    for( ; i+4<=sz; i+=4 )
+    {
+        __m512 px = _mm512_loadu_ps( ptr + i*4 );
+        _mm512_storeu_ps( ptr + i*4, _mm512_mask_blend_ps( 0x8888, Hlg512( px, mul16 ), px ) );
+    }
+#endif
+    const auto mul8 = _mm256_set1_ps( mul );
+    for( ; i+2<=sz; i+=2 )
+    {
+        __m256 px = _mm256_loadu_ps( ptr + i*4 );
+        _mm256_storeu_ps( ptr + i*4, _mm256_blend_ps( Hlg256( px, mul8 ), px, 0x88 ) );
+    }
+    const auto mul4 = _mm_set1_ps( mul );
+    for( ; i<sz; i++ )
+    {
+        __m128 px = _mm_loadu_ps( ptr + i*4 );
+        _mm_storeu_ps( ptr + i*4, _mm_blend_ps( Hlg128( px, mul4 ), px, 0x8 ) );
+    }
+    return sz;
+}
+
+}
+
+#endif
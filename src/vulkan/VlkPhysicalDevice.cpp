@@ -84,6 +84,14 @@ bool VlkPhysicalDevice::HasHostImageCopy() const
     return m_features14.hostImageCopy == VK_TRUE;
 }
 
+bool VlkPhysicalDevice::SupportsFormat( VkFormat format, VkFormatFeatureFlags2 features ) const
+{
+    VkFormatProperties3 props3 = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3 };
+    VkFormatProperties2 props = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2, &props3 };
+    vkGetPhysicalDeviceFormatProperties2( m_physDev, format, &props );
+    return ( props3.optimalTilingFeatures & features ) == features;
+}
+
 bool VlkPhysicalDevice::IsDeviceHardware() const
 {
     return m_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
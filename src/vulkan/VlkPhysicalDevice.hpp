@@ -25,6 +25,8 @@ public:
     [[nodiscard]] bool HasPciBusInfo() const;
     [[nodiscard]] bool HasHostImageCopy() const;
 
+    [[nodiscard]] bool SupportsFormat( VkFormat format, VkFormatFeatureFlags2 features ) const;
+
     [[nodiscard]] bool IsDeviceHardware() const;
 
     operator VkPhysicalDevice() const { return m_physDev; }
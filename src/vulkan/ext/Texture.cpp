@@ -1,5 +1,3 @@
-#include <algorithm>
-#include <cmath>
 #include <string.h>
 #include <vulkan/vulkan.h>
 #include <tracy/Tracy.hpp>
@@ -9,6 +7,7 @@
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
 #include "util/BitmapHdrHalf.hpp"
+#include "util/MipChainBuilder.hpp"
 #include "util/Panic.hpp"
 #include "vulkan/VlkBuffer.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
@@ -25,35 +24,11 @@ struct MipData
     uint64_t size;
 };
 
-static std::vector<MipData> CalcMipLevels( uint32_t width, uint32_t height, uint32_t bpp, uint64_t& total )
-{
-    const auto mipLevels = (uint32_t)std::floor( std::log2( std::max( width, height ) ) ) + 1;
-    uint64_t offset = 0;
-    std::vector<MipData> levels( mipLevels );
-    for( uint32_t i=0; i<mipLevels; i++ )
-    {
-        const uint64_t size = uint64_t( width ) * height * bpp;
-        levels[i] = { width, height, offset, size };
-        width = std::max( 1u, width / 2 );
-        height = std::max( 1u, height / 2 );
-        offset += size;
-    }
-    total = offset;
-    return levels;
-}
-
-static std::vector<MipData> GetMipChain( bool mips, uint32_t width, uint32_t height, uint32_t bpp, uint64_t& bufsize )
+static std::vector<MipData> GetMipChain( const MipChainBuilder& builder )
 {
     std::vector<MipData> mipChain;
-    if( mips )
-    {
-        mipChain = CalcMipLevels( width, height, bpp, bufsize );
-    }
-    else
-    {
-        bufsize = width * height * bpp;
-        mipChain.emplace_back( width, height, 0, bufsize );
-    }
+    mipChain.reserve( builder.Levels().size() );
+    for( auto& level : builder.Levels() ) mipChain.emplace_back( level.width, level.height, level.offset, level.size );
     return mipChain;
 }
 
@@ -99,72 +74,55 @@ static inline VkBufferCreateInfo GetStagingBufferInfo( uint64_t size, VkBufferUs
     };
 }
 
-template<typename T>
-static void FillStagingBuffer( const std::vector<MipData>& mipChain, std::unique_ptr<T>&& tmp, const T* bmpptr, const std::shared_ptr<VlkBuffer>& stagingBuffer, TaskDispatch* td )
+static void HostCopyLevel( VlkDevice& device, VlkImage& image, uint32_t level, uint32_t width, uint32_t height, const void* data )
 {
-    const auto mipLevels = (uint32_t)mipChain.size();
-    auto bufptr = (uint8_t*)stagingBuffer->Ptr();
-    for( uint32_t level = 0; level < mipLevels; level++ )
-    {
-        const MipData& mipdata = mipChain[level];
-        memcpy( bufptr, bmpptr->Data(), mipdata.size );
-        bufptr += mipdata.size;
-        if( level < mipLevels-1 )
-        {
-            ZoneScopedN( "Mip downscale" );
-            ZoneTextF( "Level %u, %u x %u, %u bytes", level, mipChain[level+1].width, mipChain[level+1].height, mipChain[level+1].size );
+    VkHostImageLayoutTransitionInfo transition = {
+        .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
+        .image = image,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 }
+    };
+    vkTransitionImageLayout( device, 1, &transition );
 
-            tmp = bmpptr->ResizeNew( mipChain[level+1].width, mipChain[level+1].height, td );
-            bmpptr = tmp.get();
-        }
-    }
-    stagingBuffer->Flush();
+    VkMemoryToImageCopy region = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY,
+        .pHostPointer = data,
+        .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
+        .imageExtent = { width, height, 1 },
+    };
+    VkCopyMemoryToImageInfo copy = {
+        .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO,
+        .dstImage = image,
+        .dstImageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .regionCount = 1,
+        .pRegions = &region
+    };
+    vkCopyMemoryToImage( device, &copy );
+
+    transition.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkTransitionImageLayout( device, 1, &transition );
 }
 
 template<typename T>
-static void HostCopy( VlkDevice& device, VlkImage& image, const std::vector<MipData>& mipChain, std::unique_ptr<T>&& tmp, const T* bmpptr, TaskDispatch* td )
+static void HostCopy( VlkDevice& device, VlkImage& image, const MipChainBuilder& builder, const T& bitmap )
 {
-    const auto mipLevels = (uint32_t)mipChain.size();
-    for( uint32_t level = 0; level < mipLevels; level++ )
-    {
-        const MipData& mipdata = mipChain[level];
-
-        VkHostImageLayoutTransitionInfo transition = {
-            .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
-            .image = image,
-            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 }
-        };
-        vkTransitionImageLayout( device, 1, &transition );
-
-        VkMemoryToImageCopy region = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY,
-            .pHostPointer = bmpptr->Data(),
-            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
-            .imageExtent = { mipdata.width, mipdata.height, 1 },
-        };
-        VkCopyMemoryToImageInfo copy = {
-            .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO,
-            .dstImage = image,
-            .dstImageLayout = VK_IMAGE_LAYOUT_GENERAL,
-            .regionCount = 1,
-            .pRegions = &region
-        };
-        vkCopyMemoryToImage( device, &copy );
+    const auto& levels = builder.Levels();
 
-        transition.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-        transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        vkTransitionImageLayout( device, 1, &transition );
-
-        if( level < mipLevels-1 )
-        {
-            ZoneScopedN( "Mip downscale" );
-            ZoneTextF( "Level %u, %u x %u, %u bytes", level, mipChain[level+1].width, mipChain[level+1].height, mipChain[level+1].size );
+    // Without mips, and with no format conversion, bitmap data is copied as is
+    auto data = (const uint8_t*)bitmap.Data();
+    std::unique_ptr<uint8_t[]> tmp;
+    if( levels.size() > 1 || builder.Bpp() != sizeof( *bitmap.Data() ) * 4 )
+    {
+        tmp.reset( new uint8_t[builder.Size()] );
+        builder.Build( bitmap, tmp.get() );
+        data = tmp.get();
+    }
 
-            tmp = bmpptr->ResizeNew( mipChain[level+1].width, mipChain[level+1].height, td );
-            bmpptr = tmp.get();
-        }
+    for( uint32_t level = 0; level < levels.size(); level++ )
+    {
+        HostCopyLevel( device, image, level, levels[level].width, levels[level].height, data + levels[level].offset );
     }
 }
 
@@ -270,9 +228,8 @@ Texture::Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, bool
 {
     ZoneScoped;
 
-    uint64_t bufsize;
-    const auto mipChain = GetMipChain( mips, bitmap.Width(), bitmap.Height(), 4, bufsize );
-    const auto mipLevels = (uint32_t)mipChain.size();
+    const MipChainBuilder builder( bitmap.Width(), bitmap.Height(), 4, mips, td );
+    const auto mipLevels = (uint32_t)builder.Levels().size();
     const auto hostImageCopy = device.UseHostImageCopy();
 
     m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, bitmap.Width(), bitmap.Height(), mipLevels, hostImageCopy ) );
@@ -280,14 +237,15 @@ Texture::Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, bool
 
     if( hostImageCopy )
     {
-        HostCopy( device, *m_image, mipChain, std::unique_ptr<Bitmap>(), &bitmap, td );
+        HostCopy( device, *m_image, builder, bitmap );
     }
     else
     {
-        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufsize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( builder.Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        builder.Build( bitmap, stagingBuffer->Ptr() );
+        stagingBuffer->Flush();
 
-        FillStagingBuffer( mipChain, std::unique_ptr<Bitmap>(), &bitmap, stagingBuffer, td );
-        Upload( device, mipChain, std::move( stagingBuffer ), fencesOut );
+        Upload( device, GetMipChain( builder ), std::move( stagingBuffer ), fencesOut );
     }
 }
 
@@ -299,9 +257,8 @@ Texture::Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, b
     ZoneScoped;
 
     const bool half = format == VK_FORMAT_R16G16B16A16_SFLOAT;
-    uint64_t bufsize;
-    const auto mipChain = GetMipChain( mips, bitmap.Width(), bitmap.Height(), half ? 8 : 16, bufsize );
-    const auto mipLevels = (uint32_t)mipChain.size();
+    const MipChainBuilder builder( bitmap.Width(), bitmap.Height(), half ? 8 : 16, mips, td );
+    const auto mipLevels = (uint32_t)builder.Levels().size();
     const auto hostImageCopy = device.UseHostImageCopy();
 
     m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, bitmap.Width(), bitmap.Height(), mipLevels, hostImageCopy ) );
@@ -309,39 +266,85 @@ Texture::Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, b
 
     if( hostImageCopy )
     {
-        if( half )
-        {
-            auto tmp = std::make_unique<BitmapHdrHalf>( bitmap );
-            auto bmpptr = tmp.get();
-            HostCopy( device, *m_image, mipChain, std::move( tmp ), bmpptr, td );
-        }
-        else
-        {
-            HostCopy( device, *m_image, mipChain, std::unique_ptr<BitmapHdr>(), &bitmap, td );
-        }
+        HostCopy( device, *m_image, builder, bitmap );
     }
     else
     {
-        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufsize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( builder.Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        builder.Build( bitmap, stagingBuffer->Ptr() );
+        stagingBuffer->Flush();
 
-        if( half )
-        {
-            auto tmp = std::make_unique<BitmapHdrHalf>( bitmap );
-            auto bmpptr = tmp.get();
-            FillStagingBuffer( mipChain, std::move( tmp ), bmpptr, stagingBuffer, td );
-        }
-        else
+        Upload( device, GetMipChain( builder ), std::move( stagingBuffer ), fencesOut );
+    }
+}
+
+Texture::Texture( VlkDevice& device, std::shared_ptr<CompressedBitmap> bitmap, VkFormat format, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+    : m_format( format )
+    , m_width( bitmap->Width() )
+    , m_height( bitmap->Height() )
+    , m_compressed( std::move( bitmap ) )
+{
+    ZoneScoped;
+
+    const auto& levels = m_compressed->Levels();
+    const auto mipLevels = (uint32_t)levels.size();
+    const auto hostImageCopy = device.UseHostImageCopy();
+
+    m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, m_width, m_height, mipLevels, hostImageCopy ) );
+    m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, format, mipLevels ) );
+
+    // Block data is copied straight from the file mapping, without decoding
+    if( hostImageCopy )
+    {
+        for( uint32_t level = 0; level < mipLevels; level++ )
         {
-            FillStagingBuffer( mipChain, std::unique_ptr<BitmapHdr>(), &bitmap, stagingBuffer, td );
+            HostCopyLevel( device, *m_image, level, levels[level].width, levels[level].height, m_compressed->Data() + levels[level].offset );
         }
+    }
+    else
+    {
+        std::vector<MipData> mipChain;
+        mipChain.reserve( mipLevels );
+        for( auto& level : levels ) mipChain.emplace_back( level.width, level.height, level.offset, level.size );
+
+        const auto bufsize = m_compressed->Size();
+        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufsize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        memcpy( stagingBuffer->Ptr(), m_compressed->Data(), bufsize );
+        stagingBuffer->Flush();
 
         Upload( device, mipChain, std::move( stagingBuffer ), fencesOut );
     }
 }
 
+VkFormat Texture::CompressedFormat( const VlkDevice& device, CompressedBitmap::Format format )
+{
+    // Only formats with sRGB variants are uploaded as is. Single and dual channel formats would
+    // be sampled as linear values, while decoded images are displayed as sRGB.
+    VkFormat vkFormat;
+    switch( format )
+    {
+    case CompressedBitmap::Format::Bc1: vkFormat = VK_FORMAT_BC1_RGB_SRGB_BLOCK; break;
+    case CompressedBitmap::Format::Bc3: vkFormat = VK_FORMAT_BC3_SRGB_BLOCK; break;
+    case CompressedBitmap::Format::Bc7: vkFormat = VK_FORMAT_BC7_SRGB_BLOCK; break;
+    case CompressedBitmap::Format::Etc1:
+    case CompressedBitmap::Format::Etc2Rgb: vkFormat = VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK; break;
+    case CompressedBitmap::Format::Etc2Rgba: vkFormat = VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK; break;
+    default: return VK_FORMAT_UNDEFINED;
+    }
+
+    const VkFormatFeatureFlags2 features = VK_FORMAT_FEATURE_2_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_2_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+        ( device.UseHostImageCopy() ? VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT : ( VK_FORMAT_FEATURE_2_TRANSFER_DST_BIT | VK_FORMAT_FEATURE_2_TRANSFER_SRC_BIT ) );
+    if( !device.GetPhysicalDevice()->SupportsFormat( vkFormat, features ) ) return VK_FORMAT_UNDEFINED;
+    return vkFormat;
+}
+
 std::shared_ptr<Bitmap> Texture::ReadbackSdr( VlkDevice& device ) const
 {
     ZoneScoped;
+
+    // Texture contents are the same as the source data, which is still mapped
+    if( m_compressed ) return m_compressed->Decode();
+
     CheckPanic( m_format == VK_FORMAT_R8G8B8A8_SRGB, "Texture format must be VK_FORMAT_R8G8B8A8_SRGB." );
 
     const auto bufSize = m_width * m_height * 4;
@@ -4,6 +4,7 @@
 #include <vector>
 #include <vulkan/vulkan.h>
 
+#include "util/CompressedBitmap.hpp"
 #include "util/NoCopy.hpp"
 #include "vulkan/VlkBase.hpp"
 #include "vulkan/VlkImage.hpp"
@@ -23,8 +24,12 @@ class Texture : public VlkBase
 public:
     Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, bool mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
     Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, bool mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
+    Texture( VlkDevice& device, std::shared_ptr<CompressedBitmap> bitmap, VkFormat format, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
     NoCopy( Texture );
 
+    // Texture format for uploading compressed data as is, or VK_FORMAT_UNDEFINED if the data must be decoded.
+    [[nodiscard]] static VkFormat CompressedFormat( const VlkDevice& device, CompressedBitmap::Format format );
+
     std::shared_ptr<Bitmap> ReadbackSdr( VlkDevice& device ) const;
     std::shared_ptr<BitmapHdrHalf> ReadbackHdr( VlkDevice& device ) const;
 
@@ -46,4 +51,6 @@ private:
 
     VkFormat m_format;
     uint32_t m_width, m_height;
+
+    std::shared_ptr<CompressedBitmap> m_compressed;
 };
@@ -0,0 +1,192 @@
+#include <catch2/catch_all.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <src/cursor/CursorCache.hpp>
+#include <src/cursor/XCursor.hpp>
+#include <src/util/Bitmap.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <tests/util/TestUtils.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+struct Image
+{
+    uint32_t size;
+    uint32_t xhot;
+    uint32_t yhot;
+    uint32_t delay;
+    uint8_t fill;
+};
+
+void Put( std::string& out, uint32_t value )
+{
+    out.append( (const char*)&value, sizeof( value ) );
+}
+
+void WriteXCursor( const std::string& path, const std::vector<Image>& images )
+{
+    std::string data = "Xcur";
+    Put( data, 16 );
+    Put( data, 0x10000 );
+    Put( data, (uint32_t)images.size() );
+
+    uint32_t pos = 16 + 12 * images.size();
+    for( auto& v : images )
+    {
+        Put( data, 0xfffd0002 );
+        Put( data, v.size );
+        Put( data, pos );
+        pos += 36 + v.size * v.size * 4;
+    }
+    for( auto& v : images )
+    {
+        Put( data, 36 );
+        Put( data, 0xfffd0002 );
+        Put( data, v.size );
+        Put( data, 1 );
+        for( auto val : { v.size, v.size, v.xhot, v.yhot, v.delay } ) Put( data, val );
+        for( uint32_t i=0; i<v.size*v.size; i++ ) Put( data, ( uint32_t( v.fill ) << 24 ) | ( i & 0xFFFFFF ) );
+    }
+
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    REQUIRE( fd >= 0 );
+    REQUIRE( write( fd, data.data(), data.size() ) == (ssize_t)data.size() );
+    close( fd );
+}
+
+// Cursor search paths are resolved once per process, so all tests share one icon directory
+const TempDir& IconDir()
+{
+    static TempDir dir = [] {
+        auto ret = TempDir::create();
+        setenv( "XCURSOR_PATH", ret.path(), 1 );
+        return ret;
+    }();
+    return dir;
+}
+
+std::string CreateTheme( const char* name, const char* inherits = nullptr )
+{
+    const auto themeDir = IconDir().str() + "/" + name;
+    for( auto& dir : { themeDir, themeDir + "/cursors" } )
+    {
+        REQUIRE( ( mkdir( dir.c_str(), 0755 ) == 0 || errno == EEXIST ) );
+    }
+    if( inherits )
+    {
+        const auto index = std::string( "[Icon Theme]\nInherits=" ) + inherits + "\n";
+        int fd = open( ( themeDir + "/index.theme" ).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        REQUIRE( fd >= 0 );
+        REQUIRE( write( fd, index.data(), index.size() ) == (ssize_t)index.size() );
+        close( fd );
+    }
+    return themeDir + "/cursors/";
+}
+
+void RequireSameCursors( const CursorBase& expected, const CursorBase& actual, uint32_t size )
+{
+    for( int i=0; i<(int)CursorType::NUM; i++ )
+    {
+        const auto e = expected.Get( size, (CursorType)i );
+        const auto a = actual.Get( size, (CursorType)i );
+        REQUIRE( e );
+        REQUIRE( a );
+        REQUIRE( e->bitmaps.size() == a->bitmaps.size() );
+        for( size_t j=0; j<e->bitmaps.size(); j++ )
+        {
+            auto& eb = e->bitmaps[j];
+            auto& ab = a->bitmaps[j];
+            REQUIRE( eb.xhot == ab.xhot );
+            REQUIRE( eb.yhot == ab.yhot );
+            REQUIRE( eb.bitmap->Width() == ab.bitmap->Width() );
+            REQUIRE( eb.bitmap->Height() == ab.bitmap->Height() );
+            REQUIRE( memcmp( eb.bitmap->Data(), ab.bitmap->Data(), eb.bitmap->Width() * eb.bitmap->Height() * 4 ) == 0 );
+        }
+        REQUIRE( e->frames.size() == a->frames.size() );
+        for( size_t j=0; j<e->frames.size(); j++ )
+        {
+            REQUIRE( e->frames[j].delay == a->frames[j].delay );
+            REQUIRE( e->frames[j].frame == a->frames[j].frame );
+        }
+    }
+}
+
+}
+
+TEST_CASE( "Cursor cache", "[cursor][cache]" )
+{
+    const auto cursors = CreateTheme( "cache-test", "cache-test-base" );
+    const auto baseCursors = CreateTheme( "cache-test-base" );
+
+    WriteXCursor( cursors + "left_ptr", { { 24, 1, 2, 0, 0x80 }, { 32, 3, 4, 0, 0x80 } } );
+    WriteXCursor( cursors + "pointer", { { 24, 1, 2, 0, 0x80 }, { 32, 3, 4, 0, 0x80 } } );
+    WriteXCursor( cursors + "wait", { { 24, 5, 5, 40, 0x10 }, { 24, 5, 5, 60, 0x20 }, { 32, 6, 6, 40, 0x10 }, { 32, 6, 6, 60, 0x20 } } );
+    WriteXCursor( baseCursors + "help", { { 32, 7, 7, 0, 0xFF } } );
+
+    TempDir cacheDir = TempDir::create();
+    const auto cachePath = cacheDir.str() + "/cursor.cache";
+
+    XCursor theme( "cache-test" );
+    REQUIRE( theme.Valid() );
+    REQUIRE( CursorCache::Save( cachePath, "cache-test", 30, theme ) );
+
+    SECTION( "Cached cursors match the theme" )
+    {
+        auto cache = CursorCache::Load( cachePath, "cache-test", 30 );
+        REQUIRE( cache );
+        REQUIRE( cache->FitSize( 30 ) == 32 );
+        RequireSameCursors( theme, *cache, 32 );
+        REQUIRE( cache->Get( 32, CursorType::Help )->bitmaps.front().xhot == 7 );
+        REQUIRE( cache->Get( 32, CursorType::Wait )->frames.size() == 2 );
+    }
+
+    SECTION( "Identical images are stored once" )
+    {
+        auto cache = CursorCache::Load( cachePath, "cache-test", 30 );
+        REQUIRE( cache );
+        REQUIRE( cache->Get( 32, CursorType::Default )->bitmaps.front().bitmap == cache->Get( 32, CursorType::Pointer )->bitmaps.front().bitmap );
+        REQUIRE( cache->Get( 32, CursorType::Default )->bitmaps.front().bitmap != cache->Get( 32, CursorType::Wait )->bitmaps.front().bitmap );
+    }
+
+    SECTION( "Missing cursors fall back to default" )
+    {
+        auto cache = CursorCache::Load( cachePath, "cache-test", 30 );
+        REQUIRE( cache );
+        REQUIRE( cache->Get( 32, CursorType::ZoomIn ) == cache->Get( 32, CursorType::Default ) );
+    }
+
+    SECTION( "Other theme or size is not cached" )
+    {
+        REQUIRE( !CursorCache::Load( cachePath, "cache-test", 24 ) );
+        REQUIRE( !CursorCache::Load( cachePath, "cache-test-base", 30 ) );
+    }
+
+    SECTION( "Modified theme invalidates the cache" )
+    {
+        const struct timespec times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+        REQUIRE( utimensat( AT_FDCWD, baseCursors.c_str(), times, 0 ) == 0 );
+        REQUIRE( !CursorCache::Load( cachePath, "cache-test", 30 ) );
+    }
+
+    SECTION( "Damaged cache is rejected" )
+    {
+        struct stat st;
+        REQUIRE( stat( cachePath.c_str(), &st ) == 0 );
+        for( auto size : { off_t( 0 ), off_t( 16 ), st.st_size / 2, st.st_size - 1 } )
+        {
+            REQUIRE( truncate( cachePath.c_str(), size ) == 0 );
+            REQUIRE( !CursorCache::Load( cachePath, "cache-test", 30 ) );
+        }
+    }
+
+    SECTION( "Missing cache" )
+    {
+        REQUIRE( !CursorCache::Load( cacheDir.str() + "/missing.cache", "cache-test", 30 ) );
+    }
+}
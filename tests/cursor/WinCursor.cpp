@@ -0,0 +1,422 @@
+#include <catch2/catch_all.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <src/cursor/WinCursor.hpp>
+#include <src/util/Bitmap.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <tests/util/TestUtils.hpp>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+struct Icon
+{
+    uint32_t size;
+    uint16_t bitCount;
+    uint16_t xhot;
+    uint16_t yhot;
+    uint8_t seed;
+    uint32_t colors = 0;        // written palette entries, zero for a full palette
+    bool bottomUp = true;
+};
+
+struct Ani
+{
+    std::vector<std::string> frames;
+    uint32_t displayRate = 3;
+    std::vector<uint32_t> rate;
+    std::vector<uint32_t> seq;
+    uint32_t numFrames = 0;     // frame count in the header, zero for the number of frames
+    uint32_t numSteps = 0;      // step count in the header, zero for the length of seq or rate
+};
+
+void Put( std::string& out, uint32_t value )
+{
+    out.append( (const char*)&value, sizeof( value ) );
+}
+
+void Put16( std::string& out, uint16_t value )
+{
+    out.append( (const char*)&value, sizeof( value ) );
+}
+
+uint32_t PaletteSize( const Icon& icon )
+{
+    return icon.colors ? icon.colors : 1u << icon.bitCount;
+}
+
+uint32_t PaletteColor( const Icon& icon, uint32_t idx )
+{
+    return ( idx * 0x0B0705 + icon.seed * 0x10101 ) & 0xFFFFFF;
+}
+
+uint32_t Index( const Icon& icon, uint32_t x, uint32_t y )
+{
+    return ( x * 3 + y * 5 + icon.seed ) % ( 1u << icon.bitCount );
+}
+
+uint32_t Color( const Icon& icon, uint32_t x, uint32_t y )
+{
+    return ( ( ( x * 37 + y * 11 + icon.seed ) & 0xFF ) << 24 ) | ( ( x * 0x010203 + y * 0x030201 + icon.seed ) & 0xFFFFFF );
+}
+
+bool Masked( const Icon& icon, uint32_t x, uint32_t y )
+{
+    return ( x + y * 3 + icon.seed ) % 7 == 0;
+}
+
+// Pixels the image decodes to, following the rules of the former eager loader. Palette colors
+// are opaque, 32-bit colors are premultiplied since cursor bitmaps must be.
+std::vector<uint32_t> Expected( const Icon& icon )
+{
+    std::vector<uint32_t> ret;
+    for( uint32_t y=0; y<icon.size; y++ )
+    {
+        for( uint32_t x=0; x<icon.size; x++ )
+        {
+            if( Masked( icon, x, y ) )
+            {
+                ret.emplace_back( 0 );
+            }
+            else if( icon.bitCount == 32 )
+            {
+                const auto c = Color( icon, x, y );
+                const auto a = c >> 24;
+                uint32_t px = c & 0xFF000000;
+                for( int i=0; i<3; i++ ) px |= ( ( ( c >> ( i * 8 ) ) & 0xFF ) * a + 127 ) / 255 << ( i * 8 );
+                ret.emplace_back( px );
+            }
+            else
+            {
+                const auto idx = Index( icon, x, y );
+                ret.emplace_back( ( idx < PaletteSize( icon ) ? PaletteColor( icon, idx ) : 0 ) | 0xFF000000 );
+            }
+        }
+    }
+    return ret;
+}
+
+std::string EncodeImage( const Icon& icon )
+{
+    const auto sz = icon.size;
+    std::string ret;
+    Put( ret, 40 );
+    Put( ret, sz );
+    Put( ret, icon.bottomUp ? sz * 2 : uint32_t( -int32_t( sz * 2 ) ) );
+    Put16( ret, 1 );
+    Put16( ret, icon.bitCount );
+    for( int i=0; i<4; i++ ) Put( ret, 0 );
+    Put( ret, icon.colors );
+    Put( ret, 0 );
+
+    if( icon.bitCount != 32 )
+    {
+        for( uint32_t i=0; i<PaletteSize( icon ); i++ ) Put( ret, PaletteColor( icon, i ) );
+    }
+
+    // Pixel rows are not padded, mask rows are padded to 32 bits
+    const auto row = [&]( uint32_t r ) { return icon.bottomUp ? sz - 1 - r : r; };
+    for( uint32_t r=0; r<sz; r++ )
+    {
+        const auto y = row( r );
+        if( icon.bitCount == 32 )
+        {
+            for( uint32_t x=0; x<sz; x++ ) Put( ret, Color( icon, x, y ) );
+        }
+        else
+        {
+            const auto perByte = 8 / icon.bitCount;
+            for( uint32_t x=0; x<sz; x+=perByte )
+            {
+                uint8_t byte = 0;
+                for( uint32_t i=0; i<perByte; i++ ) byte |= Index( icon, x + i, y ) << ( 8 - icon.bitCount * ( i + 1 ) );
+                ret.push_back( (char)byte );
+            }
+        }
+    }
+
+    const auto stride = ( sz + 31 ) / 32 * 4;
+    for( uint32_t r=0; r<sz; r++ )
+    {
+        std::string mask( stride, '\0' );
+        for( uint32_t x=0; x<sz; x++ )
+        {
+            if( Masked( icon, x, row( r ) ) ) mask[x / 8] |= 0x80 >> ( x % 8 );
+        }
+        ret += mask;
+    }
+    return ret;
+}
+
+std::string EncodeCursor( const std::vector<Icon>& icons )
+{
+    std::string ret;
+    Put16( ret, 0 );
+    Put16( ret, 2 );
+    Put16( ret, icons.size() );
+
+    std::string data;
+    for( auto& v : icons )
+    {
+        const auto image = EncodeImage( v );
+        ret.push_back( (char)v.size );
+        ret.push_back( (char)v.size );
+        ret.push_back( 0 );
+        ret.push_back( 0 );
+        Put16( ret, v.xhot );
+        Put16( ret, v.yhot );
+        Put( ret, image.size() );
+        Put( ret, 6 + 16 * icons.size() + data.size() );
+        data += image;
+    }
+    return ret + data;
+}
+
+std::string Chunk( const char* fourcc, const std::string& data )
+{
+    std::string ret( fourcc, 4 );
+    Put( ret, data.size() );
+    ret += data;
+    if( data.size() & 1 ) ret.push_back( 0 );
+    return ret;
+}
+
+std::string Chunk( const char* fourcc, const std::vector<uint32_t>& data )
+{
+    return Chunk( fourcc, std::string( (const char*)data.data(), data.size() * sizeof( uint32_t ) ) );
+}
+
+std::string EncodeAni( const Ani& ani )
+{
+    auto numSteps = ani.numSteps;
+    if( numSteps == 0 ) numSteps = !ani.seq.empty() ? ani.seq.size() : !ani.rate.empty() ? ani.rate.size() : ani.frames.size();
+
+    std::string anih;
+    Put( anih, 36 );
+    Put( anih, ani.numFrames ? ani.numFrames : ani.frames.size() );
+    Put( anih, numSteps );
+    for( int i=0; i<4; i++ ) Put( anih, 0 );
+    Put( anih, ani.displayRate );
+    Put( anih, 1 );
+
+    std::string body = Chunk( "anih", anih );
+    body += Chunk( "LIST", "INFO" + Chunk( "INAM", std::string( "abc" ) ) );
+    if( !ani.rate.empty() ) body += Chunk( "rate", ani.rate );
+    if( !ani.seq.empty() ) body += Chunk( "seq ", ani.seq );
+
+    std::string frames = "fram";
+    for( auto& v : ani.frames ) frames += Chunk( "icon", v );
+    body += Chunk( "LIST", frames );
+
+    std::string ret = "RIFF";
+    Put( ret, body.size() + 4 );
+    return ret + "ACON" + body;
+}
+
+// Theme search paths are resolved once per process, so all tests share one data directory
+const TempDir& DataDir()
+{
+    static TempDir dir = [] {
+        auto ret = TempDir::create();
+        setenv( "XDG_DATA_HOME", ret.path(), 1 );
+        ret.createSubdir( "ModernCore" );
+        ret.createSubdir( "ModernCore/cursors" );
+        return ret;
+    }();
+    return dir;
+}
+
+// Writes the theme.ini and cursor files of a theme, keyed by cursor name
+void CreateTheme( const char* name, const std::vector<std::pair<const char*, std::string>>& cursors )
+{
+    const auto dir = DataDir().str() + "/ModernCore/cursors/" + name + "/";
+    REQUIRE( ( mkdir( dir.c_str(), 0755 ) == 0 || errno == EEXIST ) );
+
+    std::string ini = "[Theme]\n";
+    for( auto& v : cursors )
+    {
+        const auto file = std::string( v.first ) + ".cur";
+        ini += std::string( v.first ) + " = " + file + "\n";
+
+        int fd = open( ( dir + file ).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        REQUIRE( fd >= 0 );
+        REQUIRE( write( fd, v.second.data(), v.second.size() ) == (ssize_t)v.second.size() );
+        close( fd );
+    }
+
+    int fd = open( ( dir + "theme.ini" ).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    REQUIRE( fd >= 0 );
+    REQUIRE( write( fd, ini.data(), ini.size() ) == (ssize_t)ini.size() );
+    close( fd );
+}
+
+void RequireBitmap( const CursorBitmap& bitmap, const Icon& icon )
+{
+    REQUIRE( bitmap.bitmap->Width() == icon.size );
+    REQUIRE( bitmap.bitmap->Height() == icon.size );
+    REQUIRE( bitmap.xhot == icon.xhot );
+    REQUIRE( bitmap.yhot == icon.yhot );
+
+    std::vector<uint32_t> pixels( icon.size * icon.size );
+    memcpy( pixels.data(), bitmap.bitmap->Data(), pixels.size() * 4 );
+    REQUIRE( pixels == Expected( icon ) );
+}
+
+void RequireFrames( const CursorData& data, const std::vector<std::pair<uint32_t, uint32_t>>& frames )
+{
+    REQUIRE( data.frames.size() == frames.size() );
+    for( size_t i=0; i<frames.size(); i++ )
+    {
+        REQUIRE( data.frames[i].delay == frames[i].first * 16667 );
+        REQUIRE( data.frames[i].frame == frames[i].second );
+    }
+}
+
+}
+
+TEST_CASE( "Windows cursor decoding", "[cursor][wincursor]" )
+{
+    const Icon arrow32 = { 32, 8, 1, 2, 1 };
+    const Icon arrow48 = { 48, 8, 3, 4, 2, 0, false };
+    const Icon pointer = { 32, 32, 5, 6, 3 };
+    const Icon help = { 32, 1, 7, 8, 4 };
+    const Icon text = { 32, 4, 9, 10, 5, 3 };
+    const Icon wait[] = { { 32, 4, 11, 11, 6 }, { 32, 32, 11, 11, 7 }, { 32, 8, 11, 11, 8, 16 } };
+    const Icon progress[] = { { 32, 32, 12, 12, 9 }, { 32, 32, 12, 12, 10 } };
+
+    CreateTheme( "win-decode", {
+        // The 4-bit image is skipped, only images of the highest bit count are used
+        { "Default", EncodeCursor( { arrow32, { 32, 4, 0, 0, 11 }, arrow48 } ) },
+        { "Pointer", EncodeCursor( { pointer } ) },
+        { "Help", EncodeCursor( { help } ) },
+        { "Text", EncodeCursor( { text } ) },
+        { "Wait", EncodeAni( { { EncodeCursor( { wait[0] } ), EncodeCursor( { wait[1] } ), EncodeCursor( { wait[2] } ) }, 5, { 1, 2, 3, 4 }, { 2, 0, 1, 0 } } ) },
+        { "Progress", EncodeAni( { { EncodeCursor( { progress[0] } ), EncodeCursor( { progress[1] } ) }, 4 } ) },
+    } );
+
+    WinCursor theme( "win-decode" );
+    REQUIRE( theme.Valid() );
+    REQUIRE( theme.FitSize( 30 ) == 32 );
+    REQUIRE( theme.FitSize( 44 ) == 48 );
+
+    SECTION( "Static cursors" )
+    {
+        const auto def = theme.Get( 32, CursorType::Default );
+        REQUIRE( def );
+        REQUIRE( def->bitmaps.size() == 1 );
+        RequireBitmap( def->bitmaps[0], arrow32 );
+        RequireFrames( *def, { { 0, 0 } } );
+
+        RequireBitmap( theme.Get( 32, CursorType::Pointer )->bitmaps[0], pointer );
+        RequireBitmap( theme.Get( 32, CursorType::Help )->bitmaps[0], help );
+    }
+
+    SECTION( "Short palette reads as black" )
+    {
+        const auto data = theme.Get( 32, CursorType::Text );
+        REQUIRE( data->bitmaps.size() == 1 );
+        RequireBitmap( data->bitmaps[0], text );
+    }
+
+    SECTION( "Animated cursors" )
+    {
+        const auto w = theme.Get( 32, CursorType::Wait );
+        REQUIRE( w->bitmaps.size() == 3 );
+        for( int i=0; i<3; i++ ) RequireBitmap( w->bitmaps[i], wait[i] );
+        RequireFrames( *w, { { 1, 2 }, { 2, 0 }, { 3, 1 }, { 4, 0 } } );
+
+        const auto p = theme.Get( 32, CursorType::Progress );
+        REQUIRE( p->bitmaps.size() == 2 );
+        for( int i=0; i<2; i++ ) RequireBitmap( p->bitmaps[i], progress[i] );
+        RequireFrames( *p, { { 4, 0 }, { 4, 1 } } );
+    }
+
+    SECTION( "Sizes are decoded separately" )
+    {
+        const auto def = theme.Get( 48, CursorType::Default );
+        REQUIRE( def );
+        REQUIRE( def->bitmaps.size() == 1 );
+        RequireBitmap( def->bitmaps[0], arrow48 );
+
+        // Cursors without this size fall back to the default one
+        REQUIRE( theme.Get( 48, CursorType::Pointer ) == def );
+        REQUIRE( theme.Get( 48, CursorType::Wait ) == def );
+        REQUIRE( !theme.Get( 24, CursorType::Default ) );
+    }
+}
+
+TEST_CASE( "Windows cursor validation", "[cursor][wincursor]" )
+{
+    const Icon icon = { 32, 8, 1, 1, 1 };
+    const auto cur = EncodeCursor( { icon } );
+    const std::vector<std::string> frames = { cur, EncodeCursor( { { 32, 8, 1, 1, 2 } } ) };
+
+    auto hugePalette = icon;
+    hugePalette.colors = 300;
+
+    auto tooManyIcons = cur;
+    tooManyIcons[4] = tooManyIcons[5] = (char)0xFF;
+
+    // Frame table of a cursor that is cut after the second frame
+    Ani missingFrame = { frames };
+    missingFrame.numFrames = 3;
+
+    Ani shortSeq = { frames, 3, {}, { 0, 1, 0 } };
+    shortSeq.numSteps = 4;
+
+    Ani shortRate = { frames, 3, { 1, 2 }, { 0, 1, 0 } };
+    shortRate.numSteps = 3;
+
+    CreateTheme( "win-invalid", {
+        { "Default", cur },
+        { "Pointer", cur.substr( 0, 22 + 40 + 100 ) },          // palette cut short
+        { "Help", EncodeCursor( { hugePalette } ) },
+        { "Text", cur.substr( 0, cur.size() - 1 ) },            // mask cut short
+        { "Wait", tooManyIcons },
+        { "Progress", EncodeAni( missingFrame ) },
+        { "Cell", EncodeAni( shortSeq ) },
+        { "Crosshair", EncodeAni( shortRate ) },
+        { "Alias", EncodeAni( { frames, 3, {}, { 0, 2 } } ) },  // sequence refers to a missing frame
+        { "Copy", EncodeAni( { frames, 3, { 1, 2, 3 } } ) },    // rate without sequence must match the frames
+        { "Move", EncodeAni( { frames, 3, { 1, 2 }, { 1, 0 } } ) },
+    } );
+
+    WinCursor theme( "win-invalid" );
+    REQUIRE( theme.Valid() );
+
+    // Rejected cursors are not indexed, and fall back to the default one
+    const auto def = theme.Get( 32, CursorType::Default );
+    REQUIRE( def );
+    RequireBitmap( def->bitmaps[0], icon );
+    for( auto type : { CursorType::Pointer, CursorType::Help, CursorType::Text, CursorType::Wait, CursorType::Progress, CursorType::Cell, CursorType::Crosshair, CursorType::Alias, CursorType::Copy } )
+    {
+        INFO( (int)type );
+        REQUIRE( theme.Get( 32, type ) == def );
+    }
+
+    // Valid animation, for reference
+    const auto move = theme.Get( 32, CursorType::Move );
+    REQUIRE( move != def );
+    REQUIRE( move->bitmaps.size() == 2 );
+    RequireFrames( *move, { { 1, 1 }, { 2, 0 } } );
+}
+
+TEST_CASE( "Windows cursor theme without a valid default cursor", "[cursor][wincursor]" )
+{
+    const auto cur = EncodeCursor( { { 32, 8, 1, 1, 1 } } );
+
+    CreateTheme( "win-broken", {
+        { "Default", cur.substr( 0, cur.size() / 2 ) },
+        { "Pointer", cur },
+    } );
+
+    REQUIRE( !WinCursor( "win-broken" ).Valid() );
+    REQUIRE( !WinCursor( "win-missing" ).Valid() );
+}
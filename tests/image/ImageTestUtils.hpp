@@ -0,0 +1,107 @@
+#pragma once
+
+#include <catch2/catch_all.hpp>
+#include <jpeglib.h>
+#include <src/util/Bitmap.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+// Quadrant colors, clockwise from the top left
+enum : uint32_t
+{
+    QuadRed = 0xFF0000FF,
+    QuadGreen = 0xFF00FF00,
+    QuadWhite = 0xFFFFFFFF,
+    QuadBlue = 0xFFFF0000
+};
+
+// RGB image with red, green, white and blue quadrants, clockwise from the top left
+inline std::vector<uint8_t> QuadrantImage( uint32_t width, uint32_t height )
+{
+    std::vector<uint8_t> ret;
+    ret.reserve( size_t( width ) * height * 3 );
+    for( uint32_t y=0; y<height; y++ )
+    {
+        for( uint32_t x=0; x<width; x++ )
+        {
+            const bool right = x >= width / 2;
+            const bool bottom = y >= height / 2;
+            const auto color = bottom ? ( right ? QuadWhite : QuadBlue ) : ( right ? QuadGreen : QuadRed );
+            ret.push_back( color & 0xFF );
+            ret.push_back( ( color >> 8 ) & 0xFF );
+            ret.push_back( ( color >> 16 ) & 0xFF );
+        }
+    }
+    return ret;
+}
+
+// Baseline JPEG, with an EXIF orientation tag if orientation is not zero
+inline std::vector<uint8_t> EncodeJpeg( const std::vector<uint8_t>& rgb, uint32_t width, uint32_t height, int orientation = 0 )
+{
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error( &jerr );
+    jpeg_create_compress( &cinfo );
+
+    unsigned char* out = nullptr;
+    unsigned long outSize = 0;
+    jpeg_mem_dest( &cinfo, &out, &outSize );
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults( &cinfo );
+    jpeg_set_quality( &cinfo, 95, TRUE );
+    jpeg_start_compress( &cinfo, TRUE );
+
+    if( orientation != 0 )
+    {
+        // Little endian TIFF with one IFD entry
+        const uint8_t exif[] = {
+            'E', 'x', 'i', 'f', 0, 0,
+            'I', 'I', 42, 0, 8, 0, 0, 0,
+            1, 0,
+            0x12, 0x01, 3, 0, 1, 0, 0, 0, uint8_t( orientation ), 0, 0, 0,
+            0, 0, 0, 0
+        };
+        jpeg_write_marker( &cinfo, JPEG_APP0 + 1, exif, sizeof( exif ) );
+    }
+
+    while( cinfo.next_scanline < height )
+    {
+        auto row = (JSAMPROW)rgb.data() + size_t( cinfo.next_scanline ) * width * 3;
+        jpeg_write_scanlines( &cinfo, &row, 1 );
+    }
+    jpeg_finish_compress( &cinfo );
+    jpeg_destroy_compress( &cinfo );
+
+    std::vector<uint8_t> ret( out, out + outSize );
+    free( out );
+    return ret;
+}
+
+// Checks the center of each quadrant of an upright bitmap, clockwise from the top left
+inline void RequireQuadrants( const Bitmap& bmp, uint32_t tl, uint32_t tr, uint32_t br, uint32_t bl )
+{
+    REQUIRE( bmp.Orientation() <= 1 );
+
+    const auto w = bmp.Width();
+    const auto h = bmp.Height();
+    const struct { uint32_t x, y, color; } samples[] = {
+        { w / 4, h / 4, tl },
+        { w * 3 / 4, h / 4, tr },
+        { w * 3 / 4, h * 3 / 4, br },
+        { w / 4, h * 3 / 4, bl }
+    };
+    for( auto& s : samples )
+    {
+        auto px = bmp.Data() + ( size_t( s.y ) * w + s.x ) * 4;
+        for( int c=0; c<3; c++ )
+        {
+            const int expected = ( s.color >> ( c * 8 ) ) & 0xFF;
+            REQUIRE( abs( px[c] - expected ) < 48 );
+        }
+    }
+}
@@ -0,0 +1,127 @@
+#include "ImageTestUtils.hpp"
+#include <catch2/catch_all.hpp>
+#include <src/image/ImageLoader.hpp>
+#include <src/image/JpgLoader.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/DataBuffer.hpp>
+#include <src/util/FileWrapper.hpp>
+#include <tests/util/TestUtils.hpp>
+
+namespace
+{
+
+std::shared_ptr<DataBuffer> MakeBuffer( const std::vector<uint8_t>& data )
+{
+    return std::make_shared<DataBuffer>( (const char*)data.data(), data.size() );
+}
+
+}
+
+TEST_CASE( "JPEG loading", "[image][jpeg]" )
+{
+    const auto jpg = EncodeJpeg( QuadrantImage( 64, 32 ), 64, 32 );
+
+    SECTION( "Load from memory" )
+    {
+        JpgLoader loader( MakeBuffer( jpg ), nullptr );
+        REQUIRE( loader.IsValid() );
+        auto bmp = loader.Load();
+        REQUIRE( bmp );
+        REQUIRE( bmp->Width() == 64 );
+        REQUIRE( bmp->Height() == 32 );
+        RequireQuadrants( *bmp, QuadRed, QuadGreen, QuadWhite, QuadBlue );
+    }
+
+    SECTION( "Load from file" )
+    {
+        auto tmp = TempFile::create( (const char*)jpg.data(), jpg.size() );
+        auto loader = GetImageLoader( tmp.path(), ToneMap::Operator::PbrNeutral );
+        REQUIRE( loader );
+        auto bmp = loader->Load();
+        REQUIRE( bmp );
+        REQUIRE( bmp->Width() == 64 );
+        REQUIRE( bmp->Height() == 32 );
+        RequireQuadrants( *bmp, QuadRed, QuadGreen, QuadWhite, QuadBlue );
+    }
+
+    SECTION( "Memory loader lookup" )
+    {
+        auto loader = GetImageLoader( MakeBuffer( jpg ), ToneMap::Operator::PbrNeutral );
+        REQUIRE( loader );
+        REQUIRE( loader->Load() );
+    }
+
+    SECTION( "Invalid data" )
+    {
+        const std::vector<uint8_t> data = { 'n', 'o', 't', ' ', 'j', 'p', 'e', 'g' };
+        JpgLoader loader( MakeBuffer( data ), nullptr );
+        REQUIRE( !loader.IsValid() );
+        REQUIRE( !JpgLoader( MakeBuffer( {} ), nullptr ).IsValid() );
+    }
+}
+
+TEST_CASE( "JPEG size hint", "[image][jpeg]" )
+{
+    const auto jpg = EncodeJpeg( QuadrantImage( 64, 32 ), 64, 32 );
+
+    const struct { uint32_t targetWidth, targetHeight, width, height; } cases[] = {
+        { 0, 0, 64, 32 },
+        { 100, 100, 64, 32 },
+        { 40, 40, 64, 32 },
+        { 32, 16, 32, 16 },
+        { 20, 10, 32, 16 },
+        { 16, 8, 16, 8 },
+        { 1, 1, 8, 4 }
+    };
+    for( auto& c : cases )
+    {
+        JpgLoader loader( MakeBuffer( jpg ), nullptr );
+        auto bmp = loader.LoadScaled( c.targetWidth, c.targetHeight );
+        REQUIRE( bmp );
+        REQUIRE( bmp->Width() == c.width );
+        REQUIRE( bmp->Height() == c.height );
+        RequireQuadrants( *bmp, QuadRed, QuadGreen, QuadWhite, QuadBlue );
+    }
+}
+
+TEST_CASE( "JPEG orientation", "[image][jpeg]" )
+{
+    const auto jpg = EncodeJpeg( QuadrantImage( 64, 32 ), 64, 32, 6 );
+
+    SECTION( "Orientation is applied lazily" )
+    {
+        JpgLoader loader( MakeBuffer( jpg ), nullptr );
+        auto bmp = loader.Load();
+        REQUIRE( bmp );
+        REQUIRE( bmp->Orientation() == 6 );
+        REQUIRE( bmp->Width() == 64 );
+        REQUIRE( bmp->OrientedWidth() == 32 );
+        bmp->NormalizeOrientation();
+        REQUIRE( bmp->Width() == 32 );
+        REQUIRE( bmp->Height() == 64 );
+        RequireQuadrants( *bmp, QuadBlue, QuadRed, QuadGreen, QuadWhite );
+    }
+
+    SECTION( "Size hint uses upright dimensions" )
+    {
+        JpgLoader loader( MakeBuffer( jpg ), nullptr );
+        auto bmp = loader.LoadScaled( 8, 16 );
+        REQUIRE( bmp );
+        REQUIRE( bmp->OrientedWidth() == 8 );
+        REQUIRE( bmp->OrientedHeight() == 16 );
+        bmp->NormalizeOrientation();
+        RequireQuadrants( *bmp, QuadBlue, QuadRed, QuadGreen, QuadWhite );
+    }
+
+    SECTION( "Orientation override replaces the EXIF tag" )
+    {
+        JpgLoader loader( MakeBuffer( jpg ), nullptr );
+        loader.SetOrientation( 1 );
+        auto bmp = loader.LoadScaled( 32, 16 );
+        REQUIRE( bmp );
+        REQUIRE( bmp->Orientation() <= 1 );
+        REQUIRE( bmp->Width() == 32 );
+        REQUIRE( bmp->Height() == 16 );
+        RequireQuadrants( *bmp, QuadRed, QuadGreen, QuadWhite, QuadBlue );
+    }
+}
@@ -0,0 +1,168 @@
+#include "ImageTestUtils.hpp"
+#include <catch2/catch_all.hpp>
+#include <src/image/RawLoader.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/FileWrapper.hpp>
+#include <stdint.h>
+#include <tests/util/TestUtils.hpp>
+#include <vector>
+
+namespace
+{
+
+constexpr uint32_t RawWidth = 128;
+constexpr uint32_t RawHeight = 64;
+
+enum : uint16_t
+{
+    Byte = 1,
+    Short = 3,
+    Long = 4
+};
+
+struct IfdEntry
+{
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    uint32_t value;
+};
+
+void Put( std::vector<uint8_t>& out, uint16_t value )
+{
+    out.push_back( value & 0xFF );
+    out.push_back( value >> 8 );
+}
+
+void Put( std::vector<uint8_t>& out, uint32_t value )
+{
+    Put( out, uint16_t( value & 0xFFFF ) );
+    Put( out, uint16_t( value >> 16 ) );
+}
+
+void PutIfd( std::vector<uint8_t>& out, const std::vector<IfdEntry>& entries )
+{
+    Put( out, uint16_t( entries.size() ) );
+    for( auto& e : entries )
+    {
+        Put( out, e.tag );
+        Put( out, e.type );
+        Put( out, e.count );
+        Put( out, e.value );
+    }
+    Put( out, uint32_t( 0 ) );
+}
+
+constexpr uint32_t IfdSize( uint32_t entries ) { return 2 + entries * 12 + 4; }
+
+// DNG with a JPEG preview in IFD0 and an uncompressed 16 bit RGGB mosaic in its SubIFD
+std::vector<uint8_t> MakeDng( const std::vector<uint8_t>& preview, int orientation )
+{
+    constexpr uint32_t Ifd0 = 8;
+    constexpr uint32_t Ifd0Entries = 6;
+    constexpr uint32_t SubIfd = Ifd0 + IfdSize( Ifd0Entries );
+    constexpr uint32_t SubIfdEntries = 13;
+    constexpr uint32_t PreviewOffset = SubIfd + IfdSize( SubIfdEntries );
+    const uint32_t rawOffset = ( PreviewOffset + preview.size() + 1 ) & ~1;
+    const uint32_t rawSize = RawWidth * RawHeight * 2;
+
+    std::vector<uint8_t> out = { 'I', 'I', 42, 0 };
+    Put( out, Ifd0 );
+
+    PutIfd( out, {
+        { 254, Long, 1, 1 },                        // NewSubFileType: preview
+        { 274, Short, 1, uint32_t( orientation ) }, // Orientation
+        { 330, Long, 1, SubIfd },                   // SubIFDs
+        { 513, Long, 1, PreviewOffset },            // JPEGInterchangeFormat
+        { 514, Long, 1, uint32_t( preview.size() ) },
+        { 50706, Byte, 4, 0x0401 }                  // DNGVersion 1.4
+    } );
+    PutIfd( out, {
+        { 254, Long, 1, 0 },
+        { 256, Long, 1, RawWidth },
+        { 257, Long, 1, RawHeight },
+        { 258, Short, 1, 16 },                      // BitsPerSample
+        { 259, Short, 1, 1 },                       // Compression: none
+        { 262, Short, 1, 32803 },                   // PhotometricInterpretation: CFA
+        { 273, Long, 1, rawOffset },                // StripOffsets
+        { 274, Short, 1, uint32_t( orientation ) },
+        { 277, Short, 1, 1 },                       // SamplesPerPixel
+        { 278, Long, 1, RawHeight },                // RowsPerStrip
+        { 279, Long, 1, rawSize },                  // StripByteCounts
+        { 33421, Short, 2, 0x00020002 },            // CFARepeatPatternDim 2x2
+        { 33422, Byte, 4, 0x02010100 }              // CFAPattern RGGB
+    } );
+    REQUIRE( out.size() == PreviewOffset );
+
+    out.insert( out.end(), preview.begin(), preview.end() );
+    out.resize( rawOffset );
+    for( uint32_t i=0; i<RawWidth*RawHeight; i++ ) Put( out, uint16_t( 0x3000 ) );
+    return out;
+}
+
+std::unique_ptr<Bitmap> LoadDng( const std::vector<uint8_t>& dng, uint32_t targetWidth, uint32_t targetHeight )
+{
+    auto tmp = TempFile::create( (const char*)dng.data(), dng.size() );
+    RawLoader loader( std::make_shared<FileWrapper>( tmp.path(), "rb" ) );
+    REQUIRE( loader.IsValid() );
+    return loader.LoadScaled( targetWidth, targetHeight );
+}
+
+}
+
+TEST_CASE( "RAW embedded preview", "[image][raw]" )
+{
+    const auto preview = EncodeJpeg( QuadrantImage( 64, 32 ), 64, 32 );
+
+    SECTION( "Upright" )
+    {
+        auto bmp = LoadDng( MakeDng( preview, 1 ), 16, 8 );
+        REQUIRE( bmp );
+        REQUIRE( bmp->Orientation() <= 1 );
+        REQUIRE( bmp->Width() == 16 );
+        REQUIRE( bmp->Height() == 8 );
+        RequireQuadrants( *bmp, QuadRed, QuadGreen, QuadWhite, QuadBlue );
+    }
+
+    // LibRaw writes the orientation into the preview's EXIF data, which must not rotate it again
+    SECTION( "Rotated 90 degrees" )
+    {
+        auto bmp = LoadDng( MakeDng( preview, 6 ), 8, 16 );
+        REQUIRE( bmp );
+        REQUIRE( bmp->OrientedWidth() == 8 );
+        REQUIRE( bmp->OrientedHeight() == 16 );
+        bmp->NormalizeOrientation();
+        RequireQuadrants( *bmp, QuadBlue, QuadRed, QuadGreen, QuadWhite );
+    }
+
+    SECTION( "Rotated 180 degrees" )
+    {
+        auto bmp = LoadDng( MakeDng( preview, 3 ), 16, 8 );
+        REQUIRE( bmp );
+        REQUIRE( bmp->OrientedWidth() == 16 );
+        REQUIRE( bmp->OrientedHeight() == 8 );
+        bmp->NormalizeOrientation();
+        RequireQuadrants( *bmp, QuadWhite, QuadBlue, QuadRed, QuadGreen );
+    }
+
+    SECTION( "Rotated 270 degrees" )
+    {
+        auto bmp = LoadDng( MakeDng( preview, 8 ), 8, 16 );
+        REQUIRE( bmp );
+        REQUIRE( bmp->OrientedWidth() == 8 );
+        REQUIRE( bmp->OrientedHeight() == 16 );
+        bmp->NormalizeOrientation();
+        RequireQuadrants( *bmp, QuadGreen, QuadWhite, QuadBlue, QuadRed );
+    }
+}
+
+TEST_CASE( "RAW size hint without a usable preview", "[image][raw]" )
+{
+    // Preview is too small for the target, so the RAW data is processed at half size
+    const auto preview = EncodeJpeg( QuadrantImage( 16, 8 ), 16, 8 );
+    auto bmp = LoadDng( MakeDng( preview, 6 ), 32, 64 );
+    REQUIRE( bmp );
+    REQUIRE( bmp->Orientation() <= 1 );
+    REQUIRE( bmp->Width() == RawHeight / 2 );
+    REQUIRE( bmp->Height() == RawWidth / 2 );
+}
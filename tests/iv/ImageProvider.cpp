@@ -0,0 +1,250 @@
+#include <catch2/catch_all.hpp>
+#include <condition_variable>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <src/tools/iv/ImageProvider.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/Config.hpp>
+#include <src/util/PngEncoder.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include <tests/util/TestUtils.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+constexpr uint32_t Size = 64;
+constexpr size_t ImageBytes = Size * Size * 4;
+
+std::string WritePng( const TempDir& dir, const char* name, uint32_t color )
+{
+    const auto path = dir.filePath( name );
+    std::vector<uint32_t> pixels( Size * Size, color );
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    REQUIRE( fd >= 0 );
+    REQUIRE( PngEncoder::Write( fd, pixels.data(), Size, Size ) );
+    close( fd );
+    return path;
+}
+
+void SetMtime( const std::string& path, time_t sec )
+{
+    const struct timespec times[2] = { { sec, 0 }, { sec, 0 } };
+    REQUIRE( utimensat( AT_FDCWD, path.c_str(), times, 0 ) == 0 );
+}
+
+// Issues a load and waits for its callback
+class Loader
+{
+public:
+    explicit Loader( ImageProvider& provider ) : m_provider( provider ) {}
+
+    std::shared_ptr<Bitmap> Load( const std::string& path )
+    {
+        std::unique_lock lock( m_lock );
+        m_done = false;
+        m_provider.LoadImage( path.c_str(), false, Callback, this );
+        m_cv.wait( lock, [this] { return m_done; } );
+        REQUIRE( m_result == ImageProvider::Result::Success );
+        REQUIRE( m_bitmap );
+        return m_bitmap;
+    }
+
+    ImageProvider::Result LoadResult( const std::string& path )
+    {
+        std::unique_lock lock( m_lock );
+        m_done = false;
+        m_provider.LoadImage( path.c_str(), false, Callback, this );
+        m_cv.wait( lock, [this] { return m_done; } );
+        return m_result;
+    }
+
+private:
+    static void Callback( void* ptr, int64_t, ImageProvider::Result result, ImageProvider::ReturnData data )
+    {
+        auto self = (Loader*)ptr;
+        std::lock_guard lock( self->m_lock );
+        self->m_result = result;
+        self->m_bitmap = std::move( data.bitmap );
+        self->m_done = true;
+        self->m_cv.notify_one();
+    }
+
+    ImageProvider& m_provider;
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    bool m_done = false;
+    ImageProvider::Result m_result;
+    std::shared_ptr<Bitmap> m_bitmap;
+};
+
+}
+
+TEST_CASE( "Image cache", "[iv][cache]" )
+{
+    TaskDispatch td( 2, "Worker" );
+    TempDir dir = TempDir::create();
+    const auto a = WritePng( dir, "a.png", 0xFF0000FF );
+    const auto b = WritePng( dir, "b.png", 0xFF00FF00 );
+    const auto c = WritePng( dir, "c.png", 0xFFFF0000 );
+
+    SECTION( "Cached image is returned" )
+    {
+        ImageProvider provider( td, ImageBytes * 2 );
+        Loader loader( provider );
+        auto bmp = loader.Load( a );
+        REQUIRE( bmp->Width() == Size );
+        REQUIRE( bmp->Height() == Size );
+        REQUIRE( loader.Load( a ) == bmp );
+    }
+
+    SECTION( "Disabled cache" )
+    {
+        ImageProvider provider( td );
+        Loader loader( provider );
+        auto bmp = loader.Load( a );
+        REQUIRE( loader.Load( a ) != bmp );
+    }
+
+    SECTION( "Least recently used image is evicted" )
+    {
+        ImageProvider provider( td, ImageBytes * 2 );
+        Loader loader( provider );
+        auto bmpA = loader.Load( a );
+        auto bmpB = loader.Load( b );
+        REQUIRE( loader.Load( a ) == bmpA );
+
+        // B is now the least recently used one
+        loader.Load( c );
+        REQUIRE( loader.Load( a ) == bmpA );
+        REQUIRE( loader.Load( b ) != bmpB );
+    }
+
+    SECTION( "Images larger than the cache are not kept" )
+    {
+        ImageProvider provider( td, ImageBytes - 1 );
+        Loader loader( provider );
+        auto bmp = loader.Load( a );
+        REQUIRE( loader.Load( a ) != bmp );
+    }
+
+    SECTION( "Modified file is loaded again" )
+    {
+        ImageProvider provider( td, ImageBytes * 2 );
+        Loader loader( provider );
+        SetMtime( a, 1000000000 );
+        auto bmp = loader.Load( a );
+        REQUIRE( loader.Load( a ) == bmp );
+
+        WritePng( dir, "a.png", 0xFFFFFFFF );
+        SetMtime( a, 1000000001 );
+        auto modified = loader.Load( a );
+        REQUIRE( modified != bmp );
+        REQUIRE( *(const uint32_t*)modified->Data() == 0xFFFFFFFF );
+        REQUIRE( loader.Load( a ) == modified );
+    }
+
+    SECTION( "Deleted file is not returned from the cache" )
+    {
+        ImageProvider provider( td, ImageBytes * 2 );
+        Loader loader( provider );
+        loader.Load( a );
+        REQUIRE( unlink( a.c_str() ) == 0 );
+        REQUIRE( loader.LoadResult( a ) == ImageProvider::Result::Error );
+    }
+
+    SECTION( "Prefetched images are loaded" )
+    {
+        ImageProvider provider( td, ImageBytes * 3 );
+        Loader loader( provider );
+        provider.Prefetch( a.c_str(), false );
+        provider.Prefetch( b.c_str(), false );
+        provider.Prefetch( c.c_str(), false );
+
+        // Loading an image that is being prefetched waits for it, or runs before it was started
+        auto bmpB = loader.Load( b );
+        REQUIRE( *(const uint32_t*)bmpB->Data() == 0xFF00FF00 );
+        REQUIRE( loader.Load( b ) == bmpB );
+        REQUIRE( *(const uint32_t*)loader.Load( a )->Data() == 0xFF0000FF );
+        REQUIRE( *(const uint32_t*)loader.Load( c )->Data() == 0xFFFF0000 );
+        REQUIRE( loader.Load( b ) == bmpB );
+    }
+
+    SECTION( "Cancelled prefetches" )
+    {
+        ImageProvider provider( td, ImageBytes * 3 );
+        Loader loader( provider );
+        for( int i=0; i<8; i++ ) provider.Cancel( provider.Prefetch( a.c_str(), false ) );
+        provider.Prefetch( b.c_str(), false );
+        provider.CancelAll();
+        auto bmp = loader.Load( a );
+        REQUIRE( loader.Load( a ) == bmp );
+    }
+}
+
+TEST_CASE( "Image cache config", "[iv][cache][config]" )
+{
+    EnvGuard xdgGuard( "XDG_CONFIG_HOME" );
+    TempDir configDir = TempDir::create();
+    configDir.createSubdir( "ModernCore" );
+    xdgGuard.Set( configDir.path() );
+
+    const auto writeConfig = [&]( const char* content ) {
+        auto f = fopen( ( configDir.str() + "/ModernCore/iv.ini" ).c_str(), "w" );
+        REQUIRE( f );
+        fputs( content, f );
+        fclose( f );
+    };
+
+    SECTION( "Defaults" )
+    {
+        Config cfg( "iv.ini" );
+        ImageProvider::CacheConfig cache( cfg );
+        REQUIRE( cache.size == 512 );
+        REQUIRE( cache.prefetch == 2 );
+    }
+
+    SECTION( "Defaults for missing keys" )
+    {
+        writeConfig( "[Window]\nWidth = 800\n\n[Cache]\nPrefetch = 4\n" );
+        Config cfg( "iv.ini" );
+        ImageProvider::CacheConfig cache( cfg );
+        REQUIRE( cache.size == 512 );
+        REQUIRE( cache.prefetch == 4 );
+    }
+
+    SECTION( "Values are read" )
+    {
+        writeConfig( "[Cache]\nSize = 128\nPrefetch = 0\n" );
+        Config cfg( "iv.ini" );
+        ImageProvider::CacheConfig cache( cfg );
+        REQUIRE( cache.size == 128 );
+        REQUIRE( cache.prefetch == 0 );
+    }
+
+    SECTION( "Written values are read back" )
+    {
+        ImageProvider::CacheConfig cache;
+        cache.size = 1024;
+        cache.prefetch = 5;
+
+        auto f = fopen( ( configDir.str() + "/ModernCore/iv.ini" ).c_str(), "w" );
+        REQUIRE( f );
+        fprintf( f, "[Window]\nWidth = 800\n\n" );
+        cache.Write( f );
+        fclose( f );
+
+        Config cfg( "iv.ini" );
+        ImageProvider::CacheConfig read( cfg );
+        REQUIRE( read.size == 1024 );
+        REQUIRE( read.prefetch == 5 );
+        REQUIRE( cfg.Get( "Window", "Width", 0 ) == 800 );
+    }
+}
@@ -1,9 +1,16 @@
 #include "TestUtils.hpp"
+#include <algorithm>
 #include <catch2/catch_all.hpp>
+#include <functional>
+#include <png.h>
 #include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/PixelBytes.hpp>
 #include <src/util/TaskDispatch.hpp>
 #include <stdint.h>
 #include <string.h>
+#include <string>
+#include <thread>
 
 namespace
 {
@@ -77,6 +84,67 @@ void VerifyAll( const Bitmap& bmp, uint32_t value )
     }
 }
 
+// Rearranges an upright image to be stored as seen with the given orientation
+void Unorient( Bitmap& bmp, int orientation )
+{
+    switch( orientation )
+    {
+    case 2: bmp.FlipHorizontal(); break;
+    case 3: bmp.Rotate180(); break;
+    case 4: bmp.FlipVertical(); break;
+    case 5: bmp.Transpose(); break;
+    case 6: bmp.Rotate270(); break;
+    case 7: bmp.Transverse(); break;
+    case 8: bmp.Rotate90(); break;
+    default: break;
+    }
+    bmp.SetOrientation( orientation );
+}
+
+// Transforms work in place, so each sample starts from the output of the previous one. That has
+// the same number of pixels, and its pages are already mapped.
+template<typename T>
+void BenchmarkTransforms( T& bmp, const std::string& type, TaskDispatch& td )
+{
+    const auto size = std::to_string( bmp.Width() ) + "x" + std::to_string( bmp.Height() );
+    const auto name = [&]( const char* op, bool threaded = false ) { return type + " " + op + " " + size + ( threaded ? ", threaded" : "" ); };
+
+    BENCHMARK( name( "Rotate90" ) )
+    {
+        bmp.Rotate90();
+        return bmp.Data();
+    };
+
+    BENCHMARK( name( "Rotate90", true ) )
+    {
+        bmp.Rotate90( &td );
+        return bmp.Data();
+    };
+
+    BENCHMARK( name( "Rotate270" ) )
+    {
+        bmp.Rotate270();
+        return bmp.Data();
+    };
+
+    BENCHMARK( name( "Rotate180" ) )
+    {
+        bmp.Rotate180();
+        return bmp.Data();
+    };
+
+    BENCHMARK( name( "Transpose", true ) )
+    {
+        bmp.Transpose( &td );
+        return bmp.Data();
+    };
+
+    BENCHMARK( name( "FlipHorizontal" ) )
+    {
+        bmp.FlipHorizontal();
+        return bmp.Data();
+    };
+}
 }
 
 TEST_CASE( "Bitmap constructor and accessors", "[bitmap]" )
@@ -149,6 +217,49 @@ TEST_CASE( "Bitmap move semantics", "[bitmap][move]" )
     }
 }
 
+TEST_CASE( "Bitmap adopting external data", "[bitmap][adopt]" )
+{
+    SECTION( "Data is used in place and released on destruction" )
+    {
+        int released = 0;
+        auto data = new uint8_t[4 * 3 * 4];
+        {
+            Bitmap bmp( 4, 3, data, [&released]( uint8_t* ptr ) { released++; delete[] ptr; }, 3 );
+            REQUIRE( bmp.Data() == data );
+            REQUIRE( bmp.Orientation() == 3 );
+            FillPattern( bmp );
+        }
+        REQUIRE( released == 1 );
+    }
+
+    SECTION( "Data is released when replaced" )
+    {
+        int released = 0;
+        Bitmap bmp( 4, 4, new uint8_t[4 * 4 * 4], [&released]( uint8_t* ptr ) { released++; delete[] ptr; } );
+        FillPattern( bmp );
+        auto snapshot = Snapshot( bmp );
+        bmp.Rotate90();
+        REQUIRE( released == 1 );
+        bmp.Rotate270();
+        REQUIRE( Snapshot( bmp ) == snapshot );
+        bmp.Crop( 1, 1, 2, 2 );
+        REQUIRE( released == 1 );
+    }
+
+    SECTION( "Ownership follows moves" )
+    {
+        int released = 0;
+        Bitmap bmp( 2, 2, new uint8_t[2 * 2 * 4], [&released]( uint8_t* ptr ) { released++; delete[] ptr; } );
+        Bitmap moved( std::move( bmp ) );
+        Bitmap other( 3, 3 );
+        other = std::move( moved );
+        moved = Bitmap( 1, 1 );
+        REQUIRE( released == 0 );
+        other = Bitmap( 1, 1 );
+        REQUIRE( released == 1 );
+    }
+}
+
 TEST_CASE( "Bitmap resize", "[bitmap][resize]" )
 {
     SECTION( "Resize preserves solid color" )
@@ -276,6 +387,29 @@ TEST_CASE( "Bitmap extend", "[bitmap][extend]" )
             }
         }
     }
+
+    SECTION( "Extend takes upright dimensions" )
+    {
+        Bitmap upright( 3, 2 );
+        Bitmap bmp( 3, 2 );
+        FillPattern( upright );
+        FillPattern( bmp );
+        Unorient( bmp, 6 );
+
+        bmp.Extend( 5, 4 );
+        REQUIRE( bmp.Orientation() <= 1 );
+        REQUIRE( bmp.Width() == 5 );
+        REQUIRE( bmp.Height() == 4 );
+
+        for( uint32_t y = 0; y < 4; y++ )
+        {
+            for( uint32_t x = 0; x < 5; x++ )
+            {
+                if( x < 3 && y < 2 ) REQUIRE( GetPixel( bmp, x, y ) == GetPixel( upright, x, y ) );
+                else REQUIRE( GetPixel( bmp, x, y ) == 0x00000000 );
+            }
+        }
+    }
 }
 
 TEST_CASE( "Bitmap crop", "[bitmap][crop]" )
@@ -560,6 +694,121 @@ TEST_CASE( "Bitmap normalize orientation", "[bitmap][orientation]" )
     }
 }
 
+TEST_CASE( "Bitmap lazy orientation", "[bitmap][orientation]" )
+{
+    SECTION( "Unoriented image normalizes back to upright" )
+    {
+        for( int orientation=2; orientation<=8; orientation++ )
+        {
+            Bitmap upright( 5, 3 );
+            Bitmap bmp( 5, 3 );
+            FillPattern( upright );
+            FillPattern( bmp );
+            Unorient( bmp, orientation );
+            REQUIRE( bmp.OrientedWidth() == 5 );
+            REQUIRE( bmp.OrientedHeight() == 3 );
+            bmp.NormalizeOrientation();
+            REQUIRE( Snapshot( bmp ) == Snapshot( upright ) );
+        }
+    }
+
+    SECTION( "Crop takes upright coordinates and keeps orientation" )
+    {
+        for( int orientation=2; orientation<=8; orientation++ )
+        {
+            INFO( "orientation " << orientation );
+            Bitmap expected( 5, 3 );
+            Bitmap bmp( 5, 3 );
+            FillPattern( expected );
+            FillPattern( bmp );
+            expected.Crop( 1, 1, 3, 2 );
+            Unorient( bmp, orientation );
+
+            bmp.Crop( 1, 1, 3, 2 );
+            REQUIRE( bmp.Orientation() == orientation );
+            REQUIRE( bmp.OrientedWidth() == 3 );
+            REQUIRE( bmp.OrientedHeight() == 2 );
+            bmp.NormalizeOrientation();
+            REQUIRE( Snapshot( bmp ) == Snapshot( expected ) );
+        }
+    }
+
+    SECTION( "FillBlack takes upright coordinates" )
+    {
+        for( int orientation=2; orientation<=8; orientation++ )
+        {
+            INFO( "orientation " << orientation );
+            Bitmap expected( 5, 3 );
+            Bitmap bmp( 5, 3 );
+            FillPattern( expected );
+            FillPattern( bmp );
+            expected.FillBlack( 3, 0, 2, 2 );
+            Unorient( bmp, orientation );
+
+            bmp.FillBlack( 3, 0, 2, 2 );
+            bmp.NormalizeOrientation();
+            REQUIRE( Snapshot( bmp ) == Snapshot( expected ) );
+        }
+    }
+
+    SECTION( "Resize produces an upright image" )
+    {
+        const auto red = MakePixel( 0xFF, 0, 0 );
+        const auto blue = MakePixel( 0, 0, 0xFF );
+        for( int orientation=2; orientation<=8; orientation++ )
+        {
+            INFO( "orientation " << orientation );
+            Bitmap bmp( 32, 24 );
+            FillSolid( bmp, 0xFF, 0, 0 );
+            for( uint32_t y=0; y<24; y++ )
+            {
+                for( uint32_t x=16; x<32; x++ ) SetPixel( bmp, x, y, blue );
+            }
+            Unorient( bmp, orientation );
+
+            auto resized = bmp.ResizeNew( 16, 12 );
+            REQUIRE( bmp.Orientation() == orientation );
+            REQUIRE( resized->Orientation() == 1 );
+            REQUIRE( resized->Width() == 16 );
+            REQUIRE( resized->Height() == 12 );
+            REQUIRE( GetPixel( *resized, 2, 6 ) == red );
+            REQUIRE( GetPixel( *resized, 13, 6 ) == blue );
+
+            bmp.Resize( 8, 6 );
+            REQUIRE( bmp.Orientation() == 1 );
+            REQUIRE( bmp.Width() == 8 );
+            REQUIRE( bmp.Height() == 6 );
+            REQUIRE( GetPixel( bmp, 1, 3 ) == red );
+            REQUIRE( GetPixel( bmp, 6, 3 ) == blue );
+        }
+    }
+
+    SECTION( "SavePng writes the upright image" )
+    {
+        for( int orientation : { 3, 6 } )
+        {
+            Bitmap expected( 5, 3 );
+            Bitmap bmp( 5, 3 );
+            FillPattern( expected );
+            FillPattern( bmp );
+            Unorient( bmp, orientation );
+
+            auto tempFile = TempFile::createEmpty();
+            REQUIRE( bmp.SavePng( tempFile.path() ) );
+
+            png_image image = {};
+            image.version = PNG_IMAGE_VERSION;
+            REQUIRE( png_image_begin_read_from_file( &image, tempFile.path() ) );
+            image.format = PNG_FORMAT_RGBA;
+            REQUIRE( image.width == 5 );
+            REQUIRE( image.height == 3 );
+            std::vector<uint32_t> pixels( 5 * 3 );
+            REQUIRE( png_image_finish_read( &image, nullptr, pixels.data(), 0, nullptr ) );
+            REQUIRE( pixels == Snapshot( expected ) );
+        }
+    }
+}
+
 TEST_CASE( "Bitmap bgr to rgb", "[bitmap][colorspace]" )
 {
     SECTION( "Swaps red and blue channels" )
@@ -698,3 +947,29 @@ TEST_CASE( "Bitmap panic paths abort", "[bitmap][panic]" )
         REQUIRE_ABORTS( bmp.FillBlack( 1, 1, 3, 3 ) );
     }
 }
+
+TEST_CASE( "Bitmap transform benchmarks", "[!benchmark][bitmap][transform]" )
+{
+    TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() ) - 1, "bench-rotate" );
+
+    SECTION( "Bitmap 6000x4000" )
+    {
+        Bitmap bmp( 6000, 4000 );
+        memset( bmp.Data(), 0x55, PixelChannelCount( bmp.Width(), bmp.Height() ) );
+        BenchmarkTransforms( bmp, "Bitmap", td );
+    }
+
+    SECTION( "Bitmap 12000x8400" )
+    {
+        Bitmap bmp( 12000, 8400 );
+        memset( bmp.Data(), 0x55, PixelChannelCount( bmp.Width(), bmp.Height() ) );
+        BenchmarkTransforms( bmp, "Bitmap", td );
+    }
+
+    SECTION( "BitmapHdr 6000x4000" )
+    {
+        BitmapHdr hdr( 6000, 4000, Colorspace::BT709 );
+        memset( hdr.Data(), 0, PixelChannelCount( hdr.Width(), hdr.Height() ) * sizeof( float ) );
+        BenchmarkTransforms( hdr, "BitmapHdr", td );
+    }
+}
@@ -1,6 +1,7 @@
 #include "TestUtils.hpp"
 #include <catch2/catch_all.hpp>
 #include <contrib/half.hpp>
+#include <functional>
 #include <src/util/Bitmap.hpp>
 #include <src/util/BitmapHdr.hpp>
 #include <src/util/BitmapHdrHalf.hpp>
@@ -170,7 +171,7 @@ TEST_CASE( "BitmapHdr resize", "[bitmaphdr][resize]" )
         REQUIRE( resized->Width() == 3 );
         REQUIRE( resized->Height() == 3 );
         REQUIRE( resized->GetColorspace() == Colorspace::BT2020 );
-        REQUIRE( resized->Orientation() == 2 );
+        REQUIRE( resized->Orientation() == 1 );
 
         REQUIRE( bmp.Width() == 8 );
         REQUIRE( bmp.Height() == 8 );
@@ -1,6 +1,7 @@
 #include "TestUtils.hpp"
 #include <catch2/catch_all.hpp>
 #include <contrib/half.hpp>
+#include <ImfRgbaFile.h>
 #include <src/util/BitmapHdr.hpp>
 #include <src/util/BitmapHdrHalf.hpp>
 #include <src/util/TaskDispatch.hpp>
@@ -136,7 +137,7 @@ TEST_CASE( "BitmapHdrHalf resize", "[bitmaphdrhalf][resize]" )
         REQUIRE( resized->Width() == 3 );
         REQUIRE( resized->Height() == 3 );
         REQUIRE( resized->GetColorspace() == Colorspace::BT2020 );
-        REQUIRE( resized->Orientation() == 3 );
+        REQUIRE( resized->Orientation() == 1 );
 
         REQUIRE( bmp.Width() == 8 );
         REQUIRE( bmp.Height() == 8 );
@@ -221,6 +222,35 @@ TEST_CASE( "BitmapHdrHalf crop and fill", "[bitmaphdrhalf][crop][fill]" )
     }
 }
 
+TEST_CASE( "BitmapHdrHalf normalize orientation", "[bitmaphdrhalf][orientation]" )
+{
+    SECTION( "Matches BitmapHdr for every orientation" )
+    {
+        for( int orientation=1; orientation<=8; orientation++ )
+        {
+            BitmapHdrHalf half( 5, 3, Colorspace::BT709, orientation );
+            for( uint32_t y=0; y<3; y++ )
+            {
+                for( uint32_t x=0; x<5; x++ ) SetPixel( half, x, y, float( x ), float( y ), float( x * 3 + y ), 1.f );
+            }
+            BitmapHdr full( half );
+
+            half.NormalizeOrientation();
+            full.NormalizeOrientation();
+            REQUIRE( half.Orientation() == 1 );
+            REQUIRE( half.Width() == full.Width() );
+            REQUIRE( half.Height() == full.Height() );
+            for( size_t i=0; i<size_t( half.Width() ) * half.Height() * 4; i++ ) REQUIRE( float( half.Data()[i] ) == full.Data()[i] );
+        }
+    }
+
+    SECTION( "Invalid orientation aborts" )
+    {
+        BitmapHdrHalf bmp( 2, 2, Colorspace::BT709, 9 );
+        REQUIRE_ABORTS( bmp.NormalizeOrientation() );
+    }
+}
+
 TEST_CASE( "BitmapHdrHalf colorspace transforms", "[bitmaphdrhalf][colorspace]" )
 {
     SECTION( "BT2020 to BT709 transforms pixels and preserves alpha" )
@@ -322,6 +352,64 @@ TEST_CASE( "BitmapHdrHalf save exr", "[bitmaphdrhalf][exr]" )
         REQUIRE( magic[3] == '\x01' );
     }
 
+    SECTION( "SaveExr writes the requested compression and layout" )
+    {
+        BitmapHdrHalf bmp( 67, 45, Colorspace::BT709 );
+        for( uint32_t y=0; y<45; y++ )
+        {
+            for( uint32_t x=0; x<67; x++ ) SetPixel( bmp, x, y, x / 67.f, y / 45.f, 0.5f, 1.f );
+        }
+
+        const std::pair<ExrOptions::Compression, Imf::Compression> compressions[] = {
+            { ExrOptions::Compression::None, Imf::NO_COMPRESSION },
+            { ExrOptions::Compression::Zip, Imf::ZIP_COMPRESSION },
+            { ExrOptions::Compression::Zips, Imf::ZIPS_COMPRESSION },
+            { ExrOptions::Compression::Piz, Imf::PIZ_COMPRESSION },
+            { ExrOptions::Compression::Dwab, Imf::DWAB_COMPRESSION },
+        };
+        TaskDispatch td( 4, "half-exr" );
+        for( const auto& [compression, imf] : compressions )
+        {
+            for( uint32_t tileSize : { 0u, 16u } )
+            {
+                INFO( "compression " << int( compression ) << ", tile size " << tileSize );
+                ExrOptions options;
+                options.compression = compression;
+                options.tileSize = tileSize;
+                options.lineOrder = tileSize ? ExrOptions::LineOrder::Random : ExrOptions::LineOrder::Decreasing;
+
+                auto tempFile = TempFile::createEmpty();
+                REQUIRE( bmp.SaveExr( tempFile.path(), options, &td ) );
+
+                Imf::RgbaInputFile in( tempFile.path() );
+                REQUIRE( in.header().compression() == imf );
+                REQUIRE( in.header().hasTileDescription() == ( tileSize != 0 ) );
+                const auto dw = in.dataWindow();
+                REQUIRE( dw.max.x - dw.min.x + 1 == 67 );
+                REQUIRE( dw.max.y - dw.min.y + 1 == 45 );
+
+                std::vector<Imf::Rgba> pixels( 67 * 45 );
+                in.setFrameBuffer( pixels.data(), 1, 67 );
+                in.readPixels( dw.min.y, dw.max.y );
+                const auto margin = compression == ExrOptions::Compression::Dwab ? 0.02f : 0.f;
+                for( size_t i=0; i<pixels.size(); i++ )
+                {
+                    REQUIRE( float( pixels[i].r ) == Catch::Approx( float( bmp.Data()[i*4] ) ).margin( margin ) );
+                    REQUIRE( float( pixels[i].g ) == Catch::Approx( float( bmp.Data()[i*4+1] ) ).margin( margin ) );
+                }
+            }
+        }
+    }
+
+    SECTION( "SaveExr rejects random line order for scanlines" )
+    {
+        BitmapHdrHalf bmp( 2, 2, Colorspace::BT709 );
+        auto tempFile = TempFile::createEmpty();
+        ExrOptions options;
+        options.lineOrder = ExrOptions::LineOrder::Random;
+        REQUIRE( bmp.SaveExr( tempFile.path(), options ) == false );
+    }
+
     SECTION( "SaveExr to unwritable path returns false" )
     {
         BitmapHdrHalf bmp( 2, 2, Colorspace::BT709 );
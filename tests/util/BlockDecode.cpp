@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <random>
+#include <src/util/BlockDecode.hpp>
+#include <stdint.h>
+#include <tests/util/SimdTestUtils.hpp>
+#include <vector>
+
+namespace
+{
+
+using Decoder = void(*)( uint32_t*, const uint64_t*, uint32_t, uint32_t );
+
+struct Size
+{
+    uint32_t width;
+    uint32_t height;
+};
+
+// Block rows of 1, 2, 3, 5, 6 and 17 blocks cover the vector loops and their scalar tails
+constexpr Size Sizes[] = { { 4, 4 }, { 8, 8 }, { 12, 4 }, { 20, 8 }, { 24, 12 }, { 68, 16 } };
+
+std::vector<uint64_t> RandomBlocks( size_t count, uint32_t seed )
+{
+    std::mt19937_64 rng( seed );
+    std::vector<uint64_t> ret( count );
+    for( auto& v : ret ) v = rng();
+    return ret;
+}
+
+std::vector<uint32_t> Decode( Decoder decoder, SimdLevel level, const std::vector<uint64_t>& src, Size size )
+{
+    ScopedSimdLevel scoped( level );
+    REQUIRE( GetSimdLevel() == level );
+    std::vector<uint32_t> ret( size.width * size.height, 0xDEADBEEF );
+    decoder( ret.data(), src.data(), size.width, size.height );
+    return ret;
+}
+
+// Decodes with every available level and checks that the output matches the scalar decoder
+void RequireSameAtAllLevels( Decoder decoder, const std::vector<uint64_t>& src, Size size )
+{
+    const auto expected = Decode( decoder, SimdLevel::Scalar, src, size );
+    REQUIRE( std::find( expected.begin(), expected.end(), 0xDEADBEEF ) == expected.end() );
+    for( auto level : SimdLevels() )
+    {
+        INFO( SimdLevelName( level ) );
+        REQUIRE( Decode( decoder, level, src, size ) == expected );
+    }
+}
+
+// Keeps one channel of each pixel, in the red position, with an opaque alpha
+std::vector<uint32_t> Channel( const std::vector<uint32_t>& rgba, int channel )
+{
+    std::vector<uint32_t> ret( rgba.size() );
+    for( size_t i=0; i<rgba.size(); i++ ) ret[i] = ( ( rgba[i] >> ( channel * 8 ) ) & 0xFF ) | 0xFF000000;
+    return ret;
+}
+
+// Blocks of two words, with the first and second word of each block taken from the given arrays
+std::vector<uint64_t> Interleave( const std::vector<uint64_t>& first, const std::vector<uint64_t>& second )
+{
+    std::vector<uint64_t> ret;
+    for( size_t i=0; i<first.size(); i++ )
+    {
+        ret.emplace_back( first[i] );
+        ret.emplace_back( second[i] );
+    }
+    return ret;
+}
+
+enum class EtcMode
+{
+    Individual,
+    Differential,
+    T,
+    H,
+    Planar
+};
+
+EtcMode GetEtcMode( uint64_t block )
+{
+    const auto d = __builtin_bswap32( uint32_t( block ) );
+    if( ( d & 0x2 ) == 0 ) return EtcMode::Individual;
+
+    const auto r = int32_t( ( d >> 27 ) & 0x1F ) + ( ( int32_t( d ) << 5 ) >> 29 );
+    const auto g = int32_t( ( d >> 19 ) & 0x1F ) + ( ( int32_t( d ) << 13 ) >> 29 );
+    const auto b = int32_t( ( d >> 11 ) & 0x1F ) + ( ( int32_t( d ) << 21 ) >> 29 );
+    if( r < 0 || r > 31 ) return EtcMode::T;
+    if( g < 0 || g > 31 ) return EtcMode::H;
+    if( b < 0 || b > 31 ) return EtcMode::Planar;
+    return EtcMode::Differential;
+}
+
+// Random ETC2 color blocks, cycling through all five modes
+std::vector<uint64_t> RandomEtcBlocks( size_t count, uint32_t seed )
+{
+    std::mt19937_64 rng( seed );
+    std::vector<uint64_t> ret( count );
+    for( size_t i=0; i<count; i++ )
+    {
+        const auto mode = EtcMode( i % 5 );
+        do { ret[i] = rng(); } while( GetEtcMode( ret[i] ) != mode );
+    }
+    return ret;
+}
+
+constexpr int32_t EacModifiers[16][8] = {
+    { -3, -6,  -9, -15, 2, 5, 8, 14 },
+    { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5,  -8, -13, 1, 4, 7, 12 },
+    { -2, -4,  -6, -13, 1, 3, 5, 12 },
+    { -3, -6,  -8, -12, 2, 5, 7, 11 },
+    { -3, -7,  -9, -11, 2, 6, 8, 10 },
+    { -4, -7,  -8, -11, 3, 6, 7, 10 },
+    { -3, -5,  -8, -11, 2, 4, 7, 10 },
+    { -2, -6,  -8, -10, 1, 5, 7,  9 },
+    { -2, -5,  -8, -10, 1, 4, 7,  9 },
+    { -2, -4,  -8, -10, 1, 3, 7,  9 },
+    { -2, -5,  -7, -10, 1, 4, 6,  9 },
+    { -3, -4,  -7, -10, 2, 3, 6,  9 },
+    { -1, -2,  -3, -10, 0, 1, 2,  9 },
+    { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+    { -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+// Straightforward EAC R11 decoder, following the specification, reduced to 8 bits
+std::vector<uint32_t> ReferenceEacR11( const std::vector<uint64_t>& src, Size size )
+{
+    std::vector<uint32_t> ret( size.width * size.height );
+    auto block = src.begin();
+    for( uint32_t by=0; by<size.height; by+=4 )
+    {
+        for( uint32_t bx=0; bx<size.width; bx+=4 )
+        {
+            const auto v = __builtin_bswap64( *block++ );
+            const int32_t base = int32_t( v >> 56 ) * 8 + 4;
+            const int32_t mul = ( v >> 52 ) & 0xF;
+            const auto& modifiers = EacModifiers[( v >> 48 ) & 0xF];
+            for( int x=0; x<4; x++ )
+            {
+                for( int y=0; y<4; y++ )
+                {
+                    const auto mod = modifiers[( v >> ( 45 - ( x * 4 + y ) * 3 ) ) & 0x7];
+                    const auto value = std::clamp( base + mod * ( mul == 0 ? 1 : mul * 8 ), 0, 2047 );
+                    ret[( by + y ) * size.width + bx + x] = uint32_t( value >> 3 ) | 0xFF000000;
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+}
+
+TEST_CASE( "BC block decoding", "[simd][blockdecode]" )
+{
+    // Sections are entered once per run, so each one loops over the sizes
+    const auto forEachSize = []( auto&& test )
+    {
+        for( auto size : Sizes )
+        {
+            INFO( size.width << "x" << size.height );
+            const size_t blocks = size.width / 4 * size.height / 4;
+            test( size, RandomBlocks( blocks, size.width ), RandomBlocks( blocks, size.width + 1 ) );
+        }
+    };
+
+    SECTION( "BC1" )
+    {
+        forEachSize( []( Size size, const auto& first, const auto& ) {
+            RequireSameAtAllLevels( BlockDecode::Bc1, first, size );
+        } );
+    }
+
+    SECTION( "BC3" )
+    {
+        forEachSize( []( Size size, const auto& first, const auto& second ) {
+            const auto src = Interleave( first, second );
+            RequireSameAtAllLevels( BlockDecode::Bc3, src, size );
+
+            // Alpha is encoded as in BC4
+            const auto bc3 = Decode( BlockDecode::Bc3, SimdLevel::Scalar, src, size );
+            REQUIRE( Channel( bc3, 3 ) == Decode( BlockDecode::Bc4, DetectSimdLevel(), first, size ) );
+        } );
+    }
+
+    SECTION( "BC4" )
+    {
+        forEachSize( []( Size size, const auto& first, const auto& ) {
+            RequireSameAtAllLevels( BlockDecode::Bc4, first, size );
+        } );
+    }
+
+    SECTION( "BC5" )
+    {
+        forEachSize( []( Size size, const auto& first, const auto& second ) {
+            const auto src = Interleave( first, second );
+            RequireSameAtAllLevels( BlockDecode::Bc5, src, size );
+
+            // Each channel is a BC4 block
+            const auto bc5 = Decode( BlockDecode::Bc5, DetectSimdLevel(), src, size );
+            REQUIRE( Channel( bc5, 0 ) == Decode( BlockDecode::Bc4, SimdLevel::Scalar, first, size ) );
+            REQUIRE( Channel( bc5, 1 ) == Decode( BlockDecode::Bc4, SimdLevel::Scalar, second, size ) );
+            for( auto px : bc5 ) REQUIRE( ( px & 0xFF000000 ) == 0xFF000000 );
+        } );
+    }
+}
+
+TEST_CASE( "ETC block decoding", "[simd][blockdecode]" )
+{
+    const auto forEachSize = []( auto&& test )
+    {
+        for( auto size : Sizes )
+        {
+            INFO( size.width << "x" << size.height );
+            const size_t blocks = size.width / 4 * size.height / 4;
+            test( size, RandomEtcBlocks( blocks, size.width ), RandomBlocks( blocks, size.width + 1 ) );
+        }
+    };
+
+    SECTION( "ETC2 RGB" )
+    {
+        forEachSize( []( Size size, const auto& color, const auto& ) {
+            RequireSameAtAllLevels( BlockDecode::Etc2Rgb, color, size );
+        } );
+    }
+
+    SECTION( "ETC2 RGBA" )
+    {
+        forEachSize( []( Size size, const auto& color, const auto& alpha ) {
+            const auto src = Interleave( alpha, color );
+            RequireSameAtAllLevels( BlockDecode::Etc2Rgba, src, size );
+
+            // Color is decoded as in ETC2 RGB
+            const auto rgba = Decode( BlockDecode::Etc2Rgba, DetectSimdLevel(), src, size );
+            const auto rgb = Decode( BlockDecode::Etc2Rgb, SimdLevel::Scalar, color, size );
+            for( size_t i=0; i<rgba.size(); i++ ) REQUIRE( ( rgba[i] & 0xFFFFFF ) == ( rgb[i] & 0xFFFFFF ) );
+        } );
+    }
+
+    // EAC has no vector path, so the output is also checked against a reference decoder
+    SECTION( "EAC R11" )
+    {
+        forEachSize( []( Size size, const auto&, const auto& red ) {
+            RequireSameAtAllLevels( BlockDecode::EacR11, red, size );
+            REQUIRE( Decode( BlockDecode::EacR11, DetectSimdLevel(), red, size ) == ReferenceEacR11( red, size ) );
+        } );
+    }
+
+    SECTION( "EAC RG11" )
+    {
+        forEachSize( []( Size size, const auto& green, const auto& red ) {
+            const auto src = Interleave( red, green );
+            RequireSameAtAllLevels( BlockDecode::EacRg11, src, size );
+
+            const auto rg = Decode( BlockDecode::EacRg11, DetectSimdLevel(), src, size );
+            REQUIRE( Channel( rg, 0 ) == ReferenceEacR11( red, size ) );
+            REQUIRE( Channel( rg, 1 ) == ReferenceEacR11( green, size ) );
+        } );
+    }
+}
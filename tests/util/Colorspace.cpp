@@ -0,0 +1,148 @@
+#include <catch2/catch_all.hpp>
+#include <contrib/half.hpp>
+#include <random>
+#include <src/util/Colorspace.hpp>
+#include <vector>
+
+namespace
+{
+
+std::vector<float> MakePixels( size_t count )
+{
+    std::mt19937 rng( count * 31 + 1 );
+    std::uniform_real_distribution<float> dist( -0.5f, 8.f );
+    std::vector<float> ret( count * 4 );
+    for( auto& v : ret ) v = dist( rng );
+    return ret;
+}
+
+}
+
+TEST_CASE( "ColorMatrix", "[colorspace]" )
+{
+    SECTION( "Matrices match ITU-R BT.2087" )
+    {
+        constexpr float ref[3][3] = {
+            { 0.6274f, 0.3293f, 0.0433f },
+            { 0.0691f, 0.9195f, 0.0114f },
+            { 0.0164f, 0.0880f, 0.8956f }
+        };
+        const auto& m = ColorMatrix::Get( Colorspace::BT709, Colorspace::BT2020 );
+        for( int i=0; i<3; i++ )
+        {
+            for( int j=0; j<3; j++ ) REQUIRE( m.m[i][j] == Catch::Approx( ref[i][j] ).margin( 1e-4 ) );
+        }
+
+        const auto& inv = ColorMatrix::Get( Colorspace::BT2020, Colorspace::BT709 );
+        REQUIRE( inv.m[0][0] == Catch::Approx( 1.6605f ).margin( 1e-4 ) );
+        REQUIRE( inv.m[0][1] == Catch::Approx( -0.5876f ).margin( 1e-4 ) );
+        REQUIRE( inv.m[2][2] == Catch::Approx( 1.1187f ).margin( 1e-4 ) );
+    }
+
+    SECTION( "White and alpha are preserved" )
+    {
+        std::vector<float> px( 7 * 4 );
+        for( size_t i=0; i<px.size(); i+=4 )
+        {
+            px[i+0] = px[i+1] = px[i+2] = 2.f;
+            px[i+3] = float( i ) * 0.01f;
+        }
+        ColorMatrix::Get( Colorspace::BT709, Colorspace::BT2020 ).Apply( px.data(), 7 );
+        for( size_t i=0; i<px.size(); i+=4 )
+        {
+            for( int c=0; c<3; c++ ) REQUIRE( px[i+c] == Catch::Approx( 2.f ).margin( 1e-5 ) );
+            REQUIRE( px[i+3] == float( i ) * 0.01f );
+        }
+    }
+
+    SECTION( "SIMD paths match the matrix for all pixel counts" )
+    {
+        const auto& m = ColorMatrix::Get( Colorspace::BT2020, Colorspace::BT709 );
+        for( size_t count=1; count<40; count++ )
+        {
+            const auto src = MakePixels( count );
+            auto px = src;
+            m.Apply( px.data(), count );
+            for( size_t i=0; i<count*4; i+=4 )
+            {
+                for( int c=0; c<3; c++ )
+                {
+                    const auto ref = m.m[c][0] * src[i+0] + m.m[c][1] * src[i+1] + m.m[c][2] * src[i+2];
+                    REQUIRE( px[i+c] == Catch::Approx( ref ).margin( 1e-5 ) );
+                }
+                REQUIRE( px[i+3] == src[i+3] );
+            }
+        }
+    }
+
+    SECTION( "Round trip" )
+    {
+        const auto src = MakePixels( 1000 );
+        auto px = src;
+        ColorMatrix::Get( Colorspace::BT709, Colorspace::BT2020 ).Apply( px.data(), 1000 );
+        ColorMatrix::Get( Colorspace::BT2020, Colorspace::BT709 ).Apply( px.data(), 1000 );
+        for( size_t i=0; i<px.size(); i++ ) REQUIRE( px[i] == Catch::Approx( src[i] ).epsilon( 1e-5 ).margin( 1e-5 ) );
+
+        ColorMatrix::Get( Colorspace::BT709, Colorspace::BT709 ).Apply( px.data(), 1000 );
+        for( size_t i=0; i<px.size(); i++ ) REQUIRE( px[i] == Catch::Approx( src[i] ).epsilon( 1e-5 ).margin( 1e-5 ) );
+    }
+
+    SECTION( "Half float data" )
+    {
+        const auto& m = ColorMatrix::Get( Colorspace::BT709, Colorspace::BT2020 );
+        for( size_t count : { 1, 2, 3, 5, 17, 1000 } )
+        {
+            const auto src = MakePixels( count );
+            std::vector<half_float::half> px( src.size() );
+            for( size_t i=0; i<src.size(); i++ ) px[i] = half_float::half( src[i] );
+            auto ref = src;
+            for( size_t i=0; i<src.size(); i++ ) ref[i] = float( px[i] );
+            m.Apply( ref.data(), count );
+
+            m.Apply( px.data(), count );
+            for( size_t i=0; i<src.size(); i++ )
+            {
+                if( i % 4 == 3 )
+                {
+                    REQUIRE( float( px[i] ) == float( half_float::half( src[i] ) ) );
+                }
+                else
+                {
+                    REQUIRE( float( px[i] ) == Catch::Approx( ref[i] ).epsilon( 1e-3 ).margin( 1e-3 ) );
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE( "ColorMatrix benchmarks", "[!benchmark][colorspace]" )
+{
+    constexpr size_t Count = 2048 * 2048;
+    const auto& to = ColorMatrix::Get( Colorspace::BT709, Colorspace::BT2020 );
+    const auto& from = ColorMatrix::Get( Colorspace::BT2020, Colorspace::BT709 );
+
+    // Converting there and back keeps the input the same for every sample
+    SECTION( "Float" )
+    {
+        auto px = MakePixels( Count );
+        BENCHMARK( "Float 2048x2048, BT.709 to BT.2020 and back" )
+        {
+            to.Apply( px.data(), Count );
+            from.Apply( px.data(), Count );
+            return px[0];
+        };
+    }
+
+    SECTION( "Half float" )
+    {
+        const auto src = MakePixels( Count );
+        std::vector<half_float::half> px( Count * 4 );
+        for( size_t i=0; i<px.size(); i++ ) px[i] = half_float::half( src[i] );
+        BENCHMARK( "Half float 2048x2048, BT.709 to BT.2020 and back" )
+        {
+            to.Apply( px.data(), Count );
+            from.Apply( px.data(), Count );
+            return px[0];
+        };
+    }
+}
@@ -0,0 +1,108 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/CompressedBitmap.hpp>
+#include <src/util/DataBuffer.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <random>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+TEST_CASE( "CompressedBitmap", "[compressedbitmap]" )
+{
+    SECTION( "Level layout references buffer data" )
+    {
+        std::vector<uint8_t> data( 16 + 64 + 16 + 8 + 8 + 8 );
+        auto buffer = std::make_shared<DataBuffer>( (const char*)data.data(), data.size() );
+        CompressedBitmap bmp( buffer, 16, CompressedBitmap::Format::Bc1, 16, 8, 5 );
+
+        REQUIRE( bmp.Width() == 16 );
+        REQUIRE( bmp.Height() == 8 );
+        REQUIRE( bmp.GetFormat() == CompressedBitmap::Format::Bc1 );
+        REQUIRE( bmp.Data() == data.data() + 16 );
+        REQUIRE( bmp.Size() == data.size() - 16 );
+
+        const auto& levels = bmp.Levels();
+        REQUIRE( levels.size() == 5 );
+        REQUIRE( levels[0].width == 16 );
+        REQUIRE( levels[0].height == 8 );
+        REQUIRE( levels[0].offset == 0 );
+        REQUIRE( levels[0].size == 64 );
+        REQUIRE( levels[1].width == 8 );
+        REQUIRE( levels[1].height == 4 );
+        REQUIRE( levels[1].offset == 64 );
+        REQUIRE( levels[1].size == 16 );
+        REQUIRE( levels[4].width == 1 );
+        REQUIRE( levels[4].height == 1 );
+        REQUIRE( levels[4].offset == 96 );
+        REQUIRE( levels[4].size == 8 );
+    }
+
+    SECTION( "Levels not in the buffer are dropped" )
+    {
+        std::vector<uint8_t> data( 64 + 16 + 4 );
+        auto buffer = std::make_shared<DataBuffer>( (const char*)data.data(), data.size() );
+        CompressedBitmap bmp( buffer, 0, CompressedBitmap::Format::Bc1, 16, 8, 5 );
+        REQUIRE( bmp.Levels().size() == 2 );
+    }
+
+    SECTION( "Mip chain ends at 1x1" )
+    {
+        std::vector<uint8_t> data( 4096 );
+        auto buffer = std::make_shared<DataBuffer>( (const char*)data.data(), data.size() );
+        CompressedBitmap bmp( buffer, 0, CompressedBitmap::Format::Etc2Rgba, 16, 16, 20 );
+        REQUIRE( bmp.Levels().size() == 5 );
+        REQUIRE( bmp.Size() == ( 16 + 4 + 1 + 1 + 1 ) * 16 );
+    }
+
+    SECTION( "Block sizes" )
+    {
+        REQUIRE( CompressedBitmap::BlockSize( CompressedBitmap::Format::Bc1 ) == 8 );
+        REQUIRE( CompressedBitmap::BlockSize( CompressedBitmap::Format::Bc4 ) == 8 );
+        REQUIRE( CompressedBitmap::BlockSize( CompressedBitmap::Format::Bc7 ) == 16 );
+        REQUIRE( CompressedBitmap::BlockSize( CompressedBitmap::Format::Etc2Rgb ) == 8 );
+        REQUIRE( CompressedBitmap::BlockSize( CompressedBitmap::Format::Etc2Rgba ) == 16 );
+        REQUIRE( CompressedBitmap::BlockSize( CompressedBitmap::Format::EacRg11 ) == 16 );
+        REQUIRE( CompressedBitmap::LevelSize( CompressedBitmap::Format::Bc7, 5, 5 ) == 4 * 16 );
+    }
+
+    SECTION( "BC1 decode" )
+    {
+        // Red and blue endpoints, each row of pixels uses a different palette entry
+        const uint8_t block[8] = { 0x00, 0xF8, 0x1F, 0x00, 0x00, 0x55, 0xAA, 0xFF };
+        auto buffer = std::make_shared<DataBuffer>( (const char*)block, sizeof( block ) );
+        auto bmp = CompressedBitmap( buffer, 0, CompressedBitmap::Format::Bc1, 4, 4 ).Decode();
+
+        REQUIRE( bmp->Width() == 4 );
+        REQUIRE( bmp->Height() == 4 );
+        const uint32_t expected[4] = { 0xFF0000FF, 0xFFFF0000, 0xFF5500AA, 0xFFAA0055 };
+        auto px = (const uint32_t*)bmp->Data();
+        for( int y=0; y<4; y++ )
+        {
+            for( int x=0; x<4; x++ )
+            {
+                REQUIRE( px[y*4+x] == expected[y] );
+            }
+        }
+    }
+
+    SECTION( "Parallel decode gives identical output" )
+    {
+        TaskDispatch td( 3, "Worker" );
+
+        std::mt19937_64 rng( 1 );
+        std::vector<uint64_t> data( 256 * 256 / 8 );
+        for( auto& v : data ) v = rng();
+        auto buffer = std::make_shared<DataBuffer>( (const char*)data.data(), data.size() * sizeof( uint64_t ) );
+
+        for( auto format : { CompressedBitmap::Format::Bc1, CompressedBitmap::Format::Bc3, CompressedBitmap::Format::Bc4, CompressedBitmap::Format::Bc5,
+                             CompressedBitmap::Format::Bc7, CompressedBitmap::Format::Etc2Rgb, CompressedBitmap::Format::Etc2Rgba,
+                             CompressedBitmap::Format::EacR11, CompressedBitmap::Format::EacRg11 } )
+        {
+            CompressedBitmap bmp( buffer, 0, format, 256, 128 );
+            auto serial = bmp.Decode();
+            auto parallel = bmp.Decode( &td );
+            REQUIRE( memcmp( serial->Data(), parallel->Data(), 256 * 128 * 4 ) == 0 );
+        }
+    }
+}
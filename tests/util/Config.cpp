@@ -145,6 +145,12 @@ TEST_CASE( "Config functionality", "[config][ini]" )
         REQUIRE( path == "./test.ini" );
     }
 
+    SECTION( "GetPath with absolute path" )
+    {
+        std::string path = Config::GetPath( "/usr/share/icons/theme/index.theme" );
+        REQUIRE( path == "/usr/share/icons/theme/index.theme" );
+    }
+
     SECTION( "GetPath with environment variable" )
     {
         std::string path = Config::GetPath( "test.ini" );
@@ -0,0 +1,146 @@
+#include <catch2/catch_all.hpp>
+#include <lcms2.h>
+#include <random>
+#include <src/util/Colorspace.hpp>
+#include <src/util/IccCache.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::vector<uint8_t> SrgbIcc()
+{
+    auto profile = cmsCreate_sRGBProfile();
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem( profile, nullptr, &size );
+    std::vector<uint8_t> ret( size );
+    cmsSaveProfileToMem( profile, ret.data(), &size );
+    cmsCloseProfile( profile );
+    return ret;
+}
+
+std::vector<uint8_t> MakePixels( size_t count )
+{
+    std::mt19937 rng( 1234 );
+    std::vector<uint8_t> ret( count * 4 );
+    for( auto& v : ret ) v = uint8_t( rng() );
+    return ret;
+}
+
+}
+
+TEST_CASE( "IccCache", "[icccache]" )
+{
+    const auto icc = SrgbIcc();
+    REQUIRE( !icc.empty() );
+
+    SECTION( "Cached transform gives identical output" )
+    {
+        constexpr size_t Count = 64 * 1024;
+        const auto src = MakePixels( Count );
+
+        auto profileIn = cmsOpenProfileFromMem( icc.data(), icc.size() );
+        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
+        cmsToneCurve* linear3[3] = { linear, linear, linear };
+        auto profileOut = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
+        auto direct = cmsCreateTransform( profileIn, TYPE_RGBA_8, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        REQUIRE( direct );
+        std::vector<float> ref( Count * 4 );
+        cmsDoTransform( direct, src.data(), ref.data(), Count );
+        cmsDeleteTransform( direct );
+        cmsCloseProfile( profileOut );
+        cmsCloseProfile( profileIn );
+        cmsFreeToneCurve( linear );
+
+        IccCache cache( 4 );
+        for( int i=0; i<2; i++ )
+        {
+            auto transform = cache.Get( IccProfile::FromMemory( icc.data(), icc.size() ), TYPE_RGBA_8, IccProfile::Rgb( white709, primaries2020, 1 ), TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+            REQUIRE( transform );
+            std::vector<float> out( Count * 4 );
+            cmsDoTransform( transform.get(), src.data(), out.data(), Count );
+            REQUIRE( memcmp( out.data(), ref.data(), out.size() * sizeof( float ) ) == 0 );
+        }
+        REQUIRE( cache.Hits() == 1 );
+        REQUIRE( cache.Misses() == 1 );
+    }
+
+    SECTION( "Profiles are matched by contents" )
+    {
+        IccCache cache( 4 );
+        const auto copy = icc;
+        auto a = cache.Get( IccProfile::FromMemory( icc.data(), icc.size() ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
+        auto b = cache.Get( IccProfile::FromMemory( copy.data(), copy.size() ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
+        REQUIRE( a );
+        REQUIRE( a == b );
+
+        auto c = cache.Get( IccProfile::FromMemory( icc.data(), icc.size() ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        auto d = cache.Get( IccProfile::FromMemory( icc.data(), icc.size() ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_16, INTENT_PERCEPTUAL );
+        auto e = cache.Get( IccProfile::Rgb( white709, primaries709, 1 ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
+        REQUIRE( c != a );
+        REQUIRE( d != a );
+        REQUIRE( e != a );
+        REQUIRE( cache.Size() == 4 );
+        REQUIRE( cache.Hits() == 1 );
+        REQUIRE( cache.Misses() == 4 );
+    }
+
+    SECTION( "Least recently used transforms are evicted" )
+    {
+        IccCache cache( 2 );
+        auto get = [&cache]( double gamma ) {
+            return cache.Get( IccProfile::Rgb( white709, primaries709, gamma ), TYPE_RGBA_FLT, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL );
+        };
+
+        auto first = get( 1 );
+        get( 2 );
+        REQUIRE( get( 1 ) == first );
+        get( 3 );
+        REQUIRE( cache.Size() == 2 );
+        REQUIRE( get( 1 ) == first );
+        REQUIRE( cache.Misses() == 3 );
+
+        get( 2 );
+        REQUIRE( cache.Misses() == 4 );
+
+        // Evicted transform is still usable by its holder
+        get( 3 );
+        REQUIRE( get( 1 ) != first );
+        const float px[4] = { 0.5f, 0.5f, 0.5f, 1.f };
+        uint8_t out[4];
+        cmsDoTransform( first.get(), px, out, 1 );
+
+        cache.Clear();
+        REQUIRE( cache.Size() == 0 );
+    }
+
+    SECTION( "Invalid profiles are not cached" )
+    {
+        IccCache cache( 4 );
+        const uint8_t garbage[16] = {};
+        REQUIRE( !cache.Get( IccProfile::FromMemory( garbage, sizeof( garbage ) ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_8, INTENT_PERCEPTUAL ) );
+        REQUIRE( cache.Size() == 0 );
+    }
+
+    SECTION( "Concurrent requests share a single transform" )
+    {
+        IccCache cache( 4 );
+        std::vector<IccTransform> results( 8 );
+        std::vector<std::thread> threads;
+        for( size_t i=0; i<results.size(); i++ )
+        {
+            threads.emplace_back( [&, i] {
+                results[i] = cache.Get( IccProfile::FromMemory( icc.data(), icc.size() ), TYPE_RGBA_8, IccProfile::Srgb(), TYPE_RGBA_FLT, INTENT_PERCEPTUAL );
+            } );
+        }
+        for( auto& t : threads ) t.join();
+
+        REQUIRE( results[0] );
+        for( auto& r : results ) REQUIRE( r == results[0] );
+        REQUIRE( cache.Size() == 1 );
+        REQUIRE( cache.Hits() + cache.Misses() == results.size() );
+    }
+}
@@ -0,0 +1,196 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Ansi.hpp>
+#include <src/util/LogRecord.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+namespace
+{
+
+template<typename... Args>
+std::string Printf( const char* fmt, Args... args )
+{
+    char tmp[512];
+    snprintf( tmp, sizeof( tmp ), fmt, args... );
+    return tmp;
+}
+
+template<typename... Args>
+std::string Format( const char* fmt, Args... args )
+{
+    const LogArg list[] = { LogArg::Make( args )..., LogArg::Make( 0 ) };
+    std::string ret;
+    LogRecord::FormatMessage( ret, fmt, list, sizeof...( Args ) );
+    return ret;
+}
+
+template<typename... Args>
+std::string Encode( LogLevel level, const char* fmt, Args... args )
+{
+    const LogArg list[] = { LogArg::Make( args )..., LogArg::Make( 0 ) };
+    std::string ret;
+    LogRecord::Encode( ret, level, "file.cpp", 42, fmt, list, sizeof...( Args ) );
+    return ret;
+}
+
+std::string Line( LogLevel level, const std::string& msg )
+{
+    std::string ret;
+    LogRecord::FormatPrefix( ret, level, "file.cpp", 42 );
+    return ret + msg + ANSI_RESET "\n";
+}
+
+}
+
+#define CHECK_FORMAT( fmt, ... ) REQUIRE( Format( fmt, ##__VA_ARGS__ ) == Printf( fmt, ##__VA_ARGS__ ) )
+
+TEST_CASE( "LogRecord formatting matches printf", "[logs][record]" )
+{
+    SECTION( "Integers" )
+    {
+        CHECK_FORMAT( "%d %i", 42, -42 );
+        CHECK_FORMAT( "[%5d|%-5d|%05d|%+d]", 7, 7, 7, 7 );
+        CHECK_FORMAT( "%u %x %X %o", 4000000000u, 0xbeefu, 0xbeefu, 8u );
+        CHECK_FORMAT( "%02x%04x", 5u, 0xabu );
+        CHECK_FORMAT( "%zu %llu %llx", size_t( 123456789012 ), 1ull << 63, ~0ull );
+        CHECK_FORMAT( "%hhd %hu", 300, 70000 );
+        CHECK_FORMAT( "%c%c", 'o', 'k' );
+    }
+
+    SECTION( "Floating point" )
+    {
+        CHECK_FORMAT( "%f %.3f %g %e", 1.5, 3.14159, 0.0001, 12345.678 );
+        CHECK_FORMAT( "%8.2f|%-8.2f", 2.5f, -2.5 );
+    }
+
+    SECTION( "Strings and pointers" )
+    {
+        CHECK_FORMAT( "%s, %s", "hello", "world" );
+        CHECK_FORMAT( "[%10s|%-10s|%.3s]", "right", "left", "truncated" );
+        CHECK_FORMAT( "%p", (void*)0x1234 );
+    }
+
+    SECTION( "Star width and precision" )
+    {
+        CHECK_FORMAT( "[%*d|%-*d]", 6, 1, 6, 2 );
+        CHECK_FORMAT( "[%*.*f]", 10, 2, 3.14159 );
+        CHECK_FORMAT( "[%.*s]", 4, "abcdefgh" );
+    }
+
+    SECTION( "Text without conversions" )
+    {
+        CHECK_FORMAT( "plain text" );
+        CHECK_FORMAT( "100%% done" );
+        CHECK_FORMAT( "" );
+    }
+
+    SECTION( "Scoped enums and bools print as integers" )
+    {
+        enum class E : uint8_t { A = 3 };
+        REQUIRE( Format( "%d %d", E::A, true ) == "3 1" );
+    }
+
+    SECTION( "Missing arguments keep the conversion text" )
+    {
+        REQUIRE( Format( "%d and %s", 1 ) == "1 and %s" );
+    }
+}
+
+TEST_CASE( "LogRecord encoding", "[logs][record]" )
+{
+    SECTION( "Record formats as the full output line" )
+    {
+        const auto rec = Encode( LogLevel::Warning, "%s has %d items (%.1f%%)", "list", 12, 37.5 );
+        std::string out;
+        REQUIRE( LogRecord::Format( out, rec.data(), rec.size() ) );
+        REQUIRE( out == Line( LogLevel::Warning, "list has 12 items (37.5%)" ) );
+    }
+
+    SECTION( "String arguments are copied" )
+    {
+        char buf[16] = "original";
+        const auto rec = Encode( LogLevel::Info, "[%s]", buf );
+        strcpy( buf, "changed" );
+
+        std::string out;
+        REQUIRE( LogRecord::Format( out, rec.data(), rec.size() ) );
+        REQUIRE( out == Line( LogLevel::Info, "[original]" ) );
+    }
+
+    SECTION( "Strings with precision are not read past it" )
+    {
+        const char unterminated[4] = { 'a', 'b', 'c', 'd' };
+        const auto rec = Encode( LogLevel::Info, "%.4s %.*s", unterminated, 2, unterminated );
+
+        std::string out;
+        REQUIRE( LogRecord::Format( out, rec.data(), rec.size() ) );
+        REQUIRE( out == Line( LogLevel::Info, "abcd ab" ) );
+    }
+
+    SECTION( "Null strings" )
+    {
+        const char* str = nullptr;
+        const auto rec = Encode( LogLevel::Info, "%s", str );
+
+        std::string out;
+        REQUIRE( LogRecord::Format( out, rec.data(), rec.size() ) );
+        REQUIRE( out == Line( LogLevel::Info, "(null)" ) );
+    }
+
+    SECTION( "Truncated record is rejected" )
+    {
+        const auto rec = Encode( LogLevel::Info, "%s", "text" );
+        std::string out;
+        REQUIRE( !LogRecord::Format( out, rec.data(), rec.size() - 1 ) );
+    }
+}
+
+TEST_CASE( "LogRecord binary file", "[logs][record]" )
+{
+    const auto rec1 = Encode( LogLevel::Info, "first %d", 1 );
+    const auto rec2 = Encode( LogLevel::Error, "second %s", "message" );
+    const auto rec3 = Encode( LogLevel::Info, "first %d", 2 );
+    const std::string text = "preformatted line\n";
+
+    LogRecord::FileWriter writer;
+    std::string file;
+    writer.Begin( file );
+    REQUIRE( writer.Write( file, rec1.data(), rec1.size() ) );
+    REQUIRE( writer.Write( file, rec2.data(), rec2.size() ) );
+    writer.WriteText( file, text.data(), text.size() );
+    const auto sizeBefore = file.size();
+    REQUIRE( writer.Write( file, rec3.data(), rec3.size() ) );
+
+    const auto expected = Line( LogLevel::Info, "first 1" ) + Line( LogLevel::Error, "second message" ) + text + Line( LogLevel::Info, "first 2" );
+
+    SECTION( "Decodes to the text output" )
+    {
+        std::string out;
+        REQUIRE( LogRecord::Decode( out, file.data(), file.size() ) );
+        REQUIRE( out == expected );
+    }
+
+    SECTION( "Strings are written once" )
+    {
+        LogRecord::FileWriter fresh;
+        std::string alone;
+        REQUIRE( fresh.Write( alone, rec3.data(), rec3.size() ) );
+        REQUIRE( file.size() - sizeBefore < alone.size() );
+    }
+
+    SECTION( "Truncated file keeps the complete records" )
+    {
+        std::string out;
+        REQUIRE( !LogRecord::Decode( out, file.data(), file.size() - 1 ) );
+        REQUIRE( out == Line( LogLevel::Info, "first 1" ) + Line( LogLevel::Error, "second message" ) + text );
+    }
+
+    SECTION( "Other files are rejected" )
+    {
+        const std::string other = "not a log file";
+        std::string out;
+        REQUIRE( !LogRecord::Decode( out, other.data(), other.size() ) );
+        REQUIRE( out.empty() );
+    }
+}
@@ -1,10 +1,12 @@
 #include "TestUtils.hpp"
 #include <atomic>
 #include <catch2/catch_all.hpp>
+#include <src/util/LogRecord.hpp>
 #include <src/util/Logs.hpp>
 #include <sys/stat.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 class LogLevelGuard
 {
@@ -22,6 +24,13 @@ public:
     ~LogSyncGuard() { SetLogSynchronized( false ); }
 };
 
+class LogAsyncGuard
+{
+public:
+    LogAsyncGuard() { SetLogAsync( true ); }
+    ~LogAsyncGuard() { SetLogAsync( false ); }
+};
+
 class LogFileGuard
 {
 public:
@@ -33,9 +42,9 @@ public:
         }
     }
 
-    void Enable()
+    void Enable( LogFileFormat format = LogFileFormat::Text )
     {
-        SetLogToFile( true );
+        SetLogToFile( true, format );
         m_enabled = true;
     }
 
@@ -49,6 +58,35 @@ private:
     bool m_enabled = false;
 };
 
+// Numbers of the "seq" messages of each thread, in output order
+static std::vector<std::vector<int>> parseSequences( const std::string& output, int threads )
+{
+    std::vector<std::vector<int>> ret( threads );
+    size_t pos = 0;
+    while( ( pos = output.find( "seq ", pos ) ) != std::string::npos )
+    {
+        int thread, idx;
+        if( sscanf( output.c_str() + pos, "seq %d %d", &thread, &idx ) == 2 && thread >= 0 && thread < threads )
+        {
+            ret[thread].push_back( idx );
+        }
+        pos += 4;
+    }
+    return ret;
+}
+
+static void logSequences( LogLevel level, int threads, int count )
+{
+    std::vector<std::thread> workers;
+    for( int t=0; t<threads; t++ )
+    {
+        workers.emplace_back( [=] {
+            for( int i=0; i<count; i++ ) mclog( level, "seq %d %d", t, i );
+        } );
+    }
+    for( auto& w : workers ) w.join();
+}
+
 static std::string captureLogOutput( LogLevel level, const char* msg )
 {
     OutputCapture capture;
@@ -430,4 +468,193 @@ TEST_CASE( "Log levels can be changed multiple times", "[logs][state]" )
 
     SetLogLevel( LogLevel::Info );
     REQUIRE( GetLogLevel() == LogLevel::Info );
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Async logging", "[logs][async]" )
+{
+    LogLevelGuard levelGuard;
+    SetLogLevel( LogLevel::Debug );
+
+    SECTION( "Messages keep their order within each thread" )
+    {
+        constexpr int Threads = 4;
+        constexpr int Count = 100;
+
+        OutputCapture capture;
+        {
+            LogAsyncGuard asyncGuard;
+            logSequences( LogLevel::Info, Threads, Count );
+            LogFlush();
+        }
+        const auto seqs = parseSequences( capture.getOutput(), Threads );
+
+        for( int t=0; t<Threads; t++ )
+        {
+            REQUIRE( seqs[t].size() == Count );
+            for( int i=0; i<Count; i++ ) REQUIRE( seqs[t][i] == i );
+        }
+    }
+
+    SECTION( "Fatal messages are written after the queued ones" )
+    {
+        OutputCapture capture;
+        LogAsyncGuard asyncGuard;
+
+        mclog( LogLevel::Info, "queued message" );
+        mclog( LogLevel::Fatal, "fatal message" );
+        const auto output = capture.getOutput();
+
+        const auto queued = output.find( "queued message" );
+        const auto fatal = output.find( "fatal message" );
+        REQUIRE( queued != std::string::npos );
+        REQUIRE( fatal != std::string::npos );
+        REQUIRE( queued < fatal );
+    }
+
+    SECTION( "Fatal messages are written after the queued ones of other threads too" )
+    {
+        constexpr int Threads = 4;
+        constexpr int Count = 50;
+
+        OutputCapture capture;
+        {
+            LogAsyncGuard asyncGuard;
+            std::vector<std::thread> workers;
+            for( int t=0; t<Threads; t++ )
+            {
+                workers.emplace_back( [=] {
+                    for( int i=0; i<Count; i++ ) mclog( LogLevel::Info, "seq %d %d", t, i );
+                    mclog( LogLevel::Fatal, "seq %d %d", t, Count );
+                } );
+            }
+            for( auto& w : workers ) w.join();
+            LogFlush();
+        }
+        const auto seqs = parseSequences( capture.getOutput(), Threads );
+
+        // The fatal message of each thread comes last among its own messages
+        for( int t=0; t<Threads; t++ )
+        {
+            REQUIRE( seqs[t].size() == Count + 1 );
+            for( int i=0; i<=Count; i++ ) REQUIRE( seqs[t][i] == i );
+        }
+    }
+
+    SECTION( "Synchronized mode blocks other threads until LogBlockEnd" )
+    {
+        LogSyncGuard syncGuard;
+        LogAsyncGuard asyncGuard;
+        SetLogSynchronized( true );
+
+        LogBlockBegin();
+
+        std::atomic<bool> started{ false };
+        std::atomic<bool> finished{ false };
+        std::thread worker( [&] {
+            started = true;
+            mclog( LogLevel::Info, "worker message" );
+            finished = true;
+        } );
+
+        while( !started.load() ) {}
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+
+        REQUIRE( !finished.load() );
+
+        LogBlockEnd();
+        worker.join();
+        REQUIRE( finished.load() );
+    }
+
+    SECTION( "Under overload messages are either written in order or counted as dropped" )
+    {
+        constexpr int Threads = 4;
+        constexpr int Count = 2000;
+
+        CwdGuard cwdGuard;
+        TempDir tempDir = TempDir::create();
+        chdir( tempDir.path() );
+
+        // Output is too large for the capture pipe, read it back from the log file instead
+        const auto nullFd = open( "/dev/null", O_WRONLY );
+        const auto stdoutFd = dup( STDOUT_FILENO );
+        fflush( stdout );
+        dup2( nullFd, STDOUT_FILENO );
+
+        LogFileGuard fileGuard;
+        fileGuard.Enable();
+        {
+            LogAsyncGuard asyncGuard;
+            logSequences( LogLevel::Debug, Threads, Count );
+        }
+        fileGuard.Disable();
+
+        fflush( stdout );
+        dup2( stdoutFd, STDOUT_FILENO );
+        close( stdoutFd );
+        close( nullFd );
+
+        std::string content;
+        FILE* f = fopen( "mcore.log", "r" );
+        REQUIRE( f != nullptr );
+        char buffer[1024];
+        while( fgets( buffer, sizeof( buffer ), f ) ) content += buffer;
+        fclose( f );
+
+        size_t dropped = 0;
+        size_t pos = 0;
+        while( ( pos = content.find( " log messages dropped", pos ) ) != std::string::npos )
+        {
+            auto start = pos;
+            while( start > 0 && isdigit( (unsigned char)content[start-1] ) ) start--;
+            dropped += strtoul( content.c_str() + start, nullptr, 10 );
+            pos++;
+        }
+
+        size_t written = 0;
+        const auto seqs = parseSequences( content, Threads );
+        for( auto& seq : seqs )
+        {
+            written += seq.size();
+            for( size_t i=1; i<seq.size(); i++ ) REQUIRE( seq[i-1] < seq[i] );
+        }
+        REQUIRE( written + dropped == Threads * Count );
+    }
+}
+
+TEST_CASE( "Binary log file decodes to the text output", "[logs][file][record]" )
+{
+    LogLevelGuard levelGuard;
+    SetLogLevel( LogLevel::Debug );
+
+    CwdGuard cwdGuard;
+    TempDir tempDir = TempDir::create();
+    chdir( tempDir.path() );
+
+    OutputCapture capture;
+    LogFileGuard fileGuard;
+    fileGuard.Enable( LogFileFormat::Binary );
+    {
+        LogAsyncGuard asyncGuard;
+        mclog( LogLevel::Info, "deferred %d %s", 1, "one" );
+        mclog( LogLevel::Warning, "deferred %.2f", 2.5 );
+        mclog( LogLevel::Fatal, "written directly" );
+        mclog( LogLevel::Debug, "deferred again" );
+    }
+    fileGuard.Disable();
+    const auto output = capture.getOutput();
+
+    FILE* f = fopen( "mcore.log", "rb" );
+    REQUIRE( f != nullptr );
+    std::string data;
+    char buffer[1024];
+    size_t rd;
+    while( ( rd = fread( buffer, 1, sizeof( buffer ), f ) ) > 0 ) data.append( buffer, rd );
+    fclose( f );
+
+    std::string text;
+    REQUIRE( LogRecord::Decode( text, data.data(), data.size() ) );
+    REQUIRE( text == output );
+    REQUIRE( stripAnsi( text ).find( "deferred 1 one" ) != std::string::npos );
+    REQUIRE( stripAnsi( text ).find( "deferred 2.50" ) != std::string::npos );
+}
@@ -0,0 +1,261 @@
+#include <catch2/catch_all.hpp>
+#include <random>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/MipChainBuilder.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::unique_ptr<Bitmap> MakeBitmap( uint32_t width, uint32_t height )
+{
+    std::mt19937 rng( width * 31 + height );
+    auto bmp = std::make_unique<Bitmap>( width, height );
+    auto ptr = bmp->Data();
+    for( size_t i=0; i<size_t( width ) * height * 4; i++ ) ptr[i] = uint8_t( rng() );
+    return bmp;
+}
+
+std::unique_ptr<BitmapHdr> MakeBitmapHdr( uint32_t width, uint32_t height )
+{
+    std::mt19937 rng( width * 31 + height );
+    std::uniform_real_distribution<float> dist( 0.f, 8.f );
+    auto bmp = std::make_unique<BitmapHdr>( width, height, Colorspace::BT709 );
+    auto ptr = bmp->Data();
+    for( size_t i=0; i<size_t( width ) * height * 4; i++ ) ptr[i] = dist( rng );
+    return bmp;
+}
+
+// Builds the same levels with repeated ResizeNew calls, for comparison
+std::unique_ptr<Bitmap> ResizeChain( const Bitmap& bmp, const MipChainBuilder& builder, TaskDispatch* td )
+{
+    std::unique_ptr<Bitmap> level;
+    const Bitmap* src = &bmp;
+    for( size_t l=1; l<builder.Levels().size(); l++ )
+    {
+        level = src->ResizeNew( builder.Levels()[l].width, builder.Levels()[l].height, td );
+        src = level.get();
+    }
+    return level;
+}
+
+// Straightforward reduction of one level to the next, with the same filter
+std::vector<float> ReduceReference( const float* src, uint32_t width, uint32_t height )
+{
+    const auto w = std::max( 1u, width / 2 );
+    const auto h = std::max( 1u, height / 2 );
+    auto taps = []( uint32_t x, uint32_t size, uint32_t out ) -> std::pair<uint32_t, uint32_t> {
+        if( size == 1 ) return { 0, 1 };
+        return { x * 2, x == out - 1 && ( size & 1 ) ? 3 : 2 };
+    };
+
+    std::vector<float> ret( size_t( w ) * h * 4 );
+    for( uint32_t y=0; y<h; y++ )
+    {
+        const auto [y0, ny] = taps( y, height, h );
+        for( uint32_t x=0; x<w; x++ )
+        {
+            const auto [x0, nx] = taps( x, width, w );
+            for( int c=0; c<4; c++ )
+            {
+                float sum = 0;
+                for( uint32_t j=0; j<ny; j++ )
+                {
+                    for( uint32_t i=0; i<nx; i++ )
+                    {
+                        sum += src[( size_t( y0 + j ) * width + x0 + i ) * 4 + c];
+                    }
+                }
+                ret[( size_t( y ) * w + x ) * 4 + c] = sum / ( nx * ny );
+            }
+        }
+    }
+    return ret;
+}
+
+}
+
+TEST_CASE( "MipChainBuilder", "[mipchainbuilder]" )
+{
+    SECTION( "Level layout" )
+    {
+        MipChainBuilder builder( 7, 5, 4 );
+        const auto& levels = builder.Levels();
+        REQUIRE( levels.size() == 3 );
+        REQUIRE( levels[0].width == 7 );
+        REQUIRE( levels[0].height == 5 );
+        REQUIRE( levels[0].offset == 0 );
+        REQUIRE( levels[0].size == 7 * 5 * 4 );
+        REQUIRE( levels[1].width == 3 );
+        REQUIRE( levels[1].height == 2 );
+        REQUIRE( levels[1].offset == 7 * 5 * 4 );
+        REQUIRE( levels[2].width == 1 );
+        REQUIRE( levels[2].height == 1 );
+        REQUIRE( builder.Size() == ( 35 + 6 + 1 ) * 4 );
+
+        REQUIRE( MipChainBuilder( 1024, 16, 16 ).Levels().size() == 11 );
+        REQUIRE( MipChainBuilder( 1024, 16, 16, false ).Levels().size() == 1 );
+        REQUIRE( MipChainBuilder( 1, 1, 8 ).Levels().size() == 1 );
+    }
+
+    SECTION( "Level 0 is a copy of the source" )
+    {
+        auto bmp = MakeBitmap( 33, 17 );
+        MipChainBuilder builder( 33, 17, 4 );
+        std::vector<uint8_t> out( builder.Size() );
+        builder.Build( *bmp, out.data() );
+        REQUIRE( memcmp( out.data(), bmp->Data(), 33 * 17 * 4 ) == 0 );
+    }
+
+    SECTION( "sRGB data is filtered in linear light" )
+    {
+        Bitmap bmp( 2, 1 );
+        const uint8_t px[8] = { 0, 0, 0, 255, 255, 255, 255, 0 };
+        memcpy( bmp.Data(), px, sizeof( px ) );
+
+        MipChainBuilder builder( 2, 1, 4 );
+        std::vector<uint8_t> out( builder.Size() );
+        builder.Build( bmp, out.data() );
+
+        const auto level = out.data() + builder.Levels()[1].offset;
+        REQUIRE( level[0] == 188 );
+        REQUIRE( level[1] == 188 );
+        REQUIRE( level[2] == 188 );
+        REQUIRE( level[3] == 128 );
+    }
+
+    SECTION( "Uniform color is preserved" )
+    {
+        for( int v=0; v<256; v++ )
+        {
+            Bitmap bmp( 13, 9 );
+            memset( bmp.Data(), v, 13 * 9 * 4 );
+
+            MipChainBuilder builder( 13, 9, 4 );
+            std::vector<uint8_t> out( builder.Size() );
+            builder.Build( bmp, out.data() );
+            for( auto c : out ) REQUIRE( c == v );
+        }
+    }
+
+    SECTION( "Odd sizes use three taps at the edge" )
+    {
+        BitmapHdr bmp( 3, 1, Colorspace::BT709 );
+        const float px[12] = { 1, 1, 1, 1, 2, 2, 2, 2, 6, 6, 6, 6 };
+        memcpy( bmp.Data(), px, sizeof( px ) );
+
+        MipChainBuilder builder( 3, 1, 16 );
+        std::vector<float> out( builder.Size() / sizeof( float ) );
+        builder.Build( bmp, out.data() );
+        REQUIRE( builder.Levels().size() == 2 );
+        for( int c=0; c<4; c++ ) REQUIRE( out[12+c] == Catch::Approx( 3.f ) );
+    }
+
+    SECTION( "HDR levels match reference reduction" )
+    {
+        for( auto [width, height] : { std::pair( 37u, 23u ), std::pair( 64u, 64u ), std::pair( 100u, 3u ), std::pair( 1u, 9u ) } )
+        {
+            auto bmp = MakeBitmapHdr( width, height );
+            MipChainBuilder builder( width, height, 16 );
+            std::vector<float> out( builder.Size() / sizeof( float ) );
+            builder.Build( *bmp, out.data() );
+
+            std::vector<float> ref( bmp->Data(), bmp->Data() + size_t( width ) * height * 4 );
+            const auto& levels = builder.Levels();
+            for( size_t l=1; l<levels.size(); l++ )
+            {
+                ref = ReduceReference( ref.data(), levels[l-1].width, levels[l-1].height );
+                REQUIRE( ref.size() == levels[l].size / sizeof( float ) );
+                const auto level = out.data() + levels[l].offset / sizeof( float );
+                for( size_t i=0; i<ref.size(); i++ ) REQUIRE( level[i] == Catch::Approx( ref[i] ).epsilon( 1e-4 ) );
+            }
+        }
+    }
+
+    SECTION( "Parallel build gives identical output" )
+    {
+        TaskDispatch td( 3, "Worker" );
+
+        for( auto [width, height] : { std::pair( 1000u, 701u ), std::pair( 517u, 1111u ), std::pair( 4096u, 65u ) } )
+        {
+            auto bmp = MakeBitmap( width, height );
+            MipChainBuilder serial( width, height, 4 );
+            MipChainBuilder parallel( width, height, 4, true, &td );
+            std::vector<uint8_t> a( serial.Size() ), b( parallel.Size() );
+            serial.Build( *bmp, a.data() );
+            parallel.Build( *bmp, b.data() );
+            REQUIRE( a == b );
+
+            auto hdr = MakeBitmapHdr( width, height );
+            MipChainBuilder serialHdr( width, height, 16 );
+            MipChainBuilder parallelHdr( width, height, 16, true, &td );
+            std::vector<uint8_t> c( serialHdr.Size() ), d( parallelHdr.Size() );
+            serialHdr.Build( *hdr, c.data() );
+            parallelHdr.Build( *hdr, d.data() );
+            REQUIRE( c == d );
+        }
+    }
+}
+
+TEST_CASE( "MipChainBuilder benchmarks", "[!benchmark][mipchainbuilder]" )
+{
+    constexpr uint32_t Size = 4096;
+    auto bmp = MakeBitmap( Size, Size );
+    auto hdr = MakeBitmapHdr( Size, Size );
+
+    TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() - 1 ), "bench" );
+    td.WaitInit();
+
+    SECTION( "Single thread" )
+    {
+        MipChainBuilder builder( Size, Size, 4, true );
+        std::vector<uint8_t> out( builder.Size() );
+        BENCHMARK( "sRGB 4096x4096" )
+        {
+            builder.Build( *bmp, out.data() );
+            return out[0];
+        };
+
+        BENCHMARK( "sRGB 4096x4096, ResizeNew chain" )
+        {
+            return ResizeChain( *bmp, builder, nullptr );
+        };
+
+        MipChainBuilder builderHdr( Size, Size, 8, true );
+        std::vector<uint8_t> outHdr( builderHdr.Size() );
+        BENCHMARK( "Half float 4096x4096" )
+        {
+            builderHdr.Build( *hdr, outHdr.data() );
+            return outHdr[0];
+        };
+    }
+
+    SECTION( "Parallel" )
+    {
+        MipChainBuilder builder( Size, Size, 4, true, &td );
+        std::vector<uint8_t> out( builder.Size() );
+        BENCHMARK( "sRGB 4096x4096, parallel" )
+        {
+            builder.Build( *bmp, out.data() );
+            return out[0];
+        };
+
+        BENCHMARK( "sRGB 4096x4096, ResizeNew chain, parallel" )
+        {
+            return ResizeChain( *bmp, builder, &td );
+        };
+
+        MipChainBuilder builderHdr( Size, Size, 8, true, &td );
+        std::vector<uint8_t> outHdr( builderHdr.Size() );
+        BENCHMARK( "Half float 4096x4096, parallel" )
+        {
+            builderHdr.Build( *hdr, outHdr.data() );
+            return outHdr[0];
+        };
+    }
+}
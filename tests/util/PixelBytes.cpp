@@ -2,6 +2,8 @@
 #include <catch2/catch_all.hpp>
 #include <src/util/PixelBytes.hpp>
 #include <stdint.h>
+#include <string.h>
+#include <vector>
 
 TEST_CASE( "PixelBytes helpers", "[pixelbytes]" )
 {
@@ -37,20 +39,135 @@ TEST_CASE( "PixelBytes helpers", "[pixelbytes]" )
         }
         REQUIRE( data[0] == 0.0f );
         REQUIRE( data[count - 1] == float( count - 1 ) );
-        delete[] data;
+        PixelFree( data );
     }
 
     SECTION( "PixelAlloc with custom channels" )
     {
         auto* data = PixelAlloc<uint8_t>( 2, 2, 1 );
         REQUIRE( data != nullptr );
-        delete[] data;
+        PixelFree( data );
     }
 
     SECTION( "PixelAlloc of zero size" )
     {
         auto* data = PixelAlloc<int>( 0, 0 );
-        REQUIRE( data != nullptr ); // new[] of size 0 returns a valid pointer
-        delete[] data;
+        REQUIRE( data != nullptr );
+        PixelFree( data );
+    }
+}
+
+TEST_CASE( "PixelBytes allocator", "[pixelbytes]" )
+{
+    SECTION( "Buffers are aligned" )
+    {
+        std::vector<uint8_t*> buffers;
+        for( size_t w : { 1, 3, 17, 100, 333, 1000, 1920 } ) buffers.emplace_back( PixelAlloc<uint8_t>( w, 7 ) );
+        for( auto ptr : buffers )
+        {
+            REQUIRE( uintptr_t( ptr ) % PixelAlignment == 0 );
+            PixelFree( ptr );
+        }
     }
+
+    SECTION( "Huge page sized buffers are aligned" )
+    {
+        PixelPoolTrim();
+        for( size_t size : { 2 * 1024 * 1024 - 64, 2 * 1024 * 1024, 2 * 1024 * 1024 + 1, 5 * 1024 * 1024 } )
+        {
+            auto ptr = (uint8_t*)PixelAllocBytes( size );
+            REQUIRE( uintptr_t( ptr ) % PixelAlignment == 0 );
+            memset( ptr, 0xFF, size );
+            PixelFree( ptr );
+        }
+        PixelPoolTrim();
+    }
+
+    SECTION( "Live and peak bytes are tracked" )
+    {
+        const auto before = GetPixelAllocStats();
+        auto a = PixelAlloc<float>( 10, 10 );
+        auto b = PixelAlloc<uint8_t>( 10, 10 );
+        auto during = GetPixelAllocStats();
+        REQUIRE( during.live == before.live + 10 * 10 * 4 * sizeof( float ) + 10 * 10 * 4 );
+        REQUIRE( during.peak >= during.live );
+        PixelFree( a );
+        PixelFree( b );
+        REQUIRE( GetPixelAllocStats().live == before.live );
+        REQUIRE( GetPixelAllocStats().peak >= during.live );
+    }
+
+    SECTION( "Large buffers are recycled" )
+    {
+        PixelPoolTrim();
+        const auto before = GetPixelAllocStats();
+        auto a = PixelAlloc<uint8_t>( 1000, 1000 );
+        REQUIRE( GetPixelAllocStats().poolMisses == before.poolMisses + 1 );
+        PixelFree( a );
+        REQUIRE( GetPixelAllocStats().pooled >= 1000 * 1000 * 4 );
+
+        // Slightly smaller request falls into the same size class
+        auto b = PixelAlloc<uint8_t>( 999, 1000 );
+        auto stats = GetPixelAllocStats();
+        REQUIRE( b == a );
+        REQUIRE( stats.poolHits == before.poolHits + 1 );
+        REQUIRE( stats.pooled == 0 );
+        memset( b, 0xFF, 999 * 1000 * 4 );
+
+        // Different size class needs a new buffer
+        auto c = PixelAlloc<uint8_t>( 2000, 1000 );
+        REQUIRE( GetPixelAllocStats().poolMisses == before.poolMisses + 2 );
+        PixelFree( c );
+        PixelFree( b );
+
+        PixelPoolTrim();
+        REQUIRE( GetPixelAllocStats().pooled == 0 );
+        REQUIRE( GetPixelAllocStats().live == before.live );
+    }
+
+    SECTION( "Small buffers are not pooled" )
+    {
+        PixelPoolTrim();
+        const auto before = GetPixelAllocStats();
+        PixelFree( PixelAlloc<uint8_t>( 16, 16 ) );
+        const auto after = GetPixelAllocStats();
+        REQUIRE( after.pooled == 0 );
+        REQUIRE( after.poolHits == before.poolHits );
+        REQUIRE( after.poolMisses == before.poolMisses );
+    }
+
+    SECTION( "PixelBuffer releases through the allocator" )
+    {
+        const auto before = GetPixelAllocStats();
+        {
+            PixelBuffer<float> buf( PixelAlloc<float>( 8, 8 ) );
+            REQUIRE( GetPixelAllocStats().live > before.live );
+        }
+        REQUIRE( GetPixelAllocStats().live == before.live );
+    }
+}
+
+TEST_CASE( "PixelBytes allocator benchmarks", "[!benchmark][pixelbytes]" )
+{
+    constexpr size_t Width = 1920;
+    constexpr size_t Height = 1080;
+
+    // Pages are touched, so that the cost of fresh memory is included
+    BENCHMARK( "pooled" )
+    {
+        auto ptr = PixelAlloc<uint8_t>( Width, Height );
+        memset( ptr, 1, PixelChannelCount( Width, Height ) );
+        const auto ret = ptr[0];
+        PixelFree( ptr );
+        return ret;
+    };
+
+    BENCHMARK( "new[]" )
+    {
+        auto ptr = new uint8_t[PixelChannelCount( Width, Height )];
+        memset( ptr, 1, PixelChannelCount( Width, Height ) );
+        const auto ret = ptr[0];
+        delete[] ptr;
+        return ret;
+    };
 }
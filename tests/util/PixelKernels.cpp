@@ -0,0 +1,92 @@
+#include <catch2/catch_all.hpp>
+#include <random>
+#include <src/util/PixelKernels.hpp>
+#include <src/util/SimdLevel.hpp>
+#include <stdint.h>
+#include <tests/util/SimdTestUtils.hpp>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+
+template<typename T>
+std::vector<T> Random( size_t count, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::vector<T> ret( count );
+    for( auto& v : ret )
+    {
+        if constexpr( std::is_floating_point_v<T> ) v = std::uniform_real_distribution<T>( -4, 4 )( rng );
+        else v = T( rng() );
+    }
+    return ret;
+}
+
+}
+
+TEST_CASE( "SimdLevel", "[simd]" )
+{
+    SECTION( "Forced level is clamped to the detected one" )
+    {
+        ScopedSimdLevel scoped( SimdLevel::Avx512 );
+        REQUIRE( GetSimdLevel() == DetectSimdLevel() );
+        REQUIRE( SetSimdLevel( SimdLevel::Scalar ) == SimdLevel::Scalar );
+        REQUIRE( GetSimdLevel() == SimdLevel::Scalar );
+    }
+}
+
+TEST_CASE( "PixelKernels", "[simd]" )
+{
+    // Sizes cover the tails of every vector width
+    const size_t sizes[] = { 0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 1001 };
+
+    for( auto level : SimdLevels() )
+    {
+        INFO( SimdLevelName( level ) );
+        for( auto size : sizes )
+        {
+            INFO( size << " items" );
+            const auto rgba = Random<uint32_t>( size, size );
+            const auto rgbaf = Random<float>( size * 4, size );
+            const auto halves = Random<uint16_t>( size, size );
+
+            std::vector<uint32_t> expected8( rgba );
+            std::vector<uint32_t> result8( rgba );
+            std::vector<float> expectedF( rgbaf );
+            std::vector<float> resultF( rgbaf );
+            std::vector<float> expectedH( size );
+            std::vector<float> resultH( size );
+            std::vector<uint16_t> expectedF16( size * 4 );
+            std::vector<uint16_t> resultF16( size * 4 );
+
+            {
+                ScopedSimdLevel scoped( SimdLevel::Scalar );
+                PixelKernels::SetAlpha( expected8.data(), size, 0x7F );
+                PixelKernels::BgrToRgb( expected8.data(), size );
+                PixelKernels::SetAlpha( expectedF.data(), size, 0.5f );
+                PixelKernels::HalfToFloat( halves.data(), expectedH.data(), size );
+                PixelKernels::FloatToHalf( rgbaf.data(), expectedF16.data(), size * 4 );
+            }
+            {
+                ScopedSimdLevel scoped( level );
+                REQUIRE( GetSimdLevel() == level );
+                PixelKernels::SetAlpha( result8.data(), size, 0x7F );
+                PixelKernels::BgrToRgb( result8.data(), size );
+                PixelKernels::SetAlpha( resultF.data(), size, 0.5f );
+                PixelKernels::HalfToFloat( halves.data(), resultH.data(), size );
+                PixelKernels::FloatToHalf( rgbaf.data(), resultF16.data(), size * 4 );
+            }
+
+            REQUIRE( result8 == expected8 );
+            REQUIRE( resultF == expectedF );
+            REQUIRE( resultF16 == expectedF16 );
+            for( size_t i=0; i<size; i++ )
+            {
+                // NaN payloads may differ
+                if( expectedH[i] != expectedH[i] ) REQUIRE( resultH[i] != resultH[i] );
+                else REQUIRE( resultH[i] == expectedH[i] );
+            }
+        }
+    }
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <functional>
+#include <src/util/PixelTransform.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+
+// Each pixel is unique, with all of its bytes set
+std::vector<uint8_t> MakeImage( uint32_t width, uint32_t height, size_t pixelSize )
+{
+    std::vector<uint8_t> ret( size_t( width ) * height * pixelSize );
+    for( size_t i=0; i<size_t( width ) * height; i++ )
+    {
+        for( size_t k=0; k<pixelSize; k++ ) ret[i * pixelSize + k] = uint8_t( ( i >> ( 8 * ( k % 4 ) ) ) ^ ( k * 37 ) );
+    }
+    return ret;
+}
+
+struct Op
+{
+    const char* name;
+    bool swap;
+    std::function<void( void*, const void*, uint32_t, uint32_t, size_t, TaskDispatch* )> fn;
+    // Source index of destination pixel (x, y), for source of width w and height h
+    std::function<size_t( uint32_t x, uint32_t y, uint32_t w, uint32_t h )> src;
+};
+
+const std::vector<Op>& Ops()
+{
+    static const std::vector<Op> ops = {
+        { "Transpose", true, PixelTransform::Transpose, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( x ) * w + y; } },
+        { "Transverse", true, PixelTransform::Transverse, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( h - 1 - x ) * w + ( w - 1 - y ); } },
+        { "Rotate90", true, PixelTransform::Rotate90, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( h - 1 - x ) * w + y; } },
+        { "Rotate270", true, PixelTransform::Rotate270, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( x ) * w + ( w - 1 - y ); } },
+        { "Rotate180", false, []( void* dst, const void* src, uint32_t w, uint32_t h, size_t ps, TaskDispatch* td ) {
+            memcpy( dst, src, size_t( w ) * h * ps );
+            PixelTransform::Rotate180( dst, w, h, ps, td );
+        }, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( h - 1 - y ) * w + ( w - 1 - x ); } },
+        { "FlipHorizontal", false, []( void* dst, const void* src, uint32_t w, uint32_t h, size_t ps, TaskDispatch* td ) {
+            memcpy( dst, src, size_t( w ) * h * ps );
+            PixelTransform::FlipHorizontal( dst, w, h, ps, td );
+        }, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( y ) * w + ( w - 1 - x ); } },
+        { "FlipVertical", false, []( void* dst, const void* src, uint32_t w, uint32_t h, size_t ps, TaskDispatch* td ) {
+            memcpy( dst, src, size_t( w ) * h * ps );
+            PixelTransform::FlipVertical( dst, w, h, ps, td );
+        }, []( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) { return size_t( h - 1 - y ) * w + x; } },
+    };
+    return ops;
+}
+
+bool Verify( const Op& op, uint32_t w, uint32_t h, size_t pixelSize, TaskDispatch* td )
+{
+    const auto src = MakeImage( w, h, pixelSize );
+    std::vector<uint8_t> dst( src.size() );
+    op.fn( dst.data(), src.data(), w, h, pixelSize, td );
+
+    const auto dw = op.swap ? h : w;
+    const auto dh = op.swap ? w : h;
+    for( uint32_t y=0; y<dh; y++ )
+    {
+        for( uint32_t x=0; x<dw; x++ )
+        {
+            const auto s = op.src( x, y, w, h );
+            if( memcmp( dst.data() + ( size_t( y ) * dw + x ) * pixelSize, src.data() + s * pixelSize, pixelSize ) != 0 ) return false;
+        }
+    }
+    return true;
+}
+
+}
+
+TEST_CASE( "PixelTransform", "[pixeltransform]" )
+{
+    SECTION( "All transforms match the reference" )
+    {
+        const std::pair<uint32_t, uint32_t> sizes[] = { { 1, 1 }, { 1, 9 }, { 9, 1 }, { 2, 2 }, { 3, 2 }, { 8, 8 }, { 16, 4 }, { 17, 13 }, { 64, 64 }, { 65, 63 }, { 131, 77 } };
+        for( const auto& op : Ops() )
+        {
+            for( size_t pixelSize : { 4, 8, 16 } )
+            {
+                for( const auto& [w, h] : sizes )
+                {
+                    INFO( op.name << " " << w << "x" << h << ", " << pixelSize << " bytes per pixel" );
+                    REQUIRE( Verify( op, w, h, pixelSize, nullptr ) );
+                }
+            }
+        }
+    }
+
+    SECTION( "Orient applies the EXIF orientation" )
+    {
+        // Index in Ops() of the transform for each orientation, or -1 for none
+        const int ops[] = { -1, -1, 5, 4, 6, 0, 2, 1, 3 };
+        for( int orientation=0; orientation<=8; orientation++ )
+        {
+            for( size_t pixelSize : { 4, 8, 16 } )
+            {
+                INFO( "orientation " << orientation << ", " << pixelSize << " bytes per pixel" );
+                const auto src = MakeImage( 17, 13, pixelSize );
+                std::vector<uint8_t> expected( src.size() );
+                std::vector<uint8_t> dst( src.size() );
+                if( ops[orientation] < 0 )
+                {
+                    expected = src;
+                }
+                else
+                {
+                    Ops()[ops[orientation]].fn( expected.data(), src.data(), 17, 13, pixelSize, nullptr );
+                }
+                PixelTransform::Orient( dst.data(), src.data(), 17, 13, pixelSize, orientation );
+                REQUIRE( dst == expected );
+            }
+        }
+    }
+
+    SECTION( "MapRect selects the same pixels as the oriented image" )
+    {
+        constexpr uint32_t w = 7;
+        constexpr uint32_t h = 5;
+        const auto src = MakeImage( w, h, 4 );
+        for( int orientation=1; orientation<=8; orientation++ )
+        {
+            INFO( "orientation " << orientation );
+            std::vector<uint8_t> oriented( src.size() );
+            PixelTransform::Orient( oriented.data(), src.data(), w, h, 4, orientation );
+            const auto ow = PixelTransform::SwapsAxes( orientation ) ? h : w;
+
+            uint32_t x = 1, y = 2, rw = 3, rh = 2;
+            std::vector<uint32_t> expected;
+            for( uint32_t i=y; i<y+rh; i++ )
+            {
+                for( uint32_t j=x; j<x+rw; j++ ) expected.emplace_back( ( (const uint32_t*)oriented.data() )[i * ow + j] );
+            }
+
+            PixelTransform::MapRect( orientation, w, h, x, y, rw, rh );
+            REQUIRE( x + rw <= w );
+            REQUIRE( y + rh <= h );
+            std::vector<uint32_t> mapped;
+            for( uint32_t i=y; i<y+rh; i++ )
+            {
+                for( uint32_t j=x; j<x+rw; j++ ) mapped.emplace_back( ( (const uint32_t*)src.data() )[i * w + j] );
+            }
+
+            std::sort( expected.begin(), expected.end() );
+            std::sort( mapped.begin(), mapped.end() );
+            REQUIRE( mapped == expected );
+        }
+    }
+
+    SECTION( "Multithreaded transforms match the reference" )
+    {
+        TaskDispatch td( 4, "test-transform" );
+        for( const auto& op : Ops() )
+        {
+            for( size_t pixelSize : { 4, 8, 16 } )
+            {
+                INFO( op.name << ", " << pixelSize << " bytes per pixel" );
+                REQUIRE( Verify( op, 1201, 1003, pixelSize, &td ) );
+            }
+        }
+    }
+}
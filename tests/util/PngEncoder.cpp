@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <png.h>
+#include <random>
+#include <src/util/PngEncoder.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+std::vector<uint8_t> Encode( const std::vector<uint32_t>& pixels, uint32_t w, uint32_t h, PngEncoder::Level level, TaskDispatch* td = nullptr )
+{
+    auto f = tmpfile();
+    REQUIRE( f );
+    REQUIRE( PngEncoder::Write( fileno( f ), pixels.data(), w, h, level, td ) );
+    std::vector<uint8_t> ret( lseek( fileno( f ), 0, SEEK_END ) );
+    REQUIRE( pread( fileno( f ), ret.data(), ret.size(), 0 ) == ssize_t( ret.size() ) );
+    fclose( f );
+    return ret;
+}
+
+// Reference encoding with the libpng simplified API, at its default settings
+std::vector<uint8_t> EncodeLibpng( const std::vector<uint32_t>& pixels, uint32_t w, uint32_t h )
+{
+    png_image image = {};
+    image.version = PNG_IMAGE_VERSION;
+    image.width = w;
+    image.height = h;
+    image.format = PNG_FORMAT_RGBA;
+    png_alloc_size_t size = 0;
+    png_image_write_get_memory_size( image, size, 0, pixels.data(), 0, nullptr );
+    std::vector<uint8_t> buf( size );
+    png_image_write_to_memory( &image, buf.data(), &size, 0, pixels.data(), 0, nullptr );
+    buf.resize( size );
+    return buf;
+}
+
+std::vector<uint32_t> Decode( const std::vector<uint8_t>& png, uint32_t w, uint32_t h )
+{
+    png_image image = {};
+    image.version = PNG_IMAGE_VERSION;
+    REQUIRE( png_image_begin_read_from_memory( &image, png.data(), png.size() ) );
+    image.format = PNG_FORMAT_RGBA;
+    REQUIRE( image.width == w );
+    REQUIRE( image.height == h );
+    std::vector<uint32_t> ret( size_t( w ) * h );
+    REQUIRE( png_image_finish_read( &image, nullptr, ret.data(), 0, nullptr ) );
+    return ret;
+}
+
+// Smooth gradients with sharp edges, which exercise all filters
+std::vector<uint32_t> MakeImage( uint32_t w, uint32_t h, bool noise )
+{
+    std::mt19937 rng( w * 31 + h );
+    std::vector<uint32_t> ret( size_t( w ) * h );
+    for( uint32_t y=0; y<h; y++ )
+    {
+        for( uint32_t x=0; x<w; x++ )
+        {
+            if( noise )
+            {
+                ret[size_t( y ) * w + x] = rng();
+            }
+            else
+            {
+                const uint32_t r = x * 255 / w;
+                const uint32_t g = ( x / 16 + y / 16 ) % 2 ? 0xE0 : 0x20;
+                const uint32_t b = y * 3;
+                const uint32_t a = 0xFF - ( x ^ y ) % 7;
+                ret[size_t( y ) * w + x] = r | ( g << 8 ) | ( ( b & 0xFF ) << 16 ) | ( a << 24 );
+            }
+        }
+    }
+    return ret;
+}
+
+// Large flat areas with lines of text, as in screenshots. Glyphs are 8x16 cells, drawn from a small
+// alphabet of random patterns.
+std::vector<uint32_t> MakeScreenshot( uint32_t w, uint32_t h )
+{
+    std::mt19937 rng( 1 );
+    std::vector<uint64_t> glyphs( 64 );
+    for( auto& g : glyphs ) g = ( uint64_t( rng() ) << 32 ) | rng();
+    std::vector<uint32_t> text( ( w / 8 ) * ( h / 16 ) );
+    for( auto& t : text ) t = rng() % 80;
+
+    std::vector<uint32_t> ret( size_t( w ) * h, 0xFF2A2A2A );
+    for( uint32_t y=0; y<h; y++ )
+    {
+        for( uint32_t x=0; x<w; x++ )
+        {
+            auto& px = ret[size_t( y ) * w + x];
+            if( x < 300 )
+            {
+                px = 0xFF3C3530 + ( y / 40 ) % 2 * 0x080808;
+            }
+            else if( x / 8 < w / 8 && y / 16 < h / 16 && y % 16 < 12 )
+            {
+                const auto t = text[( y / 16 ) * ( w / 8 ) + x / 8];
+                if( t < glyphs.size() && ( glyphs[t] >> ( ( y % 16 ) * 4 + x % 8 ) & 1 ) ) px = 0xFFD0D0D0;
+            }
+        }
+    }
+    return ret;
+}
+
+}
+
+TEST_CASE( "PngEncoder", "[pngencoder]" )
+{
+    const std::pair<uint32_t, uint32_t> sizes[] = { { 1, 1 }, { 1, 7 }, { 3, 2 }, { 8, 1 }, { 37, 19 }, { 16, 20000 }, { 1024, 700 } };
+    const PngEncoder::Level levels[] = { PngEncoder::Level::Fast, PngEncoder::Level::Default, PngEncoder::Level::Small };
+
+    SECTION( "Round trip is lossless" )
+    {
+        for( const auto& [w, h] : sizes )
+        {
+            for( bool noise : { false, true } )
+            {
+                const auto pixels = MakeImage( w, h, noise );
+                for( auto level : levels )
+                {
+                    INFO( w << "x" << h << ", level " << int( level ) << ( noise ? ", noise" : "" ) );
+                    REQUIRE( Decode( Encode( pixels, w, h, level ), w, h ) == pixels );
+                }
+            }
+        }
+    }
+
+    SECTION( "Output does not depend on workers" )
+    {
+        TaskDispatch td( 4, "test-png" );
+        for( auto level : levels )
+        {
+            INFO( "level " << int( level ) );
+            const auto pixels = MakeImage( 1201, 1003, false );
+            const auto png = Encode( pixels, 1201, 1003, level, &td );
+            REQUIRE( png == Encode( pixels, 1201, 1003, level ) );
+            REQUIRE( Decode( png, 1201, 1003 ) == pixels );
+        }
+    }
+
+    SECTION( "Smaller levels compress better" )
+    {
+        const auto pixels = MakeScreenshot( 1920, 1080 );
+        const auto fast = Encode( pixels, 1920, 1080, PngEncoder::Level::Fast );
+        const auto small = Encode( pixels, 1920, 1080, PngEncoder::Level::Small );
+        REQUIRE( small.size() < fast.size() );
+        REQUIRE( fast.size() < pixels.size() );
+    }
+
+    SECTION( "Invalid fd returns false" )
+    {
+        const auto pixels = MakeImage( 4, 4, false );
+        REQUIRE( PngEncoder::Write( -1, pixels.data(), 4, 4 ) == false );
+    }
+}
+
+TEST_CASE( "PngEncoder benchmarks", "[!benchmark][pngencoder]" )
+{
+    TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() ) - 1, "bench-png" );
+
+    constexpr uint32_t w = 3840;
+    constexpr uint32_t h = 2160;
+    const auto pixels = MakeScreenshot( w, h );
+
+    const auto libpng = EncodeLibpng( pixels, w, h ).size();
+    const auto fast = Encode( pixels, w, h, PngEncoder::Level::Fast ).size();
+    const auto def = Encode( pixels, w, h, PngEncoder::Level::Default ).size();
+    const auto small = Encode( pixels, w, h, PngEncoder::Level::Small ).size();
+    INFO( "libpng " << libpng / 1024 << " KB, Fast " << fast / 1024 << " KB, Default " << def / 1024 << " KB, Small " << small / 1024 << " KB" );
+    CHECK( small < fast );
+
+    BENCHMARK( "libpng 3840x2160" )
+    {
+        return EncodeLibpng( pixels, w, h );
+    };
+
+    BENCHMARK( "Fast 3840x2160" )
+    {
+        return Encode( pixels, w, h, PngEncoder::Level::Fast );
+    };
+
+    BENCHMARK( "Fast 3840x2160, threaded" )
+    {
+        return Encode( pixels, w, h, PngEncoder::Level::Fast, &td );
+    };
+
+    BENCHMARK( "Default 3840x2160" )
+    {
+        return Encode( pixels, w, h, PngEncoder::Level::Default );
+    };
+
+    BENCHMARK( "Default 3840x2160, threaded" )
+    {
+        return Encode( pixels, w, h, PngEncoder::Level::Default, &td );
+    };
+
+    BENCHMARK( "Small 3840x2160, threaded" )
+    {
+        return Encode( pixels, w, h, PngEncoder::Level::Small, &td );
+    };
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <src/util/SimdLevel.hpp>
+#include <vector>
+
+// Restores the detected level when leaving scope
+struct ScopedSimdLevel
+{
+    explicit ScopedSimdLevel( SimdLevel level ) : level( SetSimdLevel( level ) ) {}
+    ~ScopedSimdLevel() { SetSimdLevel( DetectSimdLevel() ); }
+    SimdLevel level;
+};
+
+// All levels up to the detected one, scalar first
+inline std::vector<SimdLevel> SimdLevels()
+{
+    std::vector<SimdLevel> ret;
+    for( auto level : { SimdLevel::Scalar, SimdLevel::Sse41, SimdLevel::Avx2, SimdLevel::Avx512 } )
+    {
+        if( level <= DetectSimdLevel() ) ret.emplace_back( level );
+    }
+    return ret;
+}
@@ -0,0 +1,133 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/StripPipeline.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <src/util/Tonemapper.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+
+class TestSource : public StripSource
+{
+public:
+    TestSource( uint32_t width, uint32_t height )
+        : m_width( width )
+        , m_height( height )
+        , m_data( size_t( width ) * height * 4 )
+    {
+        for( uint32_t y = 0; y < height; y++ )
+        {
+            for( uint32_t x = 0; x < width; x++ )
+            {
+                auto px = m_data.data() + ( size_t( y ) * width + x ) * 4;
+                px[0] = float( x ) / width * 4.f;
+                px[1] = float( y ) / height * 2.f;
+                px[2] = float( ( x ^ y ) & 0xFF ) / 64.f;
+                px[3] = 1.f;
+            }
+        }
+    }
+
+    uint32_t Width() const override { return m_width; }
+    uint32_t Height() const override { return m_height; }
+
+    void Read( float* dst, uint32_t y, uint32_t rows ) override
+    {
+        REQUIRE( y + rows <= m_height );
+        memcpy( dst, m_data.data() + size_t( y ) * m_width * 4, size_t( rows ) * m_width * 4 * sizeof( float ) );
+        reads.emplace_back( y, rows );
+    }
+
+    std::unique_ptr<BitmapHdr> MakeBitmap() const
+    {
+        auto bmp = std::make_unique<BitmapHdr>( m_width, m_height, Colorspace::BT709 );
+        memcpy( bmp->Data(), m_data.data(), m_data.size() * sizeof( float ) );
+        return bmp;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> reads;
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<float> m_data;
+};
+
+// Every row is read exactly once, in order
+bool ReadsAreSequential( const TestSource& src )
+{
+    uint32_t next = 0;
+    for( auto& read : src.reads )
+    {
+        if( read.first != next ) return false;
+        next += read.second;
+    }
+    return next == src.Height();
+}
+
+}
+
+TEST_CASE( "StripPipeline", "[strippipeline]" )
+{
+    SECTION( "Full size output matches whole image tone mapping" )
+    {
+        TestSource src( 1000, 1200 );
+        auto expected = src.MakeBitmap()->Tonemap( ToneMap::Operator::PbrNeutral );
+
+        StripPipeline pipeline( src, ToneMap::Operator::PbrNeutral );
+        REQUIRE( pipeline.BandRows() < src.Height() );
+
+        auto bmp = pipeline.Process();
+        REQUIRE( bmp->Width() == 1000 );
+        REQUIRE( bmp->Height() == 1200 );
+        REQUIRE( memcmp( bmp->Data(), expected->Data(), size_t( 1000 ) * 1200 * 4 ) == 0 );
+        REQUIRE( src.reads.size() > 1 );
+        REQUIRE( ReadsAreSequential( src ) );
+    }
+
+    SECTION( "Parallel processing gives identical output" )
+    {
+        TaskDispatch td( 3, "Worker" );
+        TestSource src( 1000, 1200 );
+        auto expected = src.MakeBitmap()->Tonemap( ToneMap::Operator::AgX );
+
+        auto bmp = StripPipeline( src, ToneMap::Operator::AgX, &td ).Process();
+        REQUIRE( memcmp( bmp->Data(), expected->Data(), size_t( 1000 ) * 1200 * 4 ) == 0 );
+    }
+
+    SECTION( "Small images are processed in a single band" )
+    {
+        TestSource src( 16, 8 );
+        StripPipeline pipeline( src, ToneMap::Operator::PbrNeutral );
+        REQUIRE( pipeline.BandRows() == 8 );
+
+        auto bmp = pipeline.Process();
+        REQUIRE( src.reads.size() == 1 );
+    }
+
+    SECTION( "Resized output reads each band once" )
+    {
+        TaskDispatch td( 2, "Worker" );
+        TestSource src( 3000, 900 );
+        StripPipeline pipeline( src, ToneMap::Operator::PbrNeutral, &td );
+        REQUIRE( pipeline.BandRows() < src.Height() );
+
+        auto bmp = pipeline.Process( 300, 90 );
+        REQUIRE( bmp->Width() == 300 );
+        REQUIRE( bmp->Height() == 90 );
+        REQUIRE( ReadsAreSequential( src ) );
+    }
+
+    SECTION( "Resize to source size skips the resizer" )
+    {
+        TestSource src( 64, 64 );
+        auto expected = src.MakeBitmap()->Tonemap( ToneMap::Operator::PbrNeutral );
+
+        auto bmp = StripPipeline( src, ToneMap::Operator::PbrNeutral ).Process( 64, 64 );
+        REQUIRE( memcmp( bmp->Data(), expected->Data(), 64 * 64 * 4 ) == 0 );
+    }
+}
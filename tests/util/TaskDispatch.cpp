@@ -1,9 +1,14 @@
+#include <algorithm>
 #include <atomic>
 #include <catch2/catch_all.hpp>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <src/util/TaskDispatch.hpp>
 #include <thread>
+#include <vector>
 
 TEST_CASE( "TaskDispatch construction and destruction", "[taskdispatch][ctor]" )
 {
@@ -299,4 +304,522 @@ TEST_CASE( "TaskDispatch edge cases", "[taskdispatch][edge]" )
         dispatch.Sync();
         REQUIRE( counter.load() == 1000 );
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE( "TaskDispatch task groups", "[taskdispatch][group]" )
+{
+    SECTION( "Sync on a group only waits for its own tasks" )
+    {
+        TaskDispatch dispatch( 2, "groups" );
+        dispatch.WaitInit();
+
+        std::atomic<bool> started{ false };
+        std::atomic<bool> release{ false };
+        std::atomic<int> counter{ 0 };
+        TaskDispatch::Group slow, fast;
+
+        dispatch.Queue( slow, [&] {
+            started = true;
+            while( !release.load() ) std::this_thread::yield();
+        } );
+        // Make sure the blocking task is on a worker, otherwise Sync() could pick it up
+        while( !started.load() ) std::this_thread::yield();
+
+        for( int i = 0; i < 10; i++ )
+        {
+            dispatch.Queue( fast, [&counter] { counter++; } );
+        }
+
+        dispatch.Sync( fast );
+        REQUIRE( counter.load() == 10 );
+        REQUIRE( fast.Done() );
+        REQUIRE_FALSE( slow.Done() );
+
+        release = true;
+        dispatch.Sync( slow );
+        REQUIRE( slow.Done() );
+    }
+
+    SECTION( "Zero workers run group tasks on the syncing thread" )
+    {
+        TaskDispatch dispatch( 0, "groupzero" );
+        dispatch.WaitInit();
+
+        const auto self = std::this_thread::get_id();
+        std::atomic<int> onCaller{ 0 };
+        TaskDispatch::Group group;
+
+        for( int i = 0; i < 8; i++ )
+        {
+            dispatch.Queue( group, [&] { if( std::this_thread::get_id() == self ) onCaller++; } );
+        }
+        dispatch.Sync( group );
+        REQUIRE( onCaller.load() == 8 );
+    }
+
+    SECTION( "Groups can be synced from different threads" )
+    {
+        TaskDispatch dispatch( 2, "threads" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counterA{ 0 };
+        std::atomic<int> counterB{ 0 };
+
+        std::thread other( [&] {
+            TaskDispatch::Group group;
+            for( int i = 0; i < 100; i++ )
+            {
+                dispatch.Queue( group, [&counterA] { counterA++; } );
+            }
+            dispatch.Sync( group );
+        } );
+
+        TaskDispatch::Group group;
+        for( int i = 0; i < 100; i++ )
+        {
+            dispatch.Queue( group, [&counterB] { counterB++; } );
+        }
+        dispatch.Sync( group );
+        REQUIRE( counterB.load() == 100 );
+
+        other.join();
+        REQUIRE( counterA.load() == 100 );
+    }
+}
+
+TEST_CASE( "TaskDispatch nested parallelism", "[taskdispatch][nested]" )
+{
+    SECTION( "Sync inside a task waits only for its children" )
+    {
+        TaskDispatch dispatch( 2, "nested" );
+        dispatch.WaitInit();
+
+        std::atomic<int> outer{ 0 };
+        std::atomic<int> inner{ 0 };
+        std::atomic<int> complete{ 0 };
+
+        for( int i = 0; i < 8; i++ )
+        {
+            dispatch.Queue( [&] {
+                std::atomic<int> local{ 0 };
+                for( int j = 0; j < 16; j++ )
+                {
+                    dispatch.Queue( [&] { local++; inner++; } );
+                }
+                dispatch.Sync();
+                if( local.load() == 16 ) complete++;
+                outer++;
+            } );
+        }
+
+        dispatch.Sync();
+        REQUIRE( outer.load() == 8 );
+        REQUIRE( complete.load() == 8 );
+        REQUIRE( inner.load() == 8 * 16 );
+    }
+
+    SECTION( "Nested parallelism with zero workers" )
+    {
+        TaskDispatch dispatch( 0, "nestedzero" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        dispatch.Queue( [&] {
+            for( int j = 0; j < 4; j++ )
+            {
+                dispatch.Queue( [&counter] { counter++; } );
+            }
+            dispatch.Sync();
+            counter++;
+        } );
+
+        dispatch.Sync();
+        REQUIRE( counter.load() == 5 );
+    }
+
+    SECTION( "Deep recursion" )
+    {
+        TaskDispatch dispatch( 4, "deep" );
+        dispatch.WaitInit();
+
+        std::atomic<int> leaves{ 0 };
+        std::function<void( int )> spawn = [&]( int depth ) {
+            if( depth == 0 )
+            {
+                leaves++;
+                return;
+            }
+            dispatch.Queue( [&spawn, depth] { spawn( depth - 1 ); } );
+            dispatch.Queue( [&spawn, depth] { spawn( depth - 1 ); } );
+            dispatch.Sync();
+        };
+
+        spawn( 10 );
+        REQUIRE( leaves.load() == 1024 );
+    }
+
+    SECTION( "More tasks than queue capacity" )
+    {
+        TaskDispatch dispatch( 2, "overflow" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        dispatch.Queue( [&] {
+            for( int i = 0; i < 50000; i++ )
+            {
+                dispatch.Queue( [&counter] { counter++; } );
+            }
+        } );
+        for( int i = 0; i < 50000; i++ )
+        {
+            dispatch.Queue( [&counter] { counter++; } );
+        }
+
+        dispatch.Sync();
+        REQUIRE( counter.load() == 100000 );
+    }
+}
+
+TEST_CASE( "TaskDispatch task storage", "[taskdispatch][alloc]" )
+{
+    SECTION( "Move-only captures" )
+    {
+        TaskDispatch dispatch( 2, "moveonly" );
+        dispatch.WaitInit();
+
+        std::atomic<int> result{ 0 };
+        auto value = std::make_unique<int>( 13 );
+        dispatch.Queue( [&result, v = std::move( value )] { result = *v; } );
+        dispatch.Sync();
+        REQUIRE( result == 13 );
+    }
+
+    SECTION( "Captures are released after the task runs" )
+    {
+        TaskDispatch dispatch( 2, "release" );
+        dispatch.WaitInit();
+
+        auto shared = std::make_shared<std::atomic<int>>( 0 );
+        for( int i = 0; i < 100; i++ )
+        {
+            dispatch.Queue( [shared] { (*shared)++; } );
+        }
+        dispatch.Sync();
+        REQUIRE( shared->load() == 100 );
+        REQUIRE( shared.use_count() == 1 );
+    }
+
+    SECTION( "Pending tasks are released on destruction" )
+    {
+        auto shared = std::make_shared<int>( 0 );
+        {
+            TaskDispatch dispatch( 0, "pending" );
+            dispatch.WaitInit();
+            dispatch.Queue( [shared] { (*shared)++; } );
+            REQUIRE( shared.use_count() == 2 );
+        }
+        REQUIRE( shared.use_count() == 1 );
+    }
+
+    SECTION( "No allocations in steady state" )
+    {
+        TaskDispatch dispatch( 4, "steady" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        auto round = [&] {
+            for( int i = 0; i < 64; i++ )
+            {
+                dispatch.Queue( [&] {
+                    for( int j = 0; j < 64; j++ )
+                    {
+                        dispatch.Queue( [&counter] { counter++; } );
+                    }
+                } );
+            }
+            dispatch.Sync();
+        };
+
+        round();
+        REQUIRE( dispatch.Allocations() > 0 );
+
+        // Storage is bounded by the number of tasks in flight, not by the number of tasks ever queued
+        for( int i = 0; i < 100; i++ ) round();
+        REQUIRE( counter.load() == 101 * 64 * 64 );
+        REQUIRE( dispatch.Allocations() <= 8 );
+    }
+}
+
+TEST_CASE( "TaskDispatch ParallelFor", "[taskdispatch][parallelfor]" )
+{
+    SECTION( "Every item is visited exactly once" )
+    {
+        TaskDispatch dispatch( 4, "pfor" );
+        dispatch.WaitInit();
+
+        for( size_t count : { 0, 1, 7, 1000, 1023, 65537, 100003 } )
+        {
+            std::vector<std::atomic<int>> visits( count );
+            dispatch.ParallelFor( count, 100, [&visits]( size_t begin, size_t end ) {
+                for( size_t i = begin; i < end; i++ ) visits[i]++;
+            } );
+            REQUIRE( std::all_of( visits.begin(), visits.end(), []( const auto& v ) { return v.load() == 1; } ) );
+        }
+    }
+
+    SECTION( "Sub-ranges are even and at least grain long" )
+    {
+        TaskDispatch dispatch( 4, "pfor" );
+        dispatch.WaitInit();
+
+        std::mutex lock;
+        std::vector<size_t> sizes;
+        dispatch.ParallelFor( 10007, 1000, [&]( size_t begin, size_t end ) {
+            std::lock_guard guard( lock );
+            sizes.push_back( end - begin );
+        } );
+
+        REQUIRE( sizes.size() == 10 );
+        const auto [mn, mx] = std::minmax_element( sizes.begin(), sizes.end() );
+        REQUIRE( *mn >= 1000 );
+        REQUIRE( *mx - *mn <= 1 );
+    }
+
+    SECTION( "Small ranges run inline" )
+    {
+        TaskDispatch dispatch( 4, "pfor" );
+        dispatch.WaitInit();
+
+        int calls = 0;
+        std::thread::id id;
+        dispatch.ParallelFor( 1500, 1000, [&]( size_t begin, size_t end ) {
+            calls++;
+            id = std::this_thread::get_id();
+            REQUIRE( begin == 0 );
+            REQUIRE( end == 1500 );
+        } );
+        REQUIRE( calls == 1 );
+        REQUIRE( id == std::this_thread::get_id() );
+    }
+
+    SECTION( "Zero workers run inline" )
+    {
+        TaskDispatch dispatch( 0, "pfor" );
+        dispatch.WaitInit();
+
+        int calls = 0;
+        dispatch.ParallelFor( 100000, 10, [&calls]( size_t, size_t ) { calls++; } );
+        REQUIRE( calls == 1 );
+    }
+
+    SECTION( "Nested inside a task" )
+    {
+        TaskDispatch dispatch( 4, "pfor" );
+        dispatch.WaitInit();
+
+        std::atomic<size_t> sum{ 0 };
+        for( int i = 0; i < 8; i++ )
+        {
+            dispatch.Queue( [&] {
+                dispatch.ParallelFor( 10000, 100, [&sum]( size_t begin, size_t end ) {
+                    sum += end - begin;
+                } );
+            } );
+        }
+        dispatch.Sync();
+        REQUIRE( sum.load() == 80000 );
+    }
+
+    SECTION( "Grain respects limits" )
+    {
+        TaskDispatch dispatch( 4, "pfor" );
+        dispatch.WaitInit();
+
+        REQUIRE( dispatch.Grain( 100, 16 ) >= 100 );
+        const auto grain = dispatch.Grain( 100'000'000, 16 );
+        REQUIRE( grain >= 1024 );
+        REQUIRE( grain * 16 <= 64 * 1024 * 1024 );
+        REQUIRE( dispatch.Grain( 1'000'000, 16 ) <= 200'000 );
+    }
+}
+
+namespace
+{
+
+// The previous single-queue scheduler, kept as a reference point for the benchmarks
+class LegacyDispatch
+{
+public:
+    explicit LegacyDispatch( size_t workers )
+        : m_exit( false )
+        , m_jobs( 0 )
+    {
+        for( size_t i = 0; i < workers; i++ )
+        {
+            m_workers.emplace_back( [this] { Worker(); } );
+        }
+    }
+
+    ~LegacyDispatch()
+    {
+        m_queueLock.lock();
+        m_exit = true;
+        m_cvWork.notify_all();
+        m_queueLock.unlock();
+        for( auto& worker : m_workers ) worker.join();
+    }
+
+    void Queue( std::function<void(void)>&& f )
+    {
+        std::lock_guard lock( m_queueLock );
+        m_queue.emplace_back( std::move( f ) );
+        m_cvWork.notify_one();
+    }
+
+    void Sync()
+    {
+        std::unique_lock lock( m_queueLock );
+        while( !m_queue.empty() )
+        {
+            auto f = m_queue.back();
+            m_queue.pop_back();
+            lock.unlock();
+            f();
+            lock.lock();
+        }
+        m_cvJobs.wait( lock, [this] { return m_jobs == 0; } );
+    }
+
+private:
+    void Worker()
+    {
+        for(;;)
+        {
+            std::unique_lock lock( m_queueLock );
+            m_cvWork.wait( lock, [this] { return !m_queue.empty() || m_exit; } );
+            if( m_exit ) return;
+            auto f = m_queue.back();
+            m_queue.pop_back();
+            m_jobs++;
+            lock.unlock();
+            f();
+            lock.lock();
+            m_jobs--;
+            if( m_jobs == 0 && m_queue.empty() ) m_cvJobs.notify_all();
+        }
+    }
+
+    std::vector<std::function<void(void)>> m_queue;
+    std::mutex m_queueLock;
+    std::condition_variable m_cvWork, m_cvJobs;
+    bool m_exit;
+    size_t m_jobs;
+    std::vector<std::thread> m_workers;
+};
+
+template<typename T>
+void RunChunks( T& dispatch, std::vector<float>& data, size_t chunk )
+{
+    for( size_t i = 0; i < data.size(); i += chunk )
+    {
+        auto ptr = data.data() + i;
+        const auto sz = std::min( chunk, data.size() - i );
+        dispatch.Queue( [ptr, sz] {
+            for( size_t j = 0; j < sz; j++ ) ptr[j] = ptr[j] * 0.5f + 1.f;
+        } );
+    }
+    dispatch.Sync();
+}
+
+template<typename T>
+void RunProducers( T& dispatch, std::atomic<int>& counter, int producers, int tasks )
+{
+    std::vector<std::thread> threads;
+    for( int t = 0; t < producers; t++ )
+    {
+        threads.emplace_back( [&dispatch, &counter, tasks] {
+            for( int i = 0; i < tasks; i++ )
+            {
+                dispatch.Queue( [&counter] { counter.fetch_add( 1, std::memory_order_relaxed ); } );
+            }
+            dispatch.Sync();
+        } );
+    }
+    for( auto& t : threads ) t.join();
+}
+
+}
+
+TEST_CASE( "TaskDispatch contention benchmarks", "[!benchmark][taskdispatch]" )
+{
+    const auto workers = std::max( 1u, std::thread::hardware_concurrency() - 1 );
+
+    SECTION( "Many small chunks from a single submitter" )
+    {
+        std::vector<float> data( 4 * 1024 * 1024, 1.f );
+
+        LegacyDispatch legacy( workers );
+        TaskDispatch dispatch( workers, "bench" );
+        dispatch.WaitInit();
+
+        BENCHMARK( "Legacy: 4M floats in 1K chunks" )
+        {
+            RunChunks( legacy, data, 1024 );
+        };
+        BENCHMARK( "Work stealing: 4M floats in 1K chunks" )
+        {
+            RunChunks( dispatch, data, 1024 );
+        };
+        BENCHMARK( "ParallelFor: 4M floats" )
+        {
+            dispatch.ParallelFor( data.size(), dispatch.Grain( data.size(), sizeof( float ) ), [&data]( size_t begin, size_t end ) {
+                for( size_t i = begin; i < end; i++ ) data[i] = data[i] * 0.5f + 1.f;
+            } );
+        };
+    }
+
+    SECTION( "Empty tasks from concurrent submitters" )
+    {
+        std::atomic<int> counter{ 0 };
+
+        LegacyDispatch legacy( workers );
+        TaskDispatch dispatch( workers, "bench" );
+        dispatch.WaitInit();
+
+        BENCHMARK( "Legacy: 4 producers, 10K tasks each" )
+        {
+            RunProducers( legacy, counter, 4, 10000 );
+        };
+        BENCHMARK( "Work stealing: 4 producers, 10K tasks each" )
+        {
+            RunProducers( dispatch, counter, 4, 10000 );
+        };
+    }
+
+    SECTION( "Nested parallel sections" )
+    {
+        std::vector<float> data( 1024 * 1024, 1.f );
+
+        TaskDispatch dispatch( workers, "bench" );
+        dispatch.WaitInit();
+
+        BENCHMARK( "Work stealing: 16 outer tasks, 64 inner chunks each" )
+        {
+            for( int i = 0; i < 16; i++ )
+            {
+                dispatch.Queue( [&dispatch, &data, i] {
+                    const auto base = data.data() + i * 64 * 1024;
+                    for( int j = 0; j < 64; j++ )
+                    {
+                        auto ptr = base + j * 1024;
+                        dispatch.Queue( [ptr] {
+                            for( int k = 0; k < 1024; k++ ) ptr[k] = ptr[k] * 0.5f + 1.f;
+                        } );
+                    }
+                    dispatch.Sync();
+                } );
+            }
+            dispatch.Sync();
+        };
+    }
+}
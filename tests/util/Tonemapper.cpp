@@ -1,8 +1,16 @@
 #include "TestUtils.hpp"
+#include <algorithm>
 #include <catch2/catch_all.hpp>
+#include <cmath>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
 #include <src/util/Simd.hpp>
+#include <src/util/TaskDispatch.hpp>
 #include <src/util/Tonemapper.hpp>
 #include <stdint.h>
+#include <string.h>
+#include <tests/util/SimdTestUtils.hpp>
+#include <thread>
 #include <vector>
 
 namespace
@@ -14,6 +22,34 @@ uint32_t Pack( float r, float g, float b, float a )
     return ( uint32_t( a * 255.0f ) << 24 ) | ( uint32_t( b * 255.0f ) << 16 ) | ( uint32_t( g * 255.0f ) << 8 ) | uint32_t( r * 255.0f );
 }
 
+// Deterministic HDR test pattern, covering negative, dark, mid and very bright values
+std::vector<float> MakeHdrPattern( size_t count )
+{
+    std::vector<float> data( count * 4 );
+    uint32_t seed = 0x12345678;
+    for( size_t i = 0; i < count; i++ )
+    {
+        for( int c = 0; c < 3; c++ )
+        {
+            seed = seed * 1664525u + 1013904223u;
+            const auto u = float( seed >> 8 ) / float( 1 << 24 );
+            data[i * 4 + c] = std::exp2( u * 20.f - 14.f ) - 0.001f;
+        }
+        data[i * 4 + 3] = float( i % 256 ) / 255.f;
+    }
+    return data;
+}
+
+int MaxChannelDifference( uint32_t a, uint32_t b )
+{
+    int diff = 0;
+    for( int c = 0; c < 32; c += 8 )
+    {
+        diff = std::max( diff, std::abs( int( ( a >> c ) & 0xFF ) - int( ( b >> c ) & 0xFF ) ) );
+    }
+    return diff;
+}
+
 void VerifyPixel( uint32_t px, float r, float g, float b, float a )
 {
     // Tonemappers may round or truncate when packing, and the SIMD sRGB
@@ -190,6 +226,144 @@ TEST_CASE( "Tonemapper direct operators", "[tonemapper][operators]" )
     }
 }
 
+TEST_CASE( "Tonemapper SIMD accuracy", "[tonemapper][simd]" )
+{
+    // Odd size, so that every vector width also leaves a scalar tail
+    constexpr size_t Count = 4099;
+    auto src = MakeHdrPattern( Count );
+    const float edge[] = {
+        0.f, 0.f, 0.f, 1.f,
+        0.6060606f, 0.6060606f, 0.6060606f, 1.f,
+        1e4f, 1e4f, 1e4f, 1.f,
+        -1.f, 2.f, 0.f, 0.5f,
+    };
+    std::copy( edge, edge + 16, src.begin() );
+
+    for( ToneMap::Operator op : { ToneMap::Operator::AgX, ToneMap::Operator::AgXGolden, ToneMap::Operator::AgXPunchy, ToneMap::Operator::PbrNeutral } )
+    {
+        std::vector<uint32_t> bulk( Count );
+        std::vector<uint32_t> single( Count );
+        ToneMap::Process( op, bulk.data(), src.data(), Count );
+        for( size_t i = 0; i < Count; i++ ) ToneMap::Process( op, single.data() + i, src.data() + i * 4, 1 );
+
+        int worst = 0;
+        for( size_t i = 0; i < Count; i++ ) worst = std::max( worst, MaxChannelDifference( bulk[i], single[i] ) );
+        INFO( "Operator " << int( op ) );
+        REQUIRE( worst <= 2 );
+    }
+}
+
+TEST_CASE( "Tonemapper SIMD levels", "[tonemapper][simd]" )
+{
+    auto src = MakeHdrPattern( 1001 );
+
+    for( ToneMap::Operator op : { ToneMap::Operator::AgX, ToneMap::Operator::AgXGolden, ToneMap::Operator::AgXPunchy, ToneMap::Operator::PbrNeutral } )
+    {
+        INFO( "Operator " << int( op ) );
+        // Sizes cover each vector width, the single pixel paths and the scalar tails
+        for( size_t size : { 0, 1, 3, 7, 8, 15, 16, 17, 33, 1001 } )
+        {
+            INFO( "Size " << size );
+            std::vector<uint32_t> expected( size + 1, 0xDEADBEEF );
+            {
+                ScopedSimdLevel scoped( SimdLevel::Scalar );
+                ToneMap::Process( op, expected.data(), src.data(), size );
+            }
+            REQUIRE( expected[size] == 0xDEADBEEF );
+
+            for( auto level : SimdLevels() )
+            {
+                INFO( SimdLevelName( level ) );
+                ScopedSimdLevel scoped( level );
+                std::vector<uint32_t> dst( size + 1, 0xDEADBEEF );
+                ToneMap::Process( op, dst.data(), src.data(), size );
+                REQUIRE( dst[size] == 0xDEADBEEF );
+
+                int worst = 0;
+                for( size_t i = 0; i < size; i++ ) worst = std::max( worst, MaxChannelDifference( dst[i], expected[i] ) );
+                REQUIRE( worst <= 2 );
+            }
+        }
+    }
+}
+
+TEST_CASE( "Tonemapper parallel processing", "[tonemapper][parallel]" )
+{
+    constexpr uint32_t Width = 517;
+    constexpr uint32_t Height = 263;
+    const auto pattern = MakeHdrPattern( Width * Height );
+
+    BitmapHdr hdr( Width, Height, Colorspace::BT709 );
+    std::copy( pattern.begin(), pattern.end(), hdr.Data() );
+
+    TaskDispatch td( 4, "tonemap" );
+    for( ToneMap::Operator op : { ToneMap::Operator::AgX, ToneMap::Operator::PbrNeutral } )
+    {
+        auto serial = hdr.Tonemap( op );
+        auto parallel = hdr.Tonemap( op, &td );
+        REQUIRE( parallel->Width() == Width );
+        REQUIRE( parallel->Height() == Height );
+        REQUIRE( memcmp( serial->Data(), parallel->Data(), Width * Height * 4 ) == 0 );
+    }
+}
+
+TEST_CASE( "Tonemapper benchmarks", "[!benchmark][tonemapper]" )
+{
+    const auto pattern = MakeHdrPattern( 2048 * 2048 );
+
+    BitmapHdr hdr( 2048, 2048, Colorspace::BT709 );
+    std::copy( pattern.begin(), pattern.end(), hdr.Data() );
+
+    TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() - 1 ), "bench" );
+    td.WaitInit();
+
+    SECTION( "Single thread" )
+    {
+        BENCHMARK( "AgX 2048x2048" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::AgX );
+        };
+
+        BENCHMARK( "AgX Golden 2048x2048" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::AgXGolden );
+        };
+
+        BENCHMARK( "AgX Punchy 2048x2048" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::AgXPunchy );
+        };
+
+        BENCHMARK( "PBR Neutral 2048x2048" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::PbrNeutral );
+        };
+    }
+
+    SECTION( "Parallel" )
+    {
+        BENCHMARK( "AgX 2048x2048, parallel" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::AgX, &td );
+        };
+
+        BENCHMARK( "AgX Golden 2048x2048, parallel" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::AgXGolden, &td );
+        };
+
+        BENCHMARK( "AgX Punchy 2048x2048, parallel" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::AgXPunchy, &td );
+        };
+
+        BENCHMARK( "PBR Neutral 2048x2048, parallel" )
+        {
+            return hdr.Tonemap( ToneMap::Operator::PbrNeutral, &td );
+        };
+    }
+}
+
 TEST_CASE( "Simd math helpers match std math", "[simd][math]" )
 {
     const std::vector<float> logInputs = { 0.1f, 0.5f, 1.0f, 2.0f, 4.0f, 10.0f, 100.0f };
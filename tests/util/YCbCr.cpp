@@ -0,0 +1,404 @@
+#include <catch2/catch_all.hpp>
+#include <cmath>
+#include <random>
+#include <src/util/YCbCr.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <tests/util/SimdTestUtils.hpp>
+#include <vector>
+
+namespace
+{
+
+struct Coefficients
+{
+    float a, b, c, d;
+};
+
+Coefficients GetCoefficients( YCbCr::Matrix matrix )
+{
+    switch( matrix )
+    {
+    case YCbCr::Matrix::BT601: return { 1.402f, -0.344136f, -0.714136f, 1.772f };
+    case YCbCr::Matrix::BT709: return { 1.5748f, -0.1873f, -0.4681f, 1.8556f };
+    case YCbCr::Matrix::BT2020: return { 1.4746f, -0.16455312684366f, -0.57135312684366f, 1.8814f };
+    default: return {};
+    }
+}
+
+// Scalar conversion as previously done by the HEIF loader: widening, limited range expansion of
+// luma, then the matrix. Each step is a separate pass, so that no fma contraction happens.
+template<typename T>
+std::vector<float> Reference( const T* y, const T* cb, const T* cr, const T* a, size_t count, uint32_t bpp, bool fullRange, YCbCr::Matrix matrix )
+{
+    const float div = 1.f / ( ( 1 << bpp ) - 1 );
+    const auto m = GetCoefficients( matrix );
+
+    std::vector<float> ret( count * 4 );
+    for( size_t i=0; i<count; i++ )
+    {
+        ret[i*4+0] = float( y[i] ) * div;
+        ret[i*4+1] = float( cb[i] ) * div;
+        ret[i*4+2] = float( cr[i] ) * div;
+        ret[i*4+3] = a ? float( a[i] ) * div : 1.f;
+    }
+    for( size_t i=0; i<count; i++ )
+    {
+        ret[i*4+1] -= 0.5f;
+        ret[i*4+2] -= 0.5f;
+        if( !fullRange ) ret[i*4] = ( ret[i*4] - 16.f / 255.f ) * ( 255.f / 219.f );
+    }
+
+    if( matrix == YCbCr::Matrix::GBR )
+    {
+        for( size_t i=0; i<count; i++ )
+        {
+            const auto g = ret[i*4+0];
+            const auto b = ret[i*4+1] + 0.5f;
+            const auto r = ret[i*4+2] + 0.5f;
+            ret[i*4+0] = r;
+            ret[i*4+1] = g;
+            ret[i*4+2] = b;
+        }
+    }
+    else
+    {
+        std::vector<float> products( count * 4 );
+        for( size_t i=0; i<count; i++ )
+        {
+            products[i*4+0] = m.a * ret[i*4+2];
+            products[i*4+1] = m.b * ret[i*4+1];
+            products[i*4+2] = m.c * ret[i*4+2];
+            products[i*4+3] = m.d * ret[i*4+1];
+        }
+        for( size_t i=0; i<count; i++ )
+        {
+            const auto Y = ret[i*4];
+            ret[i*4+0] = Y + products[i*4+0];
+            ret[i*4+1] = Y + ( products[i*4+1] + products[i*4+2] );
+            ret[i*4+2] = Y + products[i*4+3];
+        }
+    }
+    return ret;
+}
+
+template<typename T>
+std::vector<T> MakePlane( size_t count, uint32_t bpp, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::vector<T> ret( count );
+    for( auto& v : ret ) v = T( rng() & ( ( 1 << bpp ) - 1 ) );
+    return ret;
+}
+
+template<typename T>
+void TestConversion( uint32_t bpp )
+{
+    // Odd count exercises the vector loops and the scalar tail
+    constexpr size_t Count = 1000 + 13;
+    const auto y = MakePlane<T>( Count, bpp, 1 );
+    const auto cb = MakePlane<T>( Count, bpp, 2 );
+    const auto cr = MakePlane<T>( Count, bpp, 3 );
+    const auto a = MakePlane<T>( Count, bpp, 4 );
+
+    for( auto level : SimdLevels() )
+    {
+        INFO( SimdLevelName( level ) );
+        ScopedSimdLevel scoped( level );
+        for( auto matrix : { YCbCr::Matrix::GBR, YCbCr::Matrix::BT601, YCbCr::Matrix::BT709, YCbCr::Matrix::BT2020 } )
+        {
+            for( bool fullRange : { false, true } )
+            {
+                YCbCr::Converter converter( bpp, fullRange, matrix );
+                for( auto alpha : { (const T*)nullptr, a.data() } )
+                {
+                    std::vector<float> out( Count * 4 );
+                    converter.Convert( out.data(), y.data(), cb.data(), cr.data(), alpha, Count );
+                    const auto ref = Reference( y.data(), cb.data(), cr.data(), alpha, Count, bpp, fullRange, matrix );
+                    REQUIRE( memcmp( out.data(), ref.data(), out.size() * sizeof( float ) ) == 0 );
+                }
+            }
+        }
+    }
+}
+
+// Chroma subsampled horizontally, and vertically if second chroma rows are given. Calculated in
+// double precision, with chroma interpolated before the matrix.
+template<typename T>
+std::vector<float> ReferenceSubsampled( const T* y, const T* cb, const T* cr, const T* cb1, const T* cr1, size_t width, size_t chromaWidth, uint32_t bpp, YCbCr::Matrix matrix )
+{
+    const double div = 1.0 / ( ( 1 << bpp ) - 1 );
+    const auto m = GetCoefficients( matrix );
+    auto chroma = [&]( const T* c0, const T* c1, size_t k ) {
+        k = std::min( k, chromaWidth - 1 );
+        const auto v = c0[k] * div - 0.5;
+        return c1 ? v * 0.75 + ( c1[k] * div - 0.5 ) * 0.25 : v;
+    };
+
+    std::vector<float> ret( width * 4 );
+    for( size_t x=0; x<width; x++ )
+    {
+        const auto k = x / 2;
+        const auto Cb = x & 1 ? ( chroma( cb, cb1, k ) + chroma( cb, cb1, k+1 ) ) * 0.5 : chroma( cb, cb1, k );
+        const auto Cr = x & 1 ? ( chroma( cr, cr1, k ) + chroma( cr, cr1, k+1 ) ) * 0.5 : chroma( cr, cr1, k );
+        const auto Y = ( y[x] * div - 16.0 / 255 ) * ( 255.0 / 219 );
+
+        ret[x*4+0] = float( Y + m.a * Cr );
+        ret[x*4+1] = float( Y + m.b * Cb + m.c * Cr );
+        ret[x*4+2] = float( Y + m.d * Cb );
+        ret[x*4+3] = 1.f;
+    }
+    return ret;
+}
+
+template<typename T>
+void TestSubsampled( uint32_t bpp )
+{
+    for( auto level : SimdLevels() )
+    {
+        INFO( SimdLevelName( level ) );
+        ScopedSimdLevel scoped( level );
+        for( size_t width : { 1, 2, 17, 1000, 2501 } )
+        {
+            const auto chromaWidth = ( width + 1 ) / 2;
+            const auto y = MakePlane<T>( width, bpp, 1 );
+            const auto cb = MakePlane<T>( chromaWidth, bpp, 2 );
+            const auto cr = MakePlane<T>( chromaWidth, bpp, 3 );
+            const auto cb1 = MakePlane<T>( chromaWidth, bpp, 4 );
+            const auto cr1 = MakePlane<T>( chromaWidth, bpp, 5 );
+
+            YCbCr::Converter converter( bpp, false, YCbCr::Matrix::BT709 );
+            for( bool vertical : { false, true } )
+            {
+                const auto pcb1 = vertical ? cb1.data() : nullptr;
+                const auto pcr1 = vertical ? cr1.data() : nullptr;
+
+                std::vector<float> out( width * 4 );
+                converter.ConvertSubsampled( out.data(), y.data(), cb.data(), cr.data(), pcb1, pcr1, nullptr, 0, width, chromaWidth );
+                const auto ref = ReferenceSubsampled( y.data(), cb.data(), cr.data(), pcb1, pcr1, width, chromaWidth, bpp, YCbCr::Matrix::BT709 );
+                for( size_t i=0; i<out.size(); i++ ) REQUIRE( out[i] == Catch::Approx( ref[i] ).margin( 1e-5 ) );
+
+                // Conversion of a part of the row gives the same result
+                if( width > 8 )
+                {
+                    const size_t x = width / 3 | 1;
+                    const size_t count = width - x - 3;
+                    std::vector<float> part( count * 4 );
+                    converter.ConvertSubsampled( part.data(), y.data() + x, cb.data(), cr.data(), pcb1, pcr1, nullptr, x, count, chromaWidth );
+                    REQUIRE( memcmp( part.data(), out.data() + x * 4, count * 4 * sizeof( float ) ) == 0 );
+                }
+            }
+        }
+    }
+}
+
+float Pq( float N )
+{
+    const auto Nm2 = std::pow( std::max( N, 0.f ), 1.f / 78.84375f );
+    return 10000.f * std::pow( std::max( 0.f, Nm2 - 0.8359375f ) / ( 18.8515625f - 18.6875f * Nm2 ), 1.f / 0.1593017578125f );
+}
+
+float Hlg( float E )
+{
+    if( E < 0 ) return -Hlg( -E );
+    if( E <= 0.5f ) return E * E / 3.f;
+    return ( std::exp( ( E - 0.55991073f ) / 0.17883277f ) + 0.28466892f ) / 12.f;
+}
+
+std::vector<float> MakeSignal( size_t count, float min, float max )
+{
+    std::mt19937 rng( 5 );
+    std::uniform_real_distribution<float> dist( min, max );
+    std::vector<float> ret( count * 4 );
+    for( size_t i=0; i<count; i++ )
+    {
+        for( int c=0; c<3; c++ ) ret[i*4+c] = dist( rng );
+        ret[i*4+3] = float( i % 256 ) / 255.f;
+    }
+    return ret;
+}
+
+constexpr size_t BenchWidth = 4096;
+constexpr size_t BenchHeight = 1024;
+
+template<typename T>
+struct BenchPlanes
+{
+    explicit BenchPlanes( uint32_t bpp )
+        : y( MakePlane<T>( BenchWidth * BenchHeight, bpp, 1 ) )
+        , cb( MakePlane<T>( BenchWidth * BenchHeight, bpp, 2 ) )
+        , cr( MakePlane<T>( BenchWidth * BenchHeight, bpp, 3 ) )
+        , out( BenchWidth * BenchHeight * 4 )
+    {
+    }
+
+    std::vector<T> y, cb, cr;
+    std::vector<float> out;
+};
+
+template<typename T>
+float Convert444( const YCbCr::Converter& converter, BenchPlanes<T>& p )
+{
+    for( size_t row = 0; row < BenchHeight; row++ )
+    {
+        const auto offset = row * BenchWidth;
+        converter.Convert( p.out.data() + offset * 4, p.y.data() + offset, p.cb.data() + offset, p.cr.data() + offset, nullptr, BenchWidth );
+    }
+    return p.out[0];
+}
+
+template<typename T>
+float Convert420( const YCbCr::Converter& converter, BenchPlanes<T>& p )
+{
+    constexpr size_t ChromaWidth = BenchWidth / 2;
+    for( size_t row = 0; row < BenchHeight; row++ )
+    {
+        const auto c0 = ( row / 2 ) * ChromaWidth;
+        const auto c1 = ( row & 1 ? std::min( row / 2 + 1, BenchHeight / 2 - 1 ) : std::max<size_t>( row / 2, 1 ) - 1 ) * ChromaWidth;
+        converter.ConvertSubsampled( p.out.data() + row * BenchWidth * 4, p.y.data() + row * BenchWidth, p.cb.data() + c0, p.cr.data() + c0, p.cb.data() + c1, p.cr.data() + c1, nullptr, 0, BenchWidth, ChromaWidth );
+    }
+    return p.out[0];
+}
+
+}
+
+TEST_CASE( "YCbCr conversion", "[ycbcr]" )
+{
+    SECTION( "8-bit matches scalar reference" ) { TestConversion<uint8_t>( 8 ); }
+    SECTION( "10-bit matches scalar reference" ) { TestConversion<uint16_t>( 10 ); }
+    SECTION( "12-bit matches scalar reference" ) { TestConversion<uint16_t>( 12 ); }
+
+    SECTION( "8-bit subsampled chroma" ) { TestSubsampled<uint8_t>( 8 ); }
+    SECTION( "12-bit subsampled chroma" ) { TestSubsampled<uint16_t>( 12 ); }
+
+    SECTION( "GBR with subsampled chroma" )
+    {
+        const uint8_t y[4] = { 10, 20, 30, 40 };
+        const uint8_t cb[2] = { 100, 200 };
+        const uint8_t cr[2] = { 50, 150 };
+        float out[16];
+        YCbCr::Converter( 8, true, YCbCr::Matrix::GBR ).ConvertSubsampled( out, y, cb, cr, nullptr, nullptr, nullptr, 0, 4, 2 );
+        const float r[4] = { 50, 100, 150, 150 };
+        const float b[4] = { 100, 150, 200, 200 };
+        for( int i=0; i<4; i++ )
+        {
+            REQUIRE( out[i*4+0] == Catch::Approx( r[i] / 255.f ) );
+            REQUIRE( out[i*4+1] == Catch::Approx( y[i] / 255.f ) );
+            REQUIRE( out[i*4+2] == Catch::Approx( b[i] / 255.f ) );
+        }
+    }
+
+    SECTION( "Out of range samples are masked" )
+    {
+        const uint16_t y[1] = { 0xFFFF };
+        const uint16_t c[1] = { 0x0200 };
+        float out[4];
+        YCbCr::Converter( 10, true, YCbCr::Matrix::BT709 ).Convert( out, y, c, c, nullptr, 1 );
+        REQUIRE( out[0] == Catch::Approx( 1.f ).margin( 0.01f ) );
+        REQUIRE( out[1] == Catch::Approx( 1.f ).margin( 0.01f ) );
+        REQUIRE( out[2] == Catch::Approx( 1.f ).margin( 0.01f ) );
+        REQUIRE( out[3] == 1.f );
+    }
+}
+
+TEST_CASE( "YCbCr transfer functions", "[ycbcr]" )
+{
+    constexpr size_t Count = 1024 + 3;
+    constexpr float Mul = 1.f / 203.f;
+
+    SECTION( "PQ" )
+    {
+        for( auto level : SimdLevels() )
+        {
+            INFO( SimdLevelName( level ) );
+            ScopedSimdLevel scoped( level );
+            auto data = MakeSignal( Count, -0.1f, 1.f );
+            const auto src = data;
+            YCbCr::LinearizePq( data.data(), Count, Mul );
+            for( size_t i=0; i<Count; i++ )
+            {
+                for( int c=0; c<3; c++ )
+                {
+                    const auto ref = Pq( src[i*4+c] ) * Mul;
+                    REQUIRE( data[i*4+c] == Catch::Approx( ref ).epsilon( 1e-3 ).margin( 1e-6 ) );
+                }
+                REQUIRE( data[i*4+3] == src[i*4+3] );
+            }
+        }
+    }
+
+    SECTION( "HLG" )
+    {
+        for( auto level : SimdLevels() )
+        {
+            INFO( SimdLevelName( level ) );
+            ScopedSimdLevel scoped( level );
+            auto data = MakeSignal( Count, -1.f, 1.2f );
+            const auto src = data;
+            YCbCr::LinearizeHlg( data.data(), Count, 100.f );
+            for( size_t i=0; i<Count; i++ )
+            {
+                for( int c=0; c<3; c++ )
+                {
+                    const auto ref = Hlg( src[i*4+c] ) * 100.f;
+                    REQUIRE( data[i*4+c] == Catch::Approx( ref ).epsilon( 1e-4 ).margin( 1e-5 ) );
+                }
+                REQUIRE( data[i*4+3] == src[i*4+3] );
+            }
+        }
+    }
+}
+
+TEST_CASE( "YCbCr benchmarks", "[!benchmark][ycbcr]" )
+{
+    SECTION( "8-bit" )
+    {
+        BenchPlanes<uint8_t> planes( 8 );
+        YCbCr::Converter converter( 8, false, YCbCr::Matrix::BT2020 );
+
+        BENCHMARK( "8-bit 4:4:4 4096x1024" )
+        {
+            return Convert444( converter, planes );
+        };
+
+        BENCHMARK( "8-bit 4:2:0 4096x1024" )
+        {
+            return Convert420( converter, planes );
+        };
+    }
+
+    SECTION( "12-bit" )
+    {
+        BenchPlanes<uint16_t> planes( 12 );
+        YCbCr::Converter converter( 12, false, YCbCr::Matrix::BT2020 );
+
+        BENCHMARK( "12-bit 4:4:4 4096x1024" )
+        {
+            return Convert444( converter, planes );
+        };
+
+        BENCHMARK( "12-bit 4:2:0 4096x1024" )
+        {
+            return Convert420( converter, planes );
+        };
+    }
+
+    SECTION( "Transfer functions" )
+    {
+        const auto data = MakeSignal( BenchWidth * BenchHeight, 0.f, 1.f );
+
+        BENCHMARK( "PQ 4096x1024, with copy" )
+        {
+            auto copy = data;
+            YCbCr::LinearizePq( copy.data(), BenchWidth * BenchHeight, 1.f / 203.f );
+            return copy;
+        };
+
+        BENCHMARK( "HLG 4096x1024, with copy" )
+        {
+            auto copy = data;
+            YCbCr::LinearizeHlg( copy.data(), BenchWidth * BenchHeight, 100.f );
+            return copy;
+        };
+    }
+}